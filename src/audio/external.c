@@ -13,6 +13,13 @@
 #include "seq_ids.h"
 #include "dialog_ids.h"
 
+#ifndef TARGET_N64
+#include <sched.h>
+#include <time.h>
+#include "../pc/cheapProfiler.h"
+#include "../pc/pcm_cache.h"
+#endif
+
 #ifdef VERSION_EU
 #define EU_FLOAT(x) x ## f
 #else
@@ -402,6 +409,238 @@ void process_level_music_dynamics(void);
 u8 func_803200E4(u16 fadeTimer);
 void func_80320ED8(void);
 
+#ifndef TARGET_N64
+// Calls from the game into the sound engine. Once the port's audio thread is
+// running (audio_use_command_queue), the entry points below don't touch the
+// sound state themselves: they push the call onto this single producer,
+// single consumer ring, and the audio thread replays them in order at the
+// start of a buffer. Sound requests and the game loop tick go through it too,
+// so the audio thread sees everything a tick did in the order it was done,
+// and neither thread ever waits for the other unless the ring fills up.
+#define AUDIO_CMD_QUEUE_SIZE 1024 // power of two
+
+enum AudioCmdId {
+    AUDIO_CMD_PLAY_SOUND,
+    AUDIO_CMD_GAME_LOOP_TICK,
+    AUDIO_CMD_SEQUENCE_PLAYER_FADE_OUT,
+    AUDIO_CMD_FADE_VOLUME_SCALE,
+    AUDIO_CMD_FUNC_8031FFB4,
+    AUDIO_CMD_SEQUENCE_PLAYER_UNLOWER,
+    AUDIO_CMD_SET_SOUND_DISABLED,
+    AUDIO_CMD_FUNC_803205E8,
+    AUDIO_CMD_FUNC_803206F8,
+    AUDIO_CMD_FUNC_80320890,
+    AUDIO_CMD_SOUND_BANKS_DISABLE,
+    AUDIO_CMD_SOUND_BANKS_ENABLE,
+    AUDIO_CMD_FUNC_80320A4C,
+    AUDIO_CMD_PLAY_DIALOG_SOUND,
+    AUDIO_CMD_PLAY_MUSIC,
+    AUDIO_CMD_STOP_BACKGROUND_MUSIC,
+    AUDIO_CMD_FADEOUT_BACKGROUND_MUSIC,
+    AUDIO_CMD_DROP_QUEUED_BACKGROUND_MUSIC,
+    AUDIO_CMD_PLAY_SECONDARY_MUSIC,
+    AUDIO_CMD_FUNC_80321080,
+    AUDIO_CMD_FUNC_803210D4,
+    AUDIO_CMD_PLAY_COURSE_CLEAR,
+    AUDIO_CMD_PLAY_PEACHS_JINGLE,
+    AUDIO_CMD_PLAY_PUZZLE_JINGLE,
+    AUDIO_CMD_PLAY_STAR_FANFARE,
+    AUDIO_CMD_PLAY_POWER_STAR_JINGLE,
+    AUDIO_CMD_PLAY_RACE_FANFARE,
+    AUDIO_CMD_PLAY_TOADS_JINGLE,
+    AUDIO_CMD_SOUND_RESET,
+    AUDIO_CMD_SET_SOUND_MODE
+};
+
+struct AudioCmd {
+    u8 id;
+    uintptr_t args[4];
+};
+
+static struct {
+    struct AudioCmd cmds[AUDIO_CMD_QUEUE_SIZE];
+    u32 head; // only written by the game
+    u8 pad[60];
+    u32 tail; // only written by the audio thread
+    u8 enabled;
+} sAudioCmdQueue;
+
+// Set on the thread that runs the sound engine, whose own calls into the
+// entry points (sound_reset calls sound_init, the music dynamics fade
+// players...) must run right away
+static __thread u8 sOnAudioThread;
+
+#ifdef USE_PROFILER
+static f64 audio_cmd_time_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000.0 + ts.tv_nsec / 1000.0;
+}
+#endif
+
+// Returns TRUE if the call was queued for the audio thread, FALSE if the
+// caller should go ahead and run it
+static s32 audio_cmd_defer(u8 id, uintptr_t arg0, uintptr_t arg1, uintptr_t arg2, uintptr_t arg3) {
+    struct AudioCmd *cmd;
+    u32 head;
+
+    if (!sAudioCmdQueue.enabled || sOnAudioThread) {
+        return FALSE;
+    }
+    head = sAudioCmdQueue.head;
+    if (head - __atomic_load_n(&sAudioCmdQueue.tail, __ATOMIC_ACQUIRE) == AUDIO_CMD_QUEUE_SIZE) {
+#ifdef USE_PROFILER
+        f64 start = audio_cmd_time_us();
+#endif
+        while (head - __atomic_load_n(&sAudioCmdQueue.tail, __ATOMIC_ACQUIRE) == AUDIO_CMD_QUEUE_SIZE) {
+            sched_yield();
+        }
+#ifdef USE_PROFILER
+        ProfEmitCounter("audio_cmd_queue_full", 1);
+        ProfEmitCounter("audio_cmd_wait_us", audio_cmd_time_us() - start);
+#endif
+    }
+    cmd = &sAudioCmdQueue.cmds[head % AUDIO_CMD_QUEUE_SIZE];
+    cmd->id = id;
+    cmd->args[0] = arg0;
+    cmd->args[1] = arg1;
+    cmd->args[2] = arg2;
+    cmd->args[3] = arg3;
+    __atomic_store_n(&sAudioCmdQueue.head, head + 1, __ATOMIC_RELEASE);
+    return TRUE;
+}
+
+#define DEFER_TO_AUDIO_THREAD(id, arg0, arg1, arg2, arg3)                                     \
+    do {                                                                                      \
+        if (audio_cmd_defer(id, (uintptr_t) (arg0), (uintptr_t) (arg1), (uintptr_t) (arg2),   \
+                            (uintptr_t) (arg3))) {                                            \
+            return;                                                                           \
+        }                                                                                     \
+    } while (0)
+
+void audio_use_command_queue(void) {
+    sAudioCmdQueue.enabled = TRUE;
+}
+
+// Runs the queued calls up to and including the next game loop tick, so that
+// update_game_sound still runs once per tick when the audio thread is behind
+static void audio_cmd_drain(void) {
+    u32 head = __atomic_load_n(&sAudioCmdQueue.head, __ATOMIC_ACQUIRE);
+    u32 tail = sAudioCmdQueue.tail;
+#ifdef USE_PROFILER
+    u32 start = tail;
+#endif
+    u8 ticked = FALSE;
+
+    sOnAudioThread = TRUE;
+    while (tail != head && !ticked) {
+        struct AudioCmd *cmd = &sAudioCmdQueue.cmds[tail % AUDIO_CMD_QUEUE_SIZE];
+        uintptr_t *args = cmd->args;
+
+        switch (cmd->id) {
+            case AUDIO_CMD_PLAY_SOUND:
+                play_sound((s32) args[0], (f32 *) args[1]);
+                break;
+            case AUDIO_CMD_GAME_LOOP_TICK:
+                audio_signal_game_loop_tick();
+                ticked = TRUE;
+                break;
+            case AUDIO_CMD_SEQUENCE_PLAYER_FADE_OUT:
+                sequence_player_fade_out((u8) args[0], (u16) args[1]);
+                break;
+            case AUDIO_CMD_FADE_VOLUME_SCALE:
+                fade_volume_scale((u8) args[0], (u8) args[1], (u16) args[2]);
+                break;
+            case AUDIO_CMD_FUNC_8031FFB4:
+                func_8031FFB4((u8) args[0], (u16) args[1], (u8) args[2]);
+                break;
+            case AUDIO_CMD_SEQUENCE_PLAYER_UNLOWER:
+                sequence_player_unlower((u8) args[0], (u16) args[1]);
+                break;
+            case AUDIO_CMD_SET_SOUND_DISABLED:
+                set_sound_disabled((u8) args[0]);
+                break;
+            case AUDIO_CMD_FUNC_803205E8:
+                func_803205E8((u32) args[0], (f32 *) args[1]);
+                break;
+            case AUDIO_CMD_FUNC_803206F8:
+                func_803206F8((f32 *) args[0]);
+                break;
+            case AUDIO_CMD_FUNC_80320890:
+                func_80320890();
+                break;
+            case AUDIO_CMD_SOUND_BANKS_DISABLE:
+                sound_banks_disable((u8) args[0], (u16) args[1]);
+                break;
+            case AUDIO_CMD_SOUND_BANKS_ENABLE:
+                sound_banks_enable((u8) args[0], (u16) args[1]);
+                break;
+            case AUDIO_CMD_FUNC_80320A4C:
+                func_80320A4C((u8) args[0], (u8) args[1]);
+                break;
+            case AUDIO_CMD_PLAY_DIALOG_SOUND:
+                play_dialog_sound((u8) args[0]);
+                break;
+            case AUDIO_CMD_PLAY_MUSIC:
+                play_music((u8) args[0], (u16) args[1], (u16) args[2]);
+                break;
+            case AUDIO_CMD_STOP_BACKGROUND_MUSIC:
+                stop_background_music((u16) args[0]);
+                break;
+            case AUDIO_CMD_FADEOUT_BACKGROUND_MUSIC:
+                fadeout_background_music((u16) args[0], (u16) args[1]);
+                break;
+            case AUDIO_CMD_DROP_QUEUED_BACKGROUND_MUSIC:
+                drop_queued_background_music();
+                break;
+            case AUDIO_CMD_PLAY_SECONDARY_MUSIC:
+                play_secondary_music((u8) args[0], (u8) args[1], (u8) args[2], (u16) args[3]);
+                break;
+            case AUDIO_CMD_FUNC_80321080:
+                func_80321080((u16) args[0]);
+                break;
+            case AUDIO_CMD_FUNC_803210D4:
+                func_803210D4((u16) args[0]);
+                break;
+            case AUDIO_CMD_PLAY_COURSE_CLEAR:
+                play_course_clear();
+                break;
+            case AUDIO_CMD_PLAY_PEACHS_JINGLE:
+                play_peachs_jingle();
+                break;
+            case AUDIO_CMD_PLAY_PUZZLE_JINGLE:
+                play_puzzle_jingle();
+                break;
+            case AUDIO_CMD_PLAY_STAR_FANFARE:
+                play_star_fanfare();
+                break;
+            case AUDIO_CMD_PLAY_POWER_STAR_JINGLE:
+                play_power_star_jingle((u8) args[0]);
+                break;
+            case AUDIO_CMD_PLAY_RACE_FANFARE:
+                play_race_fanfare();
+                break;
+            case AUDIO_CMD_PLAY_TOADS_JINGLE:
+                play_toads_jingle();
+                break;
+            case AUDIO_CMD_SOUND_RESET:
+                sound_reset((u8) args[0]);
+                break;
+            case AUDIO_CMD_SET_SOUND_MODE:
+                audio_set_sound_mode((u8) args[0]);
+                break;
+        }
+        tail++;
+    }
+    __atomic_store_n(&sAudioCmdQueue.tail, tail, __ATOMIC_RELEASE);
+#ifdef USE_PROFILER
+    ProfEmitCounter("audio_cmds", tail - start);
+#endif
+}
+#else
+#define DEFER_TO_AUDIO_THREAD(id, arg0, arg1, arg2, arg3)
+#endif
+
 #ifndef VERSION_JP
 void unused_8031E4F0(void) {
     // This is a debug function which is almost entirely optimized away,
@@ -731,6 +970,7 @@ struct SPTask *create_next_audio_frame_task(void) {
     return NULL;
 }
 void create_next_audio_buffer(s16 *samples, u32 num_samples) {
+    audio_cmd_drain();
     gAudioFrameCount++;
     if (sGameLoopTicked != 0) {
         update_game_sound();
@@ -740,11 +980,17 @@ void create_next_audio_buffer(s16 *samples, u32 num_samples) {
     synthesis_execute(gAudioCmdBuffers[0], &writtenCmds, samples, num_samples);
     gAudioRandom = ((gAudioRandom + gAudioFrameCount) * gAudioFrameCount);
     decrease_sample_dma_ttls();
+#ifdef USE_PROFILER
+    struct PcmCacheStats pcmCacheStats;
+    pcm_cache_get_stats(&pcmCacheStats);
+    ProfEmitCounter("pcm_cache_kb", pcmCacheStats.bytes / 1024.0);
+#endif
 }
 #endif
 #endif
 
 void play_sound(s32 soundBits, f32 *pos) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_PLAY_SOUND, soundBits, pos, 0, 0);
     sSoundRequests[sSoundRequestCount].soundBits = soundBits;
     sSoundRequests[sSoundRequestCount].position = pos;
     sSoundRequestCount++;
@@ -1130,6 +1376,7 @@ static void noop_8031EEC8(void) {
 }
 
 void audio_signal_game_loop_tick(void) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_GAME_LOOP_TICK, 0, 0, 0, 0);
     sGameLoopTicked = 1;
 #ifdef VERSION_EU
     maybe_tick_game_sound();
@@ -1519,6 +1766,7 @@ void play_sequence(u8 player, u8 seqId, u16 fadeTimer) {
 }
 
 void sequence_player_fade_out(u8 player, u16 fadeTimer) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_SEQUENCE_PLAYER_FADE_OUT, player, fadeTimer, 0, 0);
 #ifdef VERSION_EU
     if (!player) {
         sPlayer0CurSeqId = SEQUENCE_NONE;
@@ -1534,6 +1782,9 @@ void sequence_player_fade_out(u8 player, u16 fadeTimer) {
 
 void fade_volume_scale(u8 player, u8 targetScale, u16 fadeTimer) {
     u8 i;
+
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_FADE_VOLUME_SCALE, player, targetScale, fadeTimer, 0);
+
     for (i = 0; i < CHANNELS_MAX; i++) {
         fade_channel_volume_scale(player, i, targetScale, fadeTimer);
     }
@@ -1743,6 +1994,7 @@ void unused_8031FED0(u8 player, u32 bits, s8 arg2) {
 }
 
 void func_8031FFB4(u8 player, u16 fadeTimer, u8 arg2) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_FUNC_8031FFB4, player, fadeTimer, arg2, 0);
     if (player == 0) {
         sCapVolumeTo40 = TRUE;
         func_803200E4(fadeTimer);
@@ -1752,6 +2004,7 @@ void func_8031FFB4(u8 player, u16 fadeTimer, u8 arg2) {
 }
 
 void sequence_player_unlower(u8 player, u16 fadeTimer) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_SEQUENCE_PLAYER_UNLOWER, player, fadeTimer, 0, 0);
     sCapVolumeTo40 = FALSE;
     if (player == 0) {
         if (gSequencePlayers[player].state != SEQUENCE_PLAYER_STATE_FADE_OUT) {
@@ -1812,6 +2065,8 @@ u8 func_803200E4(u16 fadeTimer) {
 void set_sound_disabled(u8 disabled) {
     u8 i;
 
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_SET_SOUND_DISABLED, disabled, 0, 0, 0);
+
     for (i = 0; i < SEQUENCE_PLAYERS; i++) {
 #ifdef VERSION_EU
         if (disabled)
@@ -1905,6 +2160,8 @@ void func_803205E8(u32 soundBits, f32 *vec) {
     u8 bankIndex;
     u8 item;
 
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_FUNC_803205E8, soundBits, vec, 0, 0);
+
     bankIndex = (soundBits & SOUNDARGS_MASK_BANK) >> SOUNDARGS_SHIFT_BANK;
     item = gSoundBanks[bankIndex][0].next;
     while (item != 0xff) {
@@ -1924,6 +2181,8 @@ void func_803206F8(f32 *arg0) {
     u8 bankIndex;
     u8 item;
 
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_FUNC_803206F8, arg0, 0, 0, 0);
+
     for (bankIndex = 0; bankIndex < SOUND_BANK_COUNT; bankIndex++) {
         item = gSoundBanks[bankIndex][0].next;
         while (item != 0xff) {
@@ -1947,6 +2206,7 @@ static void func_803207DC(u8 bankIndex) {
 }
 
 void func_80320890(void) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_FUNC_80320890, 0, 0, 0, 0);
     func_803207DC(1);
     func_803207DC(4);
     func_803207DC(6);
@@ -1955,6 +2215,8 @@ void func_80320890(void) {
 void sound_banks_disable(UNUSED u8 player, u16 bankMask) {
     u8 i;
 
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_SOUND_BANKS_DISABLE, player, bankMask, 0, 0);
+
     for (i = 0; i < SOUND_BANK_COUNT; i++) {
         if (bankMask & 1) {
             sSoundBankDisabled[i] = TRUE;
@@ -1974,6 +2236,8 @@ void disable_all_sequence_players(void) {
 void sound_banks_enable(UNUSED u8 player, u16 bankMask) {
     u8 i;
 
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_SOUND_BANKS_ENABLE, player, bankMask, 0, 0);
+
     for (i = 0; i < SOUND_BANK_COUNT; i++) {
         if (bankMask & 1) {
             sSoundBankDisabled[i] = FALSE;
@@ -1992,12 +2256,15 @@ u8 unused_803209D8(u8 player, u8 channelIndex, u8 arg2) {
 }
 
 void func_80320A4C(u8 bankIndex, u8 arg1) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_FUNC_80320A4C, bankIndex, arg1, 0, 0);
     D_80363808[bankIndex] = arg1;
 }
 
 void play_dialog_sound(u8 dialogID) {
     u8 speaker;
 
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_PLAY_DIALOG_SOUND, dialogID, 0, 0, 0);
+
     if (dialogID >= DIALOG_COUNT) {
         dialogID = 0;
     }
@@ -2025,6 +2292,8 @@ void play_music(u8 player, u16 seqArgs, u16 fadeTimer) {
     u8 i;
     u8 foundIndex = 0;
 
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_PLAY_MUSIC, player, seqArgs, fadeTimer, 0);
+
     // Except for the background music player, we don't support queued
     // sequences. Just play them immediately, stopping any old sequence.
     if (player != 0) {
@@ -2082,6 +2351,8 @@ void stop_background_music(u16 seqId) {
     u8 foundIndex;
     u8 i;
 
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_STOP_BACKGROUND_MUSIC, seqId, 0, 0, 0);
+
     if (sBackgroundMusicQueueSize == 0) {
         return;
     }
@@ -2120,12 +2391,14 @@ void stop_background_music(u16 seqId) {
 }
 
 void fadeout_background_music(u16 seqId, u16 fadeOut) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_FADEOUT_BACKGROUND_MUSIC, seqId, fadeOut, 0, 0);
     if (sBackgroundMusicQueueSize != 0 && sBackgroundMusicQueue[0].seqId == (u8)(seqId & 0xff)) {
         sequence_player_fade_out(SEQ_PLAYER_LEVEL, fadeOut);
     }
 }
 
 void drop_queued_background_music(void) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_DROP_QUEUED_BACKGROUND_MUSIC, 0, 0, 0, 0);
     if (sBackgroundMusicQueueSize != 0) {
         sBackgroundMusicQueueSize = 1;
     }
@@ -2166,6 +2439,8 @@ void func_80320ED8(void) {
 void play_secondary_music(u8 seqId, u8 bgMusicVolume, u8 volume, u16 fadeTimer) {
     UNUSED u32 dummy;
 
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_PLAY_SECONDARY_MUSIC, seqId, bgMusicVolume, volume, fadeTimer);
+
     sUnused80332118 = 0;
     if (sPlayer0CurSeqId == 0xff || sPlayer0CurSeqId == SEQ_MENU_TITLE_SCREEN) {
         return;
@@ -2189,6 +2464,7 @@ void play_secondary_music(u8 seqId, u8 bgMusicVolume, u8 volume, u16 fadeTimer)
 }
 
 void func_80321080(u16 fadeTimer) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_FUNC_80321080, fadeTimer, 0, 0, 0);
     if (D_80363812 != 0) {
         D_80363812 = 0;
         D_80332120 = 0;
@@ -2201,6 +2477,8 @@ void func_80321080(u16 fadeTimer) {
 void func_803210D4(u16 fadeOutTime) {
     u8 i;
 
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_FUNC_803210D4, fadeOutTime, 0, 0, 0);
+
     if (sHasStartedFadeOut) {
         return;
     }
@@ -2229,6 +2507,7 @@ void func_803210D4(u16 fadeOutTime) {
 }
 
 void play_course_clear(void) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_PLAY_COURSE_CLEAR, 0, 0, 0, 0);
     play_sequence(SEQ_PLAYER_ENV, SEQ_EVENT_CUTSCENE_COLLECT_STAR, 0);
     D_8033211C = 0x80 | 0;
 #ifdef VERSION_EU
@@ -2238,6 +2517,7 @@ void play_course_clear(void) {
 }
 
 void play_peachs_jingle(void) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_PLAY_PEACHS_JINGLE, 0, 0, 0, 0);
     play_sequence(SEQ_PLAYER_ENV, SEQ_EVENT_PEACH_MESSAGE, 0);
     D_8033211C = 0x80 | 0;
 #ifdef VERSION_EU
@@ -2252,6 +2532,7 @@ void play_peachs_jingle(void) {
  * yoshi, releasing chain chomp, opening the pyramid top, etc.
  */
 void play_puzzle_jingle(void) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_PLAY_PUZZLE_JINGLE, 0, 0, 0, 0);
     play_sequence(SEQ_PLAYER_ENV, SEQ_EVENT_SOLVE_PUZZLE, 0);
     D_8033211C = 0x80 | 20;
 #ifdef VERSION_EU
@@ -2261,6 +2542,7 @@ void play_puzzle_jingle(void) {
 }
 
 void play_star_fanfare(void) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_PLAY_STAR_FANFARE, 0, 0, 0, 0);
     play_sequence(SEQ_PLAYER_ENV, SEQ_EVENT_HIGH_SCORE, 0);
     D_8033211C = 0x80 | 20;
 #ifdef VERSION_EU
@@ -2270,6 +2552,7 @@ void play_star_fanfare(void) {
 }
 
 void play_power_star_jingle(u8 arg0) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_PLAY_POWER_STAR_JINGLE, arg0, 0, 0, 0);
     if (!arg0) {
         D_80363812 = 0;
     }
@@ -2282,6 +2565,7 @@ void play_power_star_jingle(u8 arg0) {
 }
 
 void play_race_fanfare(void) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_PLAY_RACE_FANFARE, 0, 0, 0, 0);
     play_sequence(SEQ_PLAYER_ENV, SEQ_EVENT_RACE, 0);
     D_8033211C = 0x80 | 20;
 #ifdef VERSION_EU
@@ -2291,6 +2575,7 @@ void play_race_fanfare(void) {
 }
 
 void play_toads_jingle(void) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_PLAY_TOADS_JINGLE, 0, 0, 0, 0);
     play_sequence(SEQ_PLAYER_ENV, SEQ_EVENT_TOAD_MESSAGE, 0);
     D_8033211C = 0x80 | 20;
 #ifdef VERSION_EU
@@ -2300,6 +2585,7 @@ void play_toads_jingle(void) {
 }
 
 void sound_reset(u8 presetId) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_SOUND_RESET, presetId, 0, 0, 0);
 #ifndef VERSION_JP
     if (presetId >= 8) {
         presetId = 0;
@@ -2327,6 +2613,7 @@ void sound_reset(u8 presetId) {
 }
 
 void audio_set_sound_mode(u8 soundMode) {
+    DEFER_TO_AUDIO_THREAD(AUDIO_CMD_SET_SOUND_MODE, soundMode, 0, 0, 0);
     D_80332108 = (D_80332108 & 0xf) + (soundMode << 4);
     gSoundMode = soundMode;
 }
@@ -62,6 +62,12 @@ void audio_set_sound_mode(u8 arg0);
 
 void audio_init(void); // in load.c
 
+#ifndef TARGET_N64
+// Queue the game's calls for the audio thread instead of running them on the
+// caller's thread, see the top of external.c
+void audio_use_command_queue(void);
+#endif
+
 #ifdef VERSION_EU
 struct SPTask *unused_80321460(void);
 #endif
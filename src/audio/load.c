@@ -6,6 +6,10 @@
 #include "load.h"
 #include "seqplayer.h"
 
+#ifndef TARGET_N64
+#include "../pc/pcm_cache.h"
+#endif
+
 #define ALIGN16(val) (((val) + 0xF) & ~0xF)
 
 struct SharedDma {
@@ -486,6 +490,11 @@ void patch_audio_bank(struct AudioBank *mem, u8 *offset, u32 numInstruments, u32
 #define PATCH(x, base) (patched = (void *)((uintptr_t) (x) + (uintptr_t) base))
 #define PATCH_MEM(x) x = PATCH(x, mem)
 
+#ifndef TARGET_N64
+    // The bank's samples may sit where cached ones of an evicted bank were
+    pcm_cache_clear();
+#endif
+
     drums = mem->drums;
 #ifndef VERSION_EU
     if (drums != NULL && numDrums > 0) {
@@ -8,7 +8,12 @@
 #include "external.h"
 
 #ifndef TARGET_N64
+#include <stdlib.h>
 #include "../pc/mixer.h"
+#include "../pc/pcm_cache.h"
+#include "../pc/thread_pool.h"
+#include "../pc/configfile.h"
+#include "../pc/cheapProfiler.h"
 #endif
 
 #define DMEM_ADDR_TEMP 0x0
@@ -38,6 +43,14 @@
 
 #define ALIGN(val, amnt) (((val) + (1 << amnt) - 1) & ~((1 << amnt) - 1))
 
+#ifndef TARGET_N64
+// Samples in the PCM cache have their frames copied rather than decoded
+#define aADPCMdecSample(pkt, f, s, pcm, frame)                                                         \
+    ((pcm) != NULL ? aADPCMdecCached(pkt, f, s, pcm, frame) : aADPCMdec(pkt, f, s))
+#else
+#define aADPCMdecSample(pkt, f, s, pcm, frame) aADPCMdec(pkt, f, s)
+#endif
+
 struct VolumeChange {
     u16 sourceLeft;
     u16 sourceRight;
@@ -573,6 +586,168 @@ u64 *synthesis_do_one_audio_update(s16 *aiBuf, s32 bufLen, u64 *cmd, u32 updateI
 }
 #endif
 
+#if !defined(TARGET_N64) && !defined(VERSION_EU)
+// With more than one audio thread (configAudioThreads), the notes of an update
+// are decoded and resampled side by side, each in a mixer context of its own,
+// which then get merged into the default context in note order. The
+// envelopes still mix into the shared channels one note after the other, as
+// their rounding depends on the order. A note whose commands read anything
+// they didn't write themselves (DMEM left over by the notes before it, mostly)
+// is synthesized again in the default context, so the output stays bit for
+// bit what the serial loop makes.
+struct NoteJob {
+    struct Note *note;
+    const s16 *pcm;    // the sample's frames, if in the PCM cache
+    s16 *loadedBook;   // the codebook the mixer has, NULL for none
+    s32 bufLen;
+    s32 flags;         // from the final resample, for the envelope
+    struct MixerContext *mixer;
+    struct Note noteBefore;
+    struct NoteSynthesisBuffers buffersBefore;
+};
+
+// The note synthesis_process_notes decodes and resamples, instead of them all
+static __thread struct NoteJob *sNoteJob;
+
+static struct {
+    struct ThreadPool *pool;
+    struct NoteJob *jobs; // by note index
+    struct NoteJob **active;
+    s32 numJobs;
+    u8 initialized;
+} sNoteWorkers;
+
+static s32 note_workers_ready(void) {
+    s32 i;
+
+    if (!sNoteWorkers.initialized) {
+        s32 numThreads = configAudioThreads;
+        sNoteWorkers.initialized = TRUE;
+        if (numThreads == 0) {
+            // The game and the renderer have threads of their own
+            numThreads = thread_pool_num_cores() / 2;
+            if (numThreads > 4) {
+                numThreads = 4;
+            }
+        }
+        if (numThreads > 1) {
+            sNoteWorkers.pool = thread_pool_create(numThreads, "th_audio_notes");
+        }
+    }
+    if (sNoteWorkers.pool == NULL) {
+        return FALSE;
+    }
+    if (sNoteWorkers.numJobs < gMaxSimultaneousNotes) {
+        struct NoteJob *jobs = realloc(sNoteWorkers.jobs, gMaxSimultaneousNotes * sizeof(struct NoteJob));
+        struct NoteJob **active;
+        if (jobs == NULL) {
+            return FALSE;
+        }
+        sNoteWorkers.jobs = jobs;
+        active = realloc(sNoteWorkers.active, gMaxSimultaneousNotes * sizeof(struct NoteJob *));
+        if (active == NULL) {
+            return FALSE;
+        }
+        sNoteWorkers.active = active;
+        for (i = sNoteWorkers.numJobs; i < gMaxSimultaneousNotes; i++) {
+            jobs[i].mixer = mixer_context_create();
+            if (jobs[i].mixer == NULL) {
+                return FALSE;
+            }
+            sNoteWorkers.numJobs = i + 1;
+        }
+    }
+    return TRUE;
+}
+
+static void note_job_run(void *arg, int index) {
+    struct NoteJob *job = ((struct NoteJob **) arg)[index];
+
+    job->noteBefore = *job->note;
+    job->buffersBefore = *job->note->synthesisBuffers;
+    job->loadedBook = NULL;
+    mixer_context_reset_tracking(job->mixer);
+    mixer_set_context(job->mixer);
+    sNoteJob = job;
+    synthesis_process_notes(NULL, job->bufLen, NULL);
+    sNoteJob = NULL;
+}
+
+static u64 *synthesis_process_notes_parallel(s16 *aiBuf, s32 bufLen, u64 *cmd) {
+    struct Note *note;
+    struct NoteJob *job;
+    s16 *curLoadedBook = NULL;
+    s32 numActive = 0;
+    s32 numRerun = 0;
+    s32 noteIndex;
+    s32 i;
+    s32 s0;
+    s32 t9;
+
+    // The samples have to stay in the cache until the jobs are done with them
+    pcm_cache_hold();
+    for (noteIndex = 0; noteIndex < gMaxSimultaneousNotes; noteIndex++) {
+        note = &gNotes[noteIndex];
+#ifdef VERSION_US
+        if (((struct vNote *)note)->enabled && IS_BANK_LOAD_COMPLETE(note->bankId) == FALSE) {
+#else
+        if (IS_BANK_LOAD_COMPLETE(note->bankId) == FALSE) {
+#endif
+            gAudioErrorFlags = (note->bankId << 8) + noteIndex + 0x1000000;
+        } else if (((struct vNote *)note)->enabled) {
+            job = &sNoteWorkers.jobs[noteIndex];
+            job->note = note;
+            job->pcm = note->sound != NULL ? pcm_cache_get(note->sound->sample) : NULL;
+            job->bufLen = bufLen;
+            sNoteWorkers.active[numActive++] = job;
+        }
+    }
+    thread_pool_run(sNoteWorkers.pool, numActive, note_job_run, sNoteWorkers.active);
+    mixer_set_context(NULL);
+
+    for (i = 0; i < numActive; i++) {
+        job = sNoteWorkers.active[i];
+        note = job->note;
+        if (!mixer_context_read_unwritten(job->mixer)) {
+            mixer_context_merge(job->mixer);
+        } else {
+            *note = job->noteBefore;
+            *note->synthesisBuffers = job->buffersBefore;
+            job->loadedBook = curLoadedBook;
+            sNoteJob = job;
+            cmd = synthesis_process_notes(aiBuf, bufLen, cmd);
+            sNoteJob = NULL;
+            numRerun++;
+        }
+        if (note->sound != NULL) {
+            curLoadedBook = note->sound->sample->book->book;
+        }
+
+        if (note->headsetPanRight != 0 || note->prevHeadsetPanRight != 0) {
+            s0 = 1;
+        } else if (note->headsetPanLeft != 0 || note->prevHeadsetPanLeft != 0) {
+            s0 = 2;
+        } else {
+            s0 = 0;
+        }
+        cmd = process_envelope(cmd, note, bufLen, 0, s0, job->flags);
+        if (note->usesHeadsetPanEffects) {
+            cmd = note_apply_headset_pan_effects(cmd, note, bufLen * 2, job->flags, s0);
+        }
+    }
+    pcm_cache_release();
+    ProfEmitCounter("audio_notes_rerun", numRerun);
+
+    t9 = bufLen * 2;
+    aSetBuffer(cmd++, 0, 0, DMEM_ADDR_TEMP, t9);
+    aInterleave(cmd++, DMEM_ADDR_LEFT_CH, DMEM_ADDR_RIGHT_CH);
+    t9 *= 2;
+    aSetBuffer(cmd++, 0, 0, DMEM_ADDR_TEMP, t9);
+    aSaveBuffer(cmd++, VIRTUAL_TO_PHYSICAL2(aiBuf));
+    return cmd;
+}
+#endif
+
 #ifdef VERSION_EU
 // Processes just one note, not all
 u64 *synthesis_process_note(struct Note *note, struct NoteSubEu *noteSubEu, struct NoteSynthesisState *synthesisState, UNUSED s16 *aiBuf, s32 bufLen, u64 *cmd) {
@@ -660,11 +835,27 @@ u64 *synthesis_process_notes(s16 *aiBuf, s32 bufLen, u64 *cmd) {
 #endif
     s32 resampledTempLen;                    // spD8, spAC
     u16 noteSamplesDmemAddrBeforeResampling; // spD6, spAA
+#ifndef TARGET_N64
+    const s16 *pcm;                          // the sample's frames, if in the PCM cache
+#endif
 
 
+#if !defined(TARGET_N64) && !defined(VERSION_EU)
+    if (sNoteJob == NULL && note_workers_ready()) {
+        return synthesis_process_notes_parallel(aiBuf, bufLen, cmd);
+    }
+#endif
 #ifndef VERSION_EU
     for (noteIndex = 0; noteIndex < gMaxSimultaneousNotes; noteIndex++) {
         note = &gNotes[noteIndex];
+#ifndef TARGET_N64
+        if (sNoteJob != NULL) {
+            if (note != sNoteJob->note) {
+                continue;
+            }
+            curLoadedBook = sNoteJob->loadedBook;
+        }
+#endif
 #ifdef VERSION_US
         //! This function requires note->enabled to be volatile, but it breaks other functions like note_enable.
         //! Casting to a struct with just the volatile bitfield works, but there may be a better way to match.
@@ -759,6 +950,14 @@ u64 *synthesis_process_notes(s16 *aiBuf, s32 bufLen, u64 *cmd) {
                 endPos = loopInfo->end;
                 sampleAddr = audioBookSample->sampleAddr;
                 resampledTempLen = 0;
+#ifndef TARGET_N64
+#ifdef VERSION_EU
+                pcm = noteSubEu->bookOffset ? NULL : pcm_cache_get(audioBookSample);
+#else
+                pcm = sNoteJob != NULL ? sNoteJob->pcm : pcm_cache_get(audioBookSample);
+#endif
+                temp = 0;
+#endif
                 for (curPart = 0; curPart < nParts; curPart++) {
                     nAdpcmSamplesProcessed = 0; // s8
                     s5 = 0;                     // s4
@@ -852,6 +1051,13 @@ u64 *synthesis_process_notes(s16 *aiBuf, s32 bufLen, u64 *cmd) {
                             }
 #else
                             temp = (note->samplePosInt - s2 + 0x10) / 16;
+#ifndef TARGET_N64
+                            if (sNoteJob != NULL) {
+                                // The DMA buffers are shared by all notes, and
+                                // only hold copies of the sample here anyway
+                                v0_2 = sampleAddr + temp * 9;
+                            } else
+#endif
                             v0_2 = dma_sample_data(
                                 (uintptr_t) (sampleAddr + temp * 9),
                                 t0 * 9, flags, &note->sampleDmaIndex);
@@ -883,26 +1089,26 @@ u64 *synthesis_process_notes(s16 *aiBuf, s32 bufLen, u64 *cmd) {
                         if (nAdpcmSamplesProcessed == 0) {
                             aSetBuffer(cmd++, 0, DMEM_ADDR_COMPRESSED_ADPCM_DATA + a3,
                                        DMEM_ADDR_UNCOMPRESSED_NOTE, s0 * 2);
-                            aADPCMdec(cmd++, flags,
-                                      VIRTUAL_TO_PHYSICAL2(synthesisState->synthesisBuffers->adpcmdecState));
+                            aADPCMdecSample(cmd++, flags,
+                                            VIRTUAL_TO_PHYSICAL2(synthesisState->synthesisBuffers->adpcmdecState), pcm, temp);
                             sp130 = s2 * 2;
                         } else {
                             s5Aligned = ALIGN(s5, 5);
                             aSetBuffer(cmd++, 0, DMEM_ADDR_COMPRESSED_ADPCM_DATA + a3,
                                        DMEM_ADDR_UNCOMPRESSED_NOTE + s5Aligned, s0 * 2);
-                            aADPCMdec(cmd++, flags,
-                                      VIRTUAL_TO_PHYSICAL2(synthesisState->synthesisBuffers->adpcmdecState));
+                            aADPCMdecSample(cmd++, flags,
+                                            VIRTUAL_TO_PHYSICAL2(synthesisState->synthesisBuffers->adpcmdecState), pcm, temp);
                             aDMEMMove(cmd++, DMEM_ADDR_UNCOMPRESSED_NOTE + s5Aligned + (s2 * 2),
                                       DMEM_ADDR_UNCOMPRESSED_NOTE + s5, (nSamplesInThisIteration) * 2);
                         }
 #else
                         if (nAdpcmSamplesProcessed == 0) {
                             aSetBuffer(cmd++, 0, DMEM_ADDR_COMPRESSED_ADPCM_DATA + a3, DMEM_ADDR_UNCOMPRESSED_NOTE, s0 * 2);
-                            aADPCMdec(cmd++, flags, VIRTUAL_TO_PHYSICAL2(note->synthesisBuffers->adpcmdecState));
+                            aADPCMdecSample(cmd++, flags, VIRTUAL_TO_PHYSICAL2(note->synthesisBuffers->adpcmdecState), pcm, temp);
                             sp130 = s2 * 2;
                         } else {
                             aSetBuffer(cmd++, 0, DMEM_ADDR_COMPRESSED_ADPCM_DATA + a3, DMEM_ADDR_UNCOMPRESSED_NOTE + ALIGN(s5, 5), s0 * 2);
-                            aADPCMdec(cmd++, flags, VIRTUAL_TO_PHYSICAL2(note->synthesisBuffers->adpcmdecState));
+                            aADPCMdecSample(cmd++, flags, VIRTUAL_TO_PHYSICAL2(note->synthesisBuffers->adpcmdecState), pcm, temp);
                             aDMEMMove(cmd++, DMEM_ADDR_UNCOMPRESSED_NOTE + ALIGN(s5, 5) + (s2 * 2), DMEM_ADDR_UNCOMPRESSED_NOTE + s5, (nSamplesInThisIteration) * 2);
                         }
 #endif
@@ -1033,6 +1239,12 @@ u64 *synthesis_process_notes(s16 *aiBuf, s32 bufLen, u64 *cmd) {
 
             cmd = final_resample(cmd, note, bufLen * 2, resamplingRateFixedPoint,
                                  noteSamplesDmemAddrBeforeResampling, flags);
+#ifndef TARGET_N64
+            if (sNoteJob != NULL) {
+                sNoteJob->flags = flags;
+                return cmd;
+            }
+#endif
 #endif
 
 #ifndef VERSION_EU
@@ -28,11 +28,9 @@ extern struct SaveBuffer gSaveBuffer;
 
 extern u8 gGfxSPTaskStack[];
 
-#ifdef TARGET_N64
+// Two pools so one frame's display list can be drawn while the next is built,
+// by the RSP on N64 and by the render thread in pipelined mode on PC
 #define GFX_NUM_POOLS 2
-#else
-#define GFX_NUM_POOLS 1
-#endif
 extern struct GfxPool gGfxPools[GFX_NUM_POOLS];
 
 #endif // BUFFERS_H
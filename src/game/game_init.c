@@ -31,6 +31,8 @@ struct Controller gControllers[3];
 struct SPTask *gGfxSPTask;
 #ifdef USE_SYSTEM_MALLOC
 struct AllocOnlyPool *gGfxAllocOnlyPool;
+// One per gfx pool, a frame's display list chunks live until its pool comes around again
+struct AllocOnlyPool *gGfxAllocOnlyPools[GFX_NUM_POOLS];
 Gfx *gDisplayListHeadInChunk;
 Gfx *gDisplayListEndInChunk;
 #else
@@ -336,6 +338,7 @@ void config_gfx_pool(void) {
 #ifdef USE_SYSTEM_MALLOC
     gDisplayListHeadInChunk = gGfxPool->buffer;
     gDisplayListEndInChunk = gDisplayListHeadInChunk + 1;
+    gGfxAllocOnlyPool = gGfxAllocOnlyPools[gGlobalTimer % GFX_NUM_POOLS];
     alloc_only_pool_clear(gGfxAllocOnlyPool);
 #else
     gDisplayListHead = gGfxPool->buffer;
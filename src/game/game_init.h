@@ -43,6 +43,7 @@ extern void *D_80339CF4;
 extern struct SPTask *gGfxSPTask;
 #ifdef USE_SYSTEM_MALLOC
 extern struct AllocOnlyPool *gGfxAllocOnlyPool;
+extern struct AllocOnlyPool *gGfxAllocOnlyPools[];
 extern Gfx *gDisplayListHeadInChunk;
 extern Gfx *gDisplayListEndInChunk;
 #else
@@ -8,6 +8,7 @@
 
 #include "macros.h"
 #include "audio_api.h"
+#include "audio_resample.h"
 
 static struct {
     pa_mainloop *mainloop;
@@ -15,6 +16,7 @@ static struct {
     pa_stream *stream;
     pa_buffer_attr attr;
     bool write_complete;
+    struct AudioResample resample;
 } pas;
 
 static void pas_context_state_cb(pa_context *c, void *userdata) {
@@ -77,14 +79,18 @@ static bool audio_pulse_init(void) {
     // Create stream
     pa_sample_spec ss;
     ss.format = PA_SAMPLE_S16LE;
-    ss.rate = 32000;
+    ss.rate = audio_resample_wanted_rate();
     ss.channels = 2;
+    if (!audio_resample_init(&pas.resample, ss.rate)) {
+        goto fail;
+    }
     
+    // The sizes are for 32 kHz, scaled to the stream's rate
     pa_buffer_attr attr;
-    attr.maxlength = (1600 + 544 + 528 + 1600) * 4;
-    attr.tlength = (528*2 + 544) * 4;
-    attr.prebuf = 1500 * 4;
-    attr.minreq = 161 * 4;
+    attr.maxlength = (uint64_t)(1600 + 544 + 528 + 1600) * ss.rate / AUDIO_SYNTHESIS_RATE * 4;
+    attr.tlength = (uint64_t)(528*2 + 544) * ss.rate / AUDIO_SYNTHESIS_RATE * 4;
+    attr.prebuf = (uint64_t)1500 * ss.rate / AUDIO_SYNTHESIS_RATE * 4;
+    attr.minreq = (uint64_t)161 * ss.rate / AUDIO_SYNTHESIS_RATE * 4;
     attr.fragsize = (uint32_t)-1;
     
     pas.stream = pa_stream_new(pas.context, "mario", &ss, NULL);
@@ -147,7 +153,8 @@ static void pas_write_complete(UNUSED void *p) {
     pas.write_complete = true;
 }
 
-static int audio_pulse_buffered(void) {
+// In frames at the stream's rate
+static int pas_buffered(void) {
     if (pas.stream == NULL) {
         return 0;
     }
@@ -170,6 +177,10 @@ static int audio_pulse_buffered(void) {
     return (info->write_index - info->read_index) / 4;
 }
 
+static int audio_pulse_buffered(void) {
+    return audio_resample_to_synthesis_frames(&pas.resample, pas_buffered());
+}
+
 static int audio_pulse_get_desired_buffered(void) {
     return 1100;
 }
@@ -180,8 +191,9 @@ static void audio_pulse_play(const uint8_t *buf, size_t len) {
             return;
         }
     }
+    buf = audio_resample_convert(&pas.resample, buf, &len);
     //size_t ws = pa_stream_writable_size(pas.stream);
-    size_t ws = pas.attr.maxlength - audio_pulse_buffered() * 4;
+    size_t ws = pas.attr.maxlength - pas_buffered() * 4;
     if (ws < len) {
         //printf("Warning: can't write everything: %d vs %d\n", (int)len, (int)ws);
         len = ws;
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "audio_resample.h"
+#include "../mixer.h"
+#include "../configfile.h"
+
+int audio_resample_wanted_rate(void) {
+    return configAudioOutputRate != 0 ? (int)configAudioOutputRate : AUDIO_SYNTHESIS_RATE;
+}
+
+bool audio_resample_init(struct AudioResample *r, int rate) {
+    mixer_resampler_destroy(r->resampler);
+    r->resampler = NULL;
+    r->rate = rate;
+    if (rate == AUDIO_SYNTHESIS_RATE) {
+        return true;
+    }
+    r->resampler = mixer_resampler_create(AUDIO_SYNTHESIS_RATE, rate);
+    if (r->resampler == NULL) {
+        fprintf(stderr, "Can't resample the audio to %d Hz\n", rate);
+        return false;
+    }
+    printf("Resampling the audio to %d Hz\n", rate);
+    return true;
+}
+
+const uint8_t *audio_resample_convert(struct AudioResample *r, const uint8_t *buf, size_t *len) {
+    int frames = *len / 4;
+    int max_frames;
+
+    if (r->resampler == NULL) {
+        return buf;
+    }
+    max_frames = mixer_resampler_max_output(r->resampler, frames);
+    if (max_frames > r->buf_frames) {
+        int16_t *grown = realloc(r->buf, max_frames * 4);
+        if (grown == NULL) {
+            *len = 0;
+            return buf;
+        }
+        r->buf = grown;
+        r->buf_frames = max_frames;
+    }
+    *len = mixer_resampler_process(r->resampler, (const int16_t *)buf, frames, r->buf) * 4;
+    return (const uint8_t *)r->buf;
+}
+
+int audio_resample_to_synthesis_frames(const struct AudioResample *r, int frames) {
+    return r->resampler == NULL ? frames : (int)((int64_t)frames * AUDIO_SYNTHESIS_RATE / r->rate);
+}
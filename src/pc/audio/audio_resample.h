@@ -0,0 +1,32 @@
+#ifndef AUDIO_RESAMPLE_H
+#define AUDIO_RESAMPLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// The synthesis puts out 32 kHz. With audio_output_rate set, the backends
+// open the device at that rate (or the nearest it takes) and convert with the
+// mixer's resampler, instead of leaving the conversion to SDL or the server.
+// buffered() and get_desired_buffered() stay in 32 kHz frames either way.
+
+#define AUDIO_SYNTHESIS_RATE 32000
+
+struct AudioResample {
+    struct MixerResampler *resampler; // NULL while the device takes 32 kHz
+    int rate; // of the device
+    int16_t *buf;
+    int buf_frames;
+};
+
+// The rate to open the device at
+int audio_resample_wanted_rate(void);
+// Sets up for a device opened at rate, returns false if it can't convert to it
+bool audio_resample_init(struct AudioResample *r, int rate);
+// Returns buf at the device's rate, and its length in len. The result stays
+// valid until the next call.
+const uint8_t *audio_resample_convert(struct AudioResample *r, const uint8_t *buf, size_t *len);
+// Frames at the device's rate to 32 kHz frames
+int audio_resample_to_synthesis_frames(const struct AudioResample *r, int frames);
+
+#endif
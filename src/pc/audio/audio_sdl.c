@@ -7,8 +7,10 @@
 #endif
 
 #include "audio_api.h"
+#include "audio_resample.h"
 
 static SDL_AudioDeviceID dev;
+static struct AudioResample resample;
 
 static bool audio_sdl_init(void) {
     if (SDL_Init(SDL_INIT_AUDIO) != 0) {
@@ -17,22 +19,26 @@ static bool audio_sdl_init(void) {
     }
     SDL_AudioSpec want, have;
     SDL_zero(want);
-    want.freq = 32000;
+    want.freq = audio_resample_wanted_rate();
     want.format = AUDIO_S16;
     want.channels = 2;
     want.samples = 512;
     want.callback = NULL;
-    dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0);
+    dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, want.freq != AUDIO_SYNTHESIS_RATE ? SDL_AUDIO_ALLOW_FREQUENCY_CHANGE : 0);
     if (dev == 0) {
         fprintf(stderr, "SDL_OpenAudio error: %s\n", SDL_GetError());
         return false;
     }
+    if (!audio_resample_init(&resample, have.freq)) {
+        SDL_CloseAudioDevice(dev);
+        return false;
+    }
     SDL_PauseAudioDevice(dev, 0);
     return true;
 }
 
 static int audio_sdl_buffered(void) {
-    return SDL_GetQueuedAudioSize(dev) / 4;
+    return audio_resample_to_synthesis_frames(&resample, SDL_GetQueuedAudioSize(dev) / 4);
 }
 
 static int audio_sdl_get_desired_buffered(void) {
@@ -42,6 +48,7 @@ static int audio_sdl_get_desired_buffered(void) {
 static void audio_sdl_play(const uint8_t *buf, size_t len) {
     if (audio_sdl_buffered() < 6000) {
         // Don't fill the audio buffer too much in case this happens
+        buf = audio_resample_convert(&resample, buf, &len);
         SDL_QueueAudio(dev, buf, len);
     }
 }
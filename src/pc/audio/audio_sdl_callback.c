@@ -0,0 +1,202 @@
+#if !defined(_WIN32) && !defined(_WIN64)
+
+#ifdef __MINGW32__
+#include "SDL.h"
+#else
+#include "SDL2/SDL.h"
+#endif
+
+#include "macros.h"
+#include "audio_api.h"
+#include "audio_resample.h"
+#include "../cheapProfiler.h"
+
+// SDL audio in pull mode. The device's callback takes what it needs from a
+// lock-free ring that play() fills from the port's audio thread, instead of
+// both going through SDL_QueueAudio's locked queue. On top of that:
+// - The fill the audio thread is asked to keep (get_desired_buffered) adapts.
+//   It grows each time the callback finds the ring short and creeps back down
+//   while it doesn't, so latency settles at what the machine can sustain.
+// - The callback plays the ring up to RATE_MAX_ADJUST faster or slower to
+//   pull the fill towards that target. This absorbs the drift between the
+//   device's clock and the rate the game produces at, and slows the drain
+//   down before it runs dry when synthesis falls behind.
+// The ring holds frames at the device's rate, the target is in 32 kHz frames
+// like everything the audio thread sees. The device runs from init(), but the
+// audio thread only starts producing after the first game frame, so until the
+// first play() the callback plays silence without counting underruns.
+
+#define RING_FRAMES 16384 // power of two, room for TARGET_MAX at 96 kHz
+#define DEVICE_FRAMES 512
+
+#define TARGET_START 1100
+#define TARGET_MIN 768
+#define TARGET_MAX 4096
+#define TARGET_GROW 256
+#define TARGET_SHRINK 32
+#define TARGET_SHRINK_PERIOD 64000 // frames played without an underrun
+
+#define RATE_MAX_ADJUST 0.005f
+
+static SDL_AudioDeviceID dev;
+static struct AudioResample resample;
+
+static struct {
+    int16_t frames[RING_FRAMES][2];
+    uint32_t head; // only written by play()
+    uint8_t pad[60];
+    uint32_t tail; // only written by the callback
+    uint32_t phase; // position between the frames at tail and tail + 1, 16.16
+    uint32_t target;
+    uint32_t device_frames;
+    float frames_per_target; // frames of the ring per 32 kHz frame
+    uint32_t last_chunk; // frames of the last play(), the fill saws up by that much
+    float avg_fill;
+    uint32_t step; // 16.16 frames of the ring per frame played
+    uint32_t frames_since_underrun;
+    uint32_t underruns; // counted by the callback, reported by play()
+    uint32_t overruns;
+    bool started; // set by the first play()
+} ring;
+
+static void audio_sdl_callback_adapt(uint32_t fill, bool underrun, uint32_t frames) {
+    uint32_t target = ring.target;
+
+    if (underrun) {
+        target = target + TARGET_GROW < TARGET_MAX ? target + TARGET_GROW : TARGET_MAX;
+        ring.frames_since_underrun = 0;
+        __atomic_fetch_add(&ring.underruns, 1, __ATOMIC_RELAXED);
+    } else {
+        ring.frames_since_underrun += frames;
+        if (ring.frames_since_underrun >= TARGET_SHRINK_PERIOD) {
+            target = target - TARGET_SHRINK > TARGET_MIN ? target - TARGET_SHRINK : TARGET_MIN;
+            ring.frames_since_underrun = 0;
+        }
+    }
+    __atomic_store_n(&ring.target, target, __ATOMIC_RELAXED);
+
+    // The audio thread tops the ring up once it's under the target, so on
+    // average it sits half a chunk above it
+    float center = target * ring.frames_per_target + __atomic_load_n(&ring.last_chunk, __ATOMIC_RELAXED) / 2.0f;
+    ring.avg_fill += (fill - ring.avg_fill) / 16.0f;
+    float error = (ring.avg_fill - center) / center;
+    if (error > 1.0f) {
+        error = 1.0f;
+    } else if (error < -1.0f) {
+        error = -1.0f;
+    }
+    __atomic_store_n(&ring.step, (uint32_t)(65536.0f * (1.0f + RATE_MAX_ADJUST * error)), __ATOMIC_RELAXED);
+}
+
+static void audio_sdl_callback_fill(UNUSED void *userdata, Uint8 *stream, int len) {
+    int16_t *out = (int16_t *)stream;
+    int frames = len / 4;
+    uint32_t tail = ring.tail;
+    uint32_t fill;
+    uint32_t step = ring.step;
+    uint32_t pos = ring.phase;
+    int i;
+
+    if (!__atomic_load_n(&ring.started, __ATOMIC_ACQUIRE)) {
+        memset(out, 0, frames * 4);
+        return;
+    }
+    fill = __atomic_load_n(&ring.head, __ATOMIC_ACQUIRE) - tail;
+
+    for (i = 0; i < frames; i++) {
+        uint32_t idx = pos >> 16;
+        if (idx + 1 >= fill) {
+            break;
+        }
+        const int16_t *a = ring.frames[(tail + idx) % RING_FRAMES];
+        const int16_t *b = ring.frames[(tail + idx + 1) % RING_FRAMES];
+        int32_t frac = (pos & 0xffff) >> 1;
+        out[i * 2] = a[0] + (((b[0] - a[0]) * frac) >> 15);
+        out[i * 2 + 1] = a[1] + (((b[1] - a[1]) * frac) >> 15);
+        pos += step;
+    }
+    if (i < frames) {
+        memset(out + i * 2, 0, (frames - i) * 4);
+    }
+    ring.phase = pos & 0xffff;
+    __atomic_store_n(&ring.tail, tail + (pos >> 16), __ATOMIC_RELEASE);
+
+    audio_sdl_callback_adapt(fill, i < frames, frames);
+}
+
+static bool audio_sdl_callback_init(void) {
+    if (SDL_Init(SDL_INIT_AUDIO) != 0) {
+        fprintf(stderr, "SDL init error: %s\n", SDL_GetError());
+        return false;
+    }
+    ring.target = TARGET_START;
+    ring.step = 65536;
+
+    SDL_AudioSpec want, have;
+    SDL_zero(want);
+    want.freq = audio_resample_wanted_rate();
+    want.format = AUDIO_S16;
+    want.channels = 2;
+    want.samples = DEVICE_FRAMES;
+    want.callback = audio_sdl_callback_fill;
+    dev = SDL_OpenAudioDevice(NULL, 0, &want, &have, want.freq != AUDIO_SYNTHESIS_RATE ? SDL_AUDIO_ALLOW_FREQUENCY_CHANGE : 0);
+    if (dev == 0) {
+        fprintf(stderr, "SDL_OpenAudio error: %s\n", SDL_GetError());
+        return false;
+    }
+    if (!audio_resample_init(&resample, have.freq)) {
+        SDL_CloseAudioDevice(dev);
+        return false;
+    }
+    ring.device_frames = have.samples;
+    ring.frames_per_target = (float)have.freq / AUDIO_SYNTHESIS_RATE;
+    ring.avg_fill = TARGET_START * ring.frames_per_target;
+    SDL_PauseAudioDevice(dev, 0);
+    return true;
+}
+
+static int audio_sdl_callback_buffered(void) {
+    uint32_t fill = __atomic_load_n(&ring.head, __ATOMIC_RELAXED) - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE);
+    return audio_resample_to_synthesis_frames(&resample, fill);
+}
+
+static int audio_sdl_callback_get_desired_buffered(void) {
+    return __atomic_load_n(&ring.target, __ATOMIC_RELAXED);
+}
+
+static void audio_sdl_callback_play(const uint8_t *buf, size_t len) {
+    uint32_t head = ring.head;
+    uint32_t fill = head - __atomic_load_n(&ring.tail, __ATOMIC_ACQUIRE);
+    uint32_t frames;
+
+    buf = audio_resample_convert(&resample, buf, &len);
+    frames = len / 4;
+
+    if (frames > RING_FRAMES - fill) {
+        ring.overruns++;
+        frames = RING_FRAMES - fill;
+    }
+    uint32_t start = head % RING_FRAMES;
+    uint32_t first = frames < RING_FRAMES - start ? frames : RING_FRAMES - start;
+    memcpy(ring.frames[start], buf, first * 4);
+    memcpy(ring.frames[0], buf + first * 4, (frames - first) * 4);
+    __atomic_store_n(&ring.last_chunk, frames, __ATOMIC_RELAXED);
+    __atomic_store_n(&ring.head, head + frames, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring.started, true, __ATOMIC_RELEASE);
+
+    ProfEmitCounter("audio_cb_underruns", __atomic_exchange_n(&ring.underruns, 0, __ATOMIC_RELAXED));
+    ProfEmitCounter("audio_overruns", ring.overruns);
+    ring.overruns = 0;
+    ProfEmitCounter("audio_target_frames", audio_sdl_callback_get_desired_buffered());
+    ProfEmitCounter("audio_latency_ms", (fill + frames + ring.device_frames) * 1000.0 / resample.rate);
+    ProfEmitCounter("audio_rate_ppm", ((int32_t)__atomic_load_n(&ring.step, __ATOMIC_RELAXED) - 65536) * 1000000.0 / 65536);
+}
+
+struct AudioAPI audio_sdl_callback = {
+    audio_sdl_callback_init,
+    audio_sdl_callback_buffered,
+    audio_sdl_callback_get_desired_buffered,
+    audio_sdl_callback_play
+};
+
+#endif
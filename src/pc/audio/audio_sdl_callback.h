@@ -0,0 +1,6 @@
+#ifndef AUDIO_SDL_CALLBACK_H
+#define AUDIO_SDL_CALLBACK_H
+
+extern struct AudioAPI audio_sdl_callback;
+
+#endif
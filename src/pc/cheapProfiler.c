@@ -4,6 +4,7 @@
 #include <time.h>
 #include <error.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "cheapProfiler.h"
 
@@ -17,6 +18,7 @@
 
 typedef struct EventSlot {
     int needs_sampling;
+    int is_counter;
     double total;
     struct timespec start;
     char label[MAX_LABEL_SIZE];
@@ -26,6 +28,8 @@ static int cur_event_frame = 0;
 static int events_allocated = 0;
 static EventSlot event_slots[MAX_PROFILER_SLOTS] = {};
 static FILE *f = NULL;
+// Events come from the game thread too when rendering is pipelined
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
 
 
 // Returns difference between two timespec structures in nanoseconds
@@ -59,19 +63,33 @@ static int getProfilerSlot(char *label)
     return -1;
 }
 
+//getOrCreateProfilerSlot: Returns the slot for label, creating it if needed, NULL when full
+static EventSlot *getOrCreateProfilerSlot(char *label, int is_counter)
+{
+    int slot;
+    if ((slot = getProfilerSlot(label)) != -1)
+        return &event_slots[slot];
+
+    if (events_allocated == MAX_PROFILER_SLOTS)
+        return NULL;
+
+    EventSlot *ev = &event_slots[events_allocated++];
+    strncpy(ev->label, label, MAX_LABEL_SIZE - 1);
+    ev->total = 0;
+    ev->needs_sampling = 0;
+    ev->is_counter = is_counter;
+    return ev;
+}
+
 void ProfEmitEventStart(char *label)
 {
     EventSlot *ev;
 
-    int slot;
-    if ((slot = getProfilerSlot(label)) == -1) {
-        // Create new event if we don't have one
-        ev = &event_slots[events_allocated++];
-        strncpy(ev->label, label, MAX_LABEL_SIZE);
-        ev->total = 0;
-        ev->needs_sampling = 0;
-    } else {
-        ev = &event_slots[slot];
+    pthread_mutex_lock(&lock);
+    // Create new event if we don't have one
+    if ((ev = getOrCreateProfilerSlot(label, 0)) == NULL) {
+        pthread_mutex_unlock(&lock);
+        return;
     }
 
     if (ev->needs_sampling == 1)
@@ -79,6 +97,7 @@ void ProfEmitEventStart(char *label)
 
     clock_gettime(CLOCK_MONOTONIC, &ev->start);
     ev->needs_sampling = 1;
+    pthread_mutex_unlock(&lock);
 }
 
 void ProfEmitEventEnd(char *label)
@@ -86,8 +105,11 @@ void ProfEmitEventEnd(char *label)
     EventSlot *ev;
 
     int slot;
-    if ((slot = getProfilerSlot(label)) == -1)
+    pthread_mutex_lock(&lock);
+    if ((slot = getProfilerSlot(label)) == -1) {
+        pthread_mutex_unlock(&lock);
         return;
+    }
 
     ev = &event_slots[slot];
     if (ev->needs_sampling == 0)
@@ -99,6 +121,17 @@ void ProfEmitEventEnd(char *label)
     ev->total += ms_diff;
 
     ev->needs_sampling = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+void ProfEmitCounter(char *label, double value)
+{
+    EventSlot *ev;
+
+    pthread_mutex_lock(&lock);
+    if ((ev = getOrCreateProfilerSlot(label, 1)) != NULL)
+        ev->total += value;
+    pthread_mutex_unlock(&lock);
 }
 
 void ProfSampleFrame()
@@ -110,6 +143,7 @@ void ProfSampleFrame()
         return;
     }
 
+    pthread_mutex_lock(&lock);
     // Keeps track if we need commas or something for the next character
     char next = '{';
     for (int i = 0; i < events_allocated; i++) {
@@ -117,8 +151,14 @@ void ProfSampleFrame()
         if (ev->needs_sampling)
             fprintf(stderr, "Frame ended with event %s end still pending.\n", ev->label);
 
+        // Counters are emitted whenever they moved, they aren't times.
+        if (ev->is_counter) {
+            if (ev->total != 0) {
+                fprintf(f, "%c \"%s\": %g", next, ev->label, ev->total);
+                next = ',';
+            }
         // Only emit samples for events with significant time spent in a frame.
-        if (ev->total > 0.1) {
+        } else if (ev->total > 0.1) {
             fprintf(f, "%c \"%s\": %.1f", next, ev->label, ev->total);
             next = ',';
         }
@@ -134,5 +174,6 @@ void ProfSampleFrame()
 
     fflush(f);
     cur_event_frame++;
+    pthread_mutex_unlock(&lock);
 }
 #endif /* USE_PROFILER */
\ No newline at end of file
@@ -4,10 +4,13 @@
 #ifdef USE_PROFILER
 extern void ProfEmitEventStart(char *label);
 extern void ProfEmitEventEnd(char *label);
+// Adds value to a per-frame counter, reset after each ProfSampleFrame
+extern void ProfEmitCounter(char *label, double value);
 extern void ProfSampleFrame();
 #else
 #define ProfEmitEventStart(...) ;
 #define ProfEmitEventEnd(...) ;
+#define ProfEmitCounter(...) ;
 #define ProfSampleFrame(...) ;
 #endif
 
@@ -71,6 +71,30 @@ unsigned int puppycam_degrade = 10;
 unsigned int puppycam_aggression = 0;
 unsigned int puppycam_panlevel = 75;
 
+// Renderer
+bool configRetainedGeometry = true;
+bool configDeferredDraws = false;
+unsigned int configTextureCacheSize = 512;
+bool configTexturePack = true;
+bool configAtlasSkyline = true;
+unsigned int configAtlasPages = 2;
+bool configShaderCache = true;
+bool configDynaresAdaptive = true;
+float configDynaresMinScale = 0.5f;
+float configDynaresMaxScale = 1.0f;
+float configDynaresTargetMs = 33.3f;
+bool configPipelinedRender = false;
+bool configHwTnl = false;
+unsigned int configCaptureStartFrame = 300;
+unsigned int configCaptureFrames = 0;
+float configFrameRate = 30.0f;
+
+// Audio
+bool configAudioCallback = false;
+unsigned int configPcmCacheKb = 2048;
+unsigned int configAudioThreads = 0; // 0 picks from the number of cores
+unsigned int configAudioOutputRate = 0; // 0 sends the synthesis' 32 kHz
+
 
 
 static const struct ConfigOption options[] = {
@@ -95,6 +119,26 @@ static const struct ConfigOption options[] = {
     {.name = "puppycam_stopping_speed", .type = CONFIG_TYPE_UINT, .uintValue = &puppycam_degrade},
     {.name = "puppycam_centre_aggression", .type = CONFIG_TYPE_UINT, .uintValue = &puppycam_aggression},
     {.name = "puppycam_pan_amount", .type = CONFIG_TYPE_UINT, .uintValue = &puppycam_panlevel},
+    {.name = "retained_geometry", .type = CONFIG_TYPE_BOOL, .boolValue = &configRetainedGeometry},
+    {.name = "deferred_draws", .type = CONFIG_TYPE_BOOL, .boolValue = &configDeferredDraws},
+    {.name = "texture_cache_size", .type = CONFIG_TYPE_UINT, .uintValue = &configTextureCacheSize},
+    {.name = "texture_pack", .type = CONFIG_TYPE_BOOL, .boolValue = &configTexturePack},
+    {.name = "atlas_skyline", .type = CONFIG_TYPE_BOOL, .boolValue = &configAtlasSkyline},
+    {.name = "atlas_pages", .type = CONFIG_TYPE_UINT, .uintValue = &configAtlasPages},
+    {.name = "shader_cache", .type = CONFIG_TYPE_BOOL, .boolValue = &configShaderCache},
+    {.name = "dynares_adaptive", .type = CONFIG_TYPE_BOOL, .boolValue = &configDynaresAdaptive},
+    {.name = "dynares_min_scale", .type = CONFIG_TYPE_FLOAT, .floatValue = &configDynaresMinScale},
+    {.name = "dynares_max_scale", .type = CONFIG_TYPE_FLOAT, .floatValue = &configDynaresMaxScale},
+    {.name = "dynares_target_ms", .type = CONFIG_TYPE_FLOAT, .floatValue = &configDynaresTargetMs},
+    {.name = "pipelined_render", .type = CONFIG_TYPE_BOOL, .boolValue = &configPipelinedRender},
+    {.name = "hw_tnl", .type = CONFIG_TYPE_BOOL, .boolValue = &configHwTnl},
+    {.name = "capture_start_frame", .type = CONFIG_TYPE_UINT, .uintValue = &configCaptureStartFrame},
+    {.name = "capture_frames", .type = CONFIG_TYPE_UINT, .uintValue = &configCaptureFrames},
+    {.name = "frame_rate", .type = CONFIG_TYPE_FLOAT, .floatValue = &configFrameRate},
+    {.name = "audio_callback", .type = CONFIG_TYPE_BOOL, .boolValue = &configAudioCallback},
+    {.name = "pcm_cache_kb", .type = CONFIG_TYPE_UINT, .uintValue = &configPcmCacheKb},
+    {.name = "audio_threads", .type = CONFIG_TYPE_UINT, .uintValue = &configAudioThreads},
+    {.name = "audio_output_rate", .type = CONFIG_TYPE_UINT, .uintValue = &configAudioOutputRate},
 
 
 };
@@ -24,6 +24,27 @@ extern unsigned int puppycam_degrade;
 extern unsigned int puppycam_aggression;
 extern unsigned int puppycam_panlevel;
 
+extern bool         configRetainedGeometry;
+extern bool         configDeferredDraws;
+extern unsigned int configTextureCacheSize;
+extern bool         configTexturePack;
+extern bool         configAtlasSkyline;
+extern unsigned int configAtlasPages;
+extern bool         configShaderCache;
+extern bool         configDynaresAdaptive;
+extern float        configDynaresMinScale;
+extern float        configDynaresMaxScale;
+extern float        configDynaresTargetMs;
+extern bool         configPipelinedRender;
+extern bool         configHwTnl;
+extern unsigned int configCaptureStartFrame;
+extern unsigned int configCaptureFrames;
+extern float        configFrameRate;
+extern bool         configAudioCallback;
+extern unsigned int configPcmCacheKb;
+extern unsigned int configAudioThreads;
+extern unsigned int configAudioOutputRate;
+
 void configfile_load(const char *filename);
 void configfile_save(const char *filename);
 
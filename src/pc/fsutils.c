@@ -1,6 +1,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <SDL2/SDL.h>
 #if defined(TARGET_OD) || defined(TARGET_LINUX)
 #include <sys/stat.h>
 #include <errno.h>
@@ -30,4 +31,17 @@ FILE *fopen_home(const char *filename, const char *mode)
 #else
     return fopen(filename, mode);
 #endif
+}
+
+const char *path_next_to_exe(const char *filename)
+{
+    static char fnamepath[2048];
+    char *base = SDL_GetBasePath();
+
+    if (base == NULL) {
+        return filename;
+    }
+    snprintf(fnamepath, sizeof(fnamepath), "%s%s", base, filename);
+    SDL_free(base);
+    return fnamepath;
 }
\ No newline at end of file
@@ -3,5 +3,9 @@
 #include <stdio.h>
 
 FILE *fopen_home(const char *filename, const char *mode);
+// Returns filename in the executable's directory, where the build puts the
+// files it makes for the game, or filename itself if SDL can't tell where
+// that is. Valid until the next call.
+const char *path_next_to_exe(const char *filename);
 
 #endif /* __FS_UTILS_H__ */
\ No newline at end of file
@@ -0,0 +1,266 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gfx_capture.h"
+#include "../fsutils.h"
+
+struct CaptureRange {
+    uintptr_t addr;
+    size_t size;
+};
+
+static struct {
+    FILE *file;
+    uint32_t num_frames;
+    uintptr_t root;
+    struct CaptureRange *ranges;
+    size_t num_ranges;
+    size_t max_ranges;
+} writer;
+
+static const uint8_t capture_padding[8];
+
+bool gfx_capture_open(const char *filename) {
+    writer.file = fopen_home(filename, "wb");
+    if (writer.file == NULL) {
+        fprintf(stderr, "Could not open %s for writing\n", filename);
+        return false;
+    }
+    writer.num_frames = 0;
+    struct GfxCaptureHeader header = {GFX_CAPTURE_MAGIC, sizeof(uintptr_t), 0, 0};
+    fwrite(&header, sizeof(header), 1, writer.file);
+    return true;
+}
+
+void gfx_capture_begin_frame(const void *root) {
+    writer.root = (uintptr_t)root;
+    writer.num_ranges = 0;
+}
+
+void gfx_capture_add(const void *addr, size_t size) {
+    uintptr_t start = (uintptr_t)addr;
+    if (writer.num_ranges > 0) {
+        // Commands of a display list come in order, extend the last range
+        // rather than sorting them all out at the end of the frame
+        struct CaptureRange *last = &writer.ranges[writer.num_ranges - 1];
+        if (start >= last->addr && start <= last->addr + last->size) {
+            if (start + size > last->addr + last->size) {
+                last->size = start + size - last->addr;
+            }
+            return;
+        }
+    }
+    if (writer.num_ranges == writer.max_ranges) {
+        writer.max_ranges = writer.max_ranges == 0 ? 1024 : writer.max_ranges * 2;
+        writer.ranges = realloc(writer.ranges, writer.max_ranges * sizeof(struct CaptureRange));
+        if (writer.ranges == NULL) {
+            fprintf(stderr, "Out of memory capturing a frame\n");
+            abort();
+        }
+    }
+    writer.ranges[writer.num_ranges].addr = start;
+    writer.ranges[writer.num_ranges].size = size;
+    writer.num_ranges++;
+}
+
+static int gfx_capture_compare_ranges(const void *a, const void *b) {
+    const struct CaptureRange *ra = (const struct CaptureRange *)a;
+    const struct CaptureRange *rb = (const struct CaptureRange *)b;
+    if (ra->addr != rb->addr) {
+        return ra->addr < rb->addr ? -1 : 1;
+    }
+    return 0;
+}
+
+void gfx_capture_end_frame(void) {
+    qsort(writer.ranges, writer.num_ranges, sizeof(struct CaptureRange), gfx_capture_compare_ranges);
+    size_t n = 0;
+    for (size_t i = 0; i < writer.num_ranges; i++) {
+        struct CaptureRange r = writer.ranges[i];
+        if (n > 0 && r.addr <= writer.ranges[n - 1].addr + writer.ranges[n - 1].size) {
+            struct CaptureRange *prev = &writer.ranges[n - 1];
+            if (r.addr + r.size > prev->addr + prev->size) {
+                prev->size = r.addr + r.size - prev->addr;
+            }
+        } else {
+            writer.ranges[n++] = r;
+        }
+    }
+    writer.num_ranges = n;
+
+    struct GfxCaptureFrameHeader frame = {writer.root, (uint32_t)n, 0};
+    fwrite(&frame, sizeof(frame), 1, writer.file);
+    for (size_t i = 0; i < n; i++) {
+        struct GfxCaptureRegionHeader region = {writer.ranges[i].addr, (uint32_t)writer.ranges[i].size, 0};
+        fwrite(&region, sizeof(region), 1, writer.file);
+        fwrite((const void *)writer.ranges[i].addr, 1, writer.ranges[i].size, writer.file);
+        fwrite(capture_padding, 1, (8 - writer.ranges[i].size % 8) % 8, writer.file);
+    }
+    writer.num_frames++;
+}
+
+void gfx_capture_close(void) {
+    struct GfxCaptureHeader header = {GFX_CAPTURE_MAGIC, sizeof(uintptr_t), writer.num_frames, 0};
+    fseek(writer.file, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, writer.file);
+    fclose(writer.file);
+    writer.file = NULL;
+    free(writer.ranges);
+    writer.ranges = NULL;
+    writer.num_ranges = 0;
+    writer.max_ranges = 0;
+}
+
+// Index of the last region starting at or before addr, or -1
+static ptrdiff_t gfx_capture_find(const struct GfxCaptureFrame *frame, uintptr_t addr) {
+    ptrdiff_t lo = 0;
+    ptrdiff_t hi = (ptrdiff_t)frame->num_regions - 1;
+    ptrdiff_t found = -1;
+    while (lo <= hi) {
+        ptrdiff_t mid = (lo + hi) / 2;
+        if (frame->regions[mid].addr <= addr) {
+            found = mid;
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+    return found;
+}
+
+void *gfx_capture_translate(const struct GfxCaptureFrame *frame, uintptr_t addr) {
+    ptrdiff_t i = gfx_capture_find(frame, addr);
+    if (i >= 0 && addr - frame->regions[i].addr < frame->regions[i].size) {
+        return (void *)(frame->regions[i].data + (addr - frame->regions[i].addr));
+    }
+    return (void *)addr;
+}
+
+// Walks the file, counting what it holds. Returns false if it's truncated.
+static bool gfx_capture_scan(const uint8_t *file, size_t file_size, size_t num_frames, size_t *num_regions, size_t *data_size) {
+    size_t pos = sizeof(struct GfxCaptureHeader);
+    *num_regions = 0;
+    *data_size = 0;
+    for (size_t i = 0; i < num_frames; i++) {
+        struct GfxCaptureFrameHeader frame;
+        if (pos + sizeof(frame) > file_size) {
+            return false;
+        }
+        memcpy(&frame, file + pos, sizeof(frame));
+        pos += sizeof(frame);
+        for (uint32_t j = 0; j < frame.num_regions; j++) {
+            struct GfxCaptureRegionHeader region;
+            if (pos + sizeof(region) > file_size) {
+                return false;
+            }
+            memcpy(&region, file + pos, sizeof(region));
+            pos += sizeof(region);
+            size_t padded = ((size_t)region.size + 7) & ~(size_t)7;
+            if (pos + padded > file_size) {
+                return false;
+            }
+            pos += padded;
+            // Room to give the copy the same alignment as the original
+            *data_size += region.size + 16;
+        }
+        *num_regions += frame.num_regions;
+    }
+    return true;
+}
+
+bool gfx_capture_load(struct GfxCapture *capture, const char *filename) {
+    memset(capture, 0, sizeof(*capture));
+    FILE *f = fopen(filename, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open %s\n", filename);
+        return false;
+    }
+    fseek(f, 0, SEEK_END);
+    long file_size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    uint8_t *file = file_size > 0 ? malloc(file_size) : NULL;
+    if (file == NULL || fread(file, 1, file_size, f) != (size_t)file_size) {
+        fprintf(stderr, "Could not read %s\n", filename);
+        fclose(f);
+        free(file);
+        return false;
+    }
+    fclose(f);
+
+    struct GfxCaptureHeader header;
+    size_t num_regions, data_size;
+    if ((size_t)file_size < sizeof(header)) {
+        goto invalid;
+    }
+    memcpy(&header, file, sizeof(header));
+    if (header.magic != GFX_CAPTURE_MAGIC || header.pointer_size != sizeof(uintptr_t)) {
+        goto invalid;
+    }
+    if (!gfx_capture_scan(file, file_size, header.num_frames, &num_regions, &data_size)) {
+        goto invalid;
+    }
+
+    capture->num_frames = header.num_frames;
+    capture->frames = calloc(header.num_frames, sizeof(struct GfxCaptureFrame));
+    capture->regions = calloc(num_regions, sizeof(struct GfxCaptureRegion));
+    capture->data = malloc(data_size + 16);
+    if (capture->frames == NULL || (num_regions > 0 && capture->regions == NULL) || capture->data == NULL) {
+        fprintf(stderr, "Out of memory loading %s\n", filename);
+        free(file);
+        gfx_capture_free(capture);
+        return false;
+    }
+
+    size_t pos = sizeof(header);
+    uintptr_t out = (uintptr_t)capture->data;
+    struct GfxCaptureRegion *regions = capture->regions;
+    for (size_t i = 0; i < capture->num_frames; i++) {
+        struct GfxCaptureFrame *frame = &capture->frames[i];
+        const struct GfxCaptureFrame *prev = i > 0 ? &capture->frames[i - 1] : NULL;
+        struct GfxCaptureFrameHeader frame_header;
+        memcpy(&frame_header, file + pos, sizeof(frame_header));
+        pos += sizeof(frame_header);
+        frame->root = (uintptr_t)frame_header.root;
+        frame->num_regions = frame_header.num_regions;
+        frame->regions = regions;
+        regions += frame->num_regions;
+
+        for (size_t j = 0; j < frame->num_regions; j++) {
+            struct GfxCaptureRegion *r = &frame->regions[j];
+            struct GfxCaptureRegionHeader region;
+            memcpy(&region, file + pos, sizeof(region));
+            pos += sizeof(region);
+            r->addr = (uintptr_t)region.addr;
+            r->size = region.size;
+
+            ptrdiff_t k = prev != NULL ? gfx_capture_find(prev, r->addr) : -1;
+            if (k >= 0 && r->addr + r->size <= prev->regions[k].addr + prev->regions[k].size &&
+                memcmp(prev->regions[k].data + (r->addr - prev->regions[k].addr), file + pos, r->size) == 0) {
+                r->data = prev->regions[k].data + (r->addr - prev->regions[k].addr);
+            } else {
+                // Same address modulo 16 as in the captured process, so
+                // vertices and matrices stay as aligned as they were
+                out += (r->addr - out) & 15;
+                memcpy((void *)out, file + pos, r->size);
+                r->data = (const uint8_t *)out;
+                out += r->size;
+            }
+            pos += ((size_t)region.size + 7) & ~(size_t)7;
+        }
+    }
+    free(file);
+    return true;
+
+invalid:
+    fprintf(stderr, "%s is not a capture from this build\n", filename);
+    free(file);
+    return false;
+}
+
+void gfx_capture_free(struct GfxCapture *capture) {
+    free(capture->frames);
+    free(capture->regions);
+    free(capture->data);
+    memset(capture, 0, sizeof(*capture));
+}
@@ -0,0 +1,80 @@
+#ifndef GFX_CAPTURE_H
+#define GFX_CAPTURE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Display list captures for tools/gfxbench. A capture holds whole frames: the
+// root display list pointer and every memory region the renderer read while
+// running it (commands, vertices, matrices, lights, viewports, textures and
+// palettes), so a frame can be replayed without the game. Pointers inside the
+// lists are kept as they were, replay maps them to where the regions ended up.
+// Layout, host endian and host pointer size (captures are meant to be replayed
+// by a gfxbench from the same build):
+//
+//   struct GfxCaptureHeader
+//   for each frame:
+//     struct GfxCaptureFrameHeader
+//     for each region, sorted by address and not overlapping:
+//       struct GfxCaptureRegionHeader
+//       the region's bytes, padded to a multiple of 8
+
+#define GFX_CAPTURE_MAGIC 0x31434647 // "GFC1"
+#define GFX_CAPTURE_FILE "gfx_capture.bin"
+
+struct GfxCaptureHeader {
+    uint32_t magic;
+    uint32_t pointer_size;
+    uint32_t num_frames;
+    uint32_t pad;
+};
+
+struct GfxCaptureFrameHeader {
+    uint64_t root;
+    uint32_t num_regions;
+    uint32_t pad;
+};
+
+struct GfxCaptureRegionHeader {
+    uint64_t addr;
+    uint32_t size;
+    uint32_t pad;
+};
+
+struct GfxCaptureRegion {
+    uintptr_t addr;
+    size_t size;
+    const uint8_t *data;
+};
+
+struct GfxCaptureFrame {
+    uintptr_t root;
+    size_t num_regions;
+    struct GfxCaptureRegion *regions;
+};
+
+struct GfxCapture {
+    size_t num_frames;
+    struct GfxCaptureFrame *frames;
+    struct GfxCaptureRegion *regions; // of all the frames
+    uint8_t *data;
+};
+
+// Writing, used by the renderer. Regions may be added in any order and overlap.
+bool gfx_capture_open(const char *filename);
+void gfx_capture_begin_frame(const void *root);
+void gfx_capture_add(const void *addr, size_t size);
+void gfx_capture_end_frame(void);
+void gfx_capture_close(void);
+
+// Reading. Regions with the same contents as in the previous frame share its
+// copy, so static data keeps one address across the frames of a capture.
+bool gfx_capture_load(struct GfxCapture *capture, const char *filename);
+void gfx_capture_free(struct GfxCapture *capture);
+
+// Where a pointer of the captured process lives in the loaded frame, or the
+// pointer itself if it isn't in any region (color and depth image addresses)
+void *gfx_capture_translate(const struct GfxCaptureFrame *frame, uintptr_t addr);
+
+#endif
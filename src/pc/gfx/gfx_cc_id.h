@@ -0,0 +1,71 @@
+#ifndef GFX_CC_ID_H
+#define GFX_CC_ID_H
+
+// How the renderer turns the RDP combine mode and other mode into a color
+// combiner id (cc_id). Shared with tools/ccenum, which works out every cc_id
+// the game's display lists can produce. PR/gbi.h has to be included first.
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "gfx_cc.h"
+
+static inline uint8_t color_comb_component(uint32_t v) {
+    switch (v) {
+        case G_CCMUX_TEXEL0:
+            return CC_TEXEL0;
+        case G_CCMUX_TEXEL1:
+            return CC_TEXEL1;
+        case G_CCMUX_PRIMITIVE:
+            return CC_PRIM;
+        case G_CCMUX_SHADE:
+            return CC_SHADE;
+        case G_CCMUX_ENVIRONMENT:
+            return CC_ENV;
+        case G_CCMUX_TEXEL0_ALPHA:
+            return CC_TEXEL0A;
+        case G_CCMUX_LOD_FRACTION:
+            return CC_LOD;
+        default:
+            return CC_0;
+    }
+}
+
+static inline uint32_t color_comb(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+    return color_comb_component(a) |
+           (color_comb_component(b) << 3) |
+           (color_comb_component(c) << 6) |
+           (color_comb_component(d) << 9);
+}
+
+// Combine mode of a G_SETCOMBINE command, only the first cycle is emulated
+static inline uint32_t gfx_cc_combine_mode(uint32_t w0, uint32_t w1) {
+    uint32_t rgb = color_comb((w0 >> 20) & 0xf, (w1 >> 28) & 0xf, (w0 >> 15) & 0x1f, (w1 >> 15) & 0x7);
+    uint32_t alpha = color_comb((w0 >> 12) & 0x7, (w1 >> 12) & 0x7, (w0 >> 9) & 0x7, (w1 >> 9) & 0x7);
+    return rgb | (alpha << 12);
+}
+
+static inline uint32_t gfx_cc_id(uint32_t combine_mode, uint32_t other_mode_l) {
+    uint32_t cc_id = combine_mode;
+
+    bool use_alpha = (other_mode_l & (G_BL_A_MEM << 18)) == 0;
+    bool use_fog = (other_mode_l >> 30) == G_BL_CLR_FOG;
+    bool texture_edge = (other_mode_l & CVG_X_ALPHA) == CVG_X_ALPHA;
+    bool use_noise = (other_mode_l & G_AC_DITHER) == G_AC_DITHER;
+
+    if (texture_edge) {
+        use_alpha = true;
+    }
+
+    if (use_alpha) cc_id |= SHADER_OPT_ALPHA;
+    if (use_fog) cc_id |= SHADER_OPT_FOG;
+    if (texture_edge) cc_id |= SHADER_OPT_TEXTURE_EDGE;
+    if (use_noise) cc_id |= SHADER_OPT_NOISE;
+
+    if (!use_alpha) {
+        cc_id &= ~0xfff000;
+    }
+    return cc_id;
+}
+
+#endif
@@ -151,6 +151,20 @@ static void gfx_dummy_renderer_end_frame(void) {
 static void gfx_dummy_renderer_finish_render(void) {
 }
 
+#ifdef USE_TEXTURE_ATLAS
+static void gfx_dummy_renderer_bind_virtual_texture_page(int tile, uint16_t page) {
+}
+
+static void gfx_dummy_renderer_create_virtual_texture_page(uint16_t page, uint16_t dimensions) {
+}
+
+static void gfx_dummy_renderer_upload_virtual_texture(uint16_t page, const uint8_t *rgba32_buf, int x, int y, int width, int height, int h_mirror, int v_mirror) {
+}
+#endif
+
+static void gfx_dummy_renderer_signal_start(uint32_t width, uint32_t height) {
+}
+
 struct GfxWindowManagerAPI gfx_dummy_wm_api = {
     gfx_dummy_wm_init,
     gfx_dummy_wm_set_keyboard_callbacks,
@@ -187,6 +201,12 @@ struct GfxRenderingAPI gfx_dummy_renderer_api = {
     gfx_dummy_renderer_on_resize,
     gfx_dummy_renderer_start_frame,
     gfx_dummy_renderer_end_frame,
-    gfx_dummy_renderer_finish_render
+    gfx_dummy_renderer_finish_render,
+#ifdef USE_TEXTURE_ATLAS
+    gfx_dummy_renderer_bind_virtual_texture_page,
+    gfx_dummy_renderer_create_virtual_texture_page,
+    gfx_dummy_renderer_upload_virtual_texture,
+#endif
+    gfx_dummy_renderer_signal_start
 };
 #endif
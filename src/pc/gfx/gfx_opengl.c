@@ -2,6 +2,9 @@
 
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #ifndef _LANGUAGE_C
 #define _LANGUAGE_C
@@ -28,31 +31,62 @@
 static int has_vao_support = 0;
 static PFNGLBINDVERTEXARRAYOESPROC glBindVertexArrayOES;
 static PFNGLGENVERTEXARRAYSOESPROC glGenVertexArraysOES;
+static PFNGLGETPROGRAMBINARYOESPROC glGetProgramBinaryOES;
+static PFNGLPROGRAMBINARYOESPROC glProgramBinaryOES;
+static PFNGLGENQUERIESEXTPROC glGenQueriesEXT;
+static PFNGLBEGINQUERYEXTPROC glBeginQueryEXT;
+static PFNGLENDQUERYEXTPROC glEndQueryEXT;
+static PFNGLGETQUERYOBJECTUIVEXTPROC glGetQueryObjectuivEXT;
+static PFNGLGETQUERYOBJECTUI64VEXTPROC glGetQueryObjectui64vEXT;
+
+#ifndef GL_PROGRAM_BINARY_LENGTH_OES
+#define GL_PROGRAM_BINARY_LENGTH_OES 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS_OES 0x87FE
+#endif
+#ifndef GL_QUERY_RESULT_EXT
+#define GL_QUERY_RESULT_EXT 0x8866
+#define GL_QUERY_RESULT_AVAILABLE_EXT 0x8867
+#endif
+#ifndef GL_TIME_ELAPSED_EXT
+#define GL_TIME_ELAPSED_EXT 0x88BF
+#endif
+#ifndef GL_GPU_DISJOINT_EXT
+#define GL_GPU_DISJOINT_EXT 0x8FBB
+#endif
 
 #include "gfx_cc.h"
 #include "gfx_rendering_api.h"
 #include "gfx_opengl_dynares.h"
 #include "../cheapProfiler.h"
+#include "../configfile.h"
+#include "../fsutils.h"
 
 struct ShaderProgram {
     uint32_t shader_id;
     GLuint opengl_program_id;
     uint8_t num_inputs;
     bool used_textures[2];
-    uint8_t num_floats;
+    uint8_t stride; // bytes per vertex
     GLint attrib_locations[12];
     uint8_t attrib_sizes[12];
+    GLenum attrib_types[12];
+    uint8_t attrib_offsets[12];
     uint8_t num_attribs;
     bool used_noise;
     GLint frame_count_location;
     GLint window_height_location;
+    GLint mvp_location;
+    struct {
+        GLint light_dirs, light_colors, ambient_color, num_lights, fog, shade_rgb, shade_alpha;
+        uint32_t serial; // of the state last uploaded, 0 before the first one
+    } tnl;
     GLuint vao;
     bool init;
 };
 
 struct FBOBlitter {
     GLuint program;
-    GLuint vao;
+    GLuint vao, vbo;
     GLuint fbo, fbo_tex, fbo_depth;
     GLfloat h_scale, v_scale;
     GLuint width, height;
@@ -62,15 +96,92 @@ struct FBOBlitter {
     int status;
 };
 
-static struct ShaderProgram shader_program_pool[64];
-static uint8_t shader_program_pool_size;
-static GLuint opengl_vbo;
+// Room for every combiner in the streamed, the object space (SHADER_OPT_MVP) and the hardware T&L flavour
+static struct ShaderProgram shader_program_pool[384];
+static uint16_t shader_program_pool_size;
+static struct ShaderProgram *opengl_prg;
+// Hardware T&L uniforms, uploaded to a SHADER_OPT_TNL program when it draws with an older serial
+static struct GfxTnlState tnl_state;
+static uint32_t tnl_serial;
+// Streamed vertices and indices are appended to one of a few big buffers
+// with glBufferSubData, moving on to the next buffer every frame. A buffer
+// is only reused after STREAM_BUFFER_COUNT frames, by when the GPU should be
+// done with it. Running out of room mid-frame orphans the buffer instead,
+// which is where the driver may have to stall or reallocate.
+#define STREAM_BUFFER_COUNT 3
+#define STREAM_VBO_SIZE (1024 * 1024) // more than gfx_pc.c's buf_vbo
+#define STREAM_IBO_SIZE (64 * 1024)
+
+struct StreamBuffer {
+    GLuint id;
+    size_t pos;
+};
+
+static struct StreamBuffer stream_vbos[STREAM_BUFFER_COUNT];
+static struct StreamBuffer stream_ibos[STREAM_BUFFER_COUNT];
+static uint8_t stream_cur;
+static GLuint opengl_vbo; // current stream VBO
 
 static uint32_t frame_count;
 static uint32_t current_height;
 
 static struct FBOBlitter dynares = {};
 
+// Picks the dynares scale for each frame. The render time is measured with a
+// GPU timer query when the driver has one, otherwise with the CPU time spent
+// between start_frame and end_frame. The scale goes down a step as soon as a
+// few frames run over budget, or miss the frame rate, and goes up a step only
+// after a long run of frames with plenty of headroom, and only if the frame
+// should still fit at the bigger size. A step down right after a step up
+// doubles how long the controller waits before trying to go up again.
+#define DYNARES_QUERY_COUNT 4
+#define DYNARES_STEP 0.0625f
+#define DYNARES_DOWN_FRAMES 3
+#define DYNARES_UP_FRAMES 30
+#define DYNARES_HOLD_FRAMES 60
+#define DYNARES_MAX_HOLD_FRAMES 960
+#define DYNARES_DOWN_LOAD 0.9f // fraction of the budget that counts as over
+#define DYNARES_UP_LOAD 0.65f  // fraction of the budget that counts as headroom
+
+static struct {
+    float scale;
+    float render_ms; // smoothed
+    float frame_ms;  // smoothed, start_frame to start_frame
+    uint64_t frame_start;
+    uint16_t over, under;
+    uint16_t hold, backoff;
+    uint16_t frames_since_up;
+    bool gpu_timer;
+    bool query_active;
+    GLuint queries[DYNARES_QUERY_COUNT];
+    uint8_t query_head, query_tail;
+} dynares_ctl;
+
+// Linked programs are kept in shader_cache.bin, so later runs load them with
+// glProgramBinary instead of compiling. Entries are keyed by the shader_id and
+// a hash of the generated GLSL, and the whole file is thrown away when the
+// driver changes.
+#define SHADER_CACHE_FILE "shader_cache.bin"
+#define SHADER_CACHE_MAGIC 0x31435053 // "SPC1"
+
+struct ShaderCacheHeader {
+    uint32_t magic;
+    uint32_t driver_hash;
+};
+
+struct ShaderCacheEntry {
+    uint32_t shader_id;
+    uint32_t source_hash;
+    uint32_t format;
+    uint32_t length; // of the binary that follows
+};
+
+static struct {
+    uint8_t *data; // contents of the file at startup
+    size_t size;
+    FILE *file; // new programs get appended
+} shader_cache;
+
 static GLuint gfx_compile_shaders(const GLchar *sources[2], const const GLint lengths[2])
 {
     GLint success;
@@ -115,22 +226,182 @@ static GLuint gfx_compile_shaders(const GLchar *sources[2], const const GLint le
     return shader_program;
 }
 
+static uint32_t gfx_opengl_hash(const void *data, size_t len, uint32_t h) {
+    // FNV-1a
+    const uint8_t *p = data;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ p[i]) * 16777619;
+    }
+    return h;
+}
+
+static void gfx_opengl_shader_cache_init(void) {
+    if (!configShaderCache) {
+        return;
+    }
+#ifdef USE_GLES2
+    if (!SDL_GL_ExtensionSupported("GL_OES_get_program_binary")) {
+        return;
+    }
+    glGetProgramBinaryOES = SDL_GL_GetProcAddress("glGetProgramBinaryOES");
+    glProgramBinaryOES = SDL_GL_GetProcAddress("glProgramBinaryOES");
+#else
+    if (!SDL_GL_ExtensionSupported("GL_ARB_get_program_binary")) {
+        return;
+    }
+    glGetProgramBinaryOES = SDL_GL_GetProcAddress("glGetProgramBinary");
+    glProgramBinaryOES = SDL_GL_GetProcAddress("glProgramBinary");
+#endif
+    GLint num_formats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS_OES, &num_formats);
+    if (!glGetProgramBinaryOES || !glProgramBinaryOES || num_formats == 0) {
+        printf("Program binaries not supported, shaders are compiled every run.\n");
+        glGetProgramBinaryOES = NULL;
+        glProgramBinaryOES = NULL;
+        return;
+    }
+
+    // Binaries from another driver, or even another version of it, won't load
+    uint32_t driver_hash = 2166136261u;
+    const GLenum strings[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for (size_t i = 0; i < sizeof(strings) / sizeof(strings[0]); i++) {
+        const char *str = (const char *)glGetString(strings[i]);
+        if (str != NULL) {
+            driver_hash = gfx_opengl_hash(str, strlen(str), driver_hash);
+        }
+    }
+
+    FILE *f = fopen_home(SHADER_CACHE_FILE, "rb");
+    if (f != NULL) {
+        fseek(f, 0, SEEK_END);
+        long size = ftell(f);
+        fseek(f, 0, SEEK_SET);
+        if (size > 0 && (shader_cache.data = malloc(size)) != NULL) {
+            shader_cache.size = fread(shader_cache.data, 1, size, f);
+        }
+        fclose(f);
+    }
+    const struct ShaderCacheHeader *header = (const struct ShaderCacheHeader *)shader_cache.data;
+    if (shader_cache.size >= sizeof(*header) && header->magic == SHADER_CACHE_MAGIC && header->driver_hash == driver_hash) {
+        shader_cache.file = fopen_home(SHADER_CACHE_FILE, "ab");
+    } else {
+        free(shader_cache.data);
+        shader_cache.data = NULL;
+        shader_cache.size = 0;
+        shader_cache.file = fopen_home(SHADER_CACHE_FILE, "wb");
+        if (shader_cache.file != NULL) {
+            struct ShaderCacheHeader new_header = { SHADER_CACHE_MAGIC, driver_hash };
+            fwrite(&new_header, sizeof(new_header), 1, shader_cache.file);
+        }
+    }
+}
+
+// Returns 0 if the program isn't in the cache or the driver rejects the binary
+static GLuint gfx_opengl_shader_cache_load(uint32_t shader_id, uint32_t source_hash) {
+    if (glProgramBinaryOES == NULL) {
+        return 0;
+    }
+    // The last entry for the program counts: one the driver rejected gets
+    // compiled and appended again, after the stale one
+    const struct ShaderCacheEntry *found = NULL;
+    const uint8_t *found_binary = NULL;
+    size_t pos = sizeof(struct ShaderCacheHeader);
+    while (pos + sizeof(struct ShaderCacheEntry) <= shader_cache.size) {
+        const struct ShaderCacheEntry *entry = (const struct ShaderCacheEntry *)(shader_cache.data + pos);
+        pos += sizeof(*entry);
+        if (entry->length > shader_cache.size - pos) {
+            break; // cut short, e.g. by a crash while writing it
+        }
+        if (entry->shader_id == shader_id && entry->source_hash == source_hash) {
+            found = entry;
+            found_binary = shader_cache.data + pos;
+        }
+        pos += entry->length;
+    }
+    if (found == NULL) {
+        return 0;
+    }
+    GLuint shader_program = glCreateProgram();
+    glProgramBinaryOES(shader_program, found->format, found_binary, found->length);
+    GLint success;
+    glGetProgramiv(shader_program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glDeleteProgram(shader_program);
+        return 0;
+    }
+    ProfEmitCounter("shader_cache_loads", 1);
+    return shader_program;
+}
+
+static void gfx_opengl_shader_cache_store(uint32_t shader_id, uint32_t source_hash, GLuint shader_program) {
+    if (glGetProgramBinaryOES == NULL || shader_cache.file == NULL) {
+        return;
+    }
+    GLint length = 0;
+    glGetProgramiv(shader_program, GL_PROGRAM_BINARY_LENGTH_OES, &length);
+    if (length <= 0) {
+        return;
+    }
+    void *binary = malloc(length);
+    if (binary == NULL) {
+        return;
+    }
+    struct ShaderCacheEntry entry;
+    GLenum format;
+    GLsizei written = 0;
+    glGetProgramBinaryOES(shader_program, length, &written, &format, binary);
+    if (written > 0) {
+        entry.shader_id = shader_id;
+        entry.source_hash = source_hash;
+        entry.format = format;
+        entry.length = written;
+        fwrite(&entry, sizeof(entry), 1, shader_cache.file);
+        fwrite(binary, 1, written, shader_cache.file);
+        // Flushed right away so a crash doesn't leave a half written entry behind
+        fflush(shader_cache.file);
+    }
+    free(binary);
+}
+
 #ifdef USE_TEXTURE_ATLAS
-GLuint vt_page;
+// Pages are created and filled through their own texture unit, so that doesn't
+// disturb what units 0 and 1 have bound for the triangles still being batched
+#define VT_PAGE_UPLOAD_UNIT GL_TEXTURE2
+GLuint vt_pages[GFX_ATLAS_MAX_PAGES];
 #endif
 
 static bool gfx_opengl_z_is_from_0_to_1(void) {
     return false;
 }
 
-static void gfx_opengl_vertex_array_set_attribs(struct ShaderProgram *prg) {
-    size_t num_floats = prg->num_floats;
-    size_t pos = 0;
+// buf_vbo_offset is in 32-bit words, every packed attribute is a whole number of them
+static void gfx_opengl_vertex_array_set_attribs(struct ShaderProgram *prg, size_t buf_vbo_offset) {
+    size_t base = buf_vbo_offset * sizeof(float);
 
     for (int i = 0; i < prg->num_attribs; i++) {
+        // Only the byte colors are normalized, texture coordinates get scaled in the shader
+        GLboolean normalized = prg->attrib_types[i] == GL_UNSIGNED_BYTE;
         glEnableVertexAttribArray(prg->attrib_locations[i]);
-        glVertexAttribPointer(prg->attrib_locations[i], prg->attrib_sizes[i], GL_FLOAT, GL_FALSE, num_floats * sizeof(float), (void *) (pos * sizeof(float)));
-        pos += prg->attrib_sizes[i];
+        glVertexAttribPointer(prg->attrib_locations[i], prg->attrib_sizes[i], prg->attrib_types[i], normalized, prg->stride, (void *) (base + prg->attrib_offsets[i]));
+    }
+}
+
+static void gfx_opengl_add_attrib(struct ShaderProgram *prg, size_t *cnt, GLuint program, const char *name, uint8_t size, GLenum type) {
+    size_t i = (*cnt)++;
+    prg->attrib_locations[i] = glGetAttribLocation(program, name);
+    prg->attrib_sizes[i] = size;
+    prg->attrib_types[i] = type;
+    prg->attrib_offsets[i] = prg->stride;
+    switch (type) {
+        case GL_FLOAT:
+            prg->stride += size * 4;
+            break;
+        case GL_SHORT:
+            prg->stride += size * 2;
+            break;
+        default:
+            prg->stride += size;
+            break;
     }
 }
 
@@ -154,18 +425,19 @@ static void gfx_opengl_unload_shader(struct ShaderProgram *old_prg) {
 
 static void gfx_opengl_load_shader(struct ShaderProgram *new_prg) {
     glUseProgram(new_prg->opengl_program_id);
+    opengl_prg = new_prg;
     if (has_vao_support) {
         if (!new_prg->init) {
             new_prg->init = 1;
             glGenVertexArraysOES(1, &new_prg->vao);
             glBindVertexArrayOES(new_prg->vao);
-            gfx_opengl_vertex_array_set_attribs(new_prg);
+            gfx_opengl_vertex_array_set_attribs(new_prg, 0);
         }
         else {
             glBindVertexArrayOES(new_prg->vao);
         }
     } else {
-        gfx_opengl_vertex_array_set_attribs(new_prg);
+        gfx_opengl_vertex_array_set_attribs(new_prg, 0);
     }
 
     gfx_opengl_set_uniforms(new_prg);
@@ -251,14 +523,18 @@ static void append_formula(char *buf, size_t *len, uint8_t c[2][4], bool do_sing
 }
 
 static struct ShaderProgram *gfx_opengl_create_and_load_new_shader(uint32_t shader_id) {
+    if (shader_program_pool_size == sizeof(shader_program_pool) / sizeof(shader_program_pool[0])) {
+        fprintf(stderr, "Out of shader programs, can't create %08x\n", shader_id);
+        abort();
+    }
+
     struct CCFeatures cc_features;
     gfx_cc_get_features(shader_id, &cc_features);
 
-    char vs_buf[4096];
+    char vs_buf[8192];
     char fs_buf[4096];
     size_t vs_len = 0;
     size_t fs_len = 0;
-    size_t num_floats = 4;
 
     int num_samplers = cc_features.used_textures[0] + cc_features.used_textures[1];
     char *aTexParams_type[] = {
@@ -275,6 +551,19 @@ static struct ShaderProgram *gfx_opengl_create_and_load_new_shader(uint32_t shad
 #endif
     append_line(vs_buf, &vs_len, "precision highp float;");
     append_line(vs_buf, &vs_len, "attribute vec4 aVtxPos;");
+    if (cc_features.opt_mvp) {
+        append_line(vs_buf, &vs_len, "uniform mat4 uMVP;");
+    }
+    if (cc_features.opt_tnl) {
+        append_line(vs_buf, &vs_len, "attribute vec4 aShade;");
+        vs_len += sprintf(vs_buf + vs_len, "uniform vec3 uLightDirs[%d];\n", GFX_TNL_MAX_LIGHTS);
+        vs_len += sprintf(vs_buf + vs_len, "uniform vec3 uLightColors[%d];\n", GFX_TNL_MAX_LIGHTS);
+        append_line(vs_buf, &vs_len, "uniform vec3 uAmbientColor;");
+        append_line(vs_buf, &vs_len, "uniform int uNumLights;");
+        append_line(vs_buf, &vs_len, "uniform vec3 uFog;"); // mul, offset, enabled
+        append_line(vs_buf, &vs_len, "uniform vec4 uShadeRGB;");
+        append_line(vs_buf, &vs_len, "uniform vec4 uShadeAlpha;");
+    }
     if (cc_features.used_textures[0] || cc_features.used_textures[1]) {
         append_line(vs_buf, &vs_len, "attribute vec2 aTexCoord;");
 #ifndef USE_TEXTURE_ATLAS
@@ -288,21 +577,18 @@ static struct ShaderProgram *gfx_opengl_create_and_load_new_shader(uint32_t shad
                 vs_len += sprintf(vs_buf + vs_len, "varying vec4 vTexSampler%d;\n", samplers);
                 vs_len += sprintf(vs_buf + vs_len, "varying vec2 vTexCoord%d;\n", samplers);
                 samplers++;
-                num_floats += 2;
             }
         }
 #endif
-        num_floats += 2;
     }
     if (cc_features.opt_fog) {
         append_line(vs_buf, &vs_len, "attribute vec4 aFog;");
         append_line(vs_buf, &vs_len, "varying vec4 vFog;");
-        num_floats += 4;
     }
     for (int i = 0; i < cc_features.num_inputs; i++) {
-        vs_len += sprintf(vs_buf + vs_len, "attribute vec%d aInput%d;\n", cc_features.opt_alpha ? 4 : 3, i + 1);
+        // Inputs are always four bytes, the alpha is just ignored without opt_alpha
+        vs_len += sprintf(vs_buf + vs_len, "attribute vec4 aInput%d;\n", i + 1);
         vs_len += sprintf(vs_buf + vs_len, "varying vec%d vInput%d;\n", cc_features.opt_alpha ? 4 : 3, i + 1);
-        num_floats += cc_features.opt_alpha ? 4 : 3;
     }
 
 #ifdef USE_TEXTURE_ATLAS
@@ -318,16 +604,49 @@ static struct ShaderProgram *gfx_opengl_create_and_load_new_shader(uint32_t shad
 #endif
     
     append_line(vs_buf, &vs_len, "void main() {");
+    if (cc_features.opt_tnl) {
+        // Same math as gfx_sp_vertex, down to where it truncates to whole color values
+        append_line(vs_buf, &vs_len, "gl_Position = uMVP * aVtxPos;");
+        append_line(vs_buf, &vs_len, "vec4 raw = floor(aShade * 255.0 + 0.5);");
+        append_line(vs_buf, &vs_len, "vec4 shade = raw;");
+        append_line(vs_buf, &vs_len, "if (uNumLights >= 0) {");
+        append_line(vs_buf, &vs_len, "    vec3 n = raw.xyz - 256.0 * step(128.0, raw.xyz);");
+        append_line(vs_buf, &vs_len, "    vec3 col = uAmbientColor;");
+        vs_len += sprintf(vs_buf + vs_len, "    for (int i = 0; i < %d; i++) {\n", GFX_TNL_MAX_LIGHTS);
+        append_line(vs_buf, &vs_len, "        if (i >= uNumLights) break;");
+        append_line(vs_buf, &vs_len, "        float intensity = dot(n, uLightDirs[i]) / 127.0;");
+        append_line(vs_buf, &vs_len, "        if (intensity > 0.0) col = floor(col + intensity * uLightColors[i]);");
+        append_line(vs_buf, &vs_len, "    }");
+        append_line(vs_buf, &vs_len, "    shade.rgb = min(col, 255.0);");
+        append_line(vs_buf, &vs_len, "}");
+        append_line(vs_buf, &vs_len, "if (uFog.z > 0.0) {");
+        append_line(vs_buf, &vs_len, "    float w = abs(gl_Position.w) < 0.001 ? 0.001 : gl_Position.w;");
+        append_line(vs_buf, &vs_len, "    float winv = w < 0.0 ? 32767.0 : 1.0 / w;");
+        append_line(vs_buf, &vs_len, "    shade.a = floor(clamp(gl_Position.z * winv * uFog.x + uFog.y, 0.0, 255.0));");
+        append_line(vs_buf, &vs_len, "}");
+        append_line(vs_buf, &vs_len, "shade /= 255.0;");
+    }
+    if (cc_features.used_textures[0] || cc_features.used_textures[1]) {
+        // Texture coordinates come in as 16 bit fixed point
+        vs_len += sprintf(vs_buf + vs_len, "vec2 texCoord = aTexCoord / %.1f;\n", GFX_PACKED_TEXCOORD_SCALE);
+    }
 #ifndef USE_TEXTURE_ATLAS
     if (cc_features.used_textures[0] || cc_features.used_textures[1]) {
-        append_line(vs_buf, &vs_len, "vTexCoord = aTexCoord;");
+        append_line(vs_buf, &vs_len, "vTexCoord = texCoord;");
     }
 #endif
     if (cc_features.opt_fog) {
-        append_line(vs_buf, &vs_len, "vFog = aFog;");
+        // The fog factor lives in the shade alpha, like in gfx_sp_vertex
+        append_line(vs_buf, &vs_len, cc_features.opt_tnl ? "vFog = vec4(aFog.rgb, shade.a);" : "vFog = aFog;");
     }
     for (int i = 0; i < cc_features.num_inputs; i++) {
-        vs_len += sprintf(vs_buf + vs_len, "vInput%d = aInput%d;\n", i + 1, i + 1);
+        if (cc_features.opt_tnl) {
+            char c = "xyzw"[i];
+            vs_len += sprintf(vs_buf + vs_len, "vInput%d = vec4(mix(aInput%d.rgb, shade.rgb, uShadeRGB.%c), mix(aInput%d.a, shade.a, uShadeAlpha.%c))%s;\n",
+                              i + 1, i + 1, c, i + 1, c, cc_features.opt_alpha ? "" : ".rgb");
+        } else {
+            vs_len += sprintf(vs_buf + vs_len, "vInput%d = aInput%d%s;\n", i + 1, i + 1, cc_features.opt_alpha ? "" : ".rgb");
+        }
     }
 
     // Extract the bundled encFloat_t in parallel
@@ -358,7 +677,7 @@ static struct ShaderProgram *gfx_opengl_create_and_load_new_shader(uint32_t shad
             // In case we have a mirrored tile, we'll used the pre-uploaded mirrors
             // For that, we'll fix the dimensions here by pre-multiplying them
             append_line(vs_buf, &vs_len, "vTexDimensions1.zw *= vTexSampler1.yw + 1.0;"); // Use mirrored images
-            append_line(vs_buf, &vs_len, "vTexCoord1 = aTexCoord / (vTexSampler1.yw + 1.0);"); // Use mirrored images
+            append_line(vs_buf, &vs_len, "vTexCoord1 = texCoord / (vTexSampler1.yw + 1.0);"); // Use mirrored images
             if (num_samplers == 2) {
                 append_line(vs_buf, &vs_len, "vTexDimensions2 = vec4(dec_xy.zw, dec_zw.zw);");
                 append_line(vs_buf, &vs_len, "vTexDimensions2 = vTexDimensions2 / 2048.0;");
@@ -366,12 +685,18 @@ static struct ShaderProgram *gfx_opengl_create_and_load_new_shader(uint32_t shad
 
                 // Same here
                 append_line(vs_buf, &vs_len, "vTexDimensions2.zw *= vTexSampler2.yw + 1.0;"); // Use mirrored images
-                append_line(vs_buf, &vs_len, "vTexCoord2 = aTexCoord / (vTexSampler2.yw + 1.0);"); // Use mirrored images
+                append_line(vs_buf, &vs_len, "vTexCoord2 = texCoord / (vTexSampler2.yw + 1.0);"); // Use mirrored images
             }
         }
     }    
 
-    append_line(vs_buf, &vs_len, "gl_Position = aVtxPos;");
+    if (cc_features.opt_tnl) {
+        // Already done up top, the fog needs it
+    } else if (cc_features.opt_mvp) {
+        append_line(vs_buf, &vs_len, "gl_Position = uMVP * aVtxPos;");
+    } else {
+        append_line(vs_buf, &vs_len, "gl_Position = aVtxPos;");
+    }
     append_line(vs_buf, &vs_len, "}");
 
     // Fragment shader
@@ -493,40 +818,44 @@ static struct ShaderProgram *gfx_opengl_create_and_load_new_shader(uint32_t shad
 
     const GLchar *sources[2] = { vs_buf, fs_buf };
     const GLint lengths[2] = { vs_len, fs_len };
-    GLuint shader_program = gfx_compile_shaders(sources, lengths);
+    uint32_t source_hash = gfx_opengl_hash(fs_buf, fs_len, gfx_opengl_hash(vs_buf, vs_len, 2166136261u));
+    GLuint shader_program = gfx_opengl_shader_cache_load(shader_id, source_hash);
+    if (shader_program == 0) {
+        ProfEmitEventStart("gfx_compile_shaders");
+        shader_program = gfx_compile_shaders(sources, lengths);
+        ProfEmitEventEnd("gfx_compile_shaders");
+        ProfEmitCounter("shader_compiles", 1);
+        gfx_opengl_shader_cache_store(shader_id, source_hash, shader_program);
+    }
 
     size_t cnt = 0;
 
+    // Packed vertex layout, see gfx_rendering_api.h
     struct ShaderProgram *prg = &shader_program_pool[shader_program_pool_size++];
-    prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, "aVtxPos");
-    prg->attrib_sizes[cnt] = 4;
-    ++cnt;
+    prg->stride = 0;
+    gfx_opengl_add_attrib(prg, &cnt, shader_program, "aVtxPos", 4, GL_FLOAT);
 
     if (cc_features.used_textures[0] || cc_features.used_textures[1]) {
-        prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, "aTexCoord");
-        prg->attrib_sizes[cnt] = 2;
-        ++cnt;
+        gfx_opengl_add_attrib(prg, &cnt, shader_program, "aTexCoord", 2, GL_SHORT);
 #ifdef USE_TEXTURE_ATLAS
         if (num_samplers > 0) {
-            prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, "aTexParams");
-            prg->attrib_sizes[cnt] = num_samplers * 2; /* vec2 or vec4 */
-            ++cnt;
+            gfx_opengl_add_attrib(prg, &cnt, shader_program, "aTexParams", num_samplers * 2, GL_FLOAT); /* vec2 or vec4 */
         }
 #endif
     }
 
     if (cc_features.opt_fog) {
-        prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, "aFog");
-        prg->attrib_sizes[cnt] = 4;
-        ++cnt;
+        gfx_opengl_add_attrib(prg, &cnt, shader_program, "aFog", 4, GL_UNSIGNED_BYTE);
     }
 
     for (int i = 0; i < cc_features.num_inputs; i++) {
         char name[16];
         sprintf(name, "aInput%d", i + 1);
-        prg->attrib_locations[cnt] = glGetAttribLocation(shader_program, name);
-        prg->attrib_sizes[cnt] = cc_features.opt_alpha ? 4 : 3;
-        ++cnt;
+        gfx_opengl_add_attrib(prg, &cnt, shader_program, name, 4, GL_UNSIGNED_BYTE);
+    }
+
+    if (cc_features.opt_tnl) {
+        gfx_opengl_add_attrib(prg, &cnt, shader_program, "aShade", 4, GL_UNSIGNED_BYTE);
     }
 
     prg->shader_id = shader_id;
@@ -534,7 +863,6 @@ static struct ShaderProgram *gfx_opengl_create_and_load_new_shader(uint32_t shad
     prg->num_inputs = cc_features.num_inputs;
     prg->used_textures[0] = cc_features.used_textures[0];
     prg->used_textures[1] = cc_features.used_textures[1];
-    prg->num_floats = num_floats;
     prg->num_attribs = cnt;
     prg->init = 0;
 
@@ -557,6 +885,18 @@ static struct ShaderProgram *gfx_opengl_create_and_load_new_shader(uint32_t shad
         prg->used_noise = false;
     }
 
+    prg->mvp_location = cc_features.opt_mvp ? glGetUniformLocation(shader_program, "uMVP") : -1;
+    prg->tnl.serial = 0;
+    if (cc_features.opt_tnl) {
+        prg->tnl.light_dirs = glGetUniformLocation(shader_program, "uLightDirs");
+        prg->tnl.light_colors = glGetUniformLocation(shader_program, "uLightColors");
+        prg->tnl.ambient_color = glGetUniformLocation(shader_program, "uAmbientColor");
+        prg->tnl.num_lights = glGetUniformLocation(shader_program, "uNumLights");
+        prg->tnl.fog = glGetUniformLocation(shader_program, "uFog");
+        prg->tnl.shade_rgb = glGetUniformLocation(shader_program, "uShadeRGB");
+        prg->tnl.shade_alpha = glGetUniformLocation(shader_program, "uShadeAlpha");
+    }
+
     return prg;
 }
 
@@ -666,12 +1006,254 @@ static void gfx_opengl_set_use_alpha(bool use_alpha) {
     }
 }
 
-static void gfx_opengl_draw_triangles(float buf_vbo[], size_t buf_vbo_len, size_t buf_vbo_num_tris) {
+// Returns the byte offset the data ended up at, the buffer must be bound to target
+static size_t gfx_opengl_stream_upload(GLenum target, struct StreamBuffer *buf, size_t capacity, const void *data, size_t size) {
+    if (buf->pos + size > capacity) {
+        glBufferData(target, capacity, NULL, GL_STREAM_DRAW);
+        buf->pos = 0;
+        ProfEmitCounter("gl_stream_orphans", 1);
+    }
+    size_t offset = buf->pos;
+    glBufferSubData(target, offset, size, data);
+    buf->pos += (size + 3) & ~3;
+    ProfEmitCounter("gl_stream_upload_bytes", size);
+    return offset;
+}
+
+static void gfx_opengl_set_tnl_state(const struct GfxTnlState *state) {
+    memcpy(&tnl_state, state, sizeof(tnl_state));
+    tnl_serial++;
+}
+
+// Uniforms are per program, so each one catches up on the state when it next draws
+static void gfx_opengl_upload_tnl_state(struct ShaderProgram *prg) {
+    glUniformMatrix4fv(prg->mvp_location, 1, GL_FALSE, &tnl_state.mvp[0][0]);
+    glUniform3fv(prg->tnl.light_dirs, GFX_TNL_MAX_LIGHTS, &tnl_state.light_dirs[0][0]);
+    glUniform3fv(prg->tnl.light_colors, GFX_TNL_MAX_LIGHTS, &tnl_state.light_colors[0][0]);
+    glUniform3fv(prg->tnl.ambient_color, 1, tnl_state.ambient_color);
+    glUniform1i(prg->tnl.num_lights, tnl_state.num_lights);
+    glUniform3f(prg->tnl.fog, tnl_state.fog_mul, tnl_state.fog_offset, tnl_state.fog ? 1.0f : 0.0f);
+    glUniform4fv(prg->tnl.shade_rgb, 1, tnl_state.shade_rgb);
+    glUniform4fv(prg->tnl.shade_alpha, 1, tnl_state.shade_alpha);
+    prg->tnl.serial = tnl_serial;
+}
+
+static void gfx_opengl_draw_indexed_triangles(float buf_vbo[], size_t buf_vbo_len, size_t buf_vbo_num_verts, const uint16_t indices[], size_t buf_vbo_num_tris) {
     //printf("flushing %d tris\n", buf_vbo_num_tris);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * buf_vbo_len, buf_vbo, GL_STREAM_DRAW);
+    if ((opengl_prg->shader_id & SHADER_OPT_TNL) && opengl_prg->tnl.serial != tnl_serial) {
+        gfx_opengl_upload_tnl_state(opengl_prg);
+    }
+    struct StreamBuffer *vbo = &stream_vbos[stream_cur];
+    struct StreamBuffer *ibo = &stream_ibos[stream_cur];
+    
+    glBindBuffer(GL_ARRAY_BUFFER, vbo->id);
+    size_t vbo_offset = gfx_opengl_stream_upload(GL_ARRAY_BUFFER, vbo, STREAM_VBO_SIZE, buf_vbo, sizeof(float) * buf_vbo_len);
+    gfx_opengl_vertex_array_set_attribs(opengl_prg, vbo_offset / sizeof(float));
+    
+    // The element buffer binding lives in the VAO, so (re)bind it every time
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo->id);
+    size_t ibo_offset = gfx_opengl_stream_upload(GL_ELEMENT_ARRAY_BUFFER, ibo, STREAM_IBO_SIZE, indices, sizeof(uint16_t) * 3 * buf_vbo_num_tris);
+    glDrawElements(GL_TRIANGLES, 3 * buf_vbo_num_tris, GL_UNSIGNED_SHORT, (void *) ibo_offset);
+}
+
+static uint32_t gfx_opengl_new_static_buffer(const float buf_vbo[], size_t buf_vbo_len) {
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(float) * buf_vbo_len, buf_vbo, GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, opengl_vbo);
+    return vbo;
+}
+
+static void gfx_opengl_delete_static_buffer(uint32_t buffer_id) {
+    GLuint vbo = buffer_id;
+    glDeleteBuffers(1, &vbo);
+}
+
+static void gfx_opengl_draw_static_triangles(uint32_t buffer_id, size_t buf_vbo_offset, size_t buf_vbo_num_tris, const float mvp[4][4]) {
+    // Streamed draws repoint the attributes at their own offset every time,
+    // so there's nothing to restore afterwards.
+    glUniformMatrix4fv(opengl_prg->mvp_location, 1, GL_FALSE, &mvp[0][0]);
+    glBindBuffer(GL_ARRAY_BUFFER, buffer_id);
+    gfx_opengl_vertex_array_set_attribs(opengl_prg, buf_vbo_offset);
     glDrawArrays(GL_TRIANGLES, 0, 3 * buf_vbo_num_tris);
 }
 
+static void gfx_opengl_set_cull_mode(bool cull_front, bool cull_back) {
+    if (cull_front || cull_back) {
+        glCullFace(cull_front && cull_back ? GL_FRONT_AND_BACK : (cull_front ? GL_FRONT : GL_BACK));
+        glEnable(GL_CULL_FACE);
+    } else {
+        glDisable(GL_CULL_FACE);
+    }
+}
+
+static float gfx_opengl_dynares_clamp(float scale) {
+    float min_scale = configDynaresMinScale < 0.25f ? 0.25f : configDynaresMinScale;
+    float max_scale = configDynaresMaxScale > 1.0f ? 1.0f : configDynaresMaxScale;
+    if (max_scale < min_scale) {
+        max_scale = min_scale;
+    }
+    return scale < min_scale ? min_scale : scale > max_scale ? max_scale : scale;
+}
+
+static void gfx_opengl_dynares_controller_init(void) {
+    dynares_ctl.scale = gfx_opengl_dynares_clamp(1.0f);
+    dynares_ctl.backoff = DYNARES_HOLD_FRAMES;
+    dynares_ctl.hold = DYNARES_HOLD_FRAMES;
+    if (!configDynaresAdaptive) {
+        return;
+    }
+#ifdef USE_GLES2
+    if (!SDL_GL_ExtensionSupported("GL_EXT_disjoint_timer_query")) {
+        return;
+    }
+    glGenQueriesEXT = SDL_GL_GetProcAddress("glGenQueriesEXT");
+    glBeginQueryEXT = SDL_GL_GetProcAddress("glBeginQueryEXT");
+    glEndQueryEXT = SDL_GL_GetProcAddress("glEndQueryEXT");
+    glGetQueryObjectuivEXT = SDL_GL_GetProcAddress("glGetQueryObjectuivEXT");
+    glGetQueryObjectui64vEXT = SDL_GL_GetProcAddress("glGetQueryObjectui64vEXT");
+#else
+    if (!SDL_GL_ExtensionSupported("GL_ARB_timer_query")) {
+        return;
+    }
+    glGenQueriesEXT = SDL_GL_GetProcAddress("glGenQueries");
+    glBeginQueryEXT = SDL_GL_GetProcAddress("glBeginQuery");
+    glEndQueryEXT = SDL_GL_GetProcAddress("glEndQuery");
+    glGetQueryObjectuivEXT = SDL_GL_GetProcAddress("glGetQueryObjectuiv");
+    glGetQueryObjectui64vEXT = SDL_GL_GetProcAddress("glGetQueryObjectui64v");
+#endif
+    if (!glGenQueriesEXT || !glBeginQueryEXT || !glEndQueryEXT || !glGetQueryObjectuivEXT || !glGetQueryObjectui64vEXT) {
+        return;
+    }
+    glGenQueriesEXT(DYNARES_QUERY_COUNT, dynares_ctl.queries);
+    dynares_ctl.gpu_timer = true;
+}
+
+static void gfx_opengl_dynares_controller_sample(float render_ms) {
+    // The first sample seeds the average instead of dragging it up from zero
+    if (dynares_ctl.render_ms == 0.0f) {
+        dynares_ctl.render_ms = render_ms;
+    } else {
+        dynares_ctl.render_ms += (render_ms - dynares_ctl.render_ms) * 0.2f;
+    }
+}
+
+// Collects finished GPU timer queries without waiting for the ones in flight
+static void gfx_opengl_dynares_controller_poll(void) {
+    while (dynares_ctl.query_tail != dynares_ctl.query_head) {
+        GLuint query = dynares_ctl.queries[dynares_ctl.query_tail % DYNARES_QUERY_COUNT];
+        GLuint available = 0;
+        glGetQueryObjectuivEXT(query, GL_QUERY_RESULT_AVAILABLE_EXT, &available);
+        if (!available) {
+            break;
+        }
+        GLuint64 elapsed = 0;
+        glGetQueryObjectui64vEXT(query, GL_QUERY_RESULT_EXT, &elapsed);
+        dynares_ctl.query_tail++;
+
+        GLint disjoint = 0;
+#ifdef USE_GLES2
+        // Timings across a frequency change or a context switch are garbage
+        glGetIntegerv(GL_GPU_DISJOINT_EXT, &disjoint);
+#endif
+        if (!disjoint) {
+            gfx_opengl_dynares_controller_sample(elapsed / 1000000.0f);
+        }
+    }
+}
+
+static void gfx_opengl_dynares_controller_update(void) {
+    uint64_t now = SDL_GetPerformanceCounter();
+    if (dynares.status <= 0) {
+        dynares_ctl.frame_start = now;
+        return;
+    }
+
+    if (!configDynaresAdaptive) {
+        dynares_ctl.scale = gfx_opengl_dynares_clamp(configDynaresMaxScale);
+    } else {
+        if (dynares_ctl.gpu_timer) {
+            gfx_opengl_dynares_controller_poll();
+        }
+        if (dynares_ctl.frame_start != 0) {
+            float frame_ms = (now - dynares_ctl.frame_start) * 1000.0f / SDL_GetPerformanceFrequency();
+            if (dynares_ctl.frame_ms == 0.0f) {
+                dynares_ctl.frame_ms = frame_ms;
+            } else {
+                dynares_ctl.frame_ms += (frame_ms - dynares_ctl.frame_ms) * 0.2f;
+            }
+        }
+
+        float target = configDynaresTargetMs;
+        bool late = dynares_ctl.frame_ms > target * 1.1f;
+        bool over = late || dynares_ctl.render_ms > target * DYNARES_DOWN_LOAD;
+        bool under = !late && dynares_ctl.render_ms < target * DYNARES_UP_LOAD;
+
+        dynares_ctl.over = over ? dynares_ctl.over + 1 : 0;
+        dynares_ctl.under = under ? dynares_ctl.under + 1 : 0;
+        if (dynares_ctl.hold > 0) {
+            dynares_ctl.hold--;
+        }
+        if (dynares_ctl.frames_since_up < UINT16_MAX) {
+            dynares_ctl.frames_since_up++;
+        }
+
+        float scale = dynares_ctl.scale;
+        if (dynares_ctl.over >= DYNARES_DOWN_FRAMES) {
+            scale = gfx_opengl_dynares_clamp(scale - DYNARES_STEP);
+            if (dynares_ctl.frames_since_up < DYNARES_HOLD_FRAMES) {
+                // The last step up didn't fit, wait longer before the next one
+                dynares_ctl.backoff = dynares_ctl.backoff * 2 > DYNARES_MAX_HOLD_FRAMES ? DYNARES_MAX_HOLD_FRAMES : dynares_ctl.backoff * 2;
+            } else {
+                dynares_ctl.backoff = DYNARES_HOLD_FRAMES;
+            }
+            dynares_ctl.hold = dynares_ctl.backoff;
+        } else if (dynares_ctl.under >= DYNARES_UP_FRAMES && dynares_ctl.hold == 0) {
+            // Fill rate bound, so the cost goes with the pixel count
+            float next = gfx_opengl_dynares_clamp(scale + DYNARES_STEP);
+            float predicted = dynares_ctl.render_ms * (next * next) / (scale * scale);
+            if (predicted < target * DYNARES_DOWN_LOAD) {
+                scale = next;
+                dynares_ctl.frames_since_up = 0;
+            }
+        }
+        if (scale != dynares_ctl.scale) {
+            dynares_ctl.scale = scale;
+            dynares_ctl.over = 0;
+            dynares_ctl.under = 0;
+            // Samples taken at the old size say nothing about the new one
+            dynares_ctl.render_ms = 0.0f;
+        }
+    }
+    dynares_ctl.frame_start = now;
+
+    dynares.h_scale = dynares_ctl.scale;
+    dynares.v_scale = dynares_ctl.scale;
+    ProfEmitCounter("dynares_scale", dynares_ctl.scale * 100.0);
+    ProfEmitCounter("dynares_render_ms", dynares_ctl.render_ms);
+
+    if (configDynaresAdaptive && dynares_ctl.gpu_timer
+        && (uint8_t)(dynares_ctl.query_head - dynares_ctl.query_tail) < DYNARES_QUERY_COUNT) {
+        glBeginQueryEXT(GL_TIME_ELAPSED_EXT, dynares_ctl.queries[dynares_ctl.query_head % DYNARES_QUERY_COUNT]);
+        dynares_ctl.query_active = true;
+    }
+}
+
+static void gfx_opengl_dynares_controller_end_frame(void) {
+    if (!configDynaresAdaptive) {
+        return;
+    }
+    if (dynares_ctl.query_active) {
+        glEndQueryEXT(GL_TIME_ELAPSED_EXT);
+        dynares_ctl.query_active = false;
+        dynares_ctl.query_head++;
+    } else if (!dynares_ctl.gpu_timer) {
+        uint64_t now = SDL_GetPerformanceCounter();
+        gfx_opengl_dynares_controller_sample((now - dynares_ctl.frame_start) * 1000.0f / SDL_GetPerformanceFrequency());
+    }
+}
+
 static void gfx_opengl_init(void) {
 #if FOR_WINDOWS
     glewInit();
@@ -688,8 +1270,18 @@ static void gfx_opengl_init(void) {
     } else {
         has_vao_support = 1;
     }
-
-    glGenBuffers(1, &opengl_vbo);
+    gfx_opengl_shader_cache_init();
+    gfx_opengl_dynares_controller_init();
+
+    for (int i = 0; i < STREAM_BUFFER_COUNT; i++) {
+        glGenBuffers(1, &stream_vbos[i].id);
+        glBindBuffer(GL_ARRAY_BUFFER, stream_vbos[i].id);
+        glBufferData(GL_ARRAY_BUFFER, STREAM_VBO_SIZE, NULL, GL_STREAM_DRAW);
+        glGenBuffers(1, &stream_ibos[i].id);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, stream_ibos[i].id);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, STREAM_IBO_SIZE, NULL, GL_STREAM_DRAW);
+    }
+    opengl_vbo = stream_vbos[0].id;
     glBindBuffer(GL_ARRAY_BUFFER, opengl_vbo);
     
     glDepthFunc(GL_LEQUAL);
@@ -700,8 +1292,13 @@ static void gfx_opengl_on_resize(void) {
 }
 
 static void gfx_opengl_start_frame() {
-    dynares.h_scale = 0.5f;
-    dynares.v_scale = 0.5f;
+    stream_cur = (stream_cur + 1) % STREAM_BUFFER_COUNT;
+    stream_vbos[stream_cur].pos = 0;
+    stream_ibos[stream_cur].pos = 0;
+    opengl_vbo = stream_vbos[stream_cur].id;
+    glBindBuffer(GL_ARRAY_BUFFER, opengl_vbo);
+
+    gfx_opengl_dynares_controller_update();
 
     gfx_opengl_bind_dynares(dynares.width, dynares.height);
     glDisable(GL_SCISSOR_TEST);
@@ -715,6 +1312,7 @@ static void gfx_opengl_end_frame(void) {
     ProfEmitEventStart("gfx_opengl_swap_dynares");
     if (dynares.status > 0) {
         gfx_opengl_swap_dynares();
+        gfx_opengl_dynares_controller_end_frame();
     }
 
     ProfEmitEventEnd("gfx_opengl_swap_dynares");
@@ -724,19 +1322,17 @@ static void gfx_opengl_finish_render(void) {
 }
 
 #ifdef USE_TEXTURE_ATLAS
-static void gfx_opengl_bind_virtual_texture_page(void)
+static void gfx_opengl_bind_virtual_texture_page(int tile, uint16_t page)
 {
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, vt_page);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, vt_page);
+    glActiveTexture(GL_TEXTURE0 + tile);
+    glBindTexture(GL_TEXTURE_2D, vt_pages[page]);
 }
 
-static void gfx_opengl_create_virtual_texture_page(uint16_t dimensions)
+static void gfx_opengl_create_virtual_texture_page(uint16_t page, uint16_t dimensions)
 {
-    glGenTextures(1, &vt_page);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, vt_page);
+    glGenTextures(1, &vt_pages[page]);
+    glActiveTexture(VT_PAGE_UPLOAD_UNIT);
+    glBindTexture(GL_TEXTURE_2D, vt_pages[page]);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
@@ -818,7 +1414,7 @@ static void only_borders(uint32_t *mirror_buf, uint32_t *rgba32_buf, int width,
     }
 }
 
-static void gfx_opengl_upload_virtual_texture(const uint8_t *rgba32_buf, int x, 
+static void gfx_opengl_upload_virtual_texture(uint16_t page, const uint8_t *rgba32_buf, int x, 
     int y, int width, int height, int h_mirror, int v_mirror)
 {
     ProfEmitEventStart("gfx_opengl_upload_virtual_texture");
@@ -841,8 +1437,8 @@ static void gfx_opengl_upload_virtual_texture(const uint8_t *rgba32_buf, int x,
     memcpy(mirror_buf_head - v_stride, mirror_buf_head - v_stride*2, v_stride * sizeof(uint32_t));
 
     // Upload texture page
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, vt_page);
+    glActiveTexture(VT_PAGE_UPLOAD_UNIT);
+    glBindTexture(GL_TEXTURE_2D, vt_pages[page]);
     glTexSubImage2D(GL_TEXTURE_2D, 0, x - 1, y - 1, v_stride, v_height, GL_RGBA, GL_UNSIGNED_BYTE, mirror_buf);
 
     ProfEmitEventEnd("gfx_opengl_upload_virtual_texture");
@@ -869,6 +1465,7 @@ void gfx_opengl_swap_dynares()
     glViewport(0, 0, dynares.width, dynares.height);
 
     glUseProgram(dynares.program);
+    glBindBuffer(GL_ARRAY_BUFFER, dynares.vbo);
     if (has_vao_support) {
         glBindVertexArrayOES(dynares.vao);
     } else {
@@ -887,13 +1484,6 @@ void gfx_opengl_swap_dynares()
     glUniform1i(dynares.uFBOTex, 0);
 
     // Dispatch drawcall
-    GLfloat vert[] = {
-        -1.0f, -1.0f,
-        -1.0f,  1.0f,
-         1.0f, -1.0f,
-         1.0f,  1.0f
-    };
-    glBufferData(GL_ARRAY_BUFFER, sizeof(vert), vert, GL_STREAM_DRAW);    
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
     // Undo VA
@@ -915,6 +1505,17 @@ int gfx_opengl_init_dynares_program(void)
     dynares.uScale = glGetUniformLocation(dynares.program, "uScale");
     dynares.uFBOTex = glGetUniformLocation(dynares.program, "uFBOTex");
 
+    // The quad gets its own buffer, the stream buffers must keep their size
+    GLfloat vert[] = {
+        -1.0f, -1.0f,
+        -1.0f,  1.0f,
+         1.0f, -1.0f,
+         1.0f,  1.0f
+    };
+    glGenBuffers(1, &dynares.vbo);
+    glBindBuffer(GL_ARRAY_BUFFER, dynares.vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vert), vert, GL_STATIC_DRAW);
+
     // Prepare the vertex array object
     if (has_vao_support) {
         glGenVertexArraysOES(1, &dynares.vao);
@@ -1007,7 +1608,7 @@ struct GfxRenderingAPI gfx_opengl_api = {
     gfx_opengl_set_viewport,
     gfx_opengl_set_scissor,
     gfx_opengl_set_use_alpha,
-    gfx_opengl_draw_triangles,
+    NULL, // only packed vertices, see draw_indexed_triangles
     gfx_opengl_init,
     gfx_opengl_on_resize,
     gfx_opengl_start_frame,
@@ -1019,6 +1620,12 @@ struct GfxRenderingAPI gfx_opengl_api = {
     gfx_opengl_upload_virtual_texture,
 #endif
     gfx_opengl_signal_start,
+    gfx_opengl_new_static_buffer,
+    gfx_opengl_delete_static_buffer,
+    gfx_opengl_draw_static_triangles,
+    gfx_opengl_set_cull_mode,
+    gfx_opengl_draw_indexed_triangles,
+    gfx_opengl_set_tnl_state,
 };
 
 #endif
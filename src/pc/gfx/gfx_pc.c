@@ -1,5 +1,6 @@
 #include <math.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
@@ -12,14 +13,31 @@
 
 #include "gfx_pc.h"
 #include "gfx_cc.h"
+#include "gfx_cc_id.h"
 #include "gfx_window_manager_api.h"
 #include "gfx_rendering_api.h"
 #include "gfx_screen_config.h"
+#include "gfx_vertex_batch.h"
+#include "gfx_texture_decode.h"
+#include "gfx_texture_pack.h"
+#include "gfx_capture.h"
 
 #include "../cheapProfiler.h"
+#include "../configfile.h"
+#include "../fsutils.h"
 #ifdef USE_TEXTURE_ATLAS
 #include "texture_atlas.h"
-Atlas *atlas = NULL;
+
+#define ATLAS_PAGE_DIMENSIONS 2048
+
+// Pages get added as they fill up, up to atlas_pages from sm64config.txt.
+// Past that, least recently used textures are evicted to make room.
+static struct {
+    Atlas *pages[GFX_ATLAS_MAX_PAGES];
+    uint32_t num_pages;
+    uint32_t max_pages;
+    char fill_labels[GFX_ATLAS_MAX_PAGES][24];
+} gfx_atlas;
 
 //  A single float is encoded as:
 //   * S.EEEEEEEE.XMMMMMMMMMMMMMMMMMMMMMM
@@ -86,6 +104,8 @@ struct RGBA {
     uint8_t r, g, b, a;
 };
 
+static const struct RGBA zero_color;
+
 struct XYWidthHeight {
     uint16_t x, y, width, height;
 };
@@ -95,6 +115,12 @@ struct LoadedVertex {
     float u, v;
     struct RGBA color;
     uint8_t clip_rej;
+    // Object space position, only filled in while a display list is being retained
+    float ob[3];
+    uint32_t retained_generation;
+    // The retained display list that last loaded this slot, which a replay
+    // leaves holding whatever was there before
+    struct RetainedEntry *retained_owner;
 };
 
 struct TextureHashmapNode {
@@ -107,25 +133,50 @@ struct TextureHashmapNode {
     uint8_t cms, cmt;
 
 #ifdef USE_TEXTURE_ATLAS
+    uint8_t page; // texture_id is only unique within the page, 0 until space is allocated
     uint16_t x, y, width, height;
     encFloat_t enc_sampler_params[2];
 #endif
     bool linear_filter;
+    bool referenced; // second chance bit for the clock eviction
 };
+
+// The pool size comes from texture_cache_size in sm64config.txt. Once every
+// node is handed out, the least recently used texture is evicted (clock sweep).
+#define TEXTURE_CACHE_MIN_SIZE 16
+// Recently evicted textures, only used to count the ones that come right back
+#define TEXTURE_CACHE_EVICTED_HISTORY 256
 static struct {
-    struct TextureHashmapNode *hashmap[1024];
-    struct TextureHashmapNode pool[512];
+    struct TextureHashmapNode **hashmap;
+    uint32_t hashmap_mask;
+    struct TextureHashmapNode *pool;
+    uint32_t pool_size;
     uint32_t pool_pos;
+    uint32_t clock_hand;
+    struct TextureHashmapNode *free_list; // evicted to make room in the atlas
+    const uint8_t *evicted[TEXTURE_CACHE_EVICTED_HISTORY];
 } gfx_texture_cache;
 
 struct ColorCombiner {
     uint32_t cc_id;
+    uint32_t shader_id;
     struct ShaderProgram *prg;
+    struct ShaderProgram *prg_mvp; // created the first time the combiner is retained
+    struct ShaderProgram *prg_tnl; // created the first time the combiner is drawn with hardware T&L
     uint8_t shader_input_mapping[2][4];
 };
 
-static struct ColorCombiner color_combiner_pool[64];
-static uint8_t color_combiner_pool_size;
+#ifdef GFX_CC_TABLE
+// Every cc_id the game's display lists can produce, sorted. Generated at build
+// time by tools/ccenum, the combiners are all set up in gfx_init.
+#include "gfx_cc_table.inc.c"
+#define COLOR_COMBINER_POOL_SIZE (sizeof(gfx_cc_table) / sizeof(gfx_cc_table[0]) + 32)
+#else
+#define COLOR_COMBINER_POOL_SIZE 64
+#endif
+static struct ColorCombiner color_combiner_pool[COLOR_COMBINER_POOL_SIZE];
+static uint16_t color_combiner_pool_size;
+static uint16_t color_combiner_num_preallocated;
 
 static struct RSP {
     float modelview_matrix_stack[11][4][4];
@@ -193,8 +244,12 @@ static struct RenderingState {
     bool alpha_blend;
     bool linear_filter[2];
     struct XYWidthHeight viewport, scissor;
+    uint32_t cull_mode;
     struct ShaderProgram *shader_program;
     struct TextureHashmapNode *textures[2];
+#ifdef USE_TEXTURE_ATLAS
+    uint8_t atlas_page[2];
+#endif
 } rendering_state;
 
 struct GfxDimensions gfx_current_dimensions;
@@ -202,15 +257,203 @@ struct GfxDimensions gfx_current_dimensions;
 static bool dropped_frame;
 
 #ifndef USE_TEXTURE_ATLAS
-static float buf_vbo[MAX_BUFFERED * (26 * 3)]; // 3 vertices in a triangle and 26 floats per vtx
+#define MAX_VERTEX_WORDS 26 // 26 floats per vtx
 #else
 //  We're also going to pack some virtual texture parameters here [see encFloat_t] 
 // so we need four extra floats.
-static float buf_vbo[MAX_BUFFERED * ((26 + 4) * 3)];
+#define MAX_VERTEX_WORDS (26 + 4)
 #endif
+static float buf_vbo[MAX_BUFFERED * (MAX_VERTEX_WORDS * 3)]; // 3 vertices in a triangle
 static size_t buf_vbo_len;
 static size_t buf_vbo_num_tris;
 
+// Indexed vertices, used when the backend has draw_indexed_triangles. Every
+// attribute is packed into 32-bit words (see gfx_rendering_api.h), and a loaded
+// vertex referenced by several triangles of the same batch is only packed once.
+// The stamp changes whenever anything a packed vertex depends on may have changed.
+struct VertexShareSlot {
+    uint16_t index;
+    uint32_t stamp;
+};
+static bool gfx_use_indexed_vertices;
+static uint16_t buf_ibo[MAX_BUFFERED * 3];
+static size_t buf_ibo_len;
+static size_t buf_vbo_num_verts;
+static size_t buf_vbo_stride; // words per vertex of the current batch
+static struct VertexShareSlot vertex_share[MAX_VERTICES + 4];
+static uint32_t vertex_share_stamp = 1;
+
+// Retained geometry: a display list called through G_DL that only draws unlit,
+// unfogged triangles is recorded once in object space into a static vertex
+// buffer, then replayed with the current MP matrix as a shader uniform.
+// Entries are keyed on the display list pointer plus the state it starts with.
+// Once recorded, a replay only hashes the commands of the list itself and the
+// vertices they load, which catches another level's data at the same address
+// and per-frame allocations (shadows, paintings...) whose vertices get written
+// in place. The full hash, which follows the lists it calls, is redone for a
+// few entries a frame, each at most every RETAINED_VERIFY_INTERVAL frames, so
+// the cost per frame doesn't grow with the nested geometry. A replay doesn't
+// load vertices, so when one of the slots gets used after it returns, the
+// list runs again for its loads only and is rejected. The recording holds every triangle, G_CULLDL never skips any
+// while recording, so a list with a bounding box prologue (see
+// tools/add_dl_culling.py) gets the box tested before each replay instead,
+// and just runs when that culls it.
+#define RETAINED_POOL_SIZE 1024
+#define RETAINED_HASHMAP_SIZE 2048
+#define RETAINED_MAX_MISMATCHES 3
+#define RETAINED_VERIFY_INTERVAL 60
+#define RETAINED_VERIFY_PER_FRAME 8
+
+enum RetainedState {
+    RETAINED_CANDIDATE,
+    RETAINED_RECORDED,
+    RETAINED_REJECTED
+};
+
+struct RetainedSignature {
+    struct RDP rdp;
+    uint32_t geometry_mode;
+    uint16_t texture_scaling_s, texture_scaling_t;
+    struct TextureHashmapNode *textures[2];
+};
+
+struct RetainedRenderState {
+    struct ShaderProgram *prg;
+    struct TextureHashmapNode *textures[2];
+    bool depth_test, depth_mask, decal_mode, alpha_blend;
+    bool linear_filter[2];
+    uint8_t cms, cmt;
+    uint32_t cull_mode;
+};
+
+struct RetainedBatch {
+    struct RetainedRenderState state;
+    size_t buf_vbo_offset;
+    size_t num_tris;
+};
+
+struct RetainedEntry {
+    struct RetainedEntry *next;
+    const Gfx *dl;
+    uint32_t sig_hash;
+    struct RetainedSignature sig;  // state when the display list is called
+    struct RetainedSignature exit; // state it leaves behind
+    uint32_t content_hash;
+    uint32_t quick_hash; // of its own commands and vertices, without the lists it calls
+    uint32_t verified_frame; // when content_hash was last checked
+    uint64_t loaded_slots; // vertex slots the display list loads
+    const Gfx *cull_prologue; // G_VTX of its bounding box, followed by G_CULLDL
+    uint8_t state;
+    uint8_t mismatches;
+    uint32_t last_frame;
+    uint32_t buffer_id;
+    struct RetainedBatch *batches;
+    size_t num_batches;
+};
+
+static struct {
+    struct RetainedEntry *hashmap[RETAINED_HASHMAP_SIZE];
+    struct RetainedEntry pool[RETAINED_POOL_SIZE];
+    uint32_t clock_hand;
+    uint32_t frame;
+    uint32_t verifies_left; // full hashes left for this frame
+
+    // Display list currently being recorded, if any
+    struct RetainedEntry *recording;
+    bool recording_failed, recording_restart;
+    bool reloading; // running a replayed list again for its vertex loads only
+    uint32_t generation;
+    float *vbo;
+    size_t vbo_len, vbo_cap;
+    struct RetainedBatch *batches;
+    size_t num_batches, batches_cap;
+} retained;
+
+// Deferred draws: instead of drawing on every state change, gfx_flush turns the
+// buffered triangles into a batch tagged with the render state they need. At the
+// end of the frame, runs of opaque depth-written batches are sorted by state,
+// batches with equal state are merged and everything is submitted in one go.
+// Blended, decal and non depth-tested batches keep their place, so the layer
+// order of the geo processor is preserved where it matters.
+struct DeferredState {
+    struct ShaderProgram *prg;
+    bool used_textures[2];
+    struct TextureHashmapNode *textures[2];
+    bool linear_filter[2];
+    uint8_t cms[2], cmt[2];
+    uint8_t atlas_page[2];
+    bool depth_test, depth_mask, decal_mode, alpha_blend;
+    uint32_t cull_mode;
+    struct XYWidthHeight viewport, scissor;
+};
+
+struct DeferredDraw {
+    struct DeferredState state;
+    uint32_t seq;
+    uint32_t buffer_id; // retained buffer, 0 for streamed triangles
+    size_t vbo_offset, vbo_len; // in words, into deferred.vbo or the retained buffer
+    size_t ibo_offset, num_verts;
+    size_t num_tris;
+    size_t mvp_index;
+};
+
+static struct {
+    bool enabled;
+    struct DeferredDraw *draws;
+    size_t num_draws, draws_cap;
+    float *vbo;
+    size_t vbo_len, vbo_cap;
+    uint16_t *ibo;
+    size_t ibo_len, ibo_cap;
+    float (*mvps)[4][4];
+    size_t num_mvps, mvps_cap;
+    uint32_t *pending_deletes; // retained buffers freed while draws still point at them
+    size_t num_pending_deletes, pending_deletes_cap;
+    
+    // What the rendering API was last told during a submit
+    struct DeferredState applied;
+    struct ShaderProgram *bound_prg;
+} deferred;
+
+#define DEFERRED_GROW(arr, len, cap, add) do { \
+    if ((len) + (add) > (cap)) { \
+        while ((len) + (add) > (cap)) { \
+            (cap) = (cap) == 0 ? 256 : (cap) * 2; \
+        } \
+        (arr) = realloc((arr), (cap) * sizeof(*(arr))); \
+    } \
+} while (0)
+
+// Hardware transform and lighting (hw_tnl in sm64config.txt). Loaded vertices
+// stay in object space and the SHADER_OPT_TNL programs do the matrices, the
+// lighting and the fog. The CPU path stays the default, so the two can be
+// compared. Needs indexed vertices and can't be combined with retained
+// geometry or deferred draws, whose batches don't carry the uniforms.
+static struct {
+    bool enabled;
+    struct GfxTnlState loaded; // what the loaded vertices go with
+    struct GfxTnlState applied; // what the rendering API was last told
+    bool applied_valid;
+} tnl;
+
+// Display list capture (capture_start_frame and capture_frames in
+// sm64config.txt) and replay of a capture by tools/gfxbench. While capturing,
+// every region the display lists make the renderer read is recorded, and
+// retained geometry is off so every list actually runs.
+static struct {
+    uint32_t frame; // gfx_run calls so far
+    uint32_t frames_left; // still to capture, 0 when not capturing
+    const struct GfxCaptureFrame *replay;
+} capture;
+
+static struct GfxFrameStats frame_stats, last_frame_stats;
+
+static inline void gfx_capture_region(const void *addr, size_t size) {
+    if (capture.frames_left != 0) {
+        gfx_capture_add(addr, size);
+    }
+}
+
 static struct GfxWindowManagerAPI *gfx_wapi;
 static struct GfxRenderingAPI *gfx_rapi;
 
@@ -221,29 +464,259 @@ static unsigned long get_time(void) {
     return (unsigned long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
 }
 
+static void gfx_deferred_submit(void);
+
+// Draws whatever is in buf_vbo with the current render state
+static void gfx_draw_buffered(void) {
+    int num = buf_vbo_num_tris;
+    unsigned long t0 = get_time();
+    if (gfx_use_indexed_vertices) {
+        gfx_rapi->draw_indexed_triangles(buf_vbo, buf_vbo_len, buf_vbo_num_verts, buf_ibo, buf_vbo_num_tris);
+        ProfEmitCounter("gfx_stream_bytes", buf_vbo_len * sizeof(float) + buf_ibo_len * sizeof(uint16_t));
+    } else {
+        gfx_rapi->draw_triangles(buf_vbo, buf_vbo_len, buf_vbo_num_tris);
+        ProfEmitCounter("gfx_stream_bytes", buf_vbo_len * sizeof(float));
+    }
+    ProfEmitCounter("gfx_draw_calls", 1);
+    frame_stats.draw_calls++;
+    unsigned long t1 = get_time();
+    /*if (t1 - t0 > 1000) {
+        printf("f: %d %d\n", num, (int)(t1 - t0));
+    }*/
+}
+
+static void gfx_deferred_get_state(struct DeferredState *state) {
+    memset(state, 0, sizeof(*state));
+    state->prg = rendering_state.shader_program;
+    state->depth_test = rendering_state.depth_test;
+    state->depth_mask = rendering_state.depth_mask;
+    state->decal_mode = rendering_state.decal_mode;
+    state->alpha_blend = rendering_state.alpha_blend;
+    state->cull_mode = rendering_state.cull_mode;
+    state->viewport = rendering_state.viewport;
+    state->scissor = rendering_state.scissor;
+    
+    uint8_t num_inputs;
+    bool used_textures[2];
+    gfx_rapi->shader_get_info(state->prg, &num_inputs, used_textures);
+    for (int i = 0; i < 2; i++) {
+        state->used_textures[i] = used_textures[i];
+        if (used_textures[i]) {
+#ifdef USE_TEXTURE_ATLAS
+            // Wrapping is done per vertex, only the page has to be bound
+            state->linear_filter[i] = rendering_state.linear_filter[i];
+            state->atlas_page[i] = rendering_state.atlas_page[i];
+#else
+            struct TextureHashmapNode *node = rendering_state.textures[i];
+            state->textures[i] = node;
+            state->linear_filter[i] = node->linear_filter;
+            state->cms[i] = node->cms;
+            state->cmt[i] = node->cmt;
+#endif
+        }
+    }
+}
+
+static struct DeferredDraw *gfx_deferred_new_draw(void) {
+    DEFERRED_GROW(deferred.draws, deferred.num_draws, deferred.draws_cap, 1);
+    struct DeferredDraw *d = &deferred.draws[deferred.num_draws];
+    memset(d, 0, sizeof(*d));
+    gfx_deferred_get_state(&d->state);
+    d->seq = deferred.num_draws++;
+    return d;
+}
+
+// Moves the buffered triangles into this frame's deferred draws
+static void gfx_deferred_push_buffered(void) {
+    struct DeferredDraw *d = gfx_deferred_new_draw();
+    
+    DEFERRED_GROW(deferred.vbo, deferred.vbo_len, deferred.vbo_cap, buf_vbo_len);
+    memcpy(&deferred.vbo[deferred.vbo_len], buf_vbo, buf_vbo_len * sizeof(float));
+    d->vbo_offset = deferred.vbo_len;
+    d->vbo_len = buf_vbo_len;
+    deferred.vbo_len += buf_vbo_len;
+    
+    DEFERRED_GROW(deferred.ibo, deferred.ibo_len, deferred.ibo_cap, buf_ibo_len);
+    memcpy(&deferred.ibo[deferred.ibo_len], buf_ibo, buf_ibo_len * sizeof(uint16_t));
+    d->ibo_offset = deferred.ibo_len;
+    deferred.ibo_len += buf_ibo_len;
+    
+    d->num_verts = buf_vbo_num_verts;
+    d->num_tris = buf_vbo_num_tris;
+}
+
 static void gfx_flush(void) {
     ProfEmitEventStart("gfx_flush");
-    if (buf_vbo_len > 0) {
-        int num = buf_vbo_num_tris;
-        unsigned long t0 = get_time();
-        gfx_rapi->draw_triangles(buf_vbo, buf_vbo_len, buf_vbo_num_tris);
-        buf_vbo_len = 0;
-        buf_vbo_num_tris = 0;
-        unsigned long t1 = get_time();
-        /*if (t1 - t0 > 1000) {
-            printf("f: %d %d\n", num, (int)(t1 - t0));
-        }*/
+    if (buf_vbo_num_tris > 0) {
+        ProfEmitCounter("gfx_flushes", 1);
+        frame_stats.flushes++;
+        frame_stats.triangles += buf_vbo_num_tris;
+        if (deferred.enabled) {
+            gfx_deferred_push_buffered();
+        } else {
+            gfx_draw_buffered();
+        }
     }
+    buf_vbo_len = 0;
+    buf_vbo_num_tris = 0;
+    buf_vbo_num_verts = 0;
+    buf_ibo_len = 0;
+    vertex_share_stamp++;
     ProfEmitEventEnd("gfx_flush");
 }
 
+static bool gfx_retained_enabled(void) {
+    return configRetainedGeometry && gfx_rapi->draw_static_triangles != NULL && !tnl.enabled && capture.frames_left == 0;
+}
+
+static void gfx_retained_delete_buffer(uint32_t buffer_id) {
+    if (deferred.num_draws > 0) {
+        // A queued draw may still use it
+        DEFERRED_GROW(deferred.pending_deletes, deferred.num_pending_deletes, deferred.pending_deletes_cap, 1);
+        deferred.pending_deletes[deferred.num_pending_deletes++] = buffer_id;
+    } else {
+        gfx_rapi->delete_static_buffer(buffer_id);
+    }
+}
+
+static void gfx_retained_free_entry(struct RetainedEntry *e) {
+    size_t hash = (((uintptr_t)e->dl >> 3) ^ e->sig_hash) & (RETAINED_HASHMAP_SIZE - 1);
+    struct RetainedEntry **node = &retained.hashmap[hash];
+    while (*node != NULL && *node != e) {
+        node = &(*node)->next;
+    }
+    if (*node != NULL) {
+        *node = e->next;
+    }
+    if (e->buffer_id != 0) {
+        gfx_retained_delete_buffer(e->buffer_id);
+    }
+    free(e->batches);
+    memset(e, 0, sizeof(*e));
+    for (int i = 0; i < MAX_VERTICES; i++) {
+        if (rsp.loaded_vertices[i].retained_owner == e) {
+            rsp.loaded_vertices[i].retained_owner = NULL;
+        }
+    }
+}
+
+// Throws away a recording but keeps the entry, e.g. to record it again
+static void gfx_retained_drop_recording(struct RetainedEntry *e) {
+    if (e->buffer_id != 0) {
+        gfx_retained_delete_buffer(e->buffer_id);
+    }
+    free(e->batches);
+    e->buffer_id = 0;
+    e->batches = NULL;
+    e->num_batches = 0;
+    e->state = RETAINED_CANDIDATE;
+}
+
+static void gfx_run_dl(Gfx* cmd);
+
+// A command after the display list returned reads a vertex slot it loaded,
+// which the replay left holding whatever was there before. The list runs
+// again from the state it was called with, drawing nothing, for what its
+// vertex loads put in the slots it owns, and it just runs from then on.
+// Neither the matrices nor the lights change inside a recorded list, the
+// ones of now are used.
+static void gfx_retained_vertex_used(struct LoadedVertex *v) {
+    static struct LoadedVertex saved_vertices[MAX_VERTICES];
+    struct RetainedEntry *e = v->retained_owner;
+    struct RDP saved_rdp;
+    uint32_t geometry_mode = rsp.geometry_mode;
+    uint16_t texture_scaling_s = rsp.texture_scaling_factor.s;
+    uint16_t texture_scaling_t = rsp.texture_scaling_factor.t;
+    
+    memcpy(&saved_rdp, &rdp, sizeof(rdp));
+    memcpy(saved_vertices, rsp.loaded_vertices, sizeof(saved_vertices));
+    memcpy(&rdp, &e->sig.rdp, sizeof(rdp));
+    rdp.viewport_or_scissor_changed = saved_rdp.viewport_or_scissor_changed;
+    rsp.geometry_mode = e->sig.geometry_mode;
+    rsp.texture_scaling_factor.s = e->sig.texture_scaling_s;
+    rsp.texture_scaling_factor.t = e->sig.texture_scaling_t;
+    
+    retained.reloading = true;
+    gfx_run_dl((Gfx *)e->dl);
+    retained.reloading = false;
+    
+    memcpy(&rdp, &saved_rdp, sizeof(rdp));
+    rsp.geometry_mode = geometry_mode;
+    rsp.texture_scaling_factor.s = texture_scaling_s;
+    rsp.texture_scaling_factor.t = texture_scaling_t;
+    for (int i = 0; i < MAX_VERTICES; i++) {
+        if (saved_vertices[i].retained_owner != e) {
+            rsp.loaded_vertices[i] = saved_vertices[i];
+        }
+    }
+    
+    if (e->state == RETAINED_RECORDED) {
+        gfx_retained_drop_recording(e);
+    }
+    e->state = RETAINED_REJECTED;
+}
+
+static bool gfx_retained_uses_texture(const struct RetainedEntry *e, const struct TextureHashmapNode *node) {
+    for (int j = 0; j < 2; j++) {
+        if (e->sig.textures[j] == node || e->exit.textures[j] == node) {
+            return true;
+        }
+    }
+    for (size_t i = 0; i < e->num_batches; i++) {
+        if (e->batches[i].state.textures[0] == node || e->batches[i].state.textures[1] == node) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Drops the recordings that point at a texture cache node about to be recycled.
+static void gfx_retained_forget_texture(const struct TextureHashmapNode *node) {
+    for (size_t i = 0; i < RETAINED_POOL_SIZE; i++) {
+        struct RetainedEntry *e = &retained.pool[i];
+        if (e->dl != NULL && e != retained.recording && gfx_retained_uses_texture(e, node)) {
+            gfx_retained_free_entry(e);
+        }
+    }
+    if (retained.recording != NULL) {
+        retained.recording_failed = true;
+        retained.recording_restart = true;
+    }
+}
+
+// Every shader_id a run has needed goes in shader_manifest.txt, one per line in
+// hex. gfx_init creates them all up front, so the shaders are compiled (or loaded
+// from the backend's program cache) before gameplay rather than in the middle of it.
+#define SHADER_MANIFEST_FILE "shader_manifest.txt"
+static struct {
+    bool warm; // done with the manifest, anything created now gets added to it
+    bool in_game; // done with gfx_init, anything created now is a hitch
+} shader_warmup;
+
+static void gfx_shader_manifest_add(uint32_t shader_id) {
+    FILE *f = fopen_home(SHADER_MANIFEST_FILE, "a");
+    if (f != NULL) {
+        fprintf(f, "%08x\n", shader_id);
+        fclose(f);
+    }
+}
+
 static struct ShaderProgram *gfx_lookup_or_create_shader_program(uint32_t shader_id) {
     ProfEmitEventStart("gfx_shader_program");
     struct ShaderProgram *prg = gfx_rapi->lookup_shader(shader_id);
     if (prg == NULL) {
-        gfx_rapi->unload_shader(rendering_state.shader_program);
+        // Creating a program also binds it
+        gfx_flush();
+        gfx_rapi->unload_shader(deferred.enabled ? deferred.bound_prg : rendering_state.shader_program);
         prg = gfx_rapi->create_and_load_new_shader(shader_id);
         rendering_state.shader_program = prg;
+        deferred.bound_prg = prg;
+        if (shader_warmup.warm) {
+            gfx_shader_manifest_add(shader_id);
+        }
+        if (shader_warmup.in_game) {
+            ProfEmitCounter("shader_compiles_in_game", 1);
+        }
     }
     ProfEmitEventEnd("gfx_shader_program");
     return prg;
@@ -292,7 +765,10 @@ static void gfx_generate_cc(struct ColorCombiner *comb, uint32_t cc_id) {
         }
     }
     comb->cc_id = cc_id;
-    comb->prg = gfx_lookup_or_create_shader_program(shader_id);
+    comb->shader_id = shader_id;
+    comb->prg = NULL; // created the first time the combiner is used
+    comb->prg_mvp = NULL;
+    comb->prg_tnl = NULL;
     memcpy(comb->shader_input_mapping, shader_input_mapping, sizeof(shader_input_mapping));
 }
 
@@ -302,56 +778,168 @@ static struct ColorCombiner *gfx_lookup_or_create_color_combiner(uint32_t cc_id)
         return prev_combiner;
     }
     
-    for (size_t i = 0; i < color_combiner_pool_size; i++) {
+    struct ColorCombiner *comb = NULL;
+    // The preallocated combiners are sorted, the ones added later are not
+    size_t lo = 0, hi = color_combiner_num_preallocated;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (color_combiner_pool[mid].cc_id < cc_id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < color_combiner_num_preallocated && color_combiner_pool[lo].cc_id == cc_id) {
+        comb = &color_combiner_pool[lo];
+    }
+    for (size_t i = color_combiner_num_preallocated; i < color_combiner_pool_size && comb == NULL; i++) {
         if (color_combiner_pool[i].cc_id == cc_id) {
-            return prev_combiner = &color_combiner_pool[i];
+            comb = &color_combiner_pool[i];
         }
     }
-    gfx_flush();
-    struct ColorCombiner *comb = &color_combiner_pool[color_combiner_pool_size++];
-    gfx_generate_cc(comb, cc_id);
+    
+    if (comb == NULL) {
+        if (color_combiner_pool_size == COLOR_COMBINER_POOL_SIZE) {
+            fprintf(stderr, "Out of color combiners, %u in use\n", (unsigned)color_combiner_pool_size);
+            abort();
+        }
+#ifdef GFX_CC_TABLE
+        fprintf(stderr, "Color combiner %08x is not in the generated table\n", cc_id);
+        ProfEmitCounter("cc_unknown_ids", 1);
+#endif
+        comb = &color_combiner_pool[color_combiner_pool_size++];
+        gfx_generate_cc(comb, cc_id);
+    }
+    if (comb->prg == NULL) {
+        gfx_flush();
+        comb->prg = gfx_lookup_or_create_shader_program(comb->shader_id);
+    }
     return prev_combiner = comb;
 }
 
+static uint32_t gfx_texture_cache_hash(const uint8_t *orig_addr, uint32_t fmt, uint32_t siz) {
+    uint64_t key = (uint64_t)(uintptr_t)orig_addr ^ ((uint64_t)(fmt << 2 | siz) << 56);
+    uint32_t h = (uint32_t)key ^ (uint32_t)(key >> 32);
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h & gfx_texture_cache.hashmap_mask;
+}
+
+static void gfx_texture_cache_init(uint32_t size) {
+    if (size < TEXTURE_CACHE_MIN_SIZE) {
+        size = TEXTURE_CACHE_MIN_SIZE;
+    }
+    uint32_t hashmap_size = 1;
+    while (hashmap_size < size * 2) {
+        hashmap_size <<= 1;
+    }
+    gfx_texture_cache.pool = calloc(size, sizeof(struct TextureHashmapNode));
+    gfx_texture_cache.hashmap = calloc(hashmap_size, sizeof(struct TextureHashmapNode *));
+    if (gfx_texture_cache.pool == NULL || gfx_texture_cache.hashmap == NULL) {
+        fprintf(stderr, "Could not allocate a texture cache of %u entries\n", size);
+        abort();
+    }
+    gfx_texture_cache.pool_size = size;
+    gfx_texture_cache.hashmap_mask = hashmap_size - 1;
+}
+
+// Picks the least recently used node that no tile is pointing at, and unlinks it.
+// Returns NULL if there is nothing to evict.
+static struct TextureHashmapNode *gfx_texture_cache_evict(void) {
+    struct TextureHashmapNode *victim = NULL;
+    // Two rounds of the clock clear every second chance bit
+    for (uint32_t i = 0; i < 2 * gfx_texture_cache.pool_pos + 1 && gfx_texture_cache.pool_pos > 0; i++) {
+        struct TextureHashmapNode *node = &gfx_texture_cache.pool[gfx_texture_cache.clock_hand];
+        gfx_texture_cache.clock_hand = (gfx_texture_cache.clock_hand + 1) % gfx_texture_cache.pool_pos;
+        if (node->texture_addr == NULL || node == rendering_state.textures[0] || node == rendering_state.textures[1]) {
+            continue;
+        }
+        if (node->referenced) {
+            node->referenced = false;
+            continue;
+        }
+        victim = node;
+        break;
+    }
+    if (victim == NULL) {
+        return NULL;
+    }
+    
+    uint32_t hash = gfx_texture_cache_hash(victim->texture_addr, victim->fmt, victim->siz);
+    struct TextureHashmapNode **node = &gfx_texture_cache.hashmap[hash];
+    while (*node != victim) {
+        node = &(*node)->next;
+    }
+    *node = victim->next;
+    gfx_texture_cache.evicted[hash % TEXTURE_CACHE_EVICTED_HISTORY] = victim->texture_addr;
+    
+    // Whatever was drawn with it has to go out before its texels are replaced
+    gfx_flush();
+    gfx_deferred_submit();
+    gfx_retained_forget_texture(victim);
+#ifdef USE_TEXTURE_ATLAS
+    if (victim->texture_id != 0) {
+        atlas_destroy_vtex(gfx_atlas.pages[victim->page], victim->texture_id);
+        victim->texture_id = 0;
+    }
+    victim->texture_addr = NULL; // not in the hashmap anymore
+#endif
+    ProfEmitCounter("tex_cache_evictions", 1);
+    return victim;
+}
+
 static bool gfx_texture_cache_lookup(int tile, struct TextureHashmapNode **n, const uint8_t *orig_addr, uint32_t fmt, uint32_t siz) {
-    size_t hash = (uintptr_t)orig_addr;
-    hash = (hash >> 5) & 0x3ff;
+    uint32_t hash = gfx_texture_cache_hash(orig_addr, fmt, siz);
     struct TextureHashmapNode **node = &gfx_texture_cache.hashmap[hash];
-    while (*node != NULL && *node - gfx_texture_cache.pool < (int)gfx_texture_cache.pool_pos) {
+    while (*node != NULL) {
         if ((*node)->texture_addr == orig_addr && (*node)->fmt == fmt && (*node)->siz == siz) {
 #ifndef USE_TEXTURE_ATLAS
             gfx_rapi->select_texture(tile, (*node)->texture_id);
 #endif
+            (*node)->referenced = true;
             *n = *node;
+            ProfEmitCounter("tex_cache_hits", 1);
             return true;
         }
         node = &(*node)->next;
     }
-    if (gfx_texture_cache.pool_pos == sizeof(gfx_texture_cache.pool) / sizeof(struct TextureHashmapNode)) {
-        // Pool is full. We just invalidate everything and start over.
-        gfx_texture_cache.pool_pos = 0;
+    ProfEmitCounter("tex_cache_misses", 1);
+    if (gfx_texture_cache.evicted[hash % TEXTURE_CACHE_EVICTED_HISTORY] == orig_addr) {
+        ProfEmitCounter("tex_cache_reuploads", 1);
+    }
+    
+    struct TextureHashmapNode *new_node;
+    if (gfx_texture_cache.free_list != NULL) {
+        new_node = gfx_texture_cache.free_list;
+        gfx_texture_cache.free_list = new_node->next;
+    } else if (gfx_texture_cache.pool_pos < gfx_texture_cache.pool_size) {
+        new_node = &gfx_texture_cache.pool[gfx_texture_cache.pool_pos++];
+    } else {
+        new_node = gfx_texture_cache_evict();
+        if (new_node == NULL) {
+            abort();
+        }
+        // The victim may have been in front of us in the same bucket
         node = &gfx_texture_cache.hashmap[hash];
-        //puts("Clearing texture cache");
+        while (*node != NULL) {
+            node = &(*node)->next;
+        }
     }
-    *node = &gfx_texture_cache.pool[gfx_texture_cache.pool_pos++];
+    *node = new_node;
 #ifndef USE_TEXTURE_ATLAS
     if ((*node)->texture_addr == NULL) {
         (*node)->texture_id = gfx_rapi->new_texture();
     }
     gfx_rapi->select_texture(tile, (*node)->texture_id);
     gfx_rapi->set_sampler_parameters(tile, false, 0, 0);
-#else
-    if ((*node)->texture_addr == NULL) {
-        uint32_t virtual_id;
-        if (!atlas_gen_texture(atlas, &virtual_id))
-            abort();
-        
-        (*node)->texture_id = virtual_id;
-    }
 #endif
     (*node)->cms = 0;
     (*node)->cmt = 0;
     (*node)->linear_filter = false;
+    (*node)->referenced = true;
     (*node)->next = NULL;
     (*node)->texture_addr = orig_addr;
     (*node)->fmt = fmt;
@@ -360,29 +948,89 @@ static bool gfx_texture_cache_lookup(int tile, struct TextureHashmapNode **n, co
     return false;
 }
 
-static void import_texture_finish(uint8_t *buf, int tile, uint16_t width, uint16_t height)
+#ifdef USE_TEXTURE_ATLAS
+static bool gfx_atlas_add_page(void) {
+    if (gfx_atlas.num_pages == gfx_atlas.max_pages) {
+        return false;
+    }
+    uint16_t page = gfx_atlas.num_pages;
+    if (!atlas_create_with_packer(&gfx_atlas.pages[page], ATLAS_PAGE_DIMENSIONS, 1, configAtlasSkyline ? ATLAS_PACKER_SKYLINE : ATLAS_PACKER_HOLES)) {
+        return false;
+    }
+    gfx_rapi->create_virtual_texture_page(page, ATLAS_PAGE_DIMENSIONS);
+    snprintf(gfx_atlas.fill_labels[page], sizeof(gfx_atlas.fill_labels[page]), "atlas_page%u_fill", (unsigned)page);
+    gfx_atlas.num_pages++;
+    return true;
+}
+
+// Gives the node's texture w x h texels on some page: first any page with room,
+// then a new page, then evicting the least recently used textures until it fits.
+static bool gfx_atlas_allocate(struct TextureHashmapNode *node, uint16_t w, uint16_t h) {
+    for (;;) {
+        for (uint32_t page = 0; page < gfx_atlas.num_pages; page++) {
+            uint32_t id;
+            if (!atlas_gen_texture(gfx_atlas.pages[page], &id)) {
+                continue;
+            }
+            if (atlas_allocate_vtex_space(gfx_atlas.pages[page], id, w, h)) {
+                node->texture_id = id;
+                node->page = page;
+                return true;
+            }
+            atlas_destroy_vtex(gfx_atlas.pages[page], id);
+        }
+        if (gfx_atlas_add_page()) {
+            continue;
+        }
+        
+        struct TextureHashmapNode *victim = gfx_texture_cache_evict();
+        if (victim == NULL) {
+            return false;
+        }
+        victim->next = gfx_texture_cache.free_list;
+        gfx_texture_cache.free_list = victim;
+        ProfEmitCounter("atlas_evictions", 1);
+    }
+}
+
+// Binds the page the tile's texture lives on
+static void gfx_update_atlas_page(int tile) {
+    uint8_t page = rendering_state.textures[tile]->page;
+    if (page != rendering_state.atlas_page[tile]) {
+        gfx_flush();
+        if (!deferred.enabled) {
+            gfx_rapi->bind_virtual_texture_page(tile, page);
+            // Filtering belongs to the page texture
+            gfx_rapi->set_sampler_parameters(tile, rendering_state.linear_filter[tile], 0, 0);
+        }
+        rendering_state.atlas_page[tile] = page;
+    }
+}
+#endif
+
+static void import_texture_finish(const uint8_t *buf, int tile, uint16_t width, uint16_t height)
 {
     ProfEmitEventEnd("import_texture_xxx");
 #ifndef USE_TEXTURE_ATLAS
     gfx_rapi->upload_texture(buf, width, height);
 #else
-    // Deal with failure gracefully - maybe invalidate a few textures for more space
-    uint32_t v_id = rendering_state.textures[tile]->texture_id;
+    struct TextureHashmapNode *node = rendering_state.textures[tile];
 
     int h_mirror = rdp.texture_tile.cms == G_TX_MIRROR;
     int v_mirror = rdp.texture_tile.cmt == G_TX_MIRROR;
 
     // Allocate enough memory for the mirrored set. This allows us to simplify
     // the fragment shader texture fetches a little.
-    if (!atlas_allocate_vtex_space(atlas, v_id, 
-        !h_mirror ? width : width*2, !v_mirror ? height : height * 2))
+    if (!gfx_atlas_allocate(node, !h_mirror ? width : width*2, !v_mirror ? height : height * 2)) {
+        fprintf(stderr, "Texture of %ux%u does not fit in the texture atlas\n", width, height);
         abort();
+    }
 
     uint16_t xyzw[4];
-    if (!atlas_get_vtex_xywh_coords(atlas, v_id, 0, &xyzw))
+    if (!atlas_get_vtex_xywh_coords(gfx_atlas.pages[node->page], node->texture_id, 0, xyzw))
         abort();
 
-    gfx_rapi->upload_virtual_texture(buf, xyzw[0], xyzw[1], width, height, h_mirror, v_mirror);
+    gfx_rapi->upload_virtual_texture(node->page, buf, xyzw[0], xyzw[1], width, height, h_mirror, v_mirror);
     rendering_state.textures[tile]->x = xyzw[0];
     rendering_state.textures[tile]->y = xyzw[1];
     rendering_state.textures[tile]->width = width;
@@ -401,25 +1049,29 @@ static void import_texture_finish(uint8_t *buf, int tile, uint16_t width, uint16
 #endif
 }
 
+// Decoded texels of the loaded texture, straight from the texture pack when it
+// has them. CI textures depend on the palette, so those are always decoded.
+static const uint8_t *import_texture_decode(int tile, enum GfxTextureDecodeFormat fmt, const uint8_t *palette, uint8_t *rgba32_buf) {
+    if (palette == NULL) {
+        const uint8_t *packed = gfx_texture_pack_lookup(rdp.loaded_texture[tile].addr, rdp.loaded_texture[tile].size_bytes,
+                                                        rdp.texture_tile.fmt, rdp.texture_tile.siz);
+        if (packed != NULL) {
+            return packed;
+        }
+    }
+    gfx_texture_decode(fmt, rdp.loaded_texture[tile].addr, rdp.loaded_texture[tile].size_bytes, palette, rgba32_buf);
+    return rgba32_buf;
+}
+
 static void import_texture_rgba16(int tile) {
     uint8_t rgba32_buf[8192];
-    
-    for (uint32_t i = 0; i < rdp.loaded_texture[tile].size_bytes / 2; i++) {
-        uint16_t col16 = (rdp.loaded_texture[tile].addr[2 * i] << 8) | rdp.loaded_texture[tile].addr[2 * i + 1];
-        uint8_t a = col16 & 1;
-        uint8_t r = col16 >> 11;
-        uint8_t g = (col16 >> 6) & 0x1f;
-        uint8_t b = (col16 >> 1) & 0x1f;
-        rgba32_buf[4*i + 0] = SCALE_5_8(r);
-        rgba32_buf[4*i + 1] = SCALE_5_8(g);
-        rgba32_buf[4*i + 2] = SCALE_5_8(b);
-        rgba32_buf[4*i + 3] = a ? 255 : 0;
-    }
+
+    const uint8_t *rgba32 = import_texture_decode(tile, GFX_TEXTURE_RGBA16, NULL, rgba32_buf);
     
     uint32_t width = rdp.texture_tile.line_size_bytes / 2;
     uint32_t height = rdp.loaded_texture[tile].size_bytes / rdp.texture_tile.line_size_bytes;
         
-    import_texture_finish(rgba32_buf, tile, width, height);
+    import_texture_finish(rgba32, tile, width, height);
 }
 
 static void import_texture_rgba32(int tile) {
@@ -431,155 +1083,80 @@ static void import_texture_rgba32(int tile) {
 
 static void import_texture_ia4(int tile) {
     uint8_t rgba32_buf[32768];
-    
-    for (uint32_t i = 0; i < rdp.loaded_texture[tile].size_bytes * 2; i++) {
-        uint8_t byte = rdp.loaded_texture[tile].addr[i / 2];
-        uint8_t part = (byte >> (4 - (i % 2) * 4)) & 0xf;
-        uint8_t intensity = part >> 1;
-        uint8_t alpha = part & 1;
-        uint8_t r = intensity;
-        uint8_t g = intensity;
-        uint8_t b = intensity;
-        rgba32_buf[4*i + 0] = SCALE_3_8(r);
-        rgba32_buf[4*i + 1] = SCALE_3_8(g);
-        rgba32_buf[4*i + 2] = SCALE_3_8(b);
-        rgba32_buf[4*i + 3] = alpha ? 255 : 0;
-    }
+
+    const uint8_t *rgba32 = import_texture_decode(tile, GFX_TEXTURE_IA4, NULL, rgba32_buf);
     
     uint32_t width = rdp.texture_tile.line_size_bytes * 2;
     uint32_t height = rdp.loaded_texture[tile].size_bytes / rdp.texture_tile.line_size_bytes;
         
-    import_texture_finish(rgba32_buf, tile, width, height);
+    import_texture_finish(rgba32, tile, width, height);
 }
 
 static void import_texture_ia8(int tile) {
     uint8_t rgba32_buf[16384];
-    
-    for (uint32_t i = 0; i < rdp.loaded_texture[tile].size_bytes; i++) {
-        uint8_t intensity = rdp.loaded_texture[tile].addr[i] >> 4;
-        uint8_t alpha = rdp.loaded_texture[tile].addr[i] & 0xf;
-        uint8_t r = intensity;
-        uint8_t g = intensity;
-        uint8_t b = intensity;
-        rgba32_buf[4*i + 0] = SCALE_4_8(r);
-        rgba32_buf[4*i + 1] = SCALE_4_8(g);
-        rgba32_buf[4*i + 2] = SCALE_4_8(b);
-        rgba32_buf[4*i + 3] = SCALE_4_8(alpha);
-    }
+
+    const uint8_t *rgba32 = import_texture_decode(tile, GFX_TEXTURE_IA8, NULL, rgba32_buf);
     
     uint32_t width = rdp.texture_tile.line_size_bytes;
     uint32_t height = rdp.loaded_texture[tile].size_bytes / rdp.texture_tile.line_size_bytes;
         
-    import_texture_finish(rgba32_buf, tile, width, height);
+    import_texture_finish(rgba32, tile, width, height);
 }
 
 static void import_texture_ia16(int tile) {
     uint8_t rgba32_buf[8192];
-    
-    for (uint32_t i = 0; i < rdp.loaded_texture[tile].size_bytes / 2; i++) {
-        uint8_t intensity = rdp.loaded_texture[tile].addr[2 * i];
-        uint8_t alpha = rdp.loaded_texture[tile].addr[2 * i + 1];
-        uint8_t r = intensity;
-        uint8_t g = intensity;
-        uint8_t b = intensity;
-        rgba32_buf[4*i + 0] = r;
-        rgba32_buf[4*i + 1] = g;
-        rgba32_buf[4*i + 2] = b;
-        rgba32_buf[4*i + 3] = alpha;
-    }
+
+    const uint8_t *rgba32 = import_texture_decode(tile, GFX_TEXTURE_IA16, NULL, rgba32_buf);
     
     uint32_t width = rdp.texture_tile.line_size_bytes / 2;
     uint32_t height = rdp.loaded_texture[tile].size_bytes / rdp.texture_tile.line_size_bytes;
         
-    import_texture_finish(rgba32_buf, tile, width, height);
+    import_texture_finish(rgba32, tile, width, height);
 }
 
 static void import_texture_i4(int tile) {
     uint8_t rgba32_buf[32768];
 
-    for (uint32_t i = 0; i < rdp.loaded_texture[tile].size_bytes * 2; i++) {
-        uint8_t byte = rdp.loaded_texture[tile].addr[i / 2];
-        uint8_t part = (byte >> (4 - (i % 2) * 4)) & 0xf;
-        uint8_t intensity = part;
-        uint8_t r = intensity;
-        uint8_t g = intensity;
-        uint8_t b = intensity;
-        rgba32_buf[4*i + 0] = SCALE_4_8(r);
-        rgba32_buf[4*i + 1] = SCALE_4_8(g);
-        rgba32_buf[4*i + 2] = SCALE_4_8(b);
-        rgba32_buf[4*i + 3] = 255;
-    }
+    const uint8_t *rgba32 = import_texture_decode(tile, GFX_TEXTURE_I4, NULL, rgba32_buf);
 
     uint32_t width = rdp.texture_tile.line_size_bytes * 2;
     uint32_t height = rdp.loaded_texture[tile].size_bytes / rdp.texture_tile.line_size_bytes;
         
-    import_texture_finish(rgba32_buf, tile, width, height);
+    import_texture_finish(rgba32, tile, width, height);
 }
 
 static void import_texture_i8(int tile) {
     uint8_t rgba32_buf[16384];
 
-    for (uint32_t i = 0; i < rdp.loaded_texture[tile].size_bytes; i++) {
-        uint8_t intensity = rdp.loaded_texture[tile].addr[i];
-        uint8_t r = intensity;
-        uint8_t g = intensity;
-        uint8_t b = intensity;
-        rgba32_buf[4*i + 0] = r;
-        rgba32_buf[4*i + 1] = g;
-        rgba32_buf[4*i + 2] = b;
-        rgba32_buf[4*i + 3] = 255;
-    }
+    const uint8_t *rgba32 = import_texture_decode(tile, GFX_TEXTURE_I8, NULL, rgba32_buf);
 
     uint32_t width = rdp.texture_tile.line_size_bytes;
     uint32_t height = rdp.loaded_texture[tile].size_bytes / rdp.texture_tile.line_size_bytes;
         
-    import_texture_finish(rgba32_buf, tile, width, height);
+    import_texture_finish(rgba32, tile, width, height);
 }
 
 
 static void import_texture_ci4(int tile) {
     uint8_t rgba32_buf[32768];
-    
-    for (uint32_t i = 0; i < rdp.loaded_texture[tile].size_bytes * 2; i++) {
-        uint8_t byte = rdp.loaded_texture[tile].addr[i / 2];
-        uint8_t idx = (byte >> (4 - (i % 2) * 4)) & 0xf;
-        uint16_t col16 = (rdp.palette[idx * 2] << 8) | rdp.palette[idx * 2 + 1]; // Big endian load
-        uint8_t a = col16 & 1;
-        uint8_t r = col16 >> 11;
-        uint8_t g = (col16 >> 6) & 0x1f;
-        uint8_t b = (col16 >> 1) & 0x1f;
-        rgba32_buf[4*i + 0] = SCALE_5_8(r);
-        rgba32_buf[4*i + 1] = SCALE_5_8(g);
-        rgba32_buf[4*i + 2] = SCALE_5_8(b);
-        rgba32_buf[4*i + 3] = a ? 255 : 0;
-    }
+
+    const uint8_t *rgba32 = import_texture_decode(tile, GFX_TEXTURE_CI4, rdp.palette, rgba32_buf);
     
     uint32_t width = rdp.texture_tile.line_size_bytes * 2;
     uint32_t height = rdp.loaded_texture[tile].size_bytes / rdp.texture_tile.line_size_bytes;
         
-    import_texture_finish(rgba32_buf, tile, width, height);
+    import_texture_finish(rgba32, tile, width, height);
 }
 
 static void import_texture_ci8(int tile) {
     uint8_t rgba32_buf[16384];
-    
-    for (uint32_t i = 0; i < rdp.loaded_texture[tile].size_bytes; i++) {
-        uint8_t idx = rdp.loaded_texture[tile].addr[i];
-        uint16_t col16 = (rdp.palette[idx * 2] << 8) | rdp.palette[idx * 2 + 1]; // Big endian load
-        uint8_t a = col16 & 1;
-        uint8_t r = col16 >> 11;
-        uint8_t g = (col16 >> 6) & 0x1f;
-        uint8_t b = (col16 >> 1) & 0x1f;
-        rgba32_buf[4*i + 0] = SCALE_5_8(r);
-        rgba32_buf[4*i + 1] = SCALE_5_8(g);
-        rgba32_buf[4*i + 2] = SCALE_5_8(b);
-        rgba32_buf[4*i + 3] = a ? 255 : 0;
-    }
+
+    const uint8_t *rgba32 = import_texture_decode(tile, GFX_TEXTURE_CI8, rdp.palette, rgba32_buf);
     
     uint32_t width = rdp.texture_tile.line_size_bytes;
     uint32_t height = rdp.loaded_texture[tile].size_bytes / rdp.texture_tile.line_size_bytes;
 
-    import_texture_finish(rgba32_buf, tile, width, height);
+    import_texture_finish(rgba32, tile, width, height);
 }
 
 static void import_texture(int tile) {
@@ -669,9 +1246,16 @@ static void gfx_matrix_mul(float res[4][4], const float a[4][4], const float b[4
     memcpy(res, tmp, sizeof(tmp));
 }
 
+// Per frame, emitted at the end of gfx_run
+static struct {
+    uint32_t float_passthrough; // matrices used as the game built them, no fixed point conversions
+    uint32_t redundant_loads; // modelview loads of the matrix that was already on top
+} mtx_stats;
+
 static void gfx_sp_matrix(uint8_t parameters, const int32_t *addr) {
-    float matrix[4][4];
+    gfx_capture_region(addr, sizeof(Mtx));
 #ifndef GBI_FLOATS
+    float matrix[4][4];
     // Original GBI where fixed point matrices are used
     for (int i = 0; i < 4; i++) {
         for (int j = 0; j < 4; j += 2) {
@@ -682,23 +1266,33 @@ static void gfx_sp_matrix(uint8_t parameters, const int32_t *addr) {
         }
     }
 #else
-    // For a modified GBI where fixed point values are replaced with floats
-    memcpy(matrix, addr, sizeof(matrix));
+    // For a modified GBI where fixed point values are replaced with floats. The
+    // Mtx is the geo processor's float matrix as is, so it is read in place.
+    const float (*matrix)[4] = (const float (*)[4])addr;
+    mtx_stats.float_passthrough++;
 #endif
     
     if (parameters & G_MTX_PROJECTION) {
         if (parameters & G_MTX_LOAD) {
-            memcpy(rsp.P_matrix, matrix, sizeof(matrix));
+            memcpy(rsp.P_matrix, matrix, sizeof(rsp.P_matrix));
         } else {
             gfx_matrix_mul(rsp.P_matrix, matrix, rsp.P_matrix);
         }
     } else { // G_MTX_MODELVIEW
+        float (*top)[4] = rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1];
+        if ((parameters & (G_MTX_PUSH | G_MTX_LOAD)) == G_MTX_LOAD && memcmp(top, matrix, sizeof(rsp.MP_matrix)) == 0) {
+            // The master lists load the same transform for every display list
+            // of a node, MP_matrix is already up to date for it
+            mtx_stats.redundant_loads++;
+            rsp.lights_changed = 1;
+            return;
+        }
         if ((parameters & G_MTX_PUSH) && rsp.modelview_matrix_stack_size < 11) {
             ++rsp.modelview_matrix_stack_size;
-            memcpy(rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1], rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 2], sizeof(matrix));
+            memcpy(rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1], rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 2], sizeof(rsp.MP_matrix));
         }
         if (parameters & G_MTX_LOAD) {
-            memcpy(rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1], matrix, sizeof(matrix));
+            memcpy(rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1], matrix, sizeof(rsp.MP_matrix));
         } else {
             gfx_matrix_mul(rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1], matrix, rsp.modelview_matrix_stack[rsp.modelview_matrix_stack_size - 1]);
         }
@@ -722,109 +1316,653 @@ static float gfx_adjust_x_for_aspect_ratio(float x) {
     return x * (4.0f / 3.0f) / ((float)gfx_current_dimensions.width / (float)gfx_current_dimensions.height);
 }
 
-static void gfx_sp_vertex(size_t n_vertices, size_t dest_index, const Vtx *vertices) {
+// MP_matrix with the aspect ratio fixup and the depth range folded in, for the
+// shaders that transform object space positions themselves
+static void gfx_calc_mvp(float mvp[4][4]) {
+    float x_scale = (4.0f / 3.0f) / ((float)gfx_current_dimensions.width / (float)gfx_current_dimensions.height);
+    bool z_is_from_0_to_1 = gfx_rapi->z_is_from_0_to_1();
+    for (int i = 0; i < 4; i++) {
+        mvp[i][0] = rsp.MP_matrix[i][0] * x_scale;
+        mvp[i][1] = rsp.MP_matrix[i][1];
+        mvp[i][2] = z_is_from_0_to_1 ? (rsp.MP_matrix[i][2] + rsp.MP_matrix[i][3]) / 2.0f : rsp.MP_matrix[i][2];
+        mvp[i][3] = rsp.MP_matrix[i][3];
+    }
+}
+
+static void gfx_vertex_tex_coords(const Vtx *vertex, struct LoadedVertex *d) {
+    const Vtx_t *v = &vertex->v;
+    const Vtx_tn *vn = &vertex->n;
+    short U = v->tc[0] * rsp.texture_scaling_factor.s >> 16;
+    short V = v->tc[1] * rsp.texture_scaling_factor.t >> 16;
+    
+    if ((rsp.geometry_mode & (G_LIGHTING | G_TEXTURE_GEN)) == (G_LIGHTING | G_TEXTURE_GEN)) {
+        float dotx = 0, doty = 0;
+        dotx += vn->n[0] * rsp.current_lookat_coeffs[0][0];
+        dotx += vn->n[1] * rsp.current_lookat_coeffs[0][1];
+        dotx += vn->n[2] * rsp.current_lookat_coeffs[0][2];
+        doty += vn->n[0] * rsp.current_lookat_coeffs[1][0];
+        doty += vn->n[1] * rsp.current_lookat_coeffs[1][1];
+        doty += vn->n[2] * rsp.current_lookat_coeffs[1][2];
+        
+        U = (int32_t)((dotx / 127.0f + 1.0f) / 4.0f * rsp.texture_scaling_factor.s);
+        V = (int32_t)((doty / 127.0f + 1.0f) / 4.0f * rsp.texture_scaling_factor.t);
+    }
+    
+    d->u = U;
+    d->v = V;
+}
+
+// Hardware T&L: the vertices are kept as they are, the state they are lit and
+// transformed with goes to the shaders instead. The shade masks are left alone,
+// they come from the combiner in gfx_sp_tri1.
+static void gfx_tnl_sp_vertex(size_t n_vertices, size_t dest_index, const Vtx *vertices) {
+    struct GfxTnlState *s = &tnl.loaded;
+    gfx_calc_mvp(s->mvp);
+    memset(s->light_dirs, 0, sizeof(s->light_dirs));
+    memset(s->light_colors, 0, sizeof(s->light_colors));
+    memset(s->ambient_color, 0, sizeof(s->ambient_color));
+    s->num_lights = -1;
+    if (rsp.geometry_mode & G_LIGHTING) {
+        int num_lights = rsp.current_num_lights - 1;
+        if (num_lights > MAX_LIGHTS) {
+            num_lights = MAX_LIGHTS;
+        }
+        for (int i = 0; i < num_lights; i++) {
+            for (int j = 0; j < 3; j++) {
+                s->light_dirs[i][j] = rsp.current_lights_coeffs[i][j];
+                s->light_colors[i][j] = rsp.current_lights[i].col[j];
+            }
+        }
+        for (int j = 0; j < 3; j++) {
+            s->ambient_color[j] = rsp.current_lights[rsp.current_num_lights - 1].col[j];
+        }
+        s->num_lights = num_lights;
+    }
+    s->fog = (rsp.geometry_mode & G_FOG) != 0;
+    s->fog_mul = s->fog ? rsp.fog_mul : 0.0f;
+    s->fog_offset = s->fog ? rsp.fog_offset : 0.0f;
+    
     for (size_t i = 0; i < n_vertices; i++, dest_index++) {
         const Vtx_t *v = &vertices[i].v;
-        const Vtx_tn *vn = &vertices[i].n;
         struct LoadedVertex *d = &rsp.loaded_vertices[dest_index];
         
-        float x = v->ob[0] * rsp.MP_matrix[0][0] + v->ob[1] * rsp.MP_matrix[1][0] + v->ob[2] * rsp.MP_matrix[2][0] + rsp.MP_matrix[3][0];
-        float y = v->ob[0] * rsp.MP_matrix[0][1] + v->ob[1] * rsp.MP_matrix[1][1] + v->ob[2] * rsp.MP_matrix[2][1] + rsp.MP_matrix[3][1];
-        float z = v->ob[0] * rsp.MP_matrix[0][2] + v->ob[1] * rsp.MP_matrix[1][2] + v->ob[2] * rsp.MP_matrix[2][2] + rsp.MP_matrix[3][2];
-        float w = v->ob[0] * rsp.MP_matrix[0][3] + v->ob[1] * rsp.MP_matrix[1][3] + v->ob[2] * rsp.MP_matrix[2][3] + rsp.MP_matrix[3][3];
-        
-        x = gfx_adjust_x_for_aspect_ratio(x);
+        gfx_vertex_tex_coords(&vertices[i], d);
+        d->retained_owner = NULL;
+        d->ob[0] = v->ob[0];
+        d->ob[1] = v->ob[1];
+        d->ob[2] = v->ob[2];
+        // Color, or normal with G_LIGHTING, the shader sorts it out
+        d->color.r = v->cn[0];
+        d->color.g = v->cn[1];
+        d->color.b = v->cn[2];
+        d->color.a = v->cn[3];
+        d->clip_rej = 0;
+    }
+}
+
+// Hardware T&L leaves the loaded vertices in object space. The few things that
+// need them in clip space (G_CULLDL, the LOD fraction) transform them here.
+static void gfx_tnl_transform_loaded(size_t start, size_t end) {
+    static Vtx vertices[GFX_VERTEX_BATCH_MAX];
+    static struct GfxVertexBatch batch;
+    
+    struct GfxVertexBatchParams params = {
+        .mp_matrix = (const float (*)[4])rsp.MP_matrix,
+        .aspect_ratio = (float)gfx_current_dimensions.width / (float)gfx_current_dimensions.height,
+        .fog = false
+    };
+    size_t n = end - start + 1;
+    for (size_t i = 0; i < n; i++) {
+        for (int j = 0; j < 3; j++) {
+            vertices[i].v.ob[j] = rsp.loaded_vertices[start + i].ob[j];
+        }
+    }
+    gfx_vertex_batch_transform(vertices, n, &params, &batch);
+    for (size_t i = 0; i < n; i++) {
+        struct LoadedVertex *d = &rsp.loaded_vertices[start + i];
+        d->x = batch.x[i];
+        d->y = batch.y[i];
+        d->z = batch.z[i];
+        d->w = batch.w[i];
+        d->clip_rej = batch.clip_rej[i];
+    }
+}
+
+static void gfx_sp_vertex(size_t n_vertices, size_t dest_index, const Vtx *vertices) {
+    static struct GfxVertexBatch batch;
+    
+    gfx_capture_region(vertices, n_vertices * sizeof(Vtx));
+    ProfEmitEventStart("gfx_sp_vertex");
+    
+    if ((rsp.geometry_mode & G_LIGHTING) && rsp.lights_changed) {
+        for (int i = 0; i < rsp.current_num_lights - 1; i++) {
+            calculate_normal_dir(&rsp.current_lights[i], rsp.current_lights_coeffs[i]);
+        }
+        static const Light_t lookat_x = {{0, 0, 0}, 0, {0, 0, 0}, 0, {127, 0, 0}, 0};
+        static const Light_t lookat_y = {{0, 0, 0}, 0, {0, 0, 0}, 0, {0, 127, 0}, 0};
+        calculate_normal_dir(&lookat_x, rsp.current_lookat_coeffs[0]);
+        calculate_normal_dir(&lookat_y, rsp.current_lookat_coeffs[1]);
+        rsp.lights_changed = false;
+    }
+    
+    if (tnl.enabled) {
+        gfx_tnl_sp_vertex(n_vertices, dest_index, vertices);
+        ProfEmitEventEnd("gfx_sp_vertex");
+        return;
+    }
+    
+    struct GfxVertexBatchParams params = {
+        .mp_matrix = (const float (*)[4])rsp.MP_matrix,
+        .aspect_ratio = (float)gfx_current_dimensions.width / (float)gfx_current_dimensions.height,
+        .fog = (rsp.geometry_mode & G_FOG) != 0,
+        .fog_mul = rsp.fog_mul,
+        .fog_offset = rsp.fog_offset
+    };
+    
+    while (n_vertices > 0) {
+        size_t n = n_vertices < GFX_VERTEX_BATCH_MAX ? n_vertices : GFX_VERTEX_BATCH_MAX;
         
-        short U = v->tc[0] * rsp.texture_scaling_factor.s >> 16;
-        short V = v->tc[1] * rsp.texture_scaling_factor.t >> 16;
+        // Position, clip codes and fog go through the vector kernels, the rest stays per vertex.
+        gfx_vertex_batch_transform(vertices, n, &params, &batch);
         
-        if (rsp.geometry_mode & G_LIGHTING) {
-            if (rsp.lights_changed) {
+        for (size_t i = 0; i < n; i++, dest_index++) {
+            const Vtx_t *v = &vertices[i].v;
+            const Vtx_tn *vn = &vertices[i].n;
+            struct LoadedVertex *d = &rsp.loaded_vertices[dest_index];
+            
+            gfx_vertex_tex_coords(&vertices[i], d);
+            d->retained_owner = NULL;
+            
+            if (rsp.geometry_mode & G_LIGHTING) {
+                int r = rsp.current_lights[rsp.current_num_lights - 1].col[0];
+                int g = rsp.current_lights[rsp.current_num_lights - 1].col[1];
+                int b = rsp.current_lights[rsp.current_num_lights - 1].col[2];
+                
                 for (int i = 0; i < rsp.current_num_lights - 1; i++) {
-                    calculate_normal_dir(&rsp.current_lights[i], rsp.current_lights_coeffs[i]);
+                    float intensity = 0;
+                    intensity += vn->n[0] * rsp.current_lights_coeffs[i][0];
+                    intensity += vn->n[1] * rsp.current_lights_coeffs[i][1];
+                    intensity += vn->n[2] * rsp.current_lights_coeffs[i][2];
+                    intensity /= 127.0f;
+                    if (intensity > 0.0f) {
+                        r += intensity * rsp.current_lights[i].col[0];
+                        g += intensity * rsp.current_lights[i].col[1];
+                        b += intensity * rsp.current_lights[i].col[2];
+                    }
                 }
-                static const Light_t lookat_x = {{0, 0, 0}, 0, {0, 0, 0}, 0, {127, 0, 0}, 0};
-                static const Light_t lookat_y = {{0, 0, 0}, 0, {0, 0, 0}, 0, {0, 127, 0}, 0};
-                calculate_normal_dir(&lookat_x, rsp.current_lookat_coeffs[0]);
-                calculate_normal_dir(&lookat_y, rsp.current_lookat_coeffs[1]);
-                rsp.lights_changed = false;
+                
+                d->color.r = r > 255 ? 255 : r;
+                d->color.g = g > 255 ? 255 : g;
+                d->color.b = b > 255 ? 255 : b;
+            } else {
+                d->color.r = v->cn[0];
+                d->color.g = v->cn[1];
+                d->color.b = v->cn[2];
             }
             
-            int r = rsp.current_lights[rsp.current_num_lights - 1].col[0];
-            int g = rsp.current_lights[rsp.current_num_lights - 1].col[1];
-            int b = rsp.current_lights[rsp.current_num_lights - 1].col[2];
-            
-            for (int i = 0; i < rsp.current_num_lights - 1; i++) {
-                float intensity = 0;
-                intensity += vn->n[0] * rsp.current_lights_coeffs[i][0];
-                intensity += vn->n[1] * rsp.current_lights_coeffs[i][1];
-                intensity += vn->n[2] * rsp.current_lights_coeffs[i][2];
-                intensity /= 127.0f;
-                if (intensity > 0.0f) {
-                    r += intensity * rsp.current_lights[i].col[0];
-                    g += intensity * rsp.current_lights[i].col[1];
-                    b += intensity * rsp.current_lights[i].col[2];
-                }
+            if (retained.recording != NULL) {
+                d->ob[0] = v->ob[0];
+                d->ob[1] = v->ob[1];
+                d->ob[2] = v->ob[2];
+                d->retained_generation = retained.generation;
             }
             
-            d->color.r = r > 255 ? 255 : r;
-            d->color.g = g > 255 ? 255 : g;
-            d->color.b = b > 255 ? 255 : b;
+            d->clip_rej = batch.clip_rej[i];
+            d->x = batch.x[i];
+            d->y = batch.y[i];
+            d->z = batch.z[i];
+            d->w = batch.w[i];
             
-            if (rsp.geometry_mode & G_TEXTURE_GEN) {
-                float dotx = 0, doty = 0;
-                dotx += vn->n[0] * rsp.current_lookat_coeffs[0][0];
-                dotx += vn->n[1] * rsp.current_lookat_coeffs[0][1];
-                dotx += vn->n[2] * rsp.current_lookat_coeffs[0][2];
-                doty += vn->n[0] * rsp.current_lookat_coeffs[1][0];
-                doty += vn->n[1] * rsp.current_lookat_coeffs[1][1];
-                doty += vn->n[2] * rsp.current_lookat_coeffs[1][2];
-                
-                U = (int32_t)((dotx / 127.0f + 1.0f) / 4.0f * rsp.texture_scaling_factor.s);
-                V = (int32_t)((doty / 127.0f + 1.0f) / 4.0f * rsp.texture_scaling_factor.t);
+            if (params.fog) {
+                d->color.a = batch.fog_z[i]; // Use alpha variable to store fog factor
+            } else {
+                d->color.a = v->cn[3];
             }
-        } else {
-            d->color.r = v->cn[0];
-            d->color.g = v->cn[1];
-            d->color.b = v->cn[2];
         }
         
-        d->u = U;
-        d->v = V;
-        
-        // trivial clip rejection
-        d->clip_rej = 0;
-        if (x < -w) d->clip_rej |= 1;
-        if (x > w) d->clip_rej |= 2;
-        if (y < -w) d->clip_rej |= 4;
-        if (y > w) d->clip_rej |= 8;
-        if (z < -w) d->clip_rej |= 16;
-        if (z > w) d->clip_rej |= 32;
+        vertices += n;
+        n_vertices -= n;
+    }
+    
+    ProfEmitEventEnd("gfx_sp_vertex");
+}
+
+// With deferred draws these only track the state, gfx_deferred_submit applies it.
+static void gfx_update_depth_state(bool depth_test, bool z_upd, bool zmode_decal) {
+    if (depth_test != rendering_state.depth_test) {
+        gfx_flush();
+        if (!deferred.enabled) gfx_rapi->set_depth_test(depth_test);
+        rendering_state.depth_test = depth_test;
+    }
+    
+    if (z_upd != rendering_state.depth_mask) {
+        gfx_flush();
+        if (!deferred.enabled) gfx_rapi->set_depth_mask(z_upd);
+        rendering_state.depth_mask = z_upd;
+    }
+    
+    if (zmode_decal != rendering_state.decal_mode) {
+        gfx_flush();
+        if (!deferred.enabled) gfx_rapi->set_zmode_decal(zmode_decal);
+        rendering_state.decal_mode = zmode_decal;
+    }
+}
+
+static void gfx_update_viewport_and_scissor(void) {
+    if (rdp.viewport_or_scissor_changed) {
+        if (memcmp(&rdp.viewport, &rendering_state.viewport, sizeof(rdp.viewport)) != 0) {
+            gfx_flush();
+            if (!deferred.enabled) gfx_rapi->set_viewport(rdp.viewport.x, rdp.viewport.y, rdp.viewport.width, rdp.viewport.height);
+            rendering_state.viewport = rdp.viewport;
+        }
+        if (memcmp(&rdp.scissor, &rendering_state.scissor, sizeof(rdp.scissor)) != 0) {
+            gfx_flush();
+            if (!deferred.enabled) gfx_rapi->set_scissor(rdp.scissor.x, rdp.scissor.y, rdp.scissor.width, rdp.scissor.height);
+            rendering_state.scissor = rdp.scissor;
+        }
+        rdp.viewport_or_scissor_changed = false;
+    }
+}
+
+static void gfx_update_shader_program(struct ShaderProgram *prg) {
+    if (prg != rendering_state.shader_program) {
+        gfx_flush();
+        if (!deferred.enabled) {
+            gfx_rapi->unload_shader(rendering_state.shader_program);
+            gfx_rapi->load_shader(prg);
+        }
+        rendering_state.shader_program = prg;
+    }
+}
+
+static void gfx_update_alpha_blend(bool use_alpha) {
+    if (use_alpha != rendering_state.alpha_blend) {
+        gfx_flush();
+        if (!deferred.enabled) gfx_rapi->set_use_alpha(use_alpha);
+        rendering_state.alpha_blend = use_alpha;
+    }
+}
+
+// Streamed triangles are culled on the CPU, so the GPU only culls retained ones.
+static void gfx_update_cull_mode(uint32_t cull_mode) {
+    if (cull_mode != rendering_state.cull_mode) {
+        gfx_flush();
+        if (!deferred.enabled) gfx_rapi->set_cull_mode((cull_mode & G_CULL_FRONT) != 0, (cull_mode & G_CULL_BACK) != 0);
+        rendering_state.cull_mode = cull_mode;
+    }
+}
+
+static void gfx_update_sampler(int tile, bool linear_filter, uint8_t cms, uint8_t cmt) {
+#ifdef USE_TEXTURE_ATLAS
+    if (rendering_state.linear_filter[tile] != linear_filter) {
+        gfx_flush();
+        if (!deferred.enabled) gfx_rapi->set_sampler_parameters(tile, linear_filter, cms, cmt);
+        rendering_state.linear_filter[tile] = linear_filter;
+    }
+#endif
+
+    if (linear_filter != rendering_state.textures[tile]->linear_filter || cms != rendering_state.textures[tile]->cms || cmt != rendering_state.textures[tile]->cmt) {
+#ifndef USE_TEXTURE_ATLAS
+        gfx_flush();
+        if (!deferred.enabled) gfx_rapi->set_sampler_parameters(tile, linear_filter, cms, cmt);
+#endif
+        rendering_state.textures[tile]->linear_filter = linear_filter;
+        rendering_state.textures[tile]->cms = cms;
+        rendering_state.textures[tile]->cmt = cmt;
+    }
+}
+
+static void gfx_deferred_apply_state(const struct DeferredState *state, bool force) {
+    struct DeferredState *applied = &deferred.applied;
+    
+    if (force || state->depth_test != applied->depth_test) {
+        gfx_rapi->set_depth_test(state->depth_test);
+    }
+    if (force || state->depth_mask != applied->depth_mask) {
+        gfx_rapi->set_depth_mask(state->depth_mask);
+    }
+    if (force || state->decal_mode != applied->decal_mode) {
+        gfx_rapi->set_zmode_decal(state->decal_mode);
+    }
+    if (force || memcmp(&state->viewport, &applied->viewport, sizeof(state->viewport)) != 0) {
+        gfx_rapi->set_viewport(state->viewport.x, state->viewport.y, state->viewport.width, state->viewport.height);
+    }
+    if (force || memcmp(&state->scissor, &applied->scissor, sizeof(state->scissor)) != 0) {
+        gfx_rapi->set_scissor(state->scissor.x, state->scissor.y, state->scissor.width, state->scissor.height);
+    }
+    if (force || state->prg != deferred.bound_prg) {
+        gfx_rapi->unload_shader(deferred.bound_prg);
+        gfx_rapi->load_shader(state->prg);
+        deferred.bound_prg = state->prg;
+    }
+    if (force || state->alpha_blend != applied->alpha_blend) {
+        gfx_rapi->set_use_alpha(state->alpha_blend);
+    }
+    if ((force || state->cull_mode != applied->cull_mode) && gfx_rapi->set_cull_mode != NULL) {
+        gfx_rapi->set_cull_mode((state->cull_mode & G_CULL_FRONT) != 0, (state->cull_mode & G_CULL_BACK) != 0);
+    }
+    for (int i = 0; i < 2; i++) {
+        if (!state->used_textures[i]) {
+            continue;
+        }
+#ifdef USE_TEXTURE_ATLAS
+        bool sampler_changed = state->linear_filter[i] != applied->linear_filter[i];
+        if (force || state->atlas_page[i] != applied->atlas_page[i]) {
+            gfx_rapi->bind_virtual_texture_page(i, state->atlas_page[i]);
+            // Filtering belongs to the page texture, so it has to be set again
+            sampler_changed = true;
+        }
+        if (force || sampler_changed) {
+            gfx_rapi->set_sampler_parameters(i, state->linear_filter[i], 0, 0);
+            if (applied->atlas_page[i ^ 1] == state->atlas_page[i]) {
+                // Changes what the other tile sees too
+                applied->linear_filter[i ^ 1] = state->linear_filter[i];
+            }
+        }
+        applied->atlas_page[i] = state->atlas_page[i];
+        applied->linear_filter[i] = state->linear_filter[i];
+#else
+        struct TextureHashmapNode *node = state->textures[i];
+        bool sampler_changed = state->linear_filter[i] != applied->linear_filter[i] || state->cms[i] != applied->cms[i] || state->cmt[i] != applied->cmt[i];
+        if (force || node != applied->textures[i]) {
+            gfx_rapi->select_texture(i, node->texture_id);
+            // Sampler parameters belong to the texture, so they have to be set again
+            sampler_changed = true;
+        }
+        if (sampler_changed) {
+            gfx_rapi->set_sampler_parameters(i, state->linear_filter[i], state->cms[i], state->cmt[i]);
+            if (applied->textures[i ^ 1] == node) {
+                // Changes what the other tile sees too
+                applied->textures[i ^ 1] = NULL;
+            }
+        }
+        applied->textures[i] = node;
+        applied->linear_filter[i] = state->linear_filter[i];
+        applied->cms[i] = state->cms[i];
+        applied->cmt[i] = state->cmt[i];
+#endif
+    }
+    
+    applied->depth_test = state->depth_test;
+    applied->depth_mask = state->depth_mask;
+    applied->decal_mode = state->decal_mode;
+    applied->viewport = state->viewport;
+    applied->scissor = state->scissor;
+    applied->prg = state->prg;
+    applied->alpha_blend = state->alpha_blend;
+    applied->cull_mode = state->cull_mode;
+}
+
+// Opaque, depth tested and depth written batches can be drawn in any order
+static bool gfx_deferred_is_sortable(const struct DeferredDraw *d) {
+    return d->state.depth_test && d->state.depth_mask && !d->state.decal_mode && !d->state.alpha_blend;
+}
+
+static int gfx_deferred_compare(const void *a, const void *b) {
+    const struct DeferredDraw *da = (const struct DeferredDraw *)a;
+    const struct DeferredDraw *db = (const struct DeferredDraw *)b;
+    int c = memcmp(&da->state, &db->state, sizeof(da->state));
+    if (c != 0) {
+        return c;
+    }
+    return da->seq < db->seq ? -1 : (da->seq > db->seq ? 1 : 0);
+}
+
+// Draws everything recorded since the last submit. Called at the end of the
+// frame, and before anything the recorded batches depend on gets recycled.
+static void gfx_deferred_submit(void) {
+    if (!deferred.enabled || deferred.num_draws == 0) {
+        return;
+    }
+    ProfEmitEventStart("gfx_deferred_submit");
+    gfx_flush();
+    
+    // Sort each run of reorderable batches, the state struct is the sort key
+    for (size_t i = 0; i < deferred.num_draws;) {
+        size_t j = i;
+        while (j < deferred.num_draws && gfx_deferred_is_sortable(&deferred.draws[j])) {
+            j++;
+        }
+        if (j - i > 1) {
+            qsort(&deferred.draws[i], j - i, sizeof(struct DeferredDraw), gfx_deferred_compare);
+        }
+        i = j + (j == i ? 1 : 0);
+    }
+    
+    // Texture imports and blits touched the API state since the last submit
+    bool force = true;
+    deferred.applied.textures[0] = NULL;
+    deferred.applied.textures[1] = NULL;
+    for (size_t i = 0; i < deferred.num_draws;) {
+        const struct DeferredDraw *d = &deferred.draws[i];
+        gfx_deferred_apply_state(&d->state, force);
+        force = false;
         
-        d->x = x;
-        d->y = y;
-        d->z = z;
-        d->w = w;
+        if (d->buffer_id != 0) {
+            gfx_rapi->draw_static_triangles(d->buffer_id, d->vbo_offset, d->num_tris, deferred.mvps[d->mvp_index]);
+            ProfEmitCounter("gfx_draw_calls", 1);
+            frame_stats.draw_calls++;
+            i++;
+            continue;
+        }
         
-        if (rsp.geometry_mode & G_FOG) {
-            if (fabsf(w) < 0.001f) {
-                // To avoid division by zero
-                w = 0.001f;
+        // Merge consecutive streamed batches with the same state into buf_vbo
+        size_t j = i;
+        while (j < deferred.num_draws) {
+            const struct DeferredDraw *m = &deferred.draws[j];
+            if (m->buffer_id != 0 || (j != i && memcmp(&m->state, &d->state, sizeof(d->state)) != 0)) {
+                break;
             }
-            
-            float winv = 1.0f / w;
-            if (winv < 0.0f) {
-                winv = 32767.0f;
+            if (buf_vbo_len + m->vbo_len > sizeof(buf_vbo) / sizeof(buf_vbo[0]) || buf_vbo_num_tris + m->num_tris > MAX_BUFFERED) {
+                break;
             }
-            
-            float fog_z = z * winv * rsp.fog_mul + rsp.fog_offset;
-            if (fog_z < 0) fog_z = 0;
-            if (fog_z > 255) fog_z = 255;
-            d->color.a = fog_z; // Use alpha variable to store fog factor
+            memcpy(&buf_vbo[buf_vbo_len], &deferred.vbo[m->vbo_offset], m->vbo_len * sizeof(float));
+            for (size_t k = 0; k < m->num_tris * 3 && gfx_use_indexed_vertices; k++) {
+                buf_ibo[buf_ibo_len++] = deferred.ibo[m->ibo_offset + k] + buf_vbo_num_verts;
+            }
+            buf_vbo_len += m->vbo_len;
+            buf_vbo_num_verts += m->num_verts;
+            buf_vbo_num_tris += m->num_tris;
+            j++;
+        }
+        gfx_draw_buffered();
+        buf_vbo_len = 0;
+        buf_vbo_num_tris = 0;
+        buf_vbo_num_verts = 0;
+        buf_ibo_len = 0;
+        i = j;
+    }
+    
+    deferred.num_draws = 0;
+    deferred.vbo_len = 0;
+    deferred.ibo_len = 0;
+    deferred.num_mvps = 0;
+    for (size_t i = 0; i < deferred.num_pending_deletes; i++) {
+        gfx_rapi->delete_static_buffer(deferred.pending_deletes[i]);
+    }
+    deferred.num_pending_deletes = 0;
+    ProfEmitEventEnd("gfx_deferred_submit");
+}
+
+static void gfx_retained_record_triangle(struct ColorCombiner *comb, const bool used_textures[2], struct LoadedVertex *v_arr[3], const float *tri[3], size_t stride) {
+    for (int i = 0; i < 3; i++) {
+        if (v_arr[i]->retained_generation != retained.generation) {
+            // Vertex was loaded before this display list started
+            retained.recording_failed = true;
+            return;
+        }
+    }
+    
+    struct RetainedRenderState state;
+    memset(&state, 0, sizeof(state));
+    state.prg = comb->prg_mvp;
+    state.depth_test = rendering_state.depth_test;
+    state.depth_mask = rendering_state.depth_mask;
+    state.decal_mode = rendering_state.decal_mode;
+    state.alpha_blend = rendering_state.alpha_blend;
+    state.cull_mode = rsp.geometry_mode & G_CULL_BOTH;
+    for (int i = 0; i < 2; i++) {
+        if (used_textures[i]) {
+            state.textures[i] = rendering_state.textures[i];
+            state.linear_filter[i] = (rdp.other_mode_h & (3U << G_MDSFT_TEXTFILT)) != G_TF_POINT;
+            state.cms = rdp.texture_tile.cms;
+            state.cmt = rdp.texture_tile.cmt;
+        }
+    }
+    
+    struct RetainedBatch *batch = retained.num_batches > 0 ? &retained.batches[retained.num_batches - 1] : NULL;
+    if (batch == NULL || memcmp(&batch->state, &state, sizeof(state)) != 0) {
+        if (retained.num_batches == retained.batches_cap) {
+            retained.batches_cap = retained.batches_cap == 0 ? 16 : retained.batches_cap * 2;
+            retained.batches = realloc(retained.batches, retained.batches_cap * sizeof(struct RetainedBatch));
+        }
+        batch = &retained.batches[retained.num_batches++];
+        batch->state = state;
+        batch->buf_vbo_offset = retained.vbo_len;
+        batch->num_tris = 0;
+    }
+    
+    size_t tri_len = stride * 3;
+    if (retained.vbo_len + tri_len > retained.vbo_cap) {
+        while (retained.vbo_len + tri_len > retained.vbo_cap) {
+            retained.vbo_cap = retained.vbo_cap == 0 ? 4096 : retained.vbo_cap * 2;
+        }
+        retained.vbo = realloc(retained.vbo, retained.vbo_cap * sizeof(float));
+    }
+    
+    // Same layout as the streamed triangle, only the position is swapped for the object space one
+    // (whole words in both the float and the packed vertex formats)
+    float *dst = &retained.vbo[retained.vbo_len];
+    for (int i = 0; i < 3; i++) {
+        memcpy(&dst[i * stride], tri[i], stride * sizeof(float));
+        dst[i * stride + 0] = v_arr[i]->ob[0];
+        dst[i * stride + 1] = v_arr[i]->ob[1];
+        dst[i * stride + 2] = v_arr[i]->ob[2];
+        dst[i * stride + 3] = 1.0f;
+    }
+    retained.vbo_len += tri_len;
+    batch->num_tris++;
+}
+
+struct VertexFormat {
+    struct ColorCombiner *comb;
+    bool z_is_from_0_to_1;
+    bool use_texture, used_textures[2];
+    bool linear_filter;
+    uint32_t tex_width, tex_height;
+    bool use_fog, use_alpha;
+    uint8_t num_inputs;
+    struct RGBA lod_color;
+    bool hw_tnl;
+};
+
+static inline void gfx_emit_rgba(uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    uint8_t rgba[4] = {r, g, b, a};
+    memcpy(&buf_vbo[buf_vbo_len++], rgba, sizeof(rgba));
+}
+
+static inline int16_t gfx_pack_tex_coord(float c) {
+    float fixed = c * GFX_PACKED_TEXCOORD_SCALE;
+    if (fixed >= 32767.0f) return 32767;
+    if (fixed <= -32768.0f) return -32768;
+    return (int16_t)(fixed < 0.0f ? fixed - 0.5f : fixed + 0.5f);
+}
+
+static void gfx_emit_vertex(struct LoadedVertex *v, const struct VertexFormat *fmt, bool packed) {
+    if (fmt->hw_tnl) {
+        buf_vbo[buf_vbo_len++] = v->ob[0];
+        buf_vbo[buf_vbo_len++] = v->ob[1];
+        buf_vbo[buf_vbo_len++] = v->ob[2];
+        buf_vbo[buf_vbo_len++] = 1.0f;
+    } else {
+        float z = v->z, w = v->w;
+        if (fmt->z_is_from_0_to_1) {
+            z = (z + w) / 2.0f;
+        }
+        buf_vbo[buf_vbo_len++] = v->x;
+        buf_vbo[buf_vbo_len++] = v->y;
+        buf_vbo[buf_vbo_len++] = z;
+        buf_vbo[buf_vbo_len++] = w;
+    }
+    
+    if (fmt->use_texture) {
+        float u = (v->u - rdp.texture_tile.uls * 8) / 32.0f;
+        float t = (v->v - rdp.texture_tile.ult * 8) / 32.0f;
+        if (fmt->linear_filter) {
+            // Linear filter adds 0.5f to the coordinates
+            u += 0.5f;
+            t += 0.5f;
+        }
+        if (packed) {
+            int16_t st[2] = {gfx_pack_tex_coord(u / fmt->tex_width), gfx_pack_tex_coord(t / fmt->tex_height)};
+            memcpy(&buf_vbo[buf_vbo_len++], st, sizeof(st));
+        } else {
+            buf_vbo[buf_vbo_len++] = u / fmt->tex_width;
+            buf_vbo[buf_vbo_len++] = t / fmt->tex_height;
+        }
+#ifdef USE_TEXTURE_ATLAS
+        for (int j = 0; j < 2; j++) {
+            if (fmt->used_textures[j]) {
+                buf_vbo[buf_vbo_len++] = rendering_state.textures[j]->enc_sampler_params[0].value;
+                buf_vbo[buf_vbo_len++] = rendering_state.textures[j]->enc_sampler_params[1].value;
+            }
+        }
+#endif
+    }
+    
+    if (fmt->use_fog) {
+        if (packed) {
+            gfx_emit_rgba(rdp.fog_color.r, rdp.fog_color.g, rdp.fog_color.b, v->color.a); // fog factor (not alpha)
+        } else {
+            buf_vbo[buf_vbo_len++] = rdp.fog_color.r / 255.0f;
+            buf_vbo[buf_vbo_len++] = rdp.fog_color.g / 255.0f;
+            buf_vbo[buf_vbo_len++] = rdp.fog_color.b / 255.0f;
+            buf_vbo[buf_vbo_len++] = v->color.a / 255.0f; // fog factor (not alpha)
+        }
+    }
+    
+    for (int j = 0; j < fmt->num_inputs; j++) {
+        const struct RGBA *colors[2];
+        for (int k = 0; k < 1 + (fmt->use_alpha ? 1 : 0); k++) {
+            switch (fmt->comb->shader_input_mapping[k][j]) {
+                case CC_PRIM:
+                    colors[k] = &rdp.prim_color;
+                    break;
+                case CC_SHADE:
+                    colors[k] = &v->color;
+                    break;
+                case CC_ENV:
+                    colors[k] = &rdp.env_color;
+                    break;
+                case CC_LOD:
+                    colors[k] = &fmt->lod_color;
+                    break;
+                default:
+                    colors[k] = &zero_color;
+                    break;
+            }
+        }
+        uint8_t alpha = 255;
+        if (fmt->use_alpha && !(fmt->use_fog && colors[1] == &v->color)) {
+            // Shade alpha is 100% for fog
+            alpha = colors[1]->a;
+        }
+        if (packed) {
+            gfx_emit_rgba(colors[0]->r, colors[0]->g, colors[0]->b, alpha);
         } else {
-            d->color.a = v->cn[3];
+            buf_vbo[buf_vbo_len++] = colors[0]->r / 255.0f;
+            buf_vbo[buf_vbo_len++] = colors[0]->g / 255.0f;
+            buf_vbo[buf_vbo_len++] = colors[0]->b / 255.0f;
+            if (fmt->use_alpha) {
+                buf_vbo[buf_vbo_len++] = alpha / 255.0f;
+            }
         }
     }
+    
+    if (fmt->hw_tnl) {
+        // Shade inputs above are placeholders, the shader swaps in the lit color
+        gfx_emit_rgba(v->color.r, v->color.g, v->color.b, v->color.a);
+    }
 }
 
 static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx) {
@@ -835,12 +1973,36 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx) {
     
     //if (rand()%2) return;
     
-    if (v1->clip_rej & v2->clip_rej & v3->clip_rej) {
-        // The whole triangle lies outside the visible area
+    if (retained.reloading) {
         return;
     }
+    for (int i = 0; i < 3; i++) {
+        if (v_arr[i]->retained_owner != NULL) {
+            gfx_retained_vertex_used(v_arr[i]);
+        }
+    }
+    
+    // Rectangles are always drawn in screen space
+    bool hw_tnl = tnl.enabled && vtx1_idx < MAX_VERTICES;
+    
+    // Triangles that are invisible right now still go into a recording,
+    // since the next replay may well be seen from another angle.
+    bool culled = false;
+    
+    if (hw_tnl) {
+        // Clip space positions only exist on the GPU, so it clips and culls
+        if ((rsp.geometry_mode & G_CULL_BOTH) == G_CULL_BOTH) {
+            return;
+        }
+    } else if (v1->clip_rej & v2->clip_rej & v3->clip_rej) {
+        // The whole triangle lies outside the visible area
+        if (retained.recording == NULL) {
+            return;
+        }
+        culled = true;
+    }
     
-    if ((rsp.geometry_mode & G_CULL_BOTH) != 0) {
+    if (!hw_tnl && (rsp.geometry_mode & G_CULL_BOTH) != 0) {
         float dx1 = v1->x / (v1->w) - v2->x / (v2->w);
         float dy1 = v1->y / (v1->w) - v2->y / (v2->w);
         float dx2 = v3->x / (v3->w) - v2->x / (v2->w);
@@ -855,89 +2017,81 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx) {
         
         switch (rsp.geometry_mode & G_CULL_BOTH) {
             case G_CULL_FRONT:
-                if (cross <= 0) return;
+                if (cross <= 0) culled = true;
                 break;
             case G_CULL_BACK:
-                if (cross >= 0) return;
+                if (cross >= 0) culled = true;
                 break;
             case G_CULL_BOTH:
                 // Why is this even an option?
                 return;
         }
-    }
-    
-    bool depth_test = (rsp.geometry_mode & G_ZBUFFER) == G_ZBUFFER;
-    if (depth_test != rendering_state.depth_test) {
-        gfx_flush();
-        gfx_rapi->set_depth_test(depth_test);
-        rendering_state.depth_test = depth_test;
-    }
-    
-    bool z_upd = (rdp.other_mode_l & Z_UPD) == Z_UPD;
-    if (z_upd != rendering_state.depth_mask) {
-        gfx_flush();
-        gfx_rapi->set_depth_mask(z_upd);
-        rendering_state.depth_mask = z_upd;
-    }
-    
-    bool zmode_decal = (rdp.other_mode_l & ZMODE_DEC) == ZMODE_DEC;
-    if (zmode_decal != rendering_state.decal_mode) {
-        gfx_flush();
-        gfx_rapi->set_zmode_decal(zmode_decal);
-        rendering_state.decal_mode = zmode_decal;
-    }
-    
-    if (rdp.viewport_or_scissor_changed) {
-        if (memcmp(&rdp.viewport, &rendering_state.viewport, sizeof(rdp.viewport)) != 0) {
-            gfx_flush();
-            gfx_rapi->set_viewport(rdp.viewport.x, rdp.viewport.y, rdp.viewport.width, rdp.viewport.height);
-            rendering_state.viewport = rdp.viewport;
-        }
-        if (memcmp(&rdp.scissor, &rendering_state.scissor, sizeof(rdp.scissor)) != 0) {
-            gfx_flush();
-            gfx_rapi->set_scissor(rdp.scissor.x, rdp.scissor.y, rdp.scissor.width, rdp.scissor.height);
-            rendering_state.scissor = rdp.scissor;
+        if (culled && retained.recording == NULL) {
+            return;
         }
-        rdp.viewport_or_scissor_changed = false;
     }
     
-    uint32_t cc_id = rdp.combine_mode;
-    
-    bool use_alpha = (rdp.other_mode_l & (G_BL_A_MEM << 18)) == 0;
-    bool use_fog = (rdp.other_mode_l >> 30) == G_BL_CLR_FOG;
-    bool texture_edge = (rdp.other_mode_l & CVG_X_ALPHA) == CVG_X_ALPHA;
-    bool use_noise = (rdp.other_mode_l & G_AC_DITHER) == G_AC_DITHER;
-    
-    if (texture_edge) {
-        use_alpha = true;
+    bool depth_test = (rsp.geometry_mode & G_ZBUFFER) == G_ZBUFFER;
+    bool z_upd = (rdp.other_mode_l & Z_UPD) == Z_UPD;
+    bool zmode_decal = (rdp.other_mode_l & ZMODE_DEC) == ZMODE_DEC;
+    gfx_update_depth_state(depth_test, z_upd, zmode_decal);
+    gfx_update_viewport_and_scissor();
+    if (hw_tnl) {
+        gfx_update_cull_mode(rsp.geometry_mode & G_CULL_BOTH);
+    } else if (rendering_state.cull_mode != 0) {
+        gfx_update_cull_mode(0);
     }
     
-    if (use_alpha) cc_id |= SHADER_OPT_ALPHA;
-    if (use_fog) cc_id |= SHADER_OPT_FOG;
-    if (texture_edge) cc_id |= SHADER_OPT_TEXTURE_EDGE;
-    if (use_noise) cc_id |= SHADER_OPT_NOISE;
-    
-    if (!use_alpha) {
-        cc_id &= ~0xfff000;
-    }
+    uint32_t cc_id = gfx_cc_id(rdp.combine_mode, rdp.other_mode_l);
+    bool use_alpha = (cc_id & SHADER_OPT_ALPHA) != 0;
+    bool use_fog = (cc_id & SHADER_OPT_FOG) != 0;
     
     struct ColorCombiner *comb = gfx_lookup_or_create_color_combiner(cc_id);
-    struct ShaderProgram *prg = comb->prg;
-    if (prg != rendering_state.shader_program) {
-        gfx_flush();
-        gfx_rapi->unload_shader(rendering_state.shader_program);
-        gfx_rapi->load_shader(prg);
-        rendering_state.shader_program = prg;
+    
+    if (retained.recording != NULL && !retained.recording_failed) {
+        // Lighting, fog and LOD all depend on where the camera is, so they can't be baked
+        bool view_dependent = (rsp.geometry_mode & (G_LIGHTING | G_FOG)) != 0 || use_fog;
+        for (int i = 0; i < 4; i++) {
+            if (comb->shader_input_mapping[0][i] == CC_LOD || comb->shader_input_mapping[1][i] == CC_LOD) {
+                view_dependent = true;
+            }
+        }
+        if (view_dependent) {
+            retained.recording_failed = true;
+        } else if (comb->prg_mvp == NULL) {
+            // Creating a program binds it, so get the streamed triangles out of the way first
+            gfx_flush();
+            comb->prg_mvp = gfx_lookup_or_create_shader_program(comb->shader_id | SHADER_OPT_MVP);
+        }
     }
-    if (use_alpha != rendering_state.alpha_blend) {
+    
+    if (hw_tnl && comb->prg_tnl == NULL) {
         gfx_flush();
-        gfx_rapi->set_use_alpha(use_alpha);
-        rendering_state.alpha_blend = use_alpha;
+        comb->prg_tnl = gfx_lookup_or_create_shader_program(comb->shader_id | SHADER_OPT_MVP | SHADER_OPT_TNL);
     }
+    
+    struct ShaderProgram *prg = hw_tnl ? comb->prg_tnl : comb->prg;
+    gfx_update_shader_program(prg);
+    gfx_update_alpha_blend(use_alpha);
     uint8_t num_inputs;
     bool used_textures[2];
     gfx_rapi->shader_get_info(prg, &num_inputs, used_textures);
     
+    if (hw_tnl) {
+        for (int i = 0; i < 4; i++) {
+            tnl.loaded.shade_rgb[i] = comb->shader_input_mapping[0][i] == CC_SHADE;
+            // Shade alpha is 100% for fog, see gfx_emit_vertex
+            tnl.loaded.shade_alpha[i] = use_alpha && !use_fog && comb->shader_input_mapping[1][i] == CC_SHADE;
+        }
+        if (!tnl.applied_valid || memcmp(&tnl.loaded, &tnl.applied, sizeof(tnl.applied)) != 0) {
+            gfx_flush();
+            memcpy(&tnl.applied, &tnl.loaded, sizeof(tnl.applied));
+            tnl.applied_valid = true;
+            gfx_rapi->set_tnl_state(&tnl.applied);
+            ProfEmitCounter("tnl_state_changes", 1);
+        }
+    }
+    
     for (int i = 0; i < 2; i++) {
         if (used_textures[i]) {
             if (rdp.textures_changed[i]) {
@@ -947,118 +2101,95 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx) {
                 import_texture(i);
                 rdp.textures_changed[i] = false;
             }
-            bool linear_filter = (rdp.other_mode_h & (3U << G_MDSFT_TEXTFILT)) != G_TF_POINT;
-
 #ifdef USE_TEXTURE_ATLAS
-            if (rendering_state.linear_filter[i] != linear_filter) {
-                gfx_flush();
-                gfx_rapi->set_sampler_parameters(i, linear_filter, rdp.texture_tile.cms, rdp.texture_tile.cmt);
-                rendering_state.linear_filter[i] = linear_filter;
-            }
-#endif
-
-            if (linear_filter != rendering_state.textures[i]->linear_filter || rdp.texture_tile.cms != rendering_state.textures[i]->cms || rdp.texture_tile.cmt != rendering_state.textures[i]->cmt) {
-#ifndef USE_TEXTURE_ATLAS
-                gfx_flush();
-                gfx_rapi->set_sampler_parameters(i, linear_filter, rdp.texture_tile.cms, rdp.texture_tile.cmt);
+            gfx_update_atlas_page(i);
 #endif
-                rendering_state.textures[i]->linear_filter = linear_filter;
-                rendering_state.textures[i]->cms = rdp.texture_tile.cms;
-                rendering_state.textures[i]->cmt = rdp.texture_tile.cmt;
-            }
+            bool linear_filter = (rdp.other_mode_h & (3U << G_MDSFT_TEXTFILT)) != G_TF_POINT;
+            gfx_update_sampler(i, linear_filter, rdp.texture_tile.cms, rdp.texture_tile.cmt);
         }
     }
     
     bool use_texture = used_textures[0] || used_textures[1];
-    uint32_t tex_width = (rdp.texture_tile.lrs - rdp.texture_tile.uls + 4) / 4;
-    uint32_t tex_height = (rdp.texture_tile.lrt - rdp.texture_tile.ult + 4) / 4;
     
-    bool z_is_from_0_to_1 = gfx_rapi->z_is_from_0_to_1();
+    struct VertexFormat fmt;
+    fmt.comb = comb;
+    fmt.z_is_from_0_to_1 = gfx_rapi->z_is_from_0_to_1();
+    fmt.use_texture = use_texture;
+    fmt.used_textures[0] = used_textures[0];
+    fmt.used_textures[1] = used_textures[1];
+    fmt.linear_filter = (rdp.other_mode_h & (3U << G_MDSFT_TEXTFILT)) != G_TF_POINT;
+    fmt.tex_width = (rdp.texture_tile.lrs - rdp.texture_tile.uls + 4) / 4;
+    fmt.tex_height = (rdp.texture_tile.lrt - rdp.texture_tile.ult + 4) / 4;
+    fmt.use_fog = use_fog;
+    fmt.use_alpha = use_alpha;
+    fmt.num_inputs = num_inputs;
+    fmt.hw_tnl = hw_tnl;
+    
+    bool use_lod = false;
+    for (int i = 0; i < num_inputs; i++) {
+        if (comb->shader_input_mapping[0][i] == CC_LOD || (use_alpha && comb->shader_input_mapping[1][i] == CC_LOD)) {
+            use_lod = true;
+        }
+    }
+    if (use_lod) {
+        if (hw_tnl) {
+            gfx_tnl_transform_loaded(vtx1_idx, vtx1_idx);
+        }
+        float distance_frac = (v1->w - 3000.0f) / 3000.0f;
+        if (distance_frac < 0.0f) distance_frac = 0.0f;
+        if (distance_frac > 1.0f) distance_frac = 1.0f;
+        fmt.lod_color.r = fmt.lod_color.g = fmt.lod_color.b = fmt.lod_color.a = distance_frac * 255.0f;
+    }
     
-    for (int i = 0; i < 3; i++) {
-        float z = v_arr[i]->z, w = v_arr[i]->w;
-        if (z_is_from_0_to_1) {
-            z = (z + w) / 2.0f;
+    const float *tri_vertices[3];
+    size_t tri_start = buf_vbo_len;
+    
+    if (!gfx_use_indexed_vertices) {
+        for (int i = 0; i < 3; i++) {
+            tri_vertices[i] = &buf_vbo[buf_vbo_len];
+            gfx_emit_vertex(v_arr[i], &fmt, false);
+        }
+        buf_vbo_stride = (buf_vbo_len - tri_start) / 3;
+    } else {
+        if (buf_vbo_len + 3 * MAX_VERTEX_WORDS > sizeof(buf_vbo) / sizeof(buf_vbo[0])) {
+            gfx_flush();
         }
-        buf_vbo[buf_vbo_len++] = v_arr[i]->x;
-        buf_vbo[buf_vbo_len++] = v_arr[i]->y;
-        buf_vbo[buf_vbo_len++] = z;
-        buf_vbo[buf_vbo_len++] = w;
         
-        if (use_texture) {
-            float u = (v_arr[i]->u - rdp.texture_tile.uls * 8) / 32.0f;
-            float v = (v_arr[i]->v - rdp.texture_tile.ult * 8) / 32.0f;
-            if ((rdp.other_mode_h & (3U << G_MDSFT_TEXTFILT)) != G_TF_POINT) {
-                // Linear filter adds 0.5f to the coordinates
-                u += 0.5f;
-                v += 0.5f;
+        // A loaded vertex is only packed once per batch, unless the LOD fraction
+        // (which comes from the first vertex of each triangle) makes it triangle specific.
+        uint8_t v_idx[3] = {vtx1_idx, vtx2_idx, vtx3_idx};
+        uint16_t indices[3];
+        for (int i = 0; i < 3; i++) {
+            struct VertexShareSlot *slot = &vertex_share[v_idx[i]];
+            if (use_lod || slot->stamp != vertex_share_stamp) {
+                size_t start = buf_vbo_len;
+                slot->index = buf_vbo_num_verts++;
+                slot->stamp = use_lod ? 0 : vertex_share_stamp;
+                gfx_emit_vertex(v_arr[i], &fmt, true);
+                buf_vbo_stride = buf_vbo_len - start;
             }
-            buf_vbo[buf_vbo_len++] = u / tex_width;
-            buf_vbo[buf_vbo_len++] = v / tex_height;
-#ifdef USE_TEXTURE_ATLAS
-            for (int j = 0; j < 2; j++) {
-                if (used_textures[j]) {
-                    buf_vbo[buf_vbo_len++] = rendering_state.textures[j]->enc_sampler_params[0].value;
-                    buf_vbo[buf_vbo_len++] = rendering_state.textures[j]->enc_sampler_params[1].value;
-                }
-            }
-#endif
+            indices[i] = slot->index;
         }
-        
-        if (use_fog) {
-            buf_vbo[buf_vbo_len++] = rdp.fog_color.r / 255.0f;
-            buf_vbo[buf_vbo_len++] = rdp.fog_color.g / 255.0f;
-            buf_vbo[buf_vbo_len++] = rdp.fog_color.b / 255.0f;
-            buf_vbo[buf_vbo_len++] = v_arr[i]->color.a / 255.0f; // fog factor (not alpha)
+        for (int i = 0; i < 3; i++) {
+            tri_vertices[i] = &buf_vbo[indices[i] * buf_vbo_stride];
         }
-        
-        for (int j = 0; j < num_inputs; j++) {
-            struct RGBA *color;
-            struct RGBA tmp;
-            for (int k = 0; k < 1 + (use_alpha ? 1 : 0); k++) {
-                switch (comb->shader_input_mapping[k][j]) {
-                    case CC_PRIM:
-                        color = &rdp.prim_color;
-                        break;
-                    case CC_SHADE:
-                        color = &v_arr[i]->color;
-                        break;
-                    case CC_ENV:
-                        color = &rdp.env_color;
-                        break;
-                    case CC_LOD:
-                    {
-                        float distance_frac = (v1->w - 3000.0f) / 3000.0f;
-                        if (distance_frac < 0.0f) distance_frac = 0.0f;
-                        if (distance_frac > 1.0f) distance_frac = 1.0f;
-                        tmp.r = tmp.g = tmp.b = tmp.a = distance_frac * 255.0f;
-                        color = &tmp;
-                        break;
-                    }
-                    default:
-                        memset(&tmp, 0, sizeof(tmp));
-                        color = &tmp;
-                        break;
-                }
-                if (k == 0) {
-                    buf_vbo[buf_vbo_len++] = color->r / 255.0f;
-                    buf_vbo[buf_vbo_len++] = color->g / 255.0f;
-                    buf_vbo[buf_vbo_len++] = color->b / 255.0f;
-                } else {
-                    if (use_fog && color == &v_arr[i]->color) {
-                        // Shade alpha is 100% for fog
-                        buf_vbo[buf_vbo_len++] = 1.0f;
-                    } else {
-                        buf_vbo[buf_vbo_len++] = color->a / 255.0f;
-                    }
-                }
+        if (!culled) {
+            buf_ibo[buf_ibo_len++] = indices[0];
+            buf_ibo[buf_ibo_len++] = indices[1];
+            buf_ibo[buf_ibo_len++] = indices[2];
+        }
+    }
+    
+    if (retained.recording != NULL) {
+        if (!retained.recording_failed) {
+            gfx_retained_record_triangle(comb, used_textures, v_arr, tri_vertices, buf_vbo_stride);
+        }
+        if (culled) {
+            if (!gfx_use_indexed_vertices) {
+                buf_vbo_len = tri_start;
             }
+            return;
         }
-        /*struct RGBA *color = &v_arr[i]->color;
-        buf_vbo[buf_vbo_len++] = color->r / 255.0f;
-        buf_vbo[buf_vbo_len++] = color->g / 255.0f;
-        buf_vbo[buf_vbo_len++] = color->b / 255.0f;
-        buf_vbo[buf_vbo_len++] = color->a / 255.0f;*/
     }
     if (++buf_vbo_num_tris == MAX_BUFFERED) {
         printf("Vertex buffer overflow!\n");
@@ -1066,6 +2197,37 @@ static void gfx_sp_tri1(uint8_t vtx1_idx, uint8_t vtx2_idx, uint8_t vtx3_idx) {
     }
 }
 
+// G_CULLDL: the rest of the display list can be skipped when the loaded
+// vertices vstart to vend, usually the corners of its bounding box, all lie
+// outside the same clip plane.
+static bool gfx_sp_cull_dl(uint32_t vstart, uint32_t vend) {
+    if (retained.recording != NULL || retained.reloading) {
+        // The recording has to hold everything, the next replay may be seen
+        // from another angle, and a reload needs every vertex load
+        return false;
+    }
+    if (vend >= MAX_VERTICES) {
+        vend = MAX_VERTICES - 1;
+    }
+    for (uint32_t i = vstart; i <= vend; i++) {
+        if (rsp.loaded_vertices[i].retained_owner != NULL) {
+            gfx_retained_vertex_used(&rsp.loaded_vertices[i]);
+        }
+    }
+    if (tnl.enabled && vstart <= vend) {
+        gfx_tnl_transform_loaded(vstart, vend);
+    }
+    uint8_t clip_rej = 0xff;
+    for (uint32_t i = vstart; i <= vend; i++) {
+        clip_rej &= rsp.loaded_vertices[i].clip_rej;
+    }
+    if (vstart > vend || clip_rej == 0) {
+        return false;
+    }
+    ProfEmitCounter("dl_culled", 1);
+    return true;
+}
+
 static void gfx_sp_geometry_mode(uint32_t clear, uint32_t set) {
     rsp.geometry_mode &= ~clear;
     rsp.geometry_mode |= set;
@@ -1094,6 +2256,7 @@ static void gfx_calc_and_set_viewport(const Vp_t *viewport) {
 static void gfx_sp_movemem(uint8_t index, uint8_t offset, const void* data) {
     switch (index) {
         case G_MV_VIEWPORT:
+            gfx_capture_region(data, sizeof(Vp_t));
             gfx_calc_and_set_viewport((const Vp_t *) data);
             break;
 #if 0
@@ -1108,6 +2271,7 @@ static void gfx_sp_movemem(uint8_t index, uint8_t offset, const void* data) {
             int lightidx = offset / 24 - 2;
             if (lightidx >= 0 && lightidx <= MAX_LIGHTS) { // skip lookat
                 // NOTE: reads out of bounds if it is an ambient light
+                gfx_capture_region(data, sizeof(Light_t));
                 memcpy(rsp.current_lights + lightidx, data, sizeof(Light_t));
             }
             break;
@@ -1117,6 +2281,7 @@ static void gfx_sp_movemem(uint8_t index, uint8_t offset, const void* data) {
         case G_MV_L1:
         case G_MV_L2:
             // NOTE: reads out of bounds if it is an ambient light
+            gfx_capture_region(data, sizeof(Light_t));
             memcpy(rsp.current_lights + (index - G_MV_L0) / 2, data, sizeof(Light_t));
             break;
 #endif
@@ -1198,6 +2363,7 @@ static void gfx_dp_load_tlut(uint8_t tile, uint32_t high_index) {
     SUPPORT_CHECK(tile == G_TX_LOADTILE);
     SUPPORT_CHECK(rdp.texture_to_load.siz == G_IM_SIZ_16b);
     rdp.palette = rdp.texture_to_load.addr;
+    gfx_capture_region(rdp.palette, (high_index + 1) * sizeof(uint16_t));
 }
 
 static void gfx_dp_load_block(uint8_t tile, uint32_t uls, uint32_t ult, uint32_t lrs, uint32_t dxt) {
@@ -1226,6 +2392,7 @@ static void gfx_dp_load_block(uint8_t tile, uint32_t uls, uint32_t ult, uint32_t
     rdp.loaded_texture[rdp.texture_to_load.tile_number].size_bytes = size_bytes;
     assert(size_bytes <= 4096 && "bug: too big texture");
     rdp.loaded_texture[rdp.texture_to_load.tile_number].addr = rdp.texture_to_load.addr;
+    gfx_capture_region(rdp.texture_to_load.addr, size_bytes);
     
     rdp.textures_changed[rdp.texture_to_load.tile_number] = true;
 }
@@ -1257,6 +2424,7 @@ static void gfx_dp_load_tile(uint8_t tile, uint32_t uls, uint32_t ult, uint32_t
 
     assert(size_bytes <= 4096 && "bug: too big texture");
     rdp.loaded_texture[rdp.texture_to_load.tile_number].addr = rdp.texture_to_load.addr;
+    gfx_capture_region(rdp.texture_to_load.addr, size_bytes);
     rdp.texture_tile.uls = uls;
     rdp.texture_tile.ult = ult;
     rdp.texture_tile.lrs = lrs;
@@ -1266,34 +2434,6 @@ static void gfx_dp_load_tile(uint8_t tile, uint32_t uls, uint32_t ult, uint32_t
 }
 
 
-static uint8_t color_comb_component(uint32_t v) {
-    switch (v) {
-        case G_CCMUX_TEXEL0:
-            return CC_TEXEL0;
-        case G_CCMUX_TEXEL1:
-            return CC_TEXEL1;
-        case G_CCMUX_PRIMITIVE:
-            return CC_PRIM;
-        case G_CCMUX_SHADE:
-            return CC_SHADE;
-        case G_CCMUX_ENVIRONMENT:
-            return CC_ENV;
-        case G_CCMUX_TEXEL0_ALPHA:
-            return CC_TEXEL0A;
-        case G_CCMUX_LOD_FRACTION:
-            return CC_LOD;
-        default:
-            return CC_0;
-    }
-}
-
-static inline uint32_t color_comb(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
-    return color_comb_component(a) |
-           (color_comb_component(b) << 3) |
-           (color_comb_component(c) << 6) |
-           (color_comb_component(d) << 9);
-}
-
 static void gfx_dp_set_combine_mode(uint32_t rgb, uint32_t alpha) {
     rdp.combine_mode = rgb | (alpha << 12);
 }
@@ -1492,17 +2632,407 @@ static void gfx_sp_set_other_mode(uint32_t shift, uint32_t num_bits, uint64_t mo
 }
 
 static inline void *seg_addr(uintptr_t w1) {
+    if (capture.replay != NULL) {
+        return gfx_capture_translate(capture.replay, w1);
+    }
     return (void *) w1;
 }
 
 #define C0(pos, width) ((cmd->words.w0 >> (pos)) & ((1U << width) - 1))
 #define C1(pos, width) ((cmd->words.w1 >> (pos)) & ((1U << width) - 1))
 
+static inline uint32_t gfx_retained_hash_word(uint32_t h, uint32_t word) {
+    h = (h ^ word) * 0x9e3779b1U;
+    return h ^ (h >> 16);
+}
+
+static uint32_t gfx_retained_hash_bytes(uint32_t h, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i + 4 <= size; i += 4) {
+        uint32_t word;
+        memcpy(&word, bytes + i, 4);
+        h = gfx_retained_hash_word(h, word);
+    }
+    return h;
+}
+
+// Hashes the commands of a display list and the lists it calls, down to depth
+// levels of calls, plus the vertices they load.
+static uint32_t gfx_retained_hash_dl(const Gfx *cmd, uint32_t h, int depth) {
+    for (;;) {
+        uint32_t opcode = cmd->words.w0 >> 24;
+        uint64_t w1 = cmd->words.w1;
+        h = gfx_retained_hash_word(h, cmd->words.w0);
+        h = gfx_retained_hash_word(h, (uint32_t)w1);
+        h = gfx_retained_hash_word(h, (uint32_t)(w1 >> 32));
+        
+        switch (opcode) {
+            case G_VTX:
+#ifdef F3DEX_GBI_2
+                h = gfx_retained_hash_bytes(h, seg_addr(cmd->words.w1), C0(12, 8) * sizeof(Vtx));
+#elif defined(F3DEX_GBI) || defined(F3DLP_GBI)
+                h = gfx_retained_hash_bytes(h, seg_addr(cmd->words.w1), C0(10, 6) * sizeof(Vtx));
+#else
+                h = gfx_retained_hash_bytes(h, seg_addr(cmd->words.w1), C0(0, 16));
+#endif
+                break;
+            case G_DL:
+                if (C0(16, 1) == 0) {
+                    if (depth > 0) {
+                        h = gfx_retained_hash_dl((const Gfx *)seg_addr(cmd->words.w1), h, depth - 1);
+                    }
+                } else {
+                    cmd = (const Gfx *)seg_addr(cmd->words.w1);
+                    continue;
+                }
+                break;
+            case (uint8_t)G_ENDDL:
+                return h;
+        }
+        ++cmd;
+    }
+}
+
+// Just the display list itself and its vertices, without following calls
+static uint32_t gfx_retained_hash_quick(const Gfx *cmd) {
+    return gfx_retained_hash_dl(cmd, 0x811c9dc5U, 0);
+}
+
+// The G_VTX right in front of a G_CULLDL, if the display list gets to one
+// before drawing anything or calling other lists
+static const Gfx *gfx_retained_find_cull_prologue(const Gfx *cmd) {
+    for (int i = 0; i < 64; i++, cmd++) {
+        switch (cmd->words.w0 >> 24) {
+            case G_VTX:
+                if ((cmd[1].words.w0 >> 24) == (uint8_t)G_CULLDL) {
+                    return cmd;
+                }
+                return NULL;
+            case G_DL:
+            case (uint8_t)G_ENDDL:
+            case (uint8_t)G_TRI1:
+#if defined(F3DEX_GBI) || defined(F3DLP_GBI)
+            case (uint8_t)G_TRI2:
+#endif
+            case (uint8_t)G_CULLDL:
+                return NULL;
+        }
+    }
+    return NULL;
+}
+
+// Whether the G_CULLDL after the G_VTX at cmd would cull with the current
+// matrices, without loading the vertices
+static bool gfx_retained_prologue_culled(const Gfx *cmd) {
+    static Vtx vertices[GFX_VERTEX_BATCH_MAX];
+    static struct GfxVertexBatch batch;
+
+#ifdef F3DEX_GBI_2
+    size_t n = C0(12, 8), dest = C0(1, 7) - C0(12, 8);
+#elif defined(F3DEX_GBI) || defined(F3DLP_GBI)
+    size_t n = C0(10, 6), dest = C0(16, 8) / 2;
+#else
+    size_t n = C0(0, 16) / sizeof(Vtx), dest = C0(16, 4);
+#endif
+    const Vtx *box = seg_addr(cmd->words.w1);
+    
+    ++cmd;
+#if defined(F3DEX_GBI_2) || defined(F3DEX_GBI) || defined(F3DLP_GBI)
+    size_t vstart = C0(0, 16) / 2, vend = C1(0, 16) / 2;
+#else
+    size_t vstart = C0(0, 16) / 40, vend = C1(0, 16) / 40 - 1;
+#endif
+    // A range reaching past the box would need vertices loaded before
+    if (vstart > vend || vstart < dest || vend >= dest + n || vend - vstart + 1 > GFX_VERTEX_BATCH_MAX) {
+        return false;
+    }
+    
+    struct GfxVertexBatchParams params = {
+        .mp_matrix = (const float (*)[4])rsp.MP_matrix,
+        .aspect_ratio = (float)gfx_current_dimensions.width / (float)gfx_current_dimensions.height,
+        .fog = false
+    };
+    size_t count = vend - vstart + 1;
+    memcpy(vertices, box + (vstart - dest), count * sizeof(Vtx));
+    gfx_vertex_batch_transform(vertices, count, &params, &batch);
+    uint8_t clip_rej = 0xff;
+    for (size_t i = 0; i < count; i++) {
+        clip_rej &= batch.clip_rej[i];
+    }
+    return clip_rej != 0;
+}
+
+static void gfx_retained_get_signature(struct RetainedSignature *sig) {
+    memset(sig, 0, sizeof(*sig));
+    memcpy(&sig->rdp, &rdp, sizeof(rdp));
+    sig->rdp.viewport_or_scissor_changed = false;
+    sig->geometry_mode = rsp.geometry_mode;
+    sig->texture_scaling_s = rsp.texture_scaling_factor.s;
+    sig->texture_scaling_t = rsp.texture_scaling_factor.t;
+    sig->textures[0] = rendering_state.textures[0];
+    sig->textures[1] = rendering_state.textures[1];
+}
+
+static struct RetainedEntry *gfx_retained_alloc_entry(void) {
+    // Clock sweep, preferring entries that weren't used this frame
+    for (int tries = 0; ; tries++) {
+        struct RetainedEntry *e = &retained.pool[retained.clock_hand];
+        retained.clock_hand = (retained.clock_hand + 1) % RETAINED_POOL_SIZE;
+        if (e == retained.recording) {
+            continue;
+        }
+        if (e->dl == NULL) {
+            return e;
+        }
+        if (e->last_frame != retained.frame || tries >= RETAINED_POOL_SIZE) {
+            gfx_retained_free_entry(e);
+            return e;
+        }
+    }
+}
+
+static struct RetainedEntry *gfx_retained_lookup(const Gfx *dl, bool *created) {
+    struct RetainedSignature sig;
+    gfx_retained_get_signature(&sig);
+    uint32_t sig_hash = gfx_retained_hash_bytes(0x811c9dc5U, &sig, sizeof(sig));
+    
+    size_t hash = (((uintptr_t)dl >> 3) ^ sig_hash) & (RETAINED_HASHMAP_SIZE - 1);
+    for (struct RetainedEntry *e = retained.hashmap[hash]; e != NULL; e = e->next) {
+        if (e->dl == dl && e->sig_hash == sig_hash && memcmp(&e->sig, &sig, sizeof(sig)) == 0) {
+            *created = false;
+            return e;
+        }
+    }
+    
+    struct RetainedEntry *e = gfx_retained_alloc_entry();
+    e->dl = dl;
+    e->sig_hash = sig_hash;
+    e->sig = sig;
+    e->state = RETAINED_CANDIDATE;
+    e->next = retained.hashmap[hash];
+    retained.hashmap[hash] = e;
+    *created = true;
+    return e;
+}
+
+static void gfx_retained_begin(struct RetainedEntry *e) {
+    retained.recording = e;
+    retained.recording_failed = false;
+    retained.recording_restart = false;
+    retained.generation++;
+    retained.vbo_len = 0;
+    retained.num_batches = 0;
+}
+
+static void gfx_retained_end(void) {
+    struct RetainedEntry *e = retained.recording;
+    retained.recording = NULL;
+    
+    if (retained.recording_failed) {
+        e->state = retained.recording_restart ? RETAINED_CANDIDATE : RETAINED_REJECTED;
+        return;
+    }
+    
+    if (retained.vbo_len > 0) {
+        e->buffer_id = gfx_rapi->new_static_buffer(retained.vbo, retained.vbo_len);
+    }
+    e->num_batches = retained.num_batches;
+    e->batches = malloc(retained.num_batches * sizeof(struct RetainedBatch));
+    memcpy(e->batches, retained.batches, retained.num_batches * sizeof(struct RetainedBatch));
+    gfx_retained_get_signature(&e->exit);
+    e->loaded_slots = 0;
+    for (int i = 0; i < MAX_VERTICES; i++) {
+        if (rsp.loaded_vertices[i].retained_generation == retained.generation) {
+            e->loaded_slots |= (uint64_t)1 << i;
+        }
+    }
+    e->verified_frame = retained.frame;
+    e->cull_prologue = gfx_retained_find_cull_prologue(e->dl);
+    e->state = RETAINED_RECORDED;
+}
+
+static void gfx_retained_replay(struct RetainedEntry *e) {
+    if (e->cull_prologue != NULL && gfx_retained_prologue_culled(e->cull_prologue)) {
+        // Running it gets as far as the G_CULLDL and leaves the state it would
+        gfx_run_dl((Gfx *)e->dl);
+        return;
+    }
+    
+    ProfEmitEventStart("gfx_retained_replay");
+    if (e->num_batches > 0) {
+        // Fold the aspect ratio fixup and the depth range into the matrix, like gfx_sp_vertex/gfx_sp_tri1 do per vertex
+        float mvp[4][4];
+        gfx_calc_mvp(mvp);
+        
+        gfx_flush();
+        gfx_update_viewport_and_scissor();
+        
+        size_t mvp_index = 0;
+        if (deferred.enabled) {
+            DEFERRED_GROW(deferred.mvps, deferred.num_mvps, deferred.mvps_cap, 1);
+            memcpy(deferred.mvps[deferred.num_mvps], mvp, sizeof(mvp));
+            mvp_index = deferred.num_mvps++;
+        }
+        
+        for (size_t i = 0; i < e->num_batches; i++) {
+            const struct RetainedBatch *batch = &e->batches[i];
+            const struct RetainedRenderState *state = &batch->state;
+            
+            gfx_update_depth_state(state->depth_test, state->depth_mask, state->decal_mode);
+            gfx_update_shader_program(state->prg);
+            gfx_update_alpha_blend(state->alpha_blend);
+            gfx_update_cull_mode(state->cull_mode);
+            for (int j = 0; j < 2; j++) {
+                if (state->textures[j] != NULL) {
+#ifndef USE_TEXTURE_ATLAS
+                    if (rendering_state.textures[j] != state->textures[j] && !deferred.enabled) {
+                        gfx_rapi->select_texture(j, state->textures[j]->texture_id);
+                    }
+#endif
+                    rendering_state.textures[j] = state->textures[j];
+#ifdef USE_TEXTURE_ATLAS
+                    gfx_update_atlas_page(j);
+#endif
+                    gfx_update_sampler(j, state->linear_filter[j], state->cms, state->cmt);
+                }
+            }
+            frame_stats.triangles += batch->num_tris;
+            if (deferred.enabled) {
+                struct DeferredDraw *d = gfx_deferred_new_draw();
+                d->buffer_id = e->buffer_id;
+                d->vbo_offset = batch->buf_vbo_offset;
+                d->num_tris = batch->num_tris;
+                d->mvp_index = mvp_index;
+            } else {
+                gfx_rapi->draw_static_triangles(e->buffer_id, batch->buf_vbo_offset, batch->num_tris, mvp);
+                ProfEmitCounter("gfx_draw_calls", 1);
+                frame_stats.draw_calls++;
+            }
+        }
+    }
+    
+    // Leave everything as if the display list had actually run
+    bool viewport_or_scissor_changed = rdp.viewport_or_scissor_changed;
+    memcpy(&rdp, &e->exit.rdp, sizeof(rdp));
+    rdp.viewport_or_scissor_changed = viewport_or_scissor_changed;
+    rsp.geometry_mode = e->exit.geometry_mode;
+    rsp.texture_scaling_factor.s = e->exit.texture_scaling_s;
+    rsp.texture_scaling_factor.t = e->exit.texture_scaling_t;
+    for (int j = 0; j < 2; j++) {
+        if (e->exit.textures[j] != NULL && rendering_state.textures[j] != e->exit.textures[j]) {
+#ifndef USE_TEXTURE_ATLAS
+            if (!deferred.enabled) {
+                gfx_rapi->select_texture(j, e->exit.textures[j]->texture_id);
+            }
+#endif
+            rendering_state.textures[j] = e->exit.textures[j];
+        }
+    }
+    // The slots still hold what was there before, note who should have loaded them
+    for (int i = 0; i < MAX_VERTICES; i++) {
+        if (e->loaded_slots & ((uint64_t)1 << i)) {
+            rsp.loaded_vertices[i].retained_owner = e;
+        }
+    }
+    ProfEmitEventEnd("gfx_retained_replay");
+}
+
+// Commands that make a display list unsuitable for recording: they either
+// change the matrices, touch memory we don't hash or draw in screen space.
+static void gfx_retained_check_opcode(uint32_t opcode) {
+    switch (opcode) {
+        case G_MTX:
+        case (uint8_t)G_POPMTX:
+        case G_MOVEMEM:
+        case (uint8_t)G_MOVEWORD:
+        case G_TEXRECT:
+        case G_TEXRECTFLIP:
+        case G_FILLRECT:
+        case G_SETSCISSOR:
+        case G_SETZIMG:
+        case G_SETCIMG:
+            retained.recording_failed = true;
+            break;
+    }
+}
+
+static void gfx_sp_display_list(Gfx *dl) {
+    if (retained.recording != NULL || retained.reloading || !gfx_retained_enabled()) {
+        gfx_run_dl(dl);
+        return;
+    }
+    
+    bool created;
+    struct RetainedEntry *e = gfx_retained_lookup(dl, &created);
+    e->last_frame = retained.frame;
+    if (e->state == RETAINED_REJECTED) {
+        gfx_run_dl(dl);
+        return;
+    }
+    
+    uint32_t quick_hash = gfx_retained_hash_quick(dl);
+    if (e->state == RETAINED_RECORDED && quick_hash == e->quick_hash) {
+        // Trust the recording, but hash it all again now and then in case
+        // something changed deeper down
+        bool verify = retained.frame - e->verified_frame >= RETAINED_VERIFY_INTERVAL && retained.verifies_left > 0;
+        if (!verify) {
+            gfx_retained_replay(e);
+            return;
+        }
+        retained.verifies_left--;
+        e->verified_frame = retained.frame;
+        if (gfx_retained_hash_dl(dl, 0x811c9dc5U, 10) == e->content_hash) {
+            gfx_retained_replay(e);
+            return;
+        }
+    }
+    
+    uint32_t content_hash = gfx_retained_hash_dl(dl, 0x811c9dc5U, 10);
+    if (created) {
+        // Only record display lists that show up again unchanged
+        e->content_hash = content_hash;
+        e->quick_hash = quick_hash;
+        gfx_run_dl(dl);
+        return;
+    }
+    
+    if (content_hash == e->content_hash && e->state != RETAINED_RECORDED) {
+        gfx_retained_begin(e);
+        gfx_run_dl(dl);
+        gfx_retained_end();
+        return;
+    }
+    
+    // Same address, different contents: a per-frame allocation, or data that changed under us
+    if (e->state == RETAINED_RECORDED) {
+        gfx_retained_drop_recording(e);
+    }
+    e->content_hash = content_hash;
+    e->quick_hash = quick_hash;
+    if (++e->mismatches >= RETAINED_MAX_MISMATCHES) {
+        e->state = RETAINED_REJECTED;
+    }
+    gfx_run_dl(dl);
+}
+
 static void gfx_run_dl(Gfx* cmd) {
     int dummy = 0;
     for (;;) {
         uint32_t opcode = cmd->words.w0 >> 24;
         
+        gfx_capture_region(cmd, sizeof(Gfx));
+        if (retained.recording != NULL) {
+            gfx_retained_check_opcode(opcode);
+        }
+        if (opcode != (uint8_t)G_TRI1
+#if defined(F3DEX_GBI) || defined(F3DLP_GBI)
+            && opcode != (uint8_t)G_TRI2
+#endif
+        ) {
+            // Anything but a triangle may change what a packed vertex looks like
+            vertex_share_stamp++;
+        }
+        
         switch (opcode) {
             // RSP commands:
             case G_MTX:
@@ -1552,7 +3082,7 @@ static void gfx_run_dl(Gfx* cmd) {
             case G_DL:
                 if (C0(16, 1) == 0) {
                     // Push return address
-                    gfx_run_dl((Gfx *)seg_addr(cmd->words.w1));
+                    gfx_sp_display_list((Gfx *)seg_addr(cmd->words.w1));
                 } else {
                     cmd = (Gfx *)seg_addr(cmd->words.w1);
                     --cmd; // increase after break
@@ -1560,6 +3090,17 @@ static void gfx_run_dl(Gfx* cmd) {
                 break;
             case (uint8_t)G_ENDDL:
                 return;
+            case (uint8_t)G_CULLDL:
+#if defined(F3DEX_GBI_2) || defined(F3DEX_GBI) || defined(F3DLP_GBI)
+                if (gfx_sp_cull_dl(C0(0, 16) / 2, C1(0, 16) / 2)) {
+                    return;
+                }
+#else
+                if (gfx_sp_cull_dl(C0(0, 16) / 40, C1(0, 16) / 40 - 1)) {
+                    return;
+                }
+#endif
+                break;
 #ifdef F3DEX_GBI_2
             case G_GEOMETRYMODE:
                 gfx_sp_geometry_mode(~C0(0, 24), cmd->words.w1);
@@ -1684,9 +3225,7 @@ static void gfx_run_dl(Gfx* cmd) {
                 gfx_dp_set_fill_color(cmd->words.w1);
                 break;
             case G_SETCOMBINE:
-                gfx_dp_set_combine_mode(
-                    color_comb(C0(20, 4), C1(28, 4), C0(15, 5), C1(15, 3)),
-                    color_comb(C0(12, 3), C1(12, 3), C0(9, 3), C1(9, 3)));
+                rdp.combine_mode = gfx_cc_combine_mode(cmd->words.w0, cmd->words.w1);
                     /*color_comb(C0(5, 4), C1(24, 4), C0(0, 5), C1(6, 3)),
                     color_comb(C1(21, 3), C1(3, 3), C1(18, 3), C1(0, 3)));*/
                 break;
@@ -1748,14 +3287,36 @@ void gfx_get_dimensions(uint32_t *width, uint32_t *height) {
 void gfx_init(struct GfxWindowManagerAPI *wapi, struct GfxRenderingAPI *rapi, const char *game_name, bool start_in_fullscreen) {
     gfx_wapi = wapi;
     gfx_rapi = rapi;
+    gfx_use_indexed_vertices = rapi->draw_indexed_triangles != NULL;
+    deferred.enabled = configDeferredDraws;
+    if (configHwTnl) {
+        tnl.enabled = gfx_use_indexed_vertices && rapi->set_tnl_state != NULL && !deferred.enabled;
+        if (!tnl.enabled) {
+            fprintf(stderr, "hw_tnl needs a backend with indexed vertices and deferred_draws off, using the CPU path\n");
+        }
+    }
+    gfx_texture_cache_init(configTextureCacheSize);
+#ifdef GFX_CC_TABLE
+    for (size_t i = 0; i < sizeof(gfx_cc_table) / sizeof(gfx_cc_table[0]); i++) {
+        gfx_generate_cc(&color_combiner_pool[color_combiner_pool_size++], gfx_cc_table[i]);
+    }
+    color_combiner_num_preallocated = color_combiner_pool_size;
+#endif
+    if (configTexturePack) {
+        gfx_texture_pack_open(path_next_to_exe(GFX_TEXTURE_PACK_FILE));
+    }
     gfx_wapi->init(game_name, start_in_fullscreen);
     gfx_rapi->init();
 
 #ifdef USE_TEXTURE_ATLAS
-    if (!atlas_create(&atlas, 2048, 1))
+    gfx_atlas.max_pages = configAtlasPages;
+    if (gfx_atlas.max_pages < 1) {
+        gfx_atlas.max_pages = 1;
+    } else if (gfx_atlas.max_pages > GFX_ATLAS_MAX_PAGES) {
+        gfx_atlas.max_pages = GFX_ATLAS_MAX_PAGES;
+    }
+    if (!gfx_atlas_add_page())
         abort();
-
-    gfx_rapi->create_virtual_texture_page(2048);
 #endif
     
     // Used in the 120 star TAS
@@ -1787,9 +3348,26 @@ void gfx_init(struct GfxWindowManagerAPI *wapi, struct GfxRenderingAPI *rapi, co
         0x0920038d,
         0x09200045
     };
+    FILE *manifest = fopen_home(SHADER_MANIFEST_FILE, "r");
+    if (manifest != NULL) {
+        char line[32];
+        int num_shaders = 0;
+        while (fgets(line, sizeof(line), manifest) != NULL) {
+            char *end;
+            uint32_t shader_id = strtoul(line, &end, 16);
+            if (end != line) {
+                gfx_lookup_or_create_shader_program(shader_id);
+                num_shaders++;
+            }
+        }
+        fclose(manifest);
+        printf("Warmed up %d shaders from %s\n", num_shaders, SHADER_MANIFEST_FILE);
+    }
+    shader_warmup.warm = true;
     for (size_t i = 0; i < sizeof(precomp_shaders) / sizeof(uint32_t); i++) {
         gfx_lookup_or_create_shader_program(precomp_shaders[i]);
     }
+    shader_warmup.in_game = true;
 }
 
 struct GfxRenderingAPI *gfx_get_current_rendering_api(void) {
@@ -1809,6 +3387,8 @@ void gfx_start_frame(void) {
 
 void gfx_run(Gfx *commands) {
     gfx_sp_reset();
+    retained.frame++;
+    retained.verifies_left = RETAINED_VERIFY_PER_FRAME;
     
     //puts("New frame");
     
@@ -1818,20 +3398,64 @@ void gfx_run(Gfx *commands) {
     }
     dropped_frame = false;
     
+    if (capture.replay == NULL && configCaptureFrames != 0 && capture.frame == configCaptureStartFrame) {
+        if (gfx_capture_open(GFX_CAPTURE_FILE)) {
+            capture.frames_left = configCaptureFrames;
+        }
+    }
+    capture.frame++;
+    if (capture.frames_left != 0) {
+        gfx_capture_begin_frame(commands);
+    }
+    memset(&frame_stats, 0, sizeof(frame_stats));
+    
     rendering_state.shader_program = NULL;
     double t0 = gfx_wapi->get_time();
     gfx_rapi->start_frame();
     #ifdef USE_TEXTURE_ATLAS
-    gfx_rapi->bind_virtual_texture_page();
+    for (int i = 0; i < 2; i++) {
+        gfx_rapi->bind_virtual_texture_page(i, 0);
+        gfx_rapi->set_sampler_parameters(i, rendering_state.linear_filter[i], 0, 0);
+        rendering_state.atlas_page[i] = 0;
+    }
     #endif
     gfx_run_dl(commands);
     gfx_flush();
+    gfx_deferred_submit();
+    ProfEmitCounter("mtx_float_passthrough", mtx_stats.float_passthrough);
+    ProfEmitCounter("mtx_redundant_loads", mtx_stats.redundant_loads);
+    mtx_stats.float_passthrough = 0;
+    mtx_stats.redundant_loads = 0;
+    last_frame_stats = frame_stats;
+    if (capture.frames_left != 0) {
+        gfx_capture_end_frame();
+        if (--capture.frames_left == 0) {
+            gfx_capture_close();
+            printf("Captured %u frames to %s\n", configCaptureFrames, GFX_CAPTURE_FILE);
+        }
+    }
+    #if defined(USE_TEXTURE_ATLAS) && defined(USE_PROFILER)
+    for (uint32_t i = 0; i < gfx_atlas.num_pages; i++) {
+        uint32_t dims = atlas_get_dimensions(gfx_atlas.pages[i]);
+        ProfEmitCounter(gfx_atlas.fill_labels[i], atlas_get_used_area(gfx_atlas.pages[i]) * 100.0 / (dims * dims));
+    }
+    #endif
     double t1 = gfx_wapi->get_time();
     //printf("Process %f %f\n", t1, t1 - t0);
     gfx_rapi->end_frame();
     gfx_wapi->swap_buffers_begin();
 }
 
+void gfx_run_capture(const struct GfxCaptureFrame *frame) {
+    capture.replay = frame;
+    gfx_run((Gfx *)gfx_capture_translate(frame, frame->root));
+    capture.replay = NULL;
+}
+
+void gfx_get_frame_stats(struct GfxFrameStats *stats) {
+    *stats = last_frame_stats;
+}
+
 void gfx_end_frame(void) {
     if (!dropped_frame) {
         gfx_rapi->finish_render();
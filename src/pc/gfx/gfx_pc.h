@@ -13,6 +13,15 @@ struct GfxDimensions {
 
 extern struct GfxDimensions gfx_current_dimensions;
 
+// What the last gfx_run submitted
+struct GfxFrameStats {
+    uint32_t triangles;
+    uint32_t flushes;
+    uint32_t draw_calls;
+};
+
+struct GfxCaptureFrame;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -21,6 +30,9 @@ void gfx_init(struct GfxWindowManagerAPI *wapi, struct GfxRenderingAPI *rapi, co
 struct GfxRenderingAPI *gfx_get_current_rendering_api(void);
 void gfx_start_frame(void);
 void gfx_run(Gfx *commands);
+// Runs a frame of a display list capture (see gfx_capture.h) in place of gfx_run
+void gfx_run_capture(const struct GfxCaptureFrame *frame);
+void gfx_get_frame_stats(struct GfxFrameStats *stats);
 void gfx_end_frame(void);
 
 #ifdef __cplusplus
@@ -7,6 +7,35 @@
 
 struct ShaderProgram;
 
+// Packed vertex layout used by draw_indexed_triangles (and by the static buffers
+// of such a backend), every attribute takes whole 32-bit words:
+//   position    4 floats
+//   texcoord    2 x int16, in units of 1 / GFX_PACKED_TEXCOORD_SCALE
+//   atlas       2 floats per used texture (USE_TEXTURE_ATLAS only)
+//   fog         4 x normalized uint8: rgb + fog factor
+//   inputs      4 x normalized uint8 each: rgb + alpha (255 without alpha)
+//   shade       4 x normalized uint8: raw Vtx color, or normal + alpha with G_LIGHTING (SHADER_OPT_TNL only)
+// With SHADER_OPT_TNL the position is the object space one (w = 1), the fog
+// factor comes from the shader and the inputs that are shade get replaced by
+// the lit shade color, see struct GfxTnlState.
+#define GFX_PACKED_TEXCOORD_SCALE 512.0f
+
+#define GFX_TNL_MAX_LIGHTS 7
+
+// Uniforms of the SHADER_OPT_TNL programs, the RSP state the vertices were loaded with
+struct GfxTnlState {
+    float mvp[4][4]; // aspect ratio and depth range already folded in
+    float light_dirs[GFX_TNL_MAX_LIGHTS][3]; // object space, unit length
+    float light_colors[GFX_TNL_MAX_LIGHTS][3]; // 0-255
+    float ambient_color[3];
+    int32_t num_lights; // directional lights only, -1 without G_LIGHTING
+    float fog_mul, fog_offset;
+    int32_t fog; // G_FOG, otherwise the fog factor is the vertex alpha
+    float shade_rgb[4], shade_alpha[4]; // 1 where a combiner input takes its rgb/alpha from shade
+};
+
+#define GFX_ATLAS_MAX_PAGES 8
+
 struct GfxRenderingAPI {
     bool (*z_is_from_0_to_1)(void);
     void (*unload_shader)(struct ShaderProgram *old_prg);
@@ -31,11 +60,21 @@ struct GfxRenderingAPI {
     void (*end_frame)(void);
     void (*finish_render)(void);
 #ifdef USE_TEXTURE_ATLAS
-    void (*bind_virtual_texture_page)(void);
-    void (*create_virtual_texture_page)(uint16_t dimensions);
-    void (*upload_virtual_texture)(const uint8_t *rgba32_buf, int x, int y, int width, int height, int h_mirror, int v_mirror);
+    // Atlas pages are numbered from 0 in creation order, at most GFX_ATLAS_MAX_PAGES of them
+    void (*bind_virtual_texture_page)(int tile, uint16_t page);
+    void (*create_virtual_texture_page)(uint16_t page, uint16_t dimensions);
+    void (*upload_virtual_texture)(uint16_t page, const uint8_t *rgba32_buf, int x, int y, int width, int height, int h_mirror, int v_mirror);
 #endif
     void (*signal_start)(uint32_t width, uint32_t height);
+    // Retained geometry. Optional, backends that leave these NULL always get streamed triangles.
+    uint32_t (*new_static_buffer)(const float buf_vbo[], size_t buf_vbo_len);
+    void (*delete_static_buffer)(uint32_t buffer_id);
+    void (*draw_static_triangles)(uint32_t buffer_id, size_t buf_vbo_offset, size_t buf_vbo_num_tris, const float mvp[4][4]);
+    void (*set_cull_mode)(bool cull_front, bool cull_back);
+    // Indexed, packed vertices. Optional, backends that leave it NULL get the float layout through draw_triangles.
+    void (*draw_indexed_triangles)(float buf_vbo[], size_t buf_vbo_len, size_t buf_vbo_num_verts, const uint16_t indices[], size_t buf_vbo_num_tris);
+    // Hardware T&L. Optional, needs draw_indexed_triangles. Applies to the indexed draws that follow.
+    void (*set_tnl_state)(const struct GfxTnlState *state);
 };
 
 #endif
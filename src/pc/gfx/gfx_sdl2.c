@@ -16,6 +16,7 @@
 #else
 #include <SDL2/SDL.h>
 #include <time.h>
+#include <errno.h>
 #define GL_GLEXT_PROTOTYPES 1
 #include <SDL2/SDL_opengles2.h>
 #endif
@@ -23,6 +24,7 @@
 #include "../cheapProfiler.h"
 #include "gfx_window_manager_api.h"
 #include "gfx_screen_config.h"
+#include "../configfile.h"
 
 #define GFX_API_NAME "SDL2 - OpenGL"
 
@@ -37,11 +39,32 @@ static bool (*on_key_down_callback)(int scancode);
 static bool (*on_key_up_callback)(int scancode);
 static void (*on_all_keys_up_callback)(void);
 
-#define S_IN_NS (1e+9)
-#define MS_IN_NS (1e+6)
-static const double TARGET_FRAMETIME = (double)S_IN_NS / 31.5f; //1.5 frames of headroom
-static const double SLEEP_FRAMETIME = MS_IN_NS * 5.0;
-static struct timespec prev_frame = {};
+#define S_IN_NS 1000000000LL
+#define US_IN_NS 1000LL
+
+// Frame pacing when vsync isn't available (frame_rate in sm64config.txt). Every
+// frame has an absolute deadline one period after the previous one, so the
+// rate doesn't drift with how long the frames took. The thread sleeps until
+// shortly before the deadline and spins the rest of the way, the spin being
+// how late clock_nanosleep has been waking up recently.
+#define PACER_MIN_SPIN_NS (50 * US_IN_NS)
+#define PACER_MAX_SPIN_NS (2000 * US_IN_NS)
+#define PACER_NUM_BUCKETS 7
+
+static struct {
+    int64_t period_ns; // 0 when the frame rate is unlimited
+    int64_t deadline_ns;
+    int64_t spin_ns;
+} pacer;
+
+// Upper bounds of the lateness histogram buckets, the last one takes the rest
+static const int64_t pacer_bucket_limits[PACER_NUM_BUCKETS - 1] = {
+    100 * US_IN_NS, 250 * US_IN_NS, 500 * US_IN_NS, 1000 * US_IN_NS, 2000 * US_IN_NS, 5000 * US_IN_NS
+};
+static char *pacer_bucket_labels[PACER_NUM_BUCKETS] = {
+    "pace_late_0_100us", "pace_late_100_250us", "pace_late_250_500us", "pace_late_500us_1ms",
+    "pace_late_1_2ms", "pace_late_2_5ms", "pace_late_5ms_plus"
+};
 
 const SDL_Scancode windows_scancode_table[] =
 { 
@@ -160,8 +183,20 @@ int test_vsync(void) {
     }
 }
 
+static int64_t pacer_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * S_IN_NS + ts.tv_nsec;
+}
+
+static void pacer_init(void) {
+    pacer.period_ns = configFrameRate > 0.0f ? (int64_t)(S_IN_NS / configFrameRate) : 0;
+    pacer.deadline_ns = pacer_now();
+    pacer.spin_ns = PACER_MIN_SPIN_NS;
+}
+
 static void gfx_sdl_init(const char *game_name, bool start_in_fullscreen) {
-    clock_gettime(CLOCK_MONOTONIC, &prev_frame);
+    pacer_init();
     SDL_Init(SDL_INIT_VIDEO);
 
     SDL_GL_SetAttribute(SDL_GL_DEPTH_SIZE, 24);
@@ -284,52 +319,49 @@ static bool gfx_sdl_start_frame(void) {
 }
 
 
-// Returns difference between two timespec structures in nanoseconds
-static double diff_timespec(struct timespec *t1, struct timespec *t2) 
-{
-    struct timespec td;
-    td.tv_nsec = t2->tv_nsec - t1->tv_nsec;
-    td.tv_sec  = t2->tv_sec - t1->tv_sec;
-
-    if (td.tv_sec > 0 && td.tv_nsec < 0) {         
-        td.tv_nsec += S_IN_NS;         
-        td.tv_sec--;
-    }     
-    else if (td.tv_sec < 0 && td.tv_nsec > 0) {         
-        td.tv_nsec -= S_IN_NS;         
-        td.tv_sec++;     
+static void sync_framerate_with_timer(void) {
+    if (pacer.period_ns == 0) {
+        return;
+    }
+    pacer.deadline_ns += pacer.period_ns;
+    int64_t now = pacer_now();
+    if (now > pacer.deadline_ns + pacer.period_ns) {
+        // More than a frame behind (a load, or the window was dragged), start
+        // over from here rather than rushing the next frames to catch up
+        ProfEmitCounter(pacer_bucket_labels[PACER_NUM_BUCKETS - 1], 1);
+        pacer.deadline_ns = now;
+        return;
     }
 
-    return td.tv_nsec + td.tv_sec * S_IN_NS;
-}
-
-static void sync_framerate_with_timer(void) {
-    static struct timespec cur_time;
-
-    do {
-        clock_gettime(CLOCK_MONOTONIC, &cur_time);
-        double frametime = diff_timespec(&prev_frame, &cur_time);
-        double wait = TARGET_FRAMETIME - frametime;
-        if (wait <= 0) {
-            break;
-        } else if (wait >= SLEEP_FRAMETIME) {
-            SDL_Delay(5);
+    int64_t wake_at = pacer.deadline_ns - pacer.spin_ns;
+    if (now < wake_at) {
+        struct timespec ts = {wake_at / S_IN_NS, wake_at % S_IN_NS};
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
         }
-    } while(1);
-
-    prev_frame.tv_nsec = cur_time.tv_nsec;
-    prev_frame.tv_sec = cur_time.tv_sec;
-
-#if 0
-    // Number of milliseconds a frame should take (30 fps)
-    const Uint32 FRAME_TIME = 1000 / 30;
-    static Uint32 last_time;
-    Uint32 elapsed = SDL_GetTicks() - last_time;
+        now = pacer_now();
+        // Follow the oversleep quickly when it grows, slowly when it shrinks
+        int64_t oversleep = now - wake_at + PACER_MIN_SPIN_NS;
+        if (oversleep > pacer.spin_ns) {
+            pacer.spin_ns = oversleep;
+        } else {
+            pacer.spin_ns -= (pacer.spin_ns - oversleep) / 16;
+        }
+        if (pacer.spin_ns > PACER_MAX_SPIN_NS) {
+            pacer.spin_ns = PACER_MAX_SPIN_NS;
+        }
+    }
+    while (now < pacer.deadline_ns) {
+        now = pacer_now();
+    }
 
-    if (elapsed < FRAME_TIME)
-        SDL_Delay(FRAME_TIME - elapsed);
-    last_time += FRAME_TIME;
-#endif
+    int64_t late = now - pacer.deadline_ns;
+    int bucket = 0;
+    while (bucket < PACER_NUM_BUCKETS - 1 && late >= pacer_bucket_limits[bucket]) {
+        bucket++;
+    }
+    ProfEmitCounter(pacer_bucket_labels[bucket], 1);
+    ProfEmitCounter("pace_late_us", (double)late / US_IN_NS);
+    ProfEmitCounter("pace_spin_us", (double)pacer.spin_ns / US_IN_NS);
 }
 
 static void gfx_sdl_swap_buffers_begin(void) {
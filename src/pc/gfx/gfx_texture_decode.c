@@ -0,0 +1,412 @@
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+
+#include "gfx_texture_decode.h"
+
+// Same selection as gfx_vertex_batch.c. -DGFX_TEXTURE_DECODE_SCALAR forces the
+// reference decoder, -DGFX_TEXTURE_DECODE_GENERIC the vector extension kernels.
+#if defined(GFX_TEXTURE_DECODE_SCALAR)
+#define HAS_SSE2 0
+#define HAS_NEON 0
+#define HAS_VECTOR_EXT 0
+#elif defined(GFX_TEXTURE_DECODE_GENERIC) && defined(__GNUC__)
+#define HAS_SSE2 0
+#define HAS_NEON 0
+#define HAS_VECTOR_EXT 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define HAS_SSE2 1
+#define HAS_NEON 0
+#define HAS_VECTOR_EXT 0
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAS_SSE2 0
+#define HAS_NEON 1
+#define HAS_VECTOR_EXT 0
+#elif defined(__GNUC__)
+#define HAS_SSE2 0
+#define HAS_NEON 0
+#define HAS_VECTOR_EXT 1
+#else
+#define HAS_SSE2 0
+#define HAS_NEON 0
+#define HAS_VECTOR_EXT 0
+#endif
+
+// SCALE_M_N: upscale M-bit integer to N-bit, same as gfx_pc.c
+#define SCALE_5_8(VAL_) (((VAL_) * 0xFF) / 0x1F)
+#define SCALE_4_8(VAL_) ((VAL_) * 0x11)
+#define SCALE_3_8(VAL_) ((VAL_) * 0x24)
+
+// x * 255 / 31 == x * 8 + (x * 7 * 265) >> 13 for every 5 bit x, and the
+// product still fits in 16 bits, so the vector kernels can stay in 16 bit lanes.
+#define SCALE_5_8_MUL 1855
+#define SCALE_5_8_SHIFT 13
+
+static inline void put_rgba(uint8_t *dst, uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    dst[0] = r;
+    dst[1] = g;
+    dst[2] = b;
+    dst[3] = a;
+}
+
+static inline void decode_rgba16_texel(uint16_t col16, uint8_t *dst) {
+    uint8_t a = col16 & 1;
+    uint8_t r = col16 >> 11;
+    uint8_t g = (col16 >> 6) & 0x1f;
+    uint8_t b = (col16 >> 1) & 0x1f;
+    put_rgba(dst, SCALE_5_8(r), SCALE_5_8(g), SCALE_5_8(b), a ? 255 : 0);
+}
+
+size_t gfx_texture_decode_scalar(enum GfxTextureDecodeFormat fmt, const uint8_t *src, size_t size_bytes, const uint8_t *palette, uint8_t *rgba32_buf) {
+    switch (fmt) {
+        case GFX_TEXTURE_RGBA16:
+            for (size_t i = 0; i < size_bytes / 2; i++) {
+                decode_rgba16_texel((src[2 * i] << 8) | src[2 * i + 1], &rgba32_buf[4 * i]);
+            }
+            return size_bytes / 2;
+        case GFX_TEXTURE_IA4:
+            for (size_t i = 0; i < size_bytes * 2; i++) {
+                uint8_t part = (src[i / 2] >> (4 - (i % 2) * 4)) & 0xf;
+                uint8_t intensity = SCALE_3_8(part >> 1);
+                put_rgba(&rgba32_buf[4 * i], intensity, intensity, intensity, (part & 1) ? 255 : 0);
+            }
+            return size_bytes * 2;
+        case GFX_TEXTURE_IA8:
+            for (size_t i = 0; i < size_bytes; i++) {
+                uint8_t intensity = SCALE_4_8(src[i] >> 4);
+                put_rgba(&rgba32_buf[4 * i], intensity, intensity, intensity, SCALE_4_8(src[i] & 0xf));
+            }
+            return size_bytes;
+        case GFX_TEXTURE_IA16:
+            for (size_t i = 0; i < size_bytes / 2; i++) {
+                uint8_t intensity = src[2 * i];
+                put_rgba(&rgba32_buf[4 * i], intensity, intensity, intensity, src[2 * i + 1]);
+            }
+            return size_bytes / 2;
+        case GFX_TEXTURE_I4:
+            for (size_t i = 0; i < size_bytes * 2; i++) {
+                uint8_t part = (src[i / 2] >> (4 - (i % 2) * 4)) & 0xf;
+                uint8_t intensity = SCALE_4_8(part);
+                put_rgba(&rgba32_buf[4 * i], intensity, intensity, intensity, 255);
+            }
+            return size_bytes * 2;
+        case GFX_TEXTURE_I8:
+            for (size_t i = 0; i < size_bytes; i++) {
+                put_rgba(&rgba32_buf[4 * i], src[i], src[i], src[i], 255);
+            }
+            return size_bytes;
+        case GFX_TEXTURE_CI4:
+            for (size_t i = 0; i < size_bytes * 2; i++) {
+                uint8_t idx = (src[i / 2] >> (4 - (i % 2) * 4)) & 0xf;
+                decode_rgba16_texel((palette[idx * 2] << 8) | palette[idx * 2 + 1], &rgba32_buf[4 * i]); // Big endian load
+            }
+            return size_bytes * 2;
+        case GFX_TEXTURE_CI8:
+            for (size_t i = 0; i < size_bytes; i++) {
+                uint8_t idx = src[i];
+                decode_rgba16_texel((palette[idx * 2] << 8) | palette[idx * 2 + 1], &rgba32_buf[4 * i]); // Big endian load
+            }
+            return size_bytes;
+    }
+    return 0;
+}
+
+#ifndef GFX_TEXTURE_DECODE_SCALAR
+
+// Each kernel decodes as many whole blocks as it can and returns how many
+// texels that was, the scalar code finishes the tail.
+
+#if HAS_SSE2
+static inline __m128i scale_5_8_sse2(__m128i x) {
+    __m128i frac = _mm_srli_epi16(_mm_mullo_epi16(x, _mm_set1_epi16(SCALE_5_8_MUL)), SCALE_5_8_SHIFT);
+    return _mm_add_epi16(_mm_slli_epi16(x, 3), frac);
+}
+
+static size_t decode_rgba16_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    const __m128i mask5 = _mm_set1_epi16(0x1f);
+    const __m128i one = _mm_set1_epi16(1);
+    const __m128i low_byte = _mm_set1_epi16(0xff);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        __m128i col = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8)); // Big endian load
+        __m128i r = scale_5_8_sse2(_mm_srli_epi16(col, 11));
+        __m128i g = scale_5_8_sse2(_mm_and_si128(_mm_srli_epi16(col, 6), mask5));
+        __m128i b = scale_5_8_sse2(_mm_and_si128(_mm_srli_epi16(col, 1), mask5));
+        __m128i a = _mm_and_si128(_mm_sub_epi16(_mm_setzero_si128(), _mm_and_si128(col, one)), low_byte);
+        __m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+        __m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), _mm_unpacklo_epi16(rg, ba));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i + 16), _mm_unpackhi_epi16(rg, ba));
+    }
+    return i;
+}
+
+static size_t decode_ia16_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    const __m128i low_byte = _mm_set1_epi16(0xff);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i ia = _mm_loadu_si128((const __m128i *)(src + 2 * i));
+        __m128i intensity = _mm_and_si128(ia, low_byte);
+        __m128i ii = _mm_or_si128(intensity, _mm_slli_epi16(intensity, 8));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i), _mm_unpacklo_epi16(ii, ia));
+        _mm_storeu_si128((__m128i *)(dst + 4 * i + 16), _mm_unpackhi_epi16(ii, ia));
+    }
+    return i;
+}
+
+static inline void store_intensity_alpha_sse2(uint8_t *dst, __m128i intensity, __m128i alpha) {
+    __m128i ii_lo = _mm_unpacklo_epi8(intensity, intensity);
+    __m128i ii_hi = _mm_unpackhi_epi8(intensity, intensity);
+    __m128i ia_lo = _mm_unpacklo_epi8(intensity, alpha);
+    __m128i ia_hi = _mm_unpackhi_epi8(intensity, alpha);
+    _mm_storeu_si128((__m128i *)(dst + 0), _mm_unpacklo_epi16(ii_lo, ia_lo));
+    _mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(ii_lo, ia_lo));
+    _mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi16(ii_hi, ia_hi));
+    _mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi16(ii_hi, ia_hi));
+}
+
+static size_t decode_i8_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    const __m128i opaque = _mm_set1_epi8((char)0xff);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        store_intensity_alpha_sse2(dst + 4 * i, _mm_loadu_si128((const __m128i *)(src + i)), opaque);
+    }
+    return i;
+}
+
+static size_t decode_ia8_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    const __m128i high_nibbles = _mm_set1_epi8((char)0xf0);
+    const __m128i low_nibbles = _mm_set1_epi8(0x0f);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        // n * 0x11 == n << 4 | n
+        __m128i intensity = _mm_or_si128(_mm_and_si128(v, high_nibbles), _mm_and_si128(_mm_srli_epi16(v, 4), low_nibbles));
+        __m128i alpha = _mm_or_si128(_mm_and_si128(_mm_slli_epi16(v, 4), high_nibbles), _mm_and_si128(v, low_nibbles));
+        store_intensity_alpha_sse2(dst + 4 * i, intensity, alpha);
+    }
+    return i;
+}
+#endif
+
+#if HAS_NEON
+static inline uint16x8_t scale_5_8_neon(uint16x8_t x) {
+    uint16x8_t frac = vshrq_n_u16(vmulq_n_u16(x, SCALE_5_8_MUL), SCALE_5_8_SHIFT);
+    return vaddq_u16(vshlq_n_u16(x, 3), frac);
+}
+
+static size_t decode_rgba16_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    const uint16x8_t mask5 = vdupq_n_u16(0x1f);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint16x8_t col = vreinterpretq_u16_u8(vrev16q_u8(vld1q_u8(src + 2 * i))); // Big endian load
+        uint8x8x4_t rgba;
+        rgba.val[0] = vmovn_u16(scale_5_8_neon(vshrq_n_u16(col, 11)));
+        rgba.val[1] = vmovn_u16(scale_5_8_neon(vandq_u16(vshrq_n_u16(col, 6), mask5)));
+        rgba.val[2] = vmovn_u16(scale_5_8_neon(vandq_u16(vshrq_n_u16(col, 1), mask5)));
+        rgba.val[3] = vmovn_u16(vsubq_u16(vdupq_n_u16(0), vandq_u16(col, vdupq_n_u16(1))));
+        vst4_u8(dst + 4 * i, rgba);
+    }
+    return i;
+}
+
+static size_t decode_ia16_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16x2_t ia = vld2q_u8(src + 2 * i);
+        uint8x16x4_t rgba = {{ ia.val[0], ia.val[0], ia.val[0], ia.val[1] }};
+        vst4q_u8(dst + 4 * i, rgba);
+    }
+    return i;
+}
+
+static size_t decode_i8_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        uint8x16x4_t rgba = {{ v, v, v, vdupq_n_u8(0xff) }};
+        vst4q_u8(dst + 4 * i, rgba);
+    }
+    return i;
+}
+
+static size_t decode_ia8_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        // n * 0x11 == n << 4 | n
+        uint8x16_t intensity = vorrq_u8(vandq_u8(v, vdupq_n_u8(0xf0)), vshrq_n_u8(v, 4));
+        uint8x16_t alpha = vorrq_u8(vshlq_n_u8(v, 4), vandq_u8(v, vdupq_n_u8(0x0f)));
+        uint8x16x4_t rgba = {{ intensity, intensity, intensity, alpha }};
+        vst4q_u8(dst + 4 * i, rgba);
+    }
+    return i;
+}
+#endif
+
+#if HAS_VECTOR_EXT
+typedef uint16_t v8u16 __attribute__((vector_size(16)));
+
+static size_t decode_rgba16_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    const v8u16 mask5 = {0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f, 0x1f};
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        v8u16 col;
+        memcpy(&col, src + 2 * i, sizeof(col));
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        col = (col << 8) | (col >> 8); // Big endian load
+#endif
+        v8u16 r = col >> 11;
+        v8u16 g = (col >> 6) & mask5;
+        v8u16 b = (col >> 1) & mask5;
+        r = (r << 3) + ((r * SCALE_5_8_MUL) >> SCALE_5_8_SHIFT);
+        g = (g << 3) + ((g * SCALE_5_8_MUL) >> SCALE_5_8_SHIFT);
+        b = (b << 3) + ((b * SCALE_5_8_MUL) >> SCALE_5_8_SHIFT);
+        v8u16 a = -(col & 1);
+        for (int lane = 0; lane < 8; lane++) {
+            put_rgba(dst + 4 * (i + lane), r[lane], g[lane], b[lane], a[lane]);
+        }
+    }
+    return i;
+}
+#endif
+
+#if !HAS_SSE2 && !HAS_NEON
+// Without byte shuffles the 8 bit formats are just table lookups. IA16 is
+// already one byte copy per channel in the scalar code, and RGBA16 without
+// vector extensions too, so they have no kernel here.
+static uint32_t lut_i8[256];
+static uint32_t lut_ia8[256];
+
+static size_t decode_i8_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    for (size_t i = 0; i < n; i++) {
+        memcpy(dst + 4 * i, &lut_i8[src[i]], 4);
+    }
+    return n;
+}
+
+static size_t decode_ia8_block(const uint8_t *src, size_t n, uint8_t *dst) {
+    for (size_t i = 0; i < n; i++) {
+        memcpy(dst + 4 * i, &lut_ia8[src[i]], 4);
+    }
+    return n;
+}
+#endif
+
+// 4 bit formats: every source byte becomes two texels
+static uint32_t lut_i4[256][2];
+static uint32_t lut_ia4[256][2];
+static bool luts_ready;
+
+static void init_luts(void) {
+    for (int i = 0; i < 256; i++) {
+        uint8_t byte = i;
+        gfx_texture_decode_scalar(GFX_TEXTURE_I4, &byte, 1, NULL, (uint8_t *)lut_i4[i]);
+        gfx_texture_decode_scalar(GFX_TEXTURE_IA4, &byte, 1, NULL, (uint8_t *)lut_ia4[i]);
+#if !HAS_SSE2 && !HAS_NEON
+        gfx_texture_decode_scalar(GFX_TEXTURE_I8, &byte, 1, NULL, (uint8_t *)&lut_i8[i]);
+        gfx_texture_decode_scalar(GFX_TEXTURE_IA8, &byte, 1, NULL, (uint8_t *)&lut_ia8[i]);
+#endif
+    }
+    luts_ready = true;
+}
+
+static void expand_pairs(const uint32_t lut[256][2], const uint8_t *src, size_t size_bytes, uint8_t *dst) {
+    for (size_t i = 0; i < size_bytes; i++) {
+        memcpy(dst + 8 * i, lut[src[i]], 8);
+    }
+}
+
+static size_t decode_fast(enum GfxTextureDecodeFormat fmt, const uint8_t *src, size_t size_bytes, const uint8_t *palette, uint8_t *rgba32_buf) {
+    size_t done;
+    uint32_t tlut[256];
+    int max_index;
+
+    if (!luts_ready) {
+        init_luts();
+    }
+
+    switch (fmt) {
+        case GFX_TEXTURE_RGBA16:
+#if HAS_SSE2 || HAS_NEON || HAS_VECTOR_EXT
+            done = decode_rgba16_block(src, size_bytes / 2, rgba32_buf);
+#else
+            done = 0;
+#endif
+            gfx_texture_decode_scalar(fmt, src + 2 * done, size_bytes - 2 * done, palette, rgba32_buf + 4 * done);
+            return size_bytes / 2;
+        case GFX_TEXTURE_IA16:
+#if HAS_SSE2 || HAS_NEON
+            done = decode_ia16_block(src, size_bytes / 2, rgba32_buf);
+#else
+            done = 0;
+#endif
+            gfx_texture_decode_scalar(fmt, src + 2 * done, size_bytes - 2 * done, palette, rgba32_buf + 4 * done);
+            return size_bytes / 2;
+        case GFX_TEXTURE_I8:
+            done = decode_i8_block(src, size_bytes, rgba32_buf);
+            gfx_texture_decode_scalar(fmt, src + done, size_bytes - done, palette, rgba32_buf + 4 * done);
+            return size_bytes;
+        case GFX_TEXTURE_IA8:
+            done = decode_ia8_block(src, size_bytes, rgba32_buf);
+            gfx_texture_decode_scalar(fmt, src + done, size_bytes - done, palette, rgba32_buf + 4 * done);
+            return size_bytes;
+        case GFX_TEXTURE_I4:
+            expand_pairs(lut_i4, src, size_bytes, rgba32_buf);
+            return size_bytes * 2;
+        case GFX_TEXTURE_IA4:
+            expand_pairs(lut_ia4, src, size_bytes, rgba32_buf);
+            return size_bytes * 2;
+        case GFX_TEXTURE_CI4:
+            // Decode the palette once, then it's a lookup per texel. Only up to
+            // the highest index used, as the TLUT loaded may be shorter.
+            max_index = 0;
+            for (size_t i = 0; i < size_bytes; i++) {
+                if ((src[i] >> 4) > max_index) {
+                    max_index = src[i] >> 4;
+                }
+                if ((src[i] & 0xf) > max_index) {
+                    max_index = src[i] & 0xf;
+                }
+            }
+            gfx_texture_decode(GFX_TEXTURE_RGBA16, palette, (max_index + 1) * 2, NULL, (uint8_t *)tlut);
+            for (size_t i = 0; i < size_bytes; i++) {
+                memcpy(rgba32_buf + 8 * i, &tlut[src[i] >> 4], 4);
+                memcpy(rgba32_buf + 8 * i + 4, &tlut[src[i] & 0xf], 4);
+            }
+            return size_bytes * 2;
+        case GFX_TEXTURE_CI8:
+            max_index = 0;
+            for (size_t i = 0; i < size_bytes; i++) {
+                if (src[i] > max_index) {
+                    max_index = src[i];
+                }
+            }
+            gfx_texture_decode(GFX_TEXTURE_RGBA16, palette, (max_index + 1) * 2, NULL, (uint8_t *)tlut);
+            for (size_t i = 0; i < size_bytes; i++) {
+                memcpy(rgba32_buf + 4 * i, &tlut[src[i]], 4);
+            }
+            return size_bytes;
+    }
+    return 0;
+}
+#endif
+
+size_t gfx_texture_decode(enum GfxTextureDecodeFormat fmt, const uint8_t *src, size_t size_bytes, const uint8_t *palette, uint8_t *rgba32_buf) {
+#ifndef GFX_TEXTURE_DECODE_SCALAR
+    size_t texels = decode_fast(fmt, src, size_bytes, palette, rgba32_buf);
+#ifdef GFX_TEXTURE_DECODE_VERIFY
+    static uint8_t reference[32768];
+    assert(texels * 4 <= sizeof(reference));
+    size_t ref_texels = gfx_texture_decode_scalar(fmt, src, size_bytes, palette, reference);
+    assert(texels == ref_texels);
+    assert(memcmp(rgba32_buf, reference, texels * 4) == 0);
+#endif
+    return texels;
+#else
+    return gfx_texture_decode_scalar(fmt, src, size_bytes, palette, rgba32_buf);
+#endif
+}
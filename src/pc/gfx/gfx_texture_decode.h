@@ -0,0 +1,33 @@
+#ifndef GFX_TEXTURE_DECODE_H
+#define GFX_TEXTURE_DECODE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum GfxTextureDecodeFormat {
+    GFX_TEXTURE_RGBA16,
+    GFX_TEXTURE_IA4,
+    GFX_TEXTURE_IA8,
+    GFX_TEXTURE_IA16,
+    GFX_TEXTURE_I4,
+    GFX_TEXTURE_I8,
+    GFX_TEXTURE_CI4,
+    GFX_TEXTURE_CI8
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Expands size_bytes of N64 texels to RGBA32 and returns the number of texels
+// written. palette is the big endian RGBA16 TLUT, only read by the CI formats.
+size_t gfx_texture_decode(enum GfxTextureDecodeFormat fmt, const uint8_t *src, size_t size_bytes, const uint8_t *palette, uint8_t *rgba32_buf);
+
+// One texel at a time reference, bit-identical to the vector kernels.
+size_t gfx_texture_decode_scalar(enum GfxTextureDecodeFormat fmt, const uint8_t *src, size_t size_bytes, const uint8_t *palette, uint8_t *rgba32_buf);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
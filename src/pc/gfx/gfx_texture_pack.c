@@ -0,0 +1,138 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "gfx_texture_pack.h"
+#include "../cheapProfiler.h"
+
+static struct {
+    const uint8_t *data;
+    size_t size;
+    const struct GfxTexturePackEntry *entries;
+    uint32_t num_entries;
+#ifdef _WIN32
+    HANDLE file;
+    HANDLE mapping;
+#endif
+} pack;
+
+static bool gfx_texture_pack_validate(void) {
+    const struct GfxTexturePackHeader *header = (const struct GfxTexturePackHeader *)pack.data;
+    if (pack.size < sizeof(*header) || header->magic != GFX_TEXTURE_PACK_MAGIC) {
+        return false;
+    }
+    size_t index_end = sizeof(*header) + (size_t)header->num_entries * sizeof(struct GfxTexturePackEntry);
+    if (index_end > pack.size) {
+        return false;
+    }
+    pack.entries = (const struct GfxTexturePackEntry *)(pack.data + sizeof(*header));
+    pack.num_entries = header->num_entries;
+    for (uint32_t i = 0; i < pack.num_entries; i++) {
+        const struct GfxTexturePackEntry *e = &pack.entries[i];
+        if (e->offset < index_end || e->offset % 4 != 0 || (size_t)e->offset + e->rgba32_size > pack.size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool gfx_texture_pack_open(const char *path) {
+#ifdef _WIN32
+    pack.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (pack.file == INVALID_HANDLE_VALUE) {
+        printf("No texture pack at %s, decoding textures as they load\n", path);
+        return false;
+    }
+    LARGE_INTEGER size;
+    GetFileSizeEx(pack.file, &size);
+    pack.size = (size_t)size.QuadPart;
+    pack.mapping = CreateFileMappingA(pack.file, NULL, PAGE_READONLY, 0, 0, NULL);
+    pack.data = pack.mapping != NULL ? MapViewOfFile(pack.mapping, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (pack.data == NULL) {
+        gfx_texture_pack_close();
+        return false;
+    }
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("No texture pack at %s, decoding textures as they load\n", path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return false;
+    }
+    pack.data = data;
+    pack.size = st.st_size;
+#endif
+
+    if (!gfx_texture_pack_validate()) {
+        fprintf(stderr, "Ignoring invalid texture pack %s\n", path);
+        gfx_texture_pack_close();
+        return false;
+    }
+    printf("Texture pack %s: %u textures\n", path, (unsigned)pack.num_entries);
+    return true;
+}
+
+void gfx_texture_pack_close(void) {
+#ifdef _WIN32
+    if (pack.data != NULL) {
+        UnmapViewOfFile(pack.data);
+    }
+    if (pack.mapping != NULL) {
+        CloseHandle(pack.mapping);
+    }
+    if (pack.file != NULL && pack.file != INVALID_HANDLE_VALUE) {
+        CloseHandle(pack.file);
+    }
+    pack.mapping = NULL;
+    pack.file = NULL;
+#else
+    if (pack.data != NULL) {
+        munmap((void *)pack.data, pack.size);
+    }
+#endif
+    pack.data = NULL;
+    pack.size = 0;
+    pack.entries = NULL;
+    pack.num_entries = 0;
+}
+
+const uint8_t *gfx_texture_pack_lookup(const uint8_t *addr, uint32_t size_bytes, uint8_t fmt, uint8_t siz) {
+    if (pack.num_entries == 0) {
+        return NULL;
+    }
+
+    uint64_t key = gfx_texture_pack_hash(addr, size_bytes);
+    uint32_t lo = 0, hi = pack.num_entries;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = gfx_texture_pack_compare(&pack.entries[mid], key, size_bytes, fmt, siz);
+        if (cmp == 0) {
+            ProfEmitCounter("tex_pack_hits", 1);
+            return pack.data + pack.entries[mid].offset;
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    ProfEmitCounter("tex_pack_misses", 1);
+    return NULL;
+}
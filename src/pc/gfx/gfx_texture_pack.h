@@ -0,0 +1,98 @@
+#ifndef GFX_TEXTURE_PACK_H
+#define GFX_TEXTURE_PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Pre-decoded texture pack written by tools/texpack. Textures are found by the
+// contents of the raw N64 data rather than its address, so the pack does not
+// depend on how the executable was linked. Layout, host endian (the tool and
+// the game have to agree, which they do for every supported target):
+//
+//   struct GfxTexturePackHeader
+//   struct GfxTexturePackEntry[num_entries], sorted by key, size_bytes, fmt, siz
+//   RGBA32 payloads, each at its entry's offset from the start of the file
+
+#define GFX_TEXTURE_PACK_MAGIC 0x314b5054 // "TPK1"
+#define GFX_TEXTURE_PACK_FILE "textures.pack" // next to the executable, see path_next_to_exe
+
+struct GfxTexturePackHeader {
+    uint32_t magic;
+    uint32_t num_entries;
+};
+
+struct GfxTexturePackEntry {
+    uint64_t key;
+    uint32_t size_bytes; // of the raw N64 data
+    uint8_t fmt;         // G_IM_FMT_*
+    uint8_t siz;         // G_IM_SIZ_*
+    uint16_t pad;
+    uint32_t offset;
+    uint32_t rgba32_size;
+};
+
+// Two murmur3 style lanes over the raw texture, shared by the tool and the game
+static inline uint64_t gfx_texture_pack_hash(const uint8_t *data, size_t size) {
+    uint32_t h1 = 0x9747b28c ^ (uint32_t)size;
+    uint32_t h2 = 0x2f2fd1a3 ^ (uint32_t)size;
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        uint32_t k;
+        memcpy(&k, data + i, 4);
+        k *= 0xcc9e2d51;
+        k = (k << 15) | (k >> 17);
+        k *= 0x1b873593;
+        h1 ^= k;
+        h1 = (h1 << 13) | (h1 >> 19);
+        h1 = h1 * 5 + 0xe6546b64;
+        h2 += k;
+        h2 = (h2 << 17) | (h2 >> 15);
+        h2 = h2 * 9 + 0x52dce729;
+    }
+    for (; i < size; i++) {
+        h1 = (h1 ^ data[i]) * 0x01000193;
+        h2 = (h2 + data[i]) * 0x85ebca6b;
+    }
+    h1 ^= h1 >> 16;
+    h1 *= 0x85ebca6b;
+    h1 ^= h1 >> 13;
+    h1 *= 0xc2b2ae35;
+    h1 ^= h1 >> 16;
+    h2 ^= h2 >> 15;
+    h2 *= 0x2c1b3c6d;
+    h2 ^= h2 >> 12;
+    h2 *= 0x297a2d39;
+    h2 ^= h2 >> 15;
+    return ((uint64_t)h1 << 32) | h2;
+}
+
+static inline int gfx_texture_pack_compare(const struct GfxTexturePackEntry *a, uint64_t key, uint32_t size_bytes, uint8_t fmt, uint8_t siz) {
+    if (a->key != key) {
+        return a->key < key ? -1 : 1;
+    }
+    if (a->size_bytes != size_bytes) {
+        return a->size_bytes < size_bytes ? -1 : 1;
+    }
+    if (a->fmt != fmt) {
+        return a->fmt < fmt ? -1 : 1;
+    }
+    if (a->siz != siz) {
+        return a->siz < siz ? -1 : 1;
+    }
+    return 0;
+}
+
+#ifndef GFX_TEXTURE_PACK_TOOL
+
+// Maps the pack, returns false (and the game decodes everything) if it's missing or stale
+bool gfx_texture_pack_open(const char *path);
+void gfx_texture_pack_close(void);
+
+// Returns the decoded RGBA32 texels of a raw texture, or NULL if it isn't in the pack
+const uint8_t *gfx_texture_pack_lookup(const uint8_t *addr, uint32_t size_bytes, uint8_t fmt, uint8_t siz);
+
+#endif
+
+#endif
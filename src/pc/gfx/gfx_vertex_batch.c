@@ -0,0 +1,338 @@
+#include <math.h>
+#include <string.h>
+#include <assert.h>
+
+#include "gfx_vertex_batch.h"
+
+// Pick the widest kernel the compiler lets us use. The scalar and generic
+// variants can be forced for comparison with -DGFX_VERTEX_BATCH_SCALAR or
+// -DGFX_VERTEX_BATCH_GENERIC. As in the mixer, the generic kernel is only
+// picked for targets with a vector unit: without one (the OD's MIPS) GCC
+// splits the lanes up again and it ends up slower than the scalar code.
+#if defined(GFX_VERTEX_BATCH_SCALAR)
+#define HAS_SSE 0
+#define HAS_NEON 0
+#define HAS_VECTOR_EXT 0
+#elif defined(GFX_VERTEX_BATCH_GENERIC) && defined(__GNUC__)
+#define HAS_SSE 0
+#define HAS_NEON 0
+#define HAS_VECTOR_EXT 1
+#elif defined(__SSE__)
+#include <xmmintrin.h>
+#define HAS_SSE 1
+#define HAS_NEON 0
+#define HAS_VECTOR_EXT 0
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#define HAS_SSE 0
+#define HAS_NEON 1
+#define HAS_VECTOR_EXT 0
+#elif defined(__GNUC__) && (defined(__ALTIVEC__) || defined(__mips_msa) || defined(__wasm_simd128__) || defined(__riscv_vector))
+#define HAS_SSE 0
+#define HAS_NEON 0
+#define HAS_VECTOR_EXT 1
+#else
+#define HAS_SSE 0
+#define HAS_NEON 0
+#define HAS_VECTOR_EXT 0
+#endif
+
+#define CLIP_NEG_X 1
+#define CLIP_POS_X 2
+#define CLIP_NEG_Y 4
+#define CLIP_POS_Y 8
+#define CLIP_NEG_Z 16
+#define CLIP_POS_Z 32
+
+// Never turn a*b+c into an fma here, the vector kernels must round exactly like the scalar one.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize ("fp-contract=off")
+#elif defined(__clang__)
+#pragma STDC FP_CONTRACT OFF
+#endif
+
+// Loads the object space positions of one lane group into structure of arrays
+// layout. Lanes past n_vertices repeat the last vertex, their results are ignored.
+static void gather_positions(const Vtx *vertices, size_t n_vertices, size_t base, float ob[3][GFX_VERTEX_BATCH_LANES]) {
+    for (int lane = 0; lane < GFX_VERTEX_BATCH_LANES; lane++) {
+        size_t i = base + lane < n_vertices ? base + lane : n_vertices - 1;
+        ob[0][lane] = vertices[i].v.ob[0];
+        ob[1][lane] = vertices[i].v.ob[1];
+        ob[2][lane] = vertices[i].v.ob[2];
+    }
+}
+
+static void transform_one_scalar(const float ob[3], const struct GfxVertexBatchParams *params, struct GfxVertexBatch *out, size_t i) {
+    const float (*m)[4] = params->mp_matrix;
+
+    float x = ob[0] * m[0][0] + ob[1] * m[1][0] + ob[2] * m[2][0] + m[3][0];
+    float y = ob[0] * m[0][1] + ob[1] * m[1][1] + ob[2] * m[2][1] + m[3][1];
+    float z = ob[0] * m[0][2] + ob[1] * m[1][2] + ob[2] * m[2][2] + m[3][2];
+    float w = ob[0] * m[0][3] + ob[1] * m[1][3] + ob[2] * m[2][3] + m[3][3];
+
+    x = x * (4.0f / 3.0f) / params->aspect_ratio;
+
+    uint8_t clip_rej = 0;
+    if (x < -w) clip_rej |= CLIP_NEG_X;
+    if (x > w) clip_rej |= CLIP_POS_X;
+    if (y < -w) clip_rej |= CLIP_NEG_Y;
+    if (y > w) clip_rej |= CLIP_POS_Y;
+    if (z < -w) clip_rej |= CLIP_NEG_Z;
+    if (z > w) clip_rej |= CLIP_POS_Z;
+
+    out->x[i] = x;
+    out->y[i] = y;
+    out->z[i] = z;
+    out->w[i] = w;
+    out->clip_rej[i] = clip_rej;
+
+    if (params->fog) {
+        if (fabsf(w) < 0.001f) {
+            // To avoid division by zero
+            w = 0.001f;
+        }
+
+        float winv = 1.0f / w;
+        if (winv < 0.0f) {
+            winv = 32767.0f;
+        }
+
+        float fog_z = z * winv * params->fog_mul + params->fog_offset;
+        if (fog_z < 0) fog_z = 0;
+        if (fog_z > 255) fog_z = 255;
+        out->fog_z[i] = fog_z;
+    }
+}
+
+void gfx_vertex_batch_transform_scalar(const Vtx *vertices, size_t n_vertices, const struct GfxVertexBatchParams *params, struct GfxVertexBatch *out) {
+    assert(n_vertices <= GFX_VERTEX_BATCH_MAX);
+    for (size_t i = 0; i < n_vertices; i++) {
+        const float ob[3] = { vertices[i].v.ob[0], vertices[i].v.ob[1], vertices[i].v.ob[2] };
+        transform_one_scalar(ob, params, out, i);
+    }
+}
+
+#if HAS_SSE
+static void transform_lanes_sse(const float ob[3][GFX_VERTEX_BATCH_LANES], const struct GfxVertexBatchParams *params, struct GfxVertexBatch *out, size_t base) {
+    const float (*m)[4] = params->mp_matrix;
+    __m128 obx = _mm_loadu_ps(ob[0]);
+    __m128 oby = _mm_loadu_ps(ob[1]);
+    __m128 obz = _mm_loadu_ps(ob[2]);
+    __m128 pos[4];
+
+    for (int c = 0; c < 4; c++) {
+        pos[c] = _mm_add_ps(_mm_add_ps(_mm_add_ps(
+            _mm_mul_ps(obx, _mm_set1_ps(m[0][c])),
+            _mm_mul_ps(oby, _mm_set1_ps(m[1][c]))),
+            _mm_mul_ps(obz, _mm_set1_ps(m[2][c]))),
+            _mm_set1_ps(m[3][c]));
+    }
+
+    __m128 x = _mm_div_ps(_mm_mul_ps(pos[0], _mm_set1_ps(4.0f / 3.0f)), _mm_set1_ps(params->aspect_ratio));
+    __m128 y = pos[1], z = pos[2], w = pos[3];
+    __m128 neg_w = _mm_sub_ps(_mm_setzero_ps(), w);
+
+    int masks[6] = {
+        _mm_movemask_ps(_mm_cmplt_ps(x, neg_w)),
+        _mm_movemask_ps(_mm_cmpgt_ps(x, w)),
+        _mm_movemask_ps(_mm_cmplt_ps(y, neg_w)),
+        _mm_movemask_ps(_mm_cmpgt_ps(y, w)),
+        _mm_movemask_ps(_mm_cmplt_ps(z, neg_w)),
+        _mm_movemask_ps(_mm_cmpgt_ps(z, w))
+    };
+    for (int lane = 0; lane < GFX_VERTEX_BATCH_LANES; lane++) {
+        uint8_t clip_rej = 0;
+        for (int plane = 0; plane < 6; plane++) {
+            clip_rej |= ((masks[plane] >> lane) & 1) << plane;
+        }
+        out->clip_rej[base + lane] = clip_rej;
+    }
+
+    _mm_storeu_ps(&out->x[base], x);
+    _mm_storeu_ps(&out->y[base], y);
+    _mm_storeu_ps(&out->z[base], z);
+    _mm_storeu_ps(&out->w[base], w);
+
+    if (params->fog) {
+        const __m128 sign_mask = _mm_set1_ps(-0.0f);
+        const __m128 min_w = _mm_set1_ps(0.001f);
+        __m128 tiny = _mm_cmplt_ps(_mm_andnot_ps(sign_mask, w), min_w);
+        __m128 safe_w = _mm_or_ps(_mm_and_ps(tiny, min_w), _mm_andnot_ps(tiny, w));
+        __m128 winv = _mm_div_ps(_mm_set1_ps(1.0f), safe_w);
+        __m128 behind = _mm_cmplt_ps(winv, _mm_setzero_ps());
+        winv = _mm_or_ps(_mm_and_ps(behind, _mm_set1_ps(32767.0f)), _mm_andnot_ps(behind, winv));
+
+        __m128 fog_z = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(z, winv), _mm_set1_ps(params->fog_mul)), _mm_set1_ps(params->fog_offset));
+        fog_z = _mm_min_ps(_mm_max_ps(fog_z, _mm_setzero_ps()), _mm_set1_ps(255.0f));
+        _mm_storeu_ps(&out->fog_z[base], fog_z);
+    }
+}
+#endif
+
+#if HAS_NEON
+static float32x4_t div_neon(float32x4_t a, float32x4_t b) {
+#ifdef __aarch64__
+    return vdivq_f32(a, b);
+#else
+    // ARMv7 NEON only has reciprocal estimates, which would not match the scalar path
+    float va[4], vb[4];
+    vst1q_f32(va, a);
+    vst1q_f32(vb, b);
+    for (int i = 0; i < 4; i++) {
+        va[i] = va[i] / vb[i];
+    }
+    return vld1q_f32(va);
+#endif
+}
+
+static void transform_lanes_neon(const float ob[3][GFX_VERTEX_BATCH_LANES], const struct GfxVertexBatchParams *params, struct GfxVertexBatch *out, size_t base) {
+    static const uint32_t plane_bits_data[6][4] = {
+        {CLIP_NEG_X, CLIP_NEG_X, CLIP_NEG_X, CLIP_NEG_X}, {CLIP_POS_X, CLIP_POS_X, CLIP_POS_X, CLIP_POS_X},
+        {CLIP_NEG_Y, CLIP_NEG_Y, CLIP_NEG_Y, CLIP_NEG_Y}, {CLIP_POS_Y, CLIP_POS_Y, CLIP_POS_Y, CLIP_POS_Y},
+        {CLIP_NEG_Z, CLIP_NEG_Z, CLIP_NEG_Z, CLIP_NEG_Z}, {CLIP_POS_Z, CLIP_POS_Z, CLIP_POS_Z, CLIP_POS_Z}
+    };
+    const float (*m)[4] = params->mp_matrix;
+    float32x4_t obx = vld1q_f32(ob[0]);
+    float32x4_t oby = vld1q_f32(ob[1]);
+    float32x4_t obz = vld1q_f32(ob[2]);
+    float32x4_t pos[4];
+
+    // vmlaq_f32 may fuse on some cores, so keep the multiplies and adds separate.
+    for (int c = 0; c < 4; c++) {
+        pos[c] = vaddq_f32(vaddq_f32(vaddq_f32(
+            vmulq_n_f32(obx, m[0][c]),
+            vmulq_n_f32(oby, m[1][c])),
+            vmulq_n_f32(obz, m[2][c])),
+            vdupq_n_f32(m[3][c]));
+    }
+
+    float32x4_t x = div_neon(vmulq_n_f32(pos[0], 4.0f / 3.0f), vdupq_n_f32(params->aspect_ratio));
+    float32x4_t y = pos[1], z = pos[2], w = pos[3];
+    float32x4_t neg_w = vnegq_f32(w);
+
+    uint32x4_t clip = vandq_u32(vcltq_f32(x, neg_w), vld1q_u32(plane_bits_data[0]));
+    clip = vorrq_u32(clip, vandq_u32(vcgtq_f32(x, w), vld1q_u32(plane_bits_data[1])));
+    clip = vorrq_u32(clip, vandq_u32(vcltq_f32(y, neg_w), vld1q_u32(plane_bits_data[2])));
+    clip = vorrq_u32(clip, vandq_u32(vcgtq_f32(y, w), vld1q_u32(plane_bits_data[3])));
+    clip = vorrq_u32(clip, vandq_u32(vcltq_f32(z, neg_w), vld1q_u32(plane_bits_data[4])));
+    clip = vorrq_u32(clip, vandq_u32(vcgtq_f32(z, w), vld1q_u32(plane_bits_data[5])));
+
+    out->clip_rej[base + 0] = vgetq_lane_u32(clip, 0);
+    out->clip_rej[base + 1] = vgetq_lane_u32(clip, 1);
+    out->clip_rej[base + 2] = vgetq_lane_u32(clip, 2);
+    out->clip_rej[base + 3] = vgetq_lane_u32(clip, 3);
+
+    vst1q_f32(&out->x[base], x);
+    vst1q_f32(&out->y[base], y);
+    vst1q_f32(&out->z[base], z);
+    vst1q_f32(&out->w[base], w);
+
+    if (params->fog) {
+        const float32x4_t min_w = vdupq_n_f32(0.001f);
+        float32x4_t safe_w = vbslq_f32(vcltq_f32(vabsq_f32(w), min_w), min_w, w);
+        float32x4_t winv = div_neon(vdupq_n_f32(1.0f), safe_w);
+        winv = vbslq_f32(vcltq_f32(winv, vdupq_n_f32(0.0f)), vdupq_n_f32(32767.0f), winv);
+
+        float32x4_t fog_z = vaddq_f32(vmulq_n_f32(vmulq_f32(z, winv), params->fog_mul), vdupq_n_f32(params->fog_offset));
+        fog_z = vminq_f32(vmaxq_f32(fog_z, vdupq_n_f32(0.0f)), vdupq_n_f32(255.0f));
+        vst1q_f32(&out->fog_z[base], fog_z);
+    }
+}
+#endif
+
+#if HAS_VECTOR_EXT
+typedef float v4sf __attribute__((vector_size(16)));
+typedef int32_t v4si __attribute__((vector_size(16)));
+
+static inline v4sf v4sf_select(v4si mask, v4sf a, v4sf b) {
+    return (v4sf)((mask & (v4si)a) | (~mask & (v4si)b));
+}
+
+static void transform_lanes_generic(const float ob[3][GFX_VERTEX_BATCH_LANES], const struct GfxVertexBatchParams *params, struct GfxVertexBatch *out, size_t base) {
+    const float (*m)[4] = params->mp_matrix;
+    v4sf obx, oby, obz;
+    v4sf pos[4];
+
+    memcpy(&obx, ob[0], sizeof(obx));
+    memcpy(&oby, ob[1], sizeof(oby));
+    memcpy(&obz, ob[2], sizeof(obz));
+
+    for (int c = 0; c < 4; c++) {
+        pos[c] = obx * m[0][c] + oby * m[1][c] + obz * m[2][c] + m[3][c];
+    }
+
+    v4sf x = pos[0] * (4.0f / 3.0f) / params->aspect_ratio;
+    v4sf y = pos[1], z = pos[2], w = pos[3];
+    v4sf neg_w = -w;
+
+    v4si clip = ((v4si)(x < neg_w) & CLIP_NEG_X) | ((v4si)(x > w) & CLIP_POS_X) |
+                ((v4si)(y < neg_w) & CLIP_NEG_Y) | ((v4si)(y > w) & CLIP_POS_Y) |
+                ((v4si)(z < neg_w) & CLIP_NEG_Z) | ((v4si)(z > w) & CLIP_POS_Z);
+
+    for (int lane = 0; lane < GFX_VERTEX_BATCH_LANES; lane++) {
+        out->clip_rej[base + lane] = clip[lane];
+    }
+
+    memcpy(&out->x[base], &x, sizeof(x));
+    memcpy(&out->y[base], &y, sizeof(y));
+    memcpy(&out->z[base], &z, sizeof(z));
+    memcpy(&out->w[base], &w, sizeof(w));
+
+    if (params->fog) {
+        const v4sf min_w = { 0.001f, 0.001f, 0.001f, 0.001f };
+        const v4sf zero = { 0.0f, 0.0f, 0.0f, 0.0f };
+        const v4sf max_fog = { 255.0f, 255.0f, 255.0f, 255.0f };
+        const v4sf behind_winv = { 32767.0f, 32767.0f, 32767.0f, 32767.0f };
+        v4sf abs_w = v4sf_select(w < zero, -w, w);
+        v4sf safe_w = v4sf_select(abs_w < min_w, min_w, w);
+        v4sf winv = 1.0f / safe_w;
+        winv = v4sf_select(winv < zero, behind_winv, winv);
+
+        v4sf fog_z = z * winv * (float)params->fog_mul + (float)params->fog_offset;
+        fog_z = v4sf_select(fog_z < zero, zero, fog_z);
+        fog_z = v4sf_select(fog_z > max_fog, max_fog, fog_z);
+        memcpy(&out->fog_z[base], &fog_z, sizeof(fog_z));
+    }
+}
+#endif
+
+static GfxVertexBatchObserver observer;
+
+void gfx_vertex_batch_set_observer(GfxVertexBatchObserver fn) {
+    observer = fn;
+}
+
+void gfx_vertex_batch_transform(const Vtx *vertices, size_t n_vertices, const struct GfxVertexBatchParams *params, struct GfxVertexBatch *out) {
+    if (observer != NULL) {
+        observer(vertices, n_vertices, params);
+    }
+#if HAS_SSE || HAS_NEON || HAS_VECTOR_EXT
+    assert(n_vertices <= GFX_VERTEX_BATCH_MAX);
+    for (size_t base = 0; base < n_vertices; base += GFX_VERTEX_BATCH_LANES) {
+        float ob[3][GFX_VERTEX_BATCH_LANES];
+        gather_positions(vertices, n_vertices, base, ob);
+#if HAS_SSE
+        transform_lanes_sse(ob, params, out, base);
+#elif HAS_NEON
+        transform_lanes_neon(ob, params, out, base);
+#else
+        transform_lanes_generic(ob, params, out, base);
+#endif
+    }
+#ifdef GFX_VERTEX_BATCH_VERIFY
+    // Debug aid: every batch is recomputed with the scalar reference and must match to the bit.
+    static struct GfxVertexBatch reference;
+    gfx_vertex_batch_transform_scalar(vertices, n_vertices, params, &reference);
+    for (size_t i = 0; i < n_vertices; i++) {
+        assert(memcmp(&out->x[i], &reference.x[i], sizeof(float)) == 0);
+        assert(memcmp(&out->y[i], &reference.y[i], sizeof(float)) == 0);
+        assert(memcmp(&out->z[i], &reference.z[i], sizeof(float)) == 0);
+        assert(memcmp(&out->w[i], &reference.w[i], sizeof(float)) == 0);
+        assert(out->clip_rej[i] == reference.clip_rej[i]);
+        assert(!params->fog || (uint8_t)out->fog_z[i] == (uint8_t)reference.fog_z[i]);
+    }
+#endif
+#else
+    gfx_vertex_batch_transform_scalar(vertices, n_vertices, params, out);
+#endif
+}
@@ -0,0 +1,54 @@
+#ifndef GFX_VERTEX_BATCH_H
+#define GFX_VERTEX_BATCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifndef _LANGUAGE_C
+#define _LANGUAGE_C
+#endif
+#include <PR/gbi.h>
+
+// Largest G_VTX load the RSP can do in one go, always a multiple of the lane count.
+#define GFX_VERTEX_BATCH_MAX 64
+#define GFX_VERTEX_BATCH_LANES 4
+
+struct GfxVertexBatchParams {
+    const float (*mp_matrix)[4];
+    float aspect_ratio; // window width / height, used to squash x to 4:3
+    bool fog;
+    int16_t fog_mul, fog_offset;
+};
+
+// Structure of arrays, so each kernel can store a whole lane group at once.
+struct GfxVertexBatch {
+    float x[GFX_VERTEX_BATCH_MAX];
+    float y[GFX_VERTEX_BATCH_MAX];
+    float z[GFX_VERTEX_BATCH_MAX];
+    float w[GFX_VERTEX_BATCH_MAX];
+    float fog_z[GFX_VERTEX_BATCH_MAX];
+    uint8_t clip_rej[GFX_VERTEX_BATCH_MAX];
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Transforms, clip-codes and fogs n_vertices (<= GFX_VERTEX_BATCH_MAX) vertices,
+// GFX_VERTEX_BATCH_LANES at a time with whatever SIMD flavour the target has.
+void gfx_vertex_batch_transform(const Vtx *vertices, size_t n_vertices, const struct GfxVertexBatchParams *params, struct GfxVertexBatch *out);
+
+// Plain C reference, bit-identical to the vector kernels.
+void gfx_vertex_batch_transform_scalar(const Vtx *vertices, size_t n_vertices, const struct GfxVertexBatchParams *params, struct GfxVertexBatch *out);
+
+// Sees the input of every gfx_vertex_batch_transform call, so tools/gfxbench
+// can record the loads of a replay and time the kernels on them. NULL stops it.
+typedef void (*GfxVertexBatchObserver)(const Vtx *vertices, size_t n_vertices, const struct GfxVertexBatchParams *params);
+void gfx_vertex_batch_set_observer(GfxVertexBatchObserver fn);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
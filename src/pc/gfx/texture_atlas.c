@@ -2,11 +2,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <limits.h>
 
 #include "texture_atlas.h"
 
 #define ATLAS_MIN_RESERVED_HOLES 32
 #define ATLAS_MIN_RESERVED_VTEXES 32
+#define ATLAS_MIN_RESERVED_SKYLINE 32
 
 // Trivial Rectangle, containing either free space or a virtual texture.
 typedef struct Rect {
@@ -16,21 +19,33 @@ typedef struct Rect {
 
 /**
  * Contains virtual texture metadata. Actual texel is an implementation detail
- * of the library user.
+ * of the library user. The id of a virtual texture is its slot index + 1.
  * @property rect: Rectangle containing the virtual texture and padding.
- * @property id: Unique identifier for the virtual texture.
+ * @property used: Whether the slot holds a virtual texture.
  * @property invalidated: Tags virtual texture for deletion upon next upload.
+ * @property next_free: Next unused slot, when this one is unused.
  **/
 typedef struct VirtualTexture {
         Rect rect;
-        uint32_t id;
+        int used;
         int invalidated;
+        int next_free;
 } VirtualTexture;
 
+/**
+ * Skyline segment, everything above y in [x, x + width) is either taken by a
+ * virtual texture or tracked as a hole, everything below it is free.
+ **/
+typedef struct SkylineNode {
+    uint16_t x, y;
+    uint16_t width;
+} SkylineNode;
+
 typedef struct Atlas {
     /**
-     * Holes describe areas in the atlas that are empty. A hole can overlap
-     * other holes, but not fully contain another.
+     * Holes describe areas in the atlas that are empty. With the holes packer
+     * a hole can overlap other holes, but not fully contain another. With the
+     * skyline packer holes only cover space above the skyline and never overlap.
      **/
     Rect *holes;
     uint16_t hole_count; // Currently created holes.
@@ -43,12 +58,18 @@ typedef struct Atlas {
      * to the altas page.
      **/
     VirtualTexture *vtexes;
-    uint16_t vtex_count;
-    uint16_t vtex_last_id;
+    uint16_t vtex_count; // Slots handed out so far, used or not.
     uint16_t vtex_reserved;
+    int vtex_free_head; // First unused slot, -1 if none.
+
+    AtlasPacker packer;
+    SkylineNode *skyline; // Sorted by x, covers the whole page width.
+    uint16_t skyline_count;
+    uint16_t skyline_reserved;
 
     uint16_t padding; // Padding to be added to the borders of every virtual texture.
     uint16_t dimensions; // Atlas page dimensions.
+    uint32_t used_area; // Area taken by virtual textures, padding included.
 } Atlas;
 
 static inline int rect_width(Rect *rect)
@@ -76,15 +97,9 @@ static inline int rect_area(Rect *rect)
  **/
 static int atlas_lookup_vtex_id(Atlas *atlas, uint32_t id)
 {
-    int i;
-    for (i = 0; i < atlas->vtex_count; i++) {
-        if (atlas->vtexes[i].id == id)
-            break;
-    }
-
-    if (i == atlas->vtex_count)
+    if (id == 0 || id > atlas->vtex_count || !atlas->vtexes[id - 1].used)
         return -1;
-    return i;
+    return id - 1;
 }
 
 /**
@@ -163,6 +178,23 @@ static int atlas_reserve_vtexes(Atlas *atlas, int reserved)
     return 1;
 }
 
+/**
+ * Private, reserves more skyline segment array space.
+ * @arg atlas: Pointer to atlas structure.
+ * @arg reserved: Number of segments to be reserved.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_reserve_skyline(Atlas *atlas, int reserved)
+{
+    SkylineNode *skyline = (SkylineNode*)realloc(atlas->skyline, sizeof(skyline[0]) * reserved);
+    if (!skyline)
+        return 0;
+
+    atlas->skyline = skyline;
+    atlas->skyline_reserved = reserved;
+    return 1;
+}
+
 /**
  * Private, resets hole count to 1 and resets first hole.
  * @arg atlas: Pointer to atlas structure.
@@ -182,6 +214,19 @@ static void atlas_reset_holes(Atlas *atlas)
  * @return: 1 on success, 0 otherwise.
  **/
 int atlas_create(Atlas **atlas_dptr, uint16_t dimensions, uint16_t padding)
+{
+    return atlas_create_with_packer(atlas_dptr, dimensions, padding, ATLAS_PACKER_HOLES);
+}
+
+/**
+ * Creates and populate atlas structure, using the given packing strategy.
+ * @arg atlas_ptr: Double pointer to atlas structure, undefined on failure.
+ * @arg dimensions: Defines atlas width and height dimenions.
+ * @arg padding: Defines padding added to all sides of a virtual texture.
+ * @arg packer: Strategy used to place virtual textures.
+ * @return: 1 on success, 0 otherwise.
+ **/
+int atlas_create_with_packer(Atlas **atlas_dptr, uint16_t dimensions, uint16_t padding, AtlasPacker packer)
 {
     Atlas *atlas = (Atlas*)calloc(1, sizeof(*atlas));
     if (!atlas)
@@ -189,15 +234,25 @@ int atlas_create(Atlas **atlas_dptr, uint16_t dimensions, uint16_t padding)
 
     // Attempt to reserve space for the necessary meta-data structures.
     if (!atlas_reserve_holes(atlas, ATLAS_MIN_RESERVED_HOLES) || 
-        !atlas_reserve_vtexes(atlas, ATLAS_MIN_RESERVED_VTEXES))
+        !atlas_reserve_vtexes(atlas, ATLAS_MIN_RESERVED_VTEXES) ||
+        !atlas_reserve_skyline(atlas, ATLAS_MIN_RESERVED_SKYLINE))
         goto err_reserve;
 
-    atlas->vtex_last_id = 1;
+    atlas->vtex_free_head = -1;
     atlas->dimensions = dimensions;
     atlas->padding = padding;
-
-    // Initializes first hole
-    atlas_reset_holes(atlas);
+    atlas->packer = packer;
+
+    if (packer == ATLAS_PACKER_SKYLINE) {
+        // Starts flat along the top edge, with no holes
+        SkylineNode first = {0, 0, dimensions};
+        atlas->skyline[0] = first;
+        atlas->skyline_count = 1;
+        atlas->hole_count = 0;
+    } else {
+        // Initializes first hole
+        atlas_reset_holes(atlas);
+    }
 
     *atlas_dptr = atlas;
     return 1;
@@ -217,6 +272,8 @@ void atlas_destroy(Atlas *atlas)
         free(atlas->holes);
     if (atlas->vtexes)
         free(atlas->vtexes);
+    if (atlas->skyline)
+        free(atlas->skyline);
         
     free(atlas);
 }
@@ -229,24 +286,42 @@ void atlas_destroy(Atlas *atlas)
  **/
 int atlas_gen_texture(Atlas *atlas, uint32_t *id_ptr)
 {
-    // If we don't have enough virtual texture slots reserved, attempt to double
-    // the number of reserved slots.
-    if (atlas->vtex_count >= atlas->vtex_reserved) {
-        if (!atlas_reserve_vtexes(atlas, atlas->vtex_reserved * 2)) {
-            return 0;
+    VirtualTexture *vt;
+    if (atlas->vtex_free_head != -1) {
+        // Reuse a slot whose virtual texture has been reclaimed.
+        vt = &atlas->vtexes[atlas->vtex_free_head];
+        atlas->vtex_free_head = vt->next_free;
+    } else {
+        // If we don't have enough virtual texture slots reserved, attempt to double
+        // the number of reserved slots.
+        if (atlas->vtex_count >= atlas->vtex_reserved) {
+            if (atlas->vtex_reserved * 2 > UINT16_MAX || !atlas_reserve_vtexes(atlas, atlas->vtex_reserved * 2)) {
+                return 0;
+            }
         }
+        vt = &atlas->vtexes[atlas->vtex_count++];
     }
 
-    // Acquire an unique ID and a reusable virtual texture slot.
-    VirtualTexture *vt = &atlas->vtexes[atlas->vtex_count++];
-    vt->id = atlas->vtex_last_id++;
+    vt->used = 1;
     vt->invalidated = 0;
     vt->rect.left = vt->rect.up = vt->rect.right = vt->rect.down = 0;
 
-    *id_ptr = vt->id;
+    *id_ptr = (vt - atlas->vtexes) + 1;
     return 1;
 }
 
+/**
+ * Private, returns a virtual texture slot to the free list.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @arg index: Slot index.
+ **/
+static void atlas_release_vtex_slot(Atlas *atlas, int index)
+{
+    atlas->vtexes[index].used = 0;
+    atlas->vtexes[index].next_free = atlas->vtex_free_head;
+    atlas->vtex_free_head = index;
+}
+
 /**
  * Private, checks if two rects have any overlap.
  * @param a: Pointer to first Rect.
@@ -342,6 +417,315 @@ static int atlas_split_holes(Atlas *atlas, Rect *cut)
     return 1;
 }
 
+/**
+ * Private, merges b into a if they share a whole edge.
+ * @param a: Pointer to Rect that grows.
+ * @param b: Pointer to Rect to be merged, left intact.
+ * @returns: 1 if merged, 0 otherwise.
+ **/
+static int rect_merge(Rect *a, const Rect *b)
+{
+    if (a->up == b->up && a->down == b->down && (a->right == b->left || b->right == a->left)) {
+        a->left  = a->left  < b->left  ? a->left  : b->left;
+        a->right = a->right > b->right ? a->right : b->right;
+        return 1;
+    }
+    if (a->left == b->left && a->right == b->right && (a->down == b->up || b->down == a->up)) {
+        a->up   = a->up   < b->up   ? a->up   : b->up;
+        a->down = a->down > b->down ? a->down : b->down;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Private, appends a hole, reserving more space if needed.
+ * @param atlas: Pointer to private Atlas structure.
+ * @param hole: Rect to be added.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_push_hole(Atlas *atlas, const Rect *hole)
+{
+    if (rect_area((Rect *)hole) == 0)
+        return 1;
+
+    if (atlas->hole_count == atlas->hole_reserved) {
+        if (!atlas_reserve_holes(atlas, atlas->hole_reserved * 2))
+            return 0;
+    }
+
+    rect_copy(&atlas->holes[atlas->hole_count++], hole);
+    return 1;
+}
+
+/**
+ * Private, makes sure a skyline segment starts at x.
+ * @param atlas: Pointer to private Atlas structure.
+ * @param x: Horizontal coordinate.
+ * @return: 1 on success, 0 otherwise. Failure leaves the skyline unchanged.
+ **/
+static int atlas_skyline_split_at(Atlas *atlas, int x)
+{
+    for (int i = 0; i < atlas->skyline_count; i++) {
+        SkylineNode *node = &atlas->skyline[i];
+        if (node->x >= x)
+            return 1;
+        if (node->x + node->width <= x)
+            continue;
+
+        if (atlas->skyline_count == atlas->skyline_reserved) {
+            if (!atlas_reserve_skyline(atlas, atlas->skyline_reserved * 2))
+                return 0;
+            node = &atlas->skyline[i];
+        }
+
+        memmove(&atlas->skyline[i + 1], &atlas->skyline[i], (atlas->skyline_count - i) * sizeof(*node));
+        atlas->skyline_count++;
+        node->width = x - node->x;
+        atlas->skyline[i + 1].x = x;
+        atlas->skyline[i + 1].width -= node->width;
+        return 1;
+    }
+    return 1;
+}
+
+/**
+ * Private, sets the skyline height of [x, x + w) to y and merges segments of
+ * equal height.
+ * @param atlas: Pointer to private Atlas structure.
+ * @return: 1 on success, 0 otherwise. Failure leaves the skyline valid.
+ **/
+static int atlas_skyline_set_span(Atlas *atlas, int x, int w, int y)
+{
+    if (!atlas_skyline_split_at(atlas, x) || !atlas_skyline_split_at(atlas, x + w))
+        return 0;
+
+    int first = 0;
+    while (atlas->skyline[first].x < x)
+        first++;
+    int last = first;
+    while (last < atlas->skyline_count && atlas->skyline[last].x < x + w)
+        last++;
+
+    // Collapse the covered segments into the first one
+    SkylineNode span = {x, y, w};
+    atlas->skyline[first] = span;
+    memmove(&atlas->skyline[first + 1], &atlas->skyline[last], (atlas->skyline_count - last) * sizeof(span));
+    atlas->skyline_count -= last - first - 1;
+
+    for (int i = first > 0 ? first - 1 : 0; i + 1 < atlas->skyline_count && i <= first + 1; ) {
+        if (atlas->skyline[i].y == atlas->skyline[i + 1].y) {
+            atlas->skyline[i].width += atlas->skyline[i + 1].width;
+            memmove(&atlas->skyline[i + 1], &atlas->skyline[i + 2], (atlas->skyline_count - i - 2) * sizeof(span));
+            atlas->skyline_count--;
+        } else {
+            i++;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Private, checks where a texture placed at the start of a skyline segment
+ * would end up.
+ * @param atlas: Pointer to private Atlas structure.
+ * @param index: Skyline segment index.
+ * @param w: Texture width.
+ * @param h: Texture height.
+ * @param y_ptr: Pointer to retrieve the top coordinate.
+ * @return: 1 if the texture fits, 0 otherwise.
+ **/
+static int atlas_skyline_fits(Atlas *atlas, int index, int w, int h, int *y_ptr)
+{
+    int x = atlas->skyline[index].x;
+    if (x + w > atlas->dimensions)
+        return 0;
+
+    // Rest on the highest segment under the texture
+    int y = 0;
+    for (int i = index; i < atlas->skyline_count && atlas->skyline[i].x < x + w; i++) {
+        if (atlas->skyline[i].y > y)
+            y = atlas->skyline[i].y;
+    }
+
+    if (y + h > atlas->dimensions)
+        return 0;
+
+    *y_ptr = y;
+    return 1;
+}
+
+/**
+ * Private, pushes the skyline back up when a hole sits right on top of it.
+ * @param atlas: Pointer to private Atlas structure.
+ * @param hole: Pointer to hole Rect.
+ * @return: 1 if the hole became part of the free space under the skyline, 0 otherwise.
+ **/
+static int atlas_skyline_absorb_hole(Atlas *atlas, Rect *hole)
+{
+    for (int i = 0; i < atlas->skyline_count; i++) {
+        SkylineNode *node = &atlas->skyline[i];
+        if (node->x >= hole->right || node->x + node->width <= hole->left)
+            continue;
+        if (node->y != hole->down)
+            return 0;
+    }
+
+    return atlas_skyline_set_span(atlas, hole->left, rect_width(hole), hole->up);
+}
+
+/**
+ * Private, merges holes sharing an edge and gives holes bordering the skyline
+ * back to it, so freed space doesn't fragment into ever more holes.
+ * @param atlas: Pointer to private Atlas structure.
+ * @param first: Index of the first hole added since the last coalesce, the
+ *               ones before it are already coalesced among themselves.
+ **/
+static void atlas_skyline_coalesce(Atlas *atlas, int first)
+{
+    int absorbed = 0;
+
+    // Merged and absorbed holes are emptied, then dropped at the end.
+    for (int i = first; i < atlas->hole_count; i++) {
+        Rect *hole = &atlas->holes[i];
+        int merged = 1;
+        while (merged && rect_area(hole) > 0) {
+            merged = 0;
+            if (atlas_skyline_absorb_hole(atlas, hole)) {
+                hole->right = hole->left;
+                absorbed = 1;
+                break;
+            }
+
+            for (int j = 0; j < atlas->hole_count; j++) {
+                Rect *other = &atlas->holes[j];
+                if (j != i && rect_area(other) > 0 && rect_merge(hole, other)) {
+                    other->right = other->left;
+                    merged = 1;
+                }
+            }
+        }
+    }
+
+    // Lowering the skyline can expose older holes that were stacked on top.
+    while (absorbed) {
+        absorbed = 0;
+        for (int i = 0; i < atlas->hole_count; i++) {
+            Rect *hole = &atlas->holes[i];
+            if (rect_area(hole) > 0 && atlas_skyline_absorb_hole(atlas, hole)) {
+                hole->right = hole->left;
+                absorbed = 1;
+            }
+        }
+    }
+
+    int count = 0;
+    for (int i = 0; i < atlas->hole_count; i++) {
+        if (rect_area(&atlas->holes[i]) > 0)
+            rect_copy(&atlas->holes[count++], &atlas->holes[i]);
+    }
+    atlas->hole_count = count;
+}
+
+/**
+ * Private, reclaims the space of invalidated virtual textures into holes.
+ * @param atlas: Pointer to private Atlas structure.
+ **/
+static void atlas_skyline_reclaim(Atlas *atlas)
+{
+    int first = atlas->hole_count;
+    for (int i = 0; i < atlas->vtex_count; i++) {
+        VirtualTexture *vt = &atlas->vtexes[i];
+        if (!vt->used || !vt->invalidated)
+            continue;
+
+        // If we can't track the hole, the space is lost but the atlas stays consistent
+        atlas_push_hole(atlas, &vt->rect);
+        atlas->used_area -= rect_area(&vt->rect);
+        atlas_release_vtex_slot(atlas, i);
+    }
+
+    atlas_skyline_coalesce(atlas, first);
+}
+
+/**
+ * Private, finds space for a texture with the skyline packer. Holes are tried
+ * best-fit first and split guillotine style, then the texture goes on top of
+ * the skyline where its bottom edge ends up highest.
+ * @param atlas: Pointer to private Atlas structure.
+ * @param w: Texture width, including padding.
+ * @param h: Texture height, including padding.
+ * @param rect: Pointer to retrieve the allocated Rect.
+ * @return: 1 on success, 0 otherwise.
+ **/
+static int atlas_skyline_allocate(Atlas *atlas, int w, int h, Rect *rect)
+{
+    Rect *best_fit = atlas_lookup_bestfit(atlas, w, h);
+    if (best_fit) {
+        Rect hole = *best_fit;
+        Rect vtex = {hole.left, hole.up, hole.left + w, hole.up + h};
+
+        // Split along the shorter leftover, keeping the larger piece whole
+        Rect right, down;
+        if (rect_width(&hole) - w < rect_height(&hole) - h) {
+            Rect r = {vtex.right, hole.up,   hole.right, vtex.down};
+            Rect d = {hole.left,  vtex.down, hole.right, hole.down};
+            right = r;
+            down = d;
+        } else {
+            Rect r = {vtex.right, hole.up,   hole.right, hole.down};
+            Rect d = {hole.left,  vtex.down, vtex.right, hole.down};
+            right = r;
+            down = d;
+        }
+
+        rect_copy(best_fit, &atlas->holes[--atlas->hole_count]);
+        if (!atlas_push_hole(atlas, &right) || !atlas_push_hole(atlas, &down))
+            return 0;
+
+        rect_copy(rect, &vtex);
+        return 1;
+    }
+
+    int best = -1;
+    int best_y = 0;
+    int best_bottom = INT_MAX;
+    for (int i = 0; i < atlas->skyline_count; i++) {
+        int y;
+        if (atlas_skyline_fits(atlas, i, w, h, &y) && y + h < best_bottom) {
+            best = i;
+            best_y = y;
+            best_bottom = y + h;
+        }
+    }
+
+    if (best == -1)
+        return 0;
+
+    int x = atlas->skyline[best].x;
+    int first = atlas->hole_count;
+
+    // Space between the lower segments and the texture becomes holes
+    for (int i = best; i < atlas->skyline_count && atlas->skyline[i].x < x + w; i++) {
+        SkylineNode *node = &atlas->skyline[i];
+        if (node->y == best_y)
+            continue;
+
+        int right = node->x + node->width;
+        Rect gap = {node->x, node->y, right < x + w ? right : x + w, best_y};
+        if (!atlas_push_hole(atlas, &gap))
+            return 0;
+    }
+
+    if (!atlas_skyline_set_span(atlas, x, w, best_y + h))
+        return 0;
+
+    Rect vtex = {x, best_y, x + w, best_y + h};
+    rect_copy(rect, &vtex);
+    atlas_skyline_coalesce(atlas, first);
+    return 1;
+}
+
 /**
  * Marks a virtual texture for future reclaiming. This happens the next time a
  * texture gets uploaded.
@@ -371,35 +755,36 @@ int atlas_destroy_vtex(Atlas *atlas, uint32_t id)
  **/
 int atlas_allocate_vtex_space(Atlas *atlas, uint32_t id, uint16_t w, uint16_t h)
 {
-    // If a texture has been deleted, we'll regenerate the holes before
-    // trying to allocate space for a new one.
-    // TODO:: Benchmark impact of this
+    // If a texture has been deleted, reclaim its space before trying to
+    // allocate space for a new one.
     if (atlas->holes_invalidated) {
         atlas->holes_invalidated = 0;
-        atlas_reset_holes(atlas);
 
-        // Delete all invalidated textures
-        for (int i = 0; i < atlas->vtex_count; i++) {
-            VirtualTexture *vt = &atlas->vtexes[i];
-            
-            if (!vt->invalidated) {
-                // Ignore textures that haven't had space allocated for them
-                if (rect_area(&vt->rect) == 0)
+        if (atlas->packer == ATLAS_PACKER_SKYLINE) {
+            atlas_skyline_reclaim(atlas);
+        } else {
+            // The holes packer regenerates its holes from the remaining textures
+            // TODO:: Benchmark impact of this
+            atlas_reset_holes(atlas);
+
+            for (int i = 0; i < atlas->vtex_count; i++) {
+                VirtualTexture *vt = &atlas->vtexes[i];
+                if (!vt->used)
                     continue;
 
-                // If virtual texture isn't invalidated, let's reallocate space for it
-                atlas_split_holes(atlas, &vt->rect);
-            } else {
-                // Otherwise, swap current virtual texture for the last entry
-                VirtualTexture *last = &atlas->vtexes[atlas->vtex_count - 1];
-                rect_copy(&vt->rect, &last->rect);
-                vt->id = last->id;
-                vt->invalidated = last->invalidated;
-
-                // Remove last virtual texture and retry current index
-                atlas->vtex_count--;
-                i--;
-            } 
+                if (!vt->invalidated) {
+                    // Ignore textures that haven't had space allocated for them
+                    if (rect_area(&vt->rect) == 0)
+                        continue;
+
+                    // If virtual texture isn't invalidated, let's reallocate space for it
+                    atlas_split_holes(atlas, &vt->rect);
+                } else {
+                    // Otherwise, the slot can be handed out again
+                    atlas->used_area -= rect_area(&vt->rect);
+                    atlas_release_vtex_slot(atlas, i);
+                }
+            }
         }
     }
 
@@ -407,18 +792,19 @@ int atlas_allocate_vtex_space(Atlas *atlas, uint32_t id, uint16_t w, uint16_t h)
     w += atlas->padding * 2;
     h += atlas->padding * 2;
 
-    // Look-up virtual texture id
-    VirtualTexture *vt = NULL;
-    for (int i = 0; i < atlas->vtex_count; i++) {
-        if (atlas->vtexes[i].id == id) {
-            vt = &atlas->vtexes[i];
-            break;
-        }
-    }
-
-    // If id not found, bail out
-    if (!vt)
+    // Look-up virtual texture id, bail out if not found
+    int index;
+    if ((index = atlas_lookup_vtex_id(atlas, id)) == -1)
         return 0;
+    VirtualTexture *vt = &atlas->vtexes[index];
+
+    if (atlas->packer == ATLAS_PACKER_SKYLINE) {
+        if (!atlas_skyline_allocate(atlas, w, h, &vt->rect))
+            return 0;
+
+        atlas->used_area += rect_area(&vt->rect);
+        return 1;
+    }
 
     // Do a best-fit lookup
     Rect *best_fit = atlas_lookup_bestfit(atlas, w, h);
@@ -432,6 +818,7 @@ int atlas_allocate_vtex_space(Atlas *atlas, uint32_t id, uint16_t w, uint16_t h)
     };
 
     rect_copy(&vt->rect, &vtex);
+    atlas->used_area += rect_area(&vt->rect);
     if (!atlas_split_holes(atlas, &vtex))
         return 0;
 
@@ -509,6 +896,16 @@ uint16_t atlas_get_dimensions(Atlas *atlas)
     return atlas->dimensions;
 }
 
+/**
+ * Retrieves the area taken by virtual textures, padding included.
+ * @arg atlas: Pointer to private Atlas structure.
+ * @returns: Used area in texels.
+ **/
+uint32_t atlas_get_used_area(Atlas *atlas)
+{
+    return atlas->used_area;
+}
+
 /**
  * Retrieves atlas padding.
  * @arg atlas: Pointer to private Atlas structure.
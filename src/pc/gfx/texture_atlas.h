@@ -9,7 +9,13 @@ extern "C"
 #endif
     typedef struct Atlas Atlas;
 
+    typedef enum AtlasPacker {
+        ATLAS_PACKER_HOLES,   // Best-fit over overlapping free rectangles.
+        ATLAS_PACKER_SKYLINE, // Bottom-left skyline, freed space kept as disjoint rectangles.
+    } AtlasPacker;
+
     extern int atlas_create(Atlas **atlas_dptr, uint16_t dimensions, uint16_t padding);
+    extern int atlas_create_with_packer(Atlas **atlas_dptr, uint16_t dimensions, uint16_t padding, AtlasPacker packer);
     extern void atlas_destroy(Atlas *atlas);
     extern int atlas_gen_texture(Atlas *atlas, uint32_t *id_ptr);
     extern int atlas_destroy_vtex(Atlas *atlas, uint32_t id);
@@ -18,6 +24,7 @@ extern "C"
     extern int atlas_get_vtex_xywh_coords(Atlas *atlas, uint32_t id, int padding, uint16_t *xywh);
     extern uint16_t atlas_get_dimensions(Atlas *atlas);
     extern uint16_t atlas_get_padding(Atlas *atlas);
+    extern uint32_t atlas_get_used_area(Atlas *atlas);
 #ifdef __cplusplus
 }
 #endif
@@ -1,21 +1,54 @@
+#include <math.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <ultra64.h>
 
+// The kernels come in four flavours: SSE4.1, NEON, GCC/Clang vector
+// extensions for the other vector units, and the scalar reference the others
+// match. The best one the target has is used unless MIXER_SSE41, MIXER_NEON,
+// MIXER_VECTOR or MIXER_SCALAR (MIXER_IMPL in the Makefile) forces one.
+// Without a vector unit (or with only SSE2, which lacks 32 bit multiplies)
+// the vector kernels are slower than the scalar ones, so they aren't picked.
+#if !defined(MIXER_SSE41) && !defined(MIXER_NEON) && !defined(MIXER_VECTOR) && !defined(MIXER_SCALAR)
 #ifdef __SSE4_1__
+#define MIXER_SSE41
+#elif __ARM_NEON
+#define MIXER_NEON
+#elif defined(__GNUC__) && (defined(__ALTIVEC__) || defined(__mips_msa) || defined(__wasm_simd128__) || defined(__riscv_vector))
+#define MIXER_VECTOR
+#else
+#define MIXER_SCALAR
+#endif
+#endif
+
+#ifdef MIXER_SSE41
+#ifndef __SSE4_1__
+#error MIXER_SSE41 needs a target with SSE4.1 (-msse4.1)
+#endif
 #include <immintrin.h>
 #define HAS_SSE41 1
-#define HAS_NEON 0
-#elif __ARM_NEON
-#include <arm_neon.h>
+#else
 #define HAS_SSE41 0
+#endif
+
+#ifdef MIXER_NEON
+#ifndef __ARM_NEON
+#error MIXER_NEON needs a target with NEON
+#endif
+#include <arm_neon.h>
 #define HAS_NEON 1
 #else
-#define HAS_SSE41 0
 #define HAS_NEON 0
 #endif
 
+#ifdef MIXER_VECTOR
+#define HAS_VECTOR 1
+#else
+#define HAS_VECTOR 0
+#endif
+
 #pragma GCC optimize ("unroll-loops")
 
 #if HAS_SSE41
@@ -26,7 +59,15 @@
 #define ROUND_UP_16(v) (((v) + 15) & ~15)
 #define ROUND_UP_8(v) (((v) + 7) & ~7)
 
-static struct {
+// Offsets into MixerContext.written. A table index past 7 reads DMEM, as on
+// the RSP.
+#define TRACK_TABLE(offset) (offset)
+#define TRACK_DMEM(addr) (sizeof(int16_t[8][2][8]) + (addr))
+#define TRACK_SIZE TRACK_DMEM(2512)
+
+// The microcode's registers and DMEM. The commands of a thread run against
+// the default context unless it picks another one (see mixer.h).
+struct MixerContext {
     uint16_t in;
     uint16_t out;
     uint16_t nbytes;
@@ -50,7 +91,41 @@ static struct {
         int16_t as_s16[2512 / sizeof(int16_t)];
         uint8_t as_u8[2512];
     } buf;
-} rspa;
+
+    // Only kept by contexts from mixer_context_create. written holds a
+    // TRACK_ value for every byte of adpcm_table and buf, from written_lo up
+    // to written_hi. read_unwritten is set by a command reading a byte that
+    // isn't TRACK_WRITTEN, or doing something the tracking doesn't follow.
+    bool tracking;
+    bool read_unwritten;
+    uint16_t regs_written;
+    uint16_t written_lo;
+    uint16_t written_hi;
+    uint8_t written[TRACK_SIZE];
+    uint16_t copied_from[TRACK_SIZE]; // for the TRACK_COPIED bytes
+};
+
+enum {
+    TRACK_UNTOUCHED,
+    TRACK_WRITTEN,
+    // Moved from an untouched byte, so it holds whatever the context the
+    // commands get merged into has at copied_from
+    TRACK_COPIED
+};
+
+enum {
+    MIXER_REG_BUF = 1 << 0, // in, out, nbytes
+    MIXER_REG_AUX = 1 << 1, // dry_right, wet_left, wet_right
+    MIXER_REG_VOL_LEFT = 1 << 2,
+    MIXER_REG_VOL_RIGHT = 1 << 3,
+    MIXER_REG_RATE_LEFT = 1 << 4, // target and rate
+    MIXER_REG_RATE_RIGHT = 1 << 5,
+    MIXER_REG_DRY_WET = 1 << 6,
+    MIXER_REG_LOOP = 1 << 7
+};
+
+static struct MixerContext mixer_default_ctx;
+static __thread struct MixerContext *mixer_ctx = &mixer_default_ctx;
 
 static int16_t resample_table[64][4] = {
     {0x0c39, 0x66ad, 0x0d46, 0xffdf}, {0x0b39, 0x6696, 0x0e5f, 0xffd8},
@@ -105,61 +180,209 @@ static inline int32_t clamp32(int64_t v) {
     return (int32_t)v;
 }
 
+static inline int track_clamp(int offset, int nbytes) {
+    return offset + nbytes > (int)TRACK_SIZE ? (int)TRACK_SIZE - offset : nbytes;
+}
+
+static inline void track_read(struct MixerContext *ctx, int offset, int nbytes) {
+    if (ctx->tracking) {
+        nbytes = track_clamp(offset, nbytes);
+        if (nbytes > 0 && (memchr(ctx->written + offset, TRACK_UNTOUCHED, nbytes) != NULL ||
+                           memchr(ctx->written + offset, TRACK_COPIED, nbytes) != NULL)) {
+            ctx->read_unwritten = true;
+        }
+    }
+}
+
+static inline void track_extend(struct MixerContext *ctx, int offset, int nbytes) {
+    if (offset < ctx->written_lo) {
+        ctx->written_lo = offset;
+    }
+    if (offset + nbytes > ctx->written_hi) {
+        ctx->written_hi = offset + nbytes;
+    }
+}
+
+static inline void track_write(struct MixerContext *ctx, int offset, int nbytes) {
+    if (ctx->tracking) {
+        nbytes = track_clamp(offset, nbytes);
+        if (nbytes > 0) {
+            memset(ctx->written + offset, TRACK_WRITTEN, nbytes);
+            track_extend(ctx, offset, nbytes);
+        }
+    }
+}
+
+// A move is exact even where it copies bytes nothing wrote: the rounding up
+// to 16 bytes often takes some along, which later commands overwrite again
+static void track_move(struct MixerContext *ctx, int in_offset, int out_offset, int nbytes) {
+    uint8_t written[TRACK_SIZE];
+    uint16_t copied_from[TRACK_SIZE];
+    int i;
+
+    nbytes = track_clamp(out_offset, track_clamp(in_offset, nbytes));
+    for (i = 0; i < nbytes; i++) {
+        written[i] = ctx->written[in_offset + i];
+        copied_from[i] = ctx->copied_from[in_offset + i];
+        if (written[i] == TRACK_UNTOUCHED) {
+            written[i] = TRACK_COPIED;
+            copied_from[i] = in_offset + i;
+        }
+    }
+    if (nbytes > 0) {
+        memcpy(ctx->written + out_offset, written, nbytes);
+        memcpy(ctx->copied_from + out_offset, copied_from, nbytes * sizeof(uint16_t));
+        track_extend(ctx, out_offset, nbytes);
+    }
+}
+
+static inline void track_read_regs(struct MixerContext *ctx, int regs) {
+    if (ctx->tracking && (ctx->regs_written & regs) != regs) {
+        ctx->read_unwritten = true;
+    }
+}
+
+static inline void track_write_regs(struct MixerContext *ctx, int regs) {
+    ctx->regs_written |= regs;
+}
+
+#if HAS_VECTOR
+#pragma GCC diagnostic ignored "-Wpsabi" // vec_load16 is static and inlined
+
+// Eight lanes wide, the compiler maps them to whatever vector unit the target
+// has or splits them up. The arithmetic is the scalar code's, lane by lane,
+// so the results are bit for bit the same.
+typedef int16_t v8s16 __attribute__((vector_size(16)));
+typedef int32_t v8s32 __attribute__((vector_size(32)));
+typedef uint32_t v8u32 __attribute__((vector_size(32)));
+typedef int64_t v8s64 __attribute__((vector_size(64)));
+
+#if defined(__clang__) || __GNUC__ >= 9
+#define VEC_CONVERT(v, type) __builtin_convertvector(v, type)
+#else
+#define VEC_CONVERT(v, type) ({ \
+    type vec_convert_out;       \
+    int vec_convert_i;          \
+    for (vec_convert_i = 0; vec_convert_i < 8; vec_convert_i++) { \
+        vec_convert_out[vec_convert_i] = (v)[vec_convert_i]; \
+    }                           \
+    vec_convert_out;            \
+})
+#endif
+
+static inline v8s32 vec_load16(const int16_t *p) {
+    v8s16 v;
+    memcpy(&v, p, sizeof(v));
+    return VEC_CONVERT(v, v8s32);
+}
+
+// Macros rather than functions, GCC notes an ABI change on every function
+// taking a 32 byte vector
+#define VEC_SELECT(mask, a, b) (((a) & (mask)) | ((b) & ~(mask)))
+
+// Clamps to 16 bits and stores, as clamp16 does for one sample
+#define VEC_STORE16(p, v) do {                                            \
+    v8s32 vec_store_v = (v);                                              \
+    v8s16 vec_store_out;                                                  \
+    vec_store_v = VEC_SELECT(vec_store_v < -0x8000, (v8s32){0} - 0x8000, vec_store_v); \
+    vec_store_v = VEC_SELECT(vec_store_v > 0x7fff, (v8s32){0} + 0x7fff, vec_store_v);  \
+    vec_store_out = VEC_CONVERT(vec_store_v, v8s16);                      \
+    memcpy((p), &vec_store_out, sizeof(vec_store_out));                   \
+} while (0)
+
+// As clamp32, for 8 lanes
+#define VEC_CLAMP32(v) ({                                                 \
+    v8s64 vec_clamp_v = (v);                                              \
+    vec_clamp_v = VEC_SELECT(vec_clamp_v < -0x7fffffff - 1, (v8s64){0} + (-0x7fffffff - 1), vec_clamp_v); \
+    vec_clamp_v = VEC_SELECT(vec_clamp_v > 0x7fffffff, (v8s64){0} + 0x7fffffff, vec_clamp_v); \
+    VEC_CONVERT(vec_clamp_v, v8s32);                                      \
+})
+#endif
+
 void aClearBufferImpl(uint16_t addr, int nbytes) {
+    struct MixerContext *ctx = mixer_ctx;
     nbytes = ROUND_UP_16(nbytes);
-    memset(rspa.buf.as_u8 + addr, 0, nbytes);
+    track_write(ctx, TRACK_DMEM(addr), nbytes);
+    memset(ctx->buf.as_u8 + addr, 0, nbytes);
 }
 
 void aLoadBufferImpl(const void *source_addr) {
-    memcpy(rspa.buf.as_u8 + rspa.in, source_addr, ROUND_UP_8(rspa.nbytes));
+    struct MixerContext *ctx = mixer_ctx;
+    track_read_regs(ctx, MIXER_REG_BUF);
+    track_write(ctx, TRACK_DMEM(ctx->in), ROUND_UP_8(ctx->nbytes));
+    memcpy(ctx->buf.as_u8 + ctx->in, source_addr, ROUND_UP_8(ctx->nbytes));
 }
 
 void aSaveBufferImpl(int16_t *dest_addr) {
-    memcpy(dest_addr, rspa.buf.as_s16 + rspa.out / sizeof(int16_t), ROUND_UP_8(rspa.nbytes));
+    struct MixerContext *ctx = mixer_ctx;
+    track_read_regs(ctx, MIXER_REG_BUF);
+    track_read(ctx, TRACK_DMEM(ctx->out), ROUND_UP_8(ctx->nbytes));
+    memcpy(dest_addr, ctx->buf.as_s16 + ctx->out / sizeof(int16_t), ROUND_UP_8(ctx->nbytes));
 }
 
 void aLoadADPCMImpl(int num_entries_times_16, const int16_t *book_source_addr) {
-    memcpy(rspa.adpcm_table, book_source_addr, num_entries_times_16);
+    struct MixerContext *ctx = mixer_ctx;
+    if (num_entries_times_16 > (int)sizeof(ctx->adpcm_table)) {
+        // Spills into DMEM. A context of its own might load a book where the
+        // default context would have gone on with the one it had.
+        ctx->read_unwritten = true;
+    }
+    track_write(ctx, TRACK_TABLE(0), num_entries_times_16);
+    memcpy(ctx->adpcm_table, book_source_addr, num_entries_times_16);
 }
 
 void aSetBufferImpl(uint8_t flags, uint16_t in, uint16_t out, uint16_t nbytes) {
+    struct MixerContext *ctx = mixer_ctx;
     if (flags & A_AUX) {
-        rspa.dry_right = in;
-        rspa.wet_left = out;
-        rspa.wet_right = nbytes;
+        ctx->dry_right = in;
+        ctx->wet_left = out;
+        ctx->wet_right = nbytes;
+        track_write_regs(ctx, MIXER_REG_AUX);
     } else {
-        rspa.in = in;
-        rspa.out = out;
-        rspa.nbytes = nbytes;
+        ctx->in = in;
+        ctx->out = out;
+        ctx->nbytes = nbytes;
+        track_write_regs(ctx, MIXER_REG_BUF);
     }
 }
 
 void aSetVolumeImpl(uint8_t flags, int16_t v, int16_t t, int16_t r) {
+    struct MixerContext *ctx = mixer_ctx;
     if (flags & A_AUX) {
-        rspa.vol_dry = v;
-        rspa.vol_wet = r;
+        ctx->vol_dry = v;
+        ctx->vol_wet = r;
+        track_write_regs(ctx, MIXER_REG_DRY_WET);
     } else if (flags & A_VOL) {
         if (flags & A_LEFT) {
-            rspa.vol[0] = v;
+            ctx->vol[0] = v;
+            track_write_regs(ctx, MIXER_REG_VOL_LEFT);
         } else {
-            rspa.vol[1] = v;
+            ctx->vol[1] = v;
+            track_write_regs(ctx, MIXER_REG_VOL_RIGHT);
         }
     } else {
         if (flags & A_LEFT) {
-            rspa.target[0] = v;
-            rspa.rate[0] = (int32_t)((uint16_t)t << 16 | ((uint16_t)r));
+            ctx->target[0] = v;
+            ctx->rate[0] = (int32_t)((uint16_t)t << 16 | ((uint16_t)r));
+            track_write_regs(ctx, MIXER_REG_RATE_LEFT);
         } else {
-            rspa.target[1] = v;
-            rspa.rate[1] = (int32_t)((uint16_t)t << 16 | ((uint16_t)r));
+            ctx->target[1] = v;
+            ctx->rate[1] = (int32_t)((uint16_t)t << 16 | ((uint16_t)r));
+            track_write_regs(ctx, MIXER_REG_RATE_RIGHT);
         }
     }
 }
 
 void aInterleaveImpl(uint16_t left, uint16_t right) {
-    int count = ROUND_UP_16(rspa.nbytes) / sizeof(int16_t) / 8;
-    int16_t *l = rspa.buf.as_s16 + left / sizeof(int16_t);
-    int16_t *r = rspa.buf.as_s16 + right / sizeof(int16_t);
-    int16_t *d = rspa.buf.as_s16 + rspa.out / sizeof(int16_t);
+    struct MixerContext *ctx = mixer_ctx;
+    int count = ROUND_UP_16(ctx->nbytes) / sizeof(int16_t) / 8;
+    int16_t *l = ctx->buf.as_s16 + left / sizeof(int16_t);
+    int16_t *r = ctx->buf.as_s16 + right / sizeof(int16_t);
+    int16_t *d = ctx->buf.as_s16 + ctx->out / sizeof(int16_t);
+    track_read_regs(ctx, MIXER_REG_BUF);
+    track_read(ctx, TRACK_DMEM(left), count * 16);
+    track_read(ctx, TRACK_DMEM(right), count * 16);
+    track_write(ctx, TRACK_DMEM(ctx->out), count * 32);
     while (count > 0) {
         int16_t l0 = *l++;
         int16_t l1 = *l++;
@@ -198,15 +421,52 @@ void aInterleaveImpl(uint16_t left, uint16_t right) {
 }
 
 void aDMEMMoveImpl(uint16_t in_addr, uint16_t out_addr, int nbytes) {
+    struct MixerContext *ctx = mixer_ctx;
     nbytes = ROUND_UP_16(nbytes);
-    memmove(rspa.buf.as_u8 + out_addr, rspa.buf.as_u8 + in_addr, nbytes);
+    if (ctx->tracking) {
+        track_move(ctx, TRACK_DMEM(in_addr), TRACK_DMEM(out_addr), nbytes);
+    }
+    memmove(ctx->buf.as_u8 + out_addr, ctx->buf.as_u8 + in_addr, nbytes);
 }
 
 void aSetLoopImpl(ADPCM_STATE *adpcm_loop_state) {
-    rspa.adpcm_loop_state = adpcm_loop_state;
+    struct MixerContext *ctx = mixer_ctx;
+    ctx->adpcm_loop_state = adpcm_loop_state;
+    track_write_regs(ctx, MIXER_REG_LOOP);
+}
+
+static inline int adpcm_loop_reg(uint8_t flags) {
+    return !(flags & A_INIT) && (flags & A_LOOP) ? MIXER_REG_LOOP : 0;
+}
+
+// The frames the decoder reads and the codebook rows their headers pick. A
+// long run writes over input it has yet to read, as on the RSP: frame k is
+// read once the 16 * (k + 1) samples before it are out.
+static void track_adpcmdec(struct MixerContext *ctx, uint8_t flags) {
+    int nbytes = ROUND_UP_32(ctx->nbytes);
+    int in_end = ctx->in + nbytes / 32 * 9;
+    int own_end = ctx->out + 16 * sizeof(int16_t);
+    int pos;
+
+    track_read_regs(ctx, MIXER_REG_BUF | adpcm_loop_reg(flags));
+    for (pos = ctx->in; pos < in_end && pos < (int)sizeof(ctx->buf); pos += 9, own_end += 32) {
+        if (pos >= ctx->out && pos < own_end) {
+            // The header is one of its own samples
+            ctx->read_unwritten = true;
+            break;
+        }
+        if (pos < ctx->out) {
+            track_read(ctx, TRACK_DMEM(pos), pos + 9 < ctx->out ? 9 : ctx->out - pos);
+        } else {
+            track_read(ctx, TRACK_DMEM(pos), 9);
+        }
+        track_read(ctx, TRACK_TABLE((ctx->buf.as_u8[pos] & 0xf) * 32), 32);
+    }
+    track_write(ctx, TRACK_DMEM(ctx->out), 16 * sizeof(int16_t) + nbytes);
 }
 
 void aADPCMdecImpl(uint8_t flags, ADPCM_STATE state) {
+    struct MixerContext *ctx = mixer_ctx;
 #if HAS_SSE41
     const __m128i tblrev = _mm_setr_epi8(12, 13, 10, 11, 8, 9, 6, 7, 4, 5, 2, 3, 0, 1, -1, -1);
     const __m128i pos0 = _mm_set_epi8(3, -1, 3, -1, 2, -1, 2, -1, 1, -1, 1, -1, 0, -1, 0, -1);
@@ -223,14 +483,21 @@ void aADPCMdecImpl(uint8_t flags, ADPCM_STATE state) {
     const int16x8_t mult = vld1q_s16(mult_data);
     const int16x8_t mask = vdupq_n_s16((int16_t)0xf000);
     const int16x8_t table_prefix = vld1q_s16(table_prefix_data);
+#elif HAS_VECTOR
+    v8s32 tblvec[2] = {{0}, {0}};
+    v8s32 tblvec1_shifted[7]; // [k][j] is tbl[1][j - k - 1], 0 for j <= k
+    int cached_index = -1;
 #endif
-    uint8_t *in = rspa.buf.as_u8 + rspa.in;
-    int16_t *out = rspa.buf.as_s16 + rspa.out / sizeof(int16_t);
-    int nbytes = ROUND_UP_32(rspa.nbytes);
+    uint8_t *in = ctx->buf.as_u8 + ctx->in;
+    int16_t *out = ctx->buf.as_s16 + ctx->out / sizeof(int16_t);
+    int nbytes = ROUND_UP_32(ctx->nbytes);
+    if (ctx->tracking) {
+        track_adpcmdec(ctx, flags);
+    }
     if (flags & A_INIT) {
         memset(out, 0, 16 * sizeof(int16_t));
     } else if (flags & A_LOOP) {
-        memcpy(out, rspa.adpcm_loop_state, 16 * sizeof(int16_t));
+        memcpy(out, ctx->adpcm_loop_state, 16 * sizeof(int16_t));
     } else {
         memcpy(out, state, 16 * sizeof(int16_t));
     }
@@ -244,7 +511,7 @@ void aADPCMdecImpl(uint8_t flags, ADPCM_STATE state) {
     while (nbytes > 0) {
         int shift = *in >> 4; // should be in 0..12
         int table_index = *in++ & 0xf; // should be in 0..7
-        int16_t (*tbl)[8] = rspa.adpcm_table[table_index];
+        int16_t (*tbl)[8] = ctx->adpcm_table[table_index];
         int i;
 #if HAS_SSE41
         // The _mm_loadu_si64 instruction was added in GCC 9, and results in the same
@@ -349,6 +616,33 @@ void aADPCMdecImpl(uint8_t flags, ADPCM_STATE state) {
             vst1q_s16(out, result);
             out += 8;
         }
+#elif HAS_VECTOR
+        if (table_index != cached_index) {
+            int j, k;
+            tblvec[0] = vec_load16(tbl[0]);
+            tblvec[1] = vec_load16(tbl[1]);
+            for (k = 0; k < 7; k++) {
+                for (j = 0; j < 8; j++) {
+                    tblvec1_shifted[k][j] = j > k ? tbl[1][j - k - 1] : 0;
+                }
+            }
+            cached_index = table_index;
+        }
+        for (i = 0; i < 2; i++) {
+            int16_t ins[8];
+            v8s32 acc;
+            int j;
+            for (j = 0; j < 4; j++) {
+                ins[j * 2] = (((*in >> 4) << 28) >> 28) << shift;
+                ins[j * 2 + 1] = (((*in++ & 0xf) << 28) >> 28) << shift;
+            }
+            acc = tblvec[0] * out[-2] + tblvec[1] * out[-1] + (vec_load16(ins) << 11);
+            for (j = 0; j < 7; j++) {
+                acc += tblvec1_shifted[j] * ins[j];
+            }
+            VEC_STORE16(out, acc >> 11);
+            out += 8;
+        }
 #else
         for (i = 0; i < 2; i++) {
             int16_t ins[8];
@@ -374,15 +668,49 @@ void aADPCMdecImpl(uint8_t flags, ADPCM_STATE state) {
     memcpy(state, out - 16, 16 * sizeof(int16_t));
 }
 
+void aADPCMdecCachedImpl(uint8_t flags, ADPCM_STATE state, const int16_t *pcm, int frame) {
+    struct MixerContext *ctx = mixer_ctx;
+    int16_t *out = ctx->buf.as_s16 + ctx->out / sizeof(int16_t);
+    int nbytes = ROUND_UP_32(ctx->nbytes);
+    const int16_t *history = (flags & A_INIT) ? NULL : (flags & A_LOOP) ? *ctx->adpcm_loop_state : state;
+    int16_t prev2 = history != NULL ? history[14] : 0;
+    int16_t prev1 = history != NULL ? history[15] : 0;
+
+    track_read_regs(ctx, MIXER_REG_BUF | adpcm_loop_reg(flags));
+    // The frames only come out as decoded from the start of the sample if the
+    // decoder starts from the same two samples, and if it wouldn't write over
+    // input it has yet to read
+    if (nbytes > 0) {
+        int in_end = ctx->in + nbytes / 32 * 9;
+        int out_end = ctx->out + 16 * sizeof(int16_t) + nbytes;
+        if (prev2 != (frame > 0 ? pcm[frame * 16 - 2] : 0) || prev1 != (frame > 0 ? pcm[frame * 16 - 1] : 0) ||
+            (ctx->out < in_end && ctx->in < out_end)) {
+            aADPCMdecImpl(flags, state);
+            return;
+        }
+    }
+    track_write(ctx, TRACK_DMEM(ctx->out), 16 * sizeof(int16_t) + nbytes);
+    if (history == NULL) {
+        memset(out, 0, 16 * sizeof(int16_t));
+    } else {
+        memcpy(out, history, 16 * sizeof(int16_t));
+    }
+    out += 16;
+    memcpy(out, pcm + frame * 16, nbytes);
+    out += nbytes / sizeof(int16_t);
+    memcpy(state, out - 16, 16 * sizeof(int16_t));
+}
+
 void aResampleImpl(uint8_t flags, uint16_t pitch, RESAMPLE_STATE state) {
+    struct MixerContext *ctx = mixer_ctx;
     int16_t tmp[16];
-    int16_t *in_initial = rspa.buf.as_s16 + rspa.in / sizeof(int16_t);
+    int16_t *in_initial = ctx->buf.as_s16 + ctx->in / sizeof(int16_t);
     int16_t *in = in_initial;
-    int16_t *out = rspa.buf.as_s16 + rspa.out / sizeof(int16_t);
-    int nbytes = ROUND_UP_16(rspa.nbytes);
+    int16_t *out = ctx->buf.as_s16 + ctx->out / sizeof(int16_t);
+    int nbytes = ROUND_UP_16(ctx->nbytes);
     uint32_t pitch_accumulator;
     int i;
-#if !HAS_SSE41 && !HAS_NEON
+#if !HAS_SSE41 && !HAS_NEON && !HAS_VECTOR
     int16_t *tbl;
     int32_t sample;
 #endif
@@ -398,6 +726,19 @@ void aResampleImpl(uint8_t flags, uint16_t pitch, RESAMPLE_STATE state) {
     in -= 4;
     pitch_accumulator = (uint16_t)tmp[4];
     memcpy(in, tmp, 4 * sizeof(int16_t));
+    if (ctx->tracking) {
+        // Reads up to the four samples the filter ends at, which go to the
+        // state for the next call
+        int num_out = (nbytes > 0 ? nbytes : 16) / (int)sizeof(int16_t);
+        int advance = (pitch_accumulator + (uint32_t)num_out * (pitch << 1)) >> 16;
+        track_read_regs(ctx, MIXER_REG_BUF);
+        if (flags & 2) {
+            ctx->read_unwritten = true;
+        }
+        track_write(ctx, TRACK_DMEM(ctx->in - 4 * sizeof(int16_t)), 4 * sizeof(int16_t));
+        track_read(ctx, TRACK_DMEM(ctx->in), advance * sizeof(int16_t));
+        track_write(ctx, TRACK_DMEM(ctx->out), num_out * sizeof(int16_t));
+    }
 
 #if HAS_SSE41
     __m128i multiples = _mm_setr_epi16(0, 2, 4, 6, 8, 10, 12, 14);
@@ -497,6 +838,34 @@ void aResampleImpl(uint8_t flags, uint16_t pitch, RESAMPLE_STATE state) {
     } while (nbytes > 0);
     in += vgetq_lane_u16(vreinterpretq_u16_u32(acc_a), 1);
     pitch_accumulator = vgetq_lane_u16(vreinterpretq_u16_u32(acc_a), 0);
+#elif HAS_VECTOR
+    // Where each of the next 8 outputs is, 16.16 from in
+    v8u32 acc = ((v8u32){0, 2, 4, 6, 8, 10, 12, 14}) * (uint32_t)pitch + pitch_accumulator;
+
+    do {
+        v8s32 taps[4];
+        v8s32 coefs[4];
+        int j;
+
+        for (i = 0; i < 8; i++) {
+            const int16_t *src = &in[acc[i] >> 16];
+            const int16_t *tbl = resample_table[(acc[i] & 0xffff) >> 10];
+            for (j = 0; j < 4; j++) {
+                taps[j][i] = src[j];
+                coefs[j][i] = tbl[j];
+            }
+        }
+        VEC_STORE16(out, ((taps[0] * coefs[0] + 0x4000) >> 15) +
+                         ((taps[1] * coefs[1] + 0x4000) >> 15) +
+                         ((taps[2] * coefs[2] + 0x4000) >> 15) +
+                         ((taps[3] * coefs[3] + 0x4000) >> 15));
+
+        acc += (uint32_t)(pitch << 1) * 8;
+        out += 8;
+        nbytes -= 8 * sizeof(int16_t);
+    } while (nbytes > 0);
+    in += acc[0] >> 16;
+    pitch_accumulator = acc[0] & 0xffff;
 #else
     do {
         for (i = 0; i < 8; i++) {
@@ -527,241 +896,300 @@ void aResampleImpl(uint8_t flags, uint16_t pitch, RESAMPLE_STATE state) {
 }
 
 
-void aEnvMixerImpl(uint8_t flags, ENVMIX_STATE state) {
-    int16_t *in = rspa.buf.as_s16 + rspa.in / sizeof(int16_t);
-    int16_t *dry[2] = {rspa.buf.as_s16 + rspa.out / sizeof(int16_t), rspa.buf.as_s16 + rspa.dry_right / sizeof(int16_t)};
-    int16_t *wet[2] = {rspa.buf.as_s16 + rspa.wet_left / sizeof(int16_t), rspa.buf.as_s16 + rspa.wet_right / sizeof(int16_t)};
-    int nbytes = ROUND_UP_16(rspa.nbytes);
+static void track_envmixer(struct MixerContext *ctx, uint8_t flags) {
+    int nbytes = ROUND_UP_16(ctx->nbytes);
+    if (nbytes == 0) {
+        nbytes = 16;
+    }
+    track_read_regs(ctx, MIXER_REG_BUF | MIXER_REG_AUX);
+    if (flags & A_INIT) {
+        track_read_regs(ctx, MIXER_REG_VOL_LEFT | MIXER_REG_VOL_RIGHT | MIXER_REG_RATE_LEFT |
+                             MIXER_REG_RATE_RIGHT | MIXER_REG_DRY_WET);
+    }
+    track_read(ctx, TRACK_DMEM(ctx->in), nbytes);
+    track_read(ctx, TRACK_DMEM(ctx->out), nbytes);
+    track_read(ctx, TRACK_DMEM(ctx->dry_right), nbytes);
+    if (flags & A_AUX) {
+        track_read(ctx, TRACK_DMEM(ctx->wet_left), nbytes);
+        track_read(ctx, TRACK_DMEM(ctx->wet_right), nbytes);
+        track_write(ctx, TRACK_DMEM(ctx->wet_left), nbytes);
+        track_write(ctx, TRACK_DMEM(ctx->wet_right), nbytes);
+    }
+    track_write(ctx, TRACK_DMEM(ctx->out), nbytes);
+    track_write(ctx, TRACK_DMEM(ctx->dry_right), nbytes);
+}
 
-#if HAS_SSE41
-    __m128 vols[2][2];
-    __m128i dry_factor;
-    __m128i wet_factor;
-    __m128 target[2];
-    __m128 rate[2];
-    __m128i in_loaded;
-    __m128i vol_s16;
-    bool increasing[2];
+// The envelope as the scalar kernel keeps it in the state: the volumes of
+// eight samples in a row per channel in 16.16, then the targets, the rates
+// they ramp at, and the dry and wet gains. Every flavour keeps the same one,
+// and does the same integer arithmetic on it, so that they all match.
+struct EnvMixerParams {
+    int32_t vols[2][8];
+    int16_t target[2];
+    int32_t rate[2];
+    int16_t vol_dry;
+    int16_t vol_wet;
+};
 
-    int c;
+static void envmixer_load(struct MixerContext *ctx, uint8_t flags, const int16_t *state, struct EnvMixerParams *p) {
+    int32_t step_diff[2];
+    int i;
 
     if (flags & A_INIT) {
-        float vol_init[2] = {rspa.vol[0], rspa.vol[1]};
-        float rate_float[2] = {(float)rspa.rate[0] * (1.0f / 65536.0f), (float)rspa.rate[1] * (1.0f / 65536.0f)};
-        float step_diff[2] = {vol_init[0] * (rate_float[0] - 1.0f), vol_init[1] * (rate_float[1] - 1.0f)};
+        p->target[0] = ctx->target[0];
+        p->target[1] = ctx->target[1];
+        p->rate[0] = ctx->rate[0];
+        p->rate[1] = ctx->rate[1];
+        p->vol_dry = ctx->vol_dry;
+        p->vol_wet = ctx->vol_wet;
+        step_diff[0] = ctx->vol[0] * (p->rate[0] - 0x10000) / 8;
+        step_diff[1] = ctx->vol[0] * (p->rate[1] - 0x10000) / 8;
 
-        for (c = 0; c < 2; c++) {
-            vols[c][0] = _mm_add_ps(
-                _mm_set_ps1(vol_init[c]),
-                _mm_mul_ps(_mm_set1_ps(step_diff[c]), _mm_setr_ps(1.0f / 8.0f, 2.0f / 8.0f, 3.0f / 8.0f, 4.0f / 8.0f)));
-            vols[c][1] = _mm_add_ps(
-                _mm_set_ps1(vol_init[c]),
-                _mm_mul_ps(_mm_set1_ps(step_diff[c]), _mm_setr_ps(5.0f / 8.0f, 6.0f / 8.0f, 7.0f / 8.0f, 8.0f / 8.0f)));
-
-            increasing[c] = rate_float[c] >= 1.0f;
-            target[c] = _mm_set1_ps(rspa.target[c]);
-            rate[c] = _mm_set1_ps(rate_float[c]);
+        for (i = 0; i < 8; i++) {
+            p->vols[0][i] = clamp32((int64_t)(ctx->vol[0] << 16) + step_diff[0] * (i + 1));
+            p->vols[1][i] = clamp32((int64_t)(ctx->vol[1] << 16) + step_diff[1] * (i + 1));
         }
+    } else {
+        memcpy(p->vols[0], state, 32);
+        memcpy(p->vols[1], state + 16, 32);
+        p->target[0] = state[32];
+        p->target[1] = state[35];
+        p->rate[0] = (state[33] << 16) | (uint16_t)state[34];
+        p->rate[1] = (state[36] << 16) | (uint16_t)state[37];
+        p->vol_dry = state[38];
+        p->vol_wet = state[39];
+    }
+}
 
-        dry_factor = _mm_set1_epi16(rspa.vol_dry);
-        wet_factor = _mm_set1_epi16(rspa.vol_wet);
+static void envmixer_save(const struct EnvMixerParams *p, int16_t *state) {
+    memcpy(state, p->vols[0], 32);
+    memcpy(state + 16, p->vols[1], 32);
+    state[32] = p->target[0];
+    state[35] = p->target[1];
+    state[33] = (int16_t)(p->rate[0] >> 16);
+    state[34] = (int16_t)p->rate[0];
+    state[36] = (int16_t)(p->rate[1] >> 16);
+    state[37] = (int16_t)p->rate[1];
+    state[38] = p->vol_dry;
+    state[39] = p->vol_wet;
+}
 
-        memcpy(state + 32, &rate_float[0], 4);
-        memcpy(state + 34, &rate_float[1], 4);
-        state[36] = rspa.target[0];
-        state[37] = rspa.target[1];
-        state[38] = rspa.vol_dry;
-        state[39] = rspa.vol_wet;
-    } else {
-        float floats[2];
-        vols[0][0] = _mm_loadu_ps((const float *)state);
-        vols[0][1] = _mm_loadu_ps((const float *)(state + 8));
-        vols[1][0] = _mm_loadu_ps((const float *)(state + 16));
-        vols[1][1] = _mm_loadu_ps((const float *)(state + 24));
-        memcpy(floats, state + 32, 8);
-        rate[0] = _mm_set1_ps(floats[0]);
-        rate[1] = _mm_set1_ps(floats[1]);
-        increasing[0] = floats[0] >= 1.0f;
-        increasing[1] = floats[1] >= 1.0f;
-        target[0] = _mm_set1_ps(state[36]);
-        target[1] = _mm_set1_ps(state[37]);
-        dry_factor = _mm_set1_epi16(state[38]);
-        wet_factor = _mm_set1_epi16(state[39]);
+#if HAS_SSE41
+// (out * 0x7fff + in * ((vol * gain + 0x4000) >> 15) + 0x4000) >> 15 for four
+// samples, unclamped
+static inline __m128i envmix_sse41(__m128i out, __m128i in, __m128i vol, __m128i gain) {
+    __m128i round = _mm_set1_epi32(0x4000);
+    __m128i factor = _mm_srai_epi32(_mm_add_epi32(_mm_mullo_epi32(vol, gain), round), 15);
+    __m128i sum = _mm_add_epi32(_mm_mullo_epi32(out, _mm_set1_epi32(0x7fff)), _mm_mullo_epi32(in, factor));
+    return _mm_srai_epi32(_mm_add_epi32(sum, round), 15);
+}
+
+// clamp32((int64_t)vols * rate >> 16) for four volumes. The product only fits
+// in 32 bits once shifted if its top 32 bits are in the int16_t range.
+static inline __m128i envmix_ramp_sse41(__m128i vols, __m128i rate) {
+    __m128i even = _mm_mul_epi32(vols, rate);
+    __m128i odd = _mm_mul_epi32(_mm_srli_epi64(vols, 32), rate);
+    __m128i low = _mm_blend_epi16(_mm_srli_epi64(even, 16), _mm_slli_epi64(odd, 16), 0xcc);
+    __m128i high = _mm_blend_epi16(_mm_srli_epi64(even, 32), odd, 0xcc);
+    low = _mm_blendv_epi8(low, _mm_set1_epi32(0x7fffffff), _mm_cmpgt_epi32(high, _mm_set1_epi32(0x7fff)));
+    return _mm_blendv_epi8(low, _mm_set1_epi32(-0x7fffffff - 1), _mm_cmplt_epi32(high, _mm_set1_epi32(-0x8000)));
+}
+#elif HAS_NEON
+// As envmix_sse41
+static inline int32x4_t envmix_neon(int32x4_t out, int32x4_t in, int32x4_t vol, int32_t gain) {
+    int32x4_t round = vdupq_n_s32(0x4000);
+    int32x4_t factor = vshrq_n_s32(vaddq_s32(vmulq_n_s32(vol, gain), round), 15);
+    return vshrq_n_s32(vaddq_s32(vmlaq_s32(vmulq_n_s32(out, 0x7fff), in, factor), round), 15);
+}
+
+// clamp32((int64_t)vols * rate >> 16) for four volumes
+static inline int32x4_t envmix_ramp_neon(int32x4_t vols, int32_t rate) {
+    return vcombine_s32(vqmovn_s64(vshrq_n_s64(vmull_n_s32(vget_low_s32(vols), rate), 16)),
+                        vqmovn_s64(vshrq_n_s64(vmull_n_s32(vget_high_s32(vols), rate), 16)));
+}
+#endif
+
+void aEnvMixerImpl(uint8_t flags, ENVMIX_STATE state) {
+    struct MixerContext *ctx = mixer_ctx;
+    int16_t *in = ctx->buf.as_s16 + ctx->in / sizeof(int16_t);
+    int16_t *dry[2] = {ctx->buf.as_s16 + ctx->out / sizeof(int16_t), ctx->buf.as_s16 + ctx->dry_right / sizeof(int16_t)};
+    int16_t *wet[2] = {ctx->buf.as_s16 + ctx->wet_left / sizeof(int16_t), ctx->buf.as_s16 + ctx->wet_right / sizeof(int16_t)};
+    int nbytes = ROUND_UP_16(ctx->nbytes);
+    struct EnvMixerParams p;
+    int c;
+    if (ctx->tracking) {
+        track_envmixer(ctx, flags);
+    }
+    envmixer_load(ctx, flags, state, &p);
+
+#if HAS_SSE41
+    __m128i vols[2][2];
+    __m128i dry_gain = _mm_set1_epi32(p.vol_dry);
+    __m128i wet_gain = _mm_set1_epi32(p.vol_wet);
+    int i;
+
+    for (c = 0; c < 2; c++) {
+        vols[c][0] = _mm_loadu_si128((const __m128i *)p.vols[c]);
+        vols[c][1] = _mm_loadu_si128((const __m128i *)(p.vols[c] + 4));
     }
+
     do {
-        in_loaded = _mm_loadu_si128((const __m128i *)in);
-        in += 8;
+        __m128i in_loaded = _mm_loadu_si128((const __m128i *)in);
+        __m128i in32[2] = {_mm_cvtepi16_epi32(in_loaded), _mm_cvtepi16_epi32(_mm_unpackhi_epi64(in_loaded, in_loaded))};
         for (c = 0; c < 2; c++) {
-            if (increasing[c]) {
-                vols[c][0] = _mm_min_ps(vols[c][0], target[c]);
-                vols[c][1] = _mm_min_ps(vols[c][1], target[c]);
-            } else {
-                vols[c][0] = _mm_max_ps(vols[c][0], target[c]);
-                vols[c][1] = _mm_max_ps(vols[c][1], target[c]);
+            __m128i target = _mm_set1_epi32(p.target[c]);
+            __m128i target_vol = _mm_set1_epi32(p.target[c] << 16);
+            __m128i rate = _mm_set1_epi32(p.rate[c]);
+            __m128i vol[2], out;
+            for (i = 0; i < 2; i++) {
+                if ((p.rate[c] >> 16) > 0) {
+                    // Increasing volume
+                    vols[c][i] = _mm_blendv_epi8(vols[c][i], target_vol, _mm_cmpgt_epi32(_mm_srai_epi32(vols[c][i], 16), target));
+                } else {
+                    // Decreasing volume
+                    vols[c][i] = _mm_blendv_epi8(vols[c][i], target_vol, _mm_cmplt_epi32(_mm_srai_epi32(vols[c][i], 16), target));
+                }
+                vol[i] = _mm_srai_epi32(vols[c][i], 16);
             }
+            out = _mm_loadu_si128((const __m128i *)dry[c]);
+            _mm_storeu_si128((__m128i *)dry[c], _mm_packs_epi32(
+                envmix_sse41(_mm_cvtepi16_epi32(out), in32[0], vol[0], dry_gain),
+                envmix_sse41(_mm_cvtepi16_epi32(_mm_unpackhi_epi64(out, out)), in32[1], vol[1], dry_gain)));
+            if (flags & A_AUX) {
+                out = _mm_loadu_si128((const __m128i *)wet[c]);
+                _mm_storeu_si128((__m128i *)wet[c], _mm_packs_epi32(
+                    envmix_sse41(_mm_cvtepi16_epi32(out), in32[0], vol[0], wet_gain),
+                    envmix_sse41(_mm_cvtepi16_epi32(_mm_unpackhi_epi64(out, out)), in32[1], vol[1], wet_gain)));
+            }
+            vols[c][0] = envmix_ramp_sse41(vols[c][0], rate);
+            vols[c][1] = envmix_ramp_sse41(vols[c][1], rate);
 
-            vol_s16 = _mm_packs_epi32(_mm_cvtps_epi32(vols[c][0]), _mm_cvtps_epi32(vols[c][1]));
-            _mm_storeu_si128((__m128i *)dry[c],
-                             _mm_adds_epi16(
-                                 _mm_loadu_si128((const __m128i *)dry[c]),
-                                 _mm_mulhrs_epi16(in_loaded, _mm_mulhrs_epi16(vol_s16, dry_factor))));
             dry[c] += 8;
-
             if (flags & A_AUX) {
-                _mm_storeu_si128((__m128i *)wet[c],
-                                 _mm_adds_epi16(
-                                     _mm_loadu_si128((const __m128i *)wet[c]),
-                                     _mm_mulhrs_epi16(in_loaded, _mm_mulhrs_epi16(vol_s16, wet_factor))));
                 wet[c] += 8;
             }
-
-            vols[c][0] = _mm_mul_ps(vols[c][0], rate[c]);
-            vols[c][1] = _mm_mul_ps(vols[c][1], rate[c]);
         }
 
-        nbytes -= 8 * sizeof(int16_t);
+        nbytes -= 16;
+        in += 8;
     } while (nbytes > 0);
 
-    _mm_storeu_ps((float *)state, vols[0][0]);
-    _mm_storeu_ps((float *)(state + 8), vols[0][1]);
-    _mm_storeu_ps((float *)(state + 16), vols[1][0]);
-    _mm_storeu_ps((float *)(state + 24), vols[1][1]);
+    for (c = 0; c < 2; c++) {
+        _mm_storeu_si128((__m128i *)p.vols[c], vols[c][0]);
+        _mm_storeu_si128((__m128i *)(p.vols[c] + 4), vols[c][1]);
+    }
 #elif HAS_NEON
-    float32x4_t vols[2][2];
-    int16_t dry_factor;
-    int16_t wet_factor;
-    float32x4_t target[2];
-    float rate[2];
-    int16x8_t in_loaded;
-    int16x8_t vol_s16;
-    bool increasing[2];
-
-    int c;
+    int32x4_t vols[2][2];
+    int i;
 
-    if (flags & A_INIT) {
-        float vol_init[2] = {rspa.vol[0], rspa.vol[1]};
-        float rate_float[2] = {(float)rspa.rate[0] * (1.0f / 65536.0f), (float)rspa.rate[1] * (1.0f / 65536.0f)};
-        float step_diff[2] = {vol_init[0] * (rate_float[0] - 1.0f), vol_init[1] * (rate_float[1] - 1.0f)};
-        static const float step_dividers_data[2][4] = {{1.0f / 8.0f, 2.0f / 8.0f, 3.0f / 8.0f, 4.0f / 8.0f},
-                                                      {5.0f / 8.0f, 6.0f / 8.0f, 7.0f / 8.0f, 8.0f / 8.0f}};
-        float32x4_t step_dividers[2] = {vld1q_f32(step_dividers_data[0]), vld1q_f32(step_dividers_data[1])};
+    for (c = 0; c < 2; c++) {
+        vols[c][0] = vld1q_s32(p.vols[c]);
+        vols[c][1] = vld1q_s32(p.vols[c] + 4);
+    }
 
+    do {
+        int16x8_t in_loaded = vld1q_s16(in);
+        int32x4_t in32[2] = {vmovl_s16(vget_low_s16(in_loaded)), vmovl_s16(vget_high_s16(in_loaded))};
         for (c = 0; c < 2; c++) {
-            vols[c][0] = vaddq_f32(vdupq_n_f32(vol_init[c]), vmulq_n_f32(step_dividers[0], step_diff[c]));
-            vols[c][1] = vaddq_f32(vdupq_n_f32(vol_init[c]), vmulq_n_f32(step_dividers[1], step_diff[c]));
-            increasing[c] = rate_float[c] >= 1.0f;
-            target[c] = vdupq_n_f32(rspa.target[c]);
-            rate[c] = rate_float[c];
+            int32x4_t target = vdupq_n_s32(p.target[c]);
+            int32x4_t target_vol = vdupq_n_s32(p.target[c] << 16);
+            int32x4_t vol[2];
+            int16x8_t out;
+            for (i = 0; i < 2; i++) {
+                if ((p.rate[c] >> 16) > 0) {
+                    // Increasing volume
+                    vols[c][i] = vbslq_s32(vcgtq_s32(vshrq_n_s32(vols[c][i], 16), target), target_vol, vols[c][i]);
+                } else {
+                    // Decreasing volume
+                    vols[c][i] = vbslq_s32(vcltq_s32(vshrq_n_s32(vols[c][i], 16), target), target_vol, vols[c][i]);
+                }
+                vol[i] = vshrq_n_s32(vols[c][i], 16);
+            }
+            out = vld1q_s16(dry[c]);
+            vst1q_s16(dry[c], vcombine_s16(
+                vqmovn_s32(envmix_neon(vmovl_s16(vget_low_s16(out)), in32[0], vol[0], p.vol_dry)),
+                vqmovn_s32(envmix_neon(vmovl_s16(vget_high_s16(out)), in32[1], vol[1], p.vol_dry))));
+            if (flags & A_AUX) {
+                out = vld1q_s16(wet[c]);
+                vst1q_s16(wet[c], vcombine_s16(
+                    vqmovn_s32(envmix_neon(vmovl_s16(vget_low_s16(out)), in32[0], vol[0], p.vol_wet)),
+                    vqmovn_s32(envmix_neon(vmovl_s16(vget_high_s16(out)), in32[1], vol[1], p.vol_wet))));
+            }
+            vols[c][0] = envmix_ramp_neon(vols[c][0], p.rate[c]);
+            vols[c][1] = envmix_ramp_neon(vols[c][1], p.rate[c]);
+
+            dry[c] += 8;
+            if (flags & A_AUX) {
+                wet[c] += 8;
+            }
         }
 
-        dry_factor = rspa.vol_dry;
-        wet_factor = rspa.vol_wet;
+        nbytes -= 16;
+        in += 8;
+    } while (nbytes > 0);
 
-        memcpy(state + 32, &rate_float[0], 4);
-        memcpy(state + 34, &rate_float[1], 4);
-        state[36] = rspa.target[0];
-        state[37] = rspa.target[1];
-        state[38] = rspa.vol_dry;
-        state[39] = rspa.vol_wet;
-    } else {
-        vols[0][0] = vreinterpretq_f32_s16(vld1q_s16(state));
-        vols[0][1] = vreinterpretq_f32_s16(vld1q_s16(state + 8));
-        vols[1][0] = vreinterpretq_f32_s16(vld1q_s16(state + 16));
-        vols[1][1] = vreinterpretq_f32_s16(vld1q_s16(state + 24));
-        memcpy(&rate[0], state + 32, 4);
-        memcpy(&rate[1], state + 34, 4);
-        increasing[0] = rate[0] >= 1.0f;
-        increasing[1] = rate[1] >= 1.0f;
-        target[0] = vdupq_n_f32(state[36]);
-        target[1] = vdupq_n_f32(state[37]);
-        dry_factor = state[38];
-        wet_factor = state[39];
+    for (c = 0; c < 2; c++) {
+        vst1q_s32(p.vols[c], vols[c][0]);
+        vst1q_s32(p.vols[c] + 4, vols[c][1]);
     }
+#elif HAS_VECTOR
+    v8s32 vols[2];
+
+    memcpy(&vols[0], p.vols[0], 32);
+    memcpy(&vols[1], p.vols[1], 32);
 
     do {
-        in_loaded = vld1q_s16(in);
-        in += 8;
+        v8s32 in_loaded = vec_load16(in);
         for (c = 0; c < 2; c++) {
-            if (increasing[c]) {
-                vols[c][0] = vminq_f32(vols[c][0], target[c]);
-                vols[c][1] = vminq_f32(vols[c][1], target[c]);
+            v8s32 vol;
+            if ((p.rate[c] >> 16) > 0) {
+                // Increasing volume
+                vols[c] = VEC_SELECT((vols[c] >> 16) > p.target[c], (v8s32){0} + (p.target[c] << 16), vols[c]);
             } else {
-                vols[c][0] = vmaxq_f32(vols[c][0], target[c]);
-                vols[c][1] = vmaxq_f32(vols[c][1], target[c]);
+                // Decreasing volume
+                vols[c] = VEC_SELECT((vols[c] >> 16) < p.target[c], (v8s32){0} + (p.target[c] << 16), vols[c]);
             }
+            vol = vols[c] >> 16;
+            VEC_STORE16(dry[c], (vec_load16(dry[c]) * 0x7fff + in_loaded * ((vol * p.vol_dry + 0x4000) >> 15) + 0x4000) >> 15);
+            if (flags & A_AUX) {
+                VEC_STORE16(wet[c], (vec_load16(wet[c]) * 0x7fff + in_loaded * ((vol * p.vol_wet + 0x4000) >> 15) + 0x4000) >> 15);
+            }
+            vols[c] = VEC_CLAMP32(VEC_CONVERT(vols[c], v8s64) * p.rate[c] >> 16);
 
-            vol_s16 = vcombine_s16(vqmovn_s32(vcvtq_s32_f32(vols[c][0])), vqmovn_s32(vcvtq_s32_f32(vols[c][1])));
-            vst1q_s16(dry[c], vqaddq_s16(vld1q_s16(dry[c]), vqrdmulhq_s16(in_loaded, vqrdmulhq_n_s16(vol_s16, dry_factor))));
             dry[c] += 8;
             if (flags & A_AUX) {
-                vst1q_s16(wet[c], vqaddq_s16(vld1q_s16(wet[c]), vqrdmulhq_s16(in_loaded, vqrdmulhq_n_s16(vol_s16, wet_factor))));
                 wet[c] += 8;
             }
-            vols[c][0] = vmulq_n_f32(vols[c][0], rate[c]);
-            vols[c][1] = vmulq_n_f32(vols[c][1], rate[c]);
         }
 
-        nbytes -= 8 * sizeof(int16_t);
+        nbytes -= 16;
+        in += 8;
     } while (nbytes > 0);
 
-    vst1q_s16(state, vreinterpretq_s16_f32(vols[0][0]));
-    vst1q_s16(state + 8, vreinterpretq_s16_f32(vols[0][1]));
-    vst1q_s16(state + 16, vreinterpretq_s16_f32(vols[1][0]));
-    vst1q_s16(state + 24, vreinterpretq_s16_f32(vols[1][1]));
+    memcpy(p.vols[0], &vols[0], 32);
+    memcpy(p.vols[1], &vols[1], 32);
 #else
-    int16_t target[2];
-    int32_t rate[2];
-    int16_t vol_dry, vol_wet;
-
-    int32_t step_diff[2];
-    int32_t vols[2][8];
-
-    int c, i;
-
-    if (flags & A_INIT) {
-        target[0] = rspa.target[0];
-        target[1] = rspa.target[1];
-        rate[0] = rspa.rate[0];
-        rate[1] = rspa.rate[1];
-        vol_dry = rspa.vol_dry;
-        vol_wet = rspa.vol_wet;
-        step_diff[0] = rspa.vol[0] * (rate[0] - 0x10000) / 8;
-        step_diff[1] = rspa.vol[0] * (rate[1] - 0x10000) / 8;
-
-        for (i = 0; i < 8; i++) {
-            vols[0][i] = clamp32((int64_t)(rspa.vol[0] << 16) + step_diff[0] * (i + 1));
-            vols[1][i] = clamp32((int64_t)(rspa.vol[1] << 16) + step_diff[1] * (i + 1));
-        }
-    } else {
-        memcpy(vols[0], state, 32);
-        memcpy(vols[1], state + 16, 32);
-        target[0] = state[32];
-        target[1] = state[35];
-        rate[0] = (state[33] << 16) | (uint16_t)state[34];
-        rate[1] = (state[36] << 16) | (uint16_t)state[37];
-        vol_dry = state[38];
-        vol_wet = state[39];
-    }
+    int i;
 
     do {
         for (c = 0; c < 2; c++) {
             for (i = 0; i < 8; i++) {
-                if ((rate[c] >> 16) > 0) {
+                if ((p.rate[c] >> 16) > 0) {
                     // Increasing volume
-                    if ((vols[c][i] >> 16) > target[c]) {
-                        vols[c][i] = target[c] << 16;
+                    if ((p.vols[c][i] >> 16) > p.target[c]) {
+                        p.vols[c][i] = p.target[c] << 16;
                     }
                 } else {
                     // Decreasing volume
-                    if ((vols[c][i] >> 16) < target[c]) {
-                        vols[c][i] = target[c] << 16;
+                    if ((p.vols[c][i] >> 16) < p.target[c]) {
+                        p.vols[c][i] = p.target[c] << 16;
                     }
                 }
-                dry[c][i] = clamp16((dry[c][i] * 0x7fff + in[i] * (((vols[c][i] >> 16) * vol_dry + 0x4000) >> 15) + 0x4000) >> 15);
+                dry[c][i] = clamp16((dry[c][i] * 0x7fff + in[i] * (((p.vols[c][i] >> 16) * p.vol_dry + 0x4000) >> 15) + 0x4000) >> 15);
                 if (flags & A_AUX) {
-                    wet[c][i] = clamp16((wet[c][i] * 0x7fff + in[i] * (((vols[c][i] >> 16) * vol_wet + 0x4000) >> 15) + 0x4000) >> 15);
+                    wet[c][i] = clamp16((wet[c][i] * 0x7fff + in[i] * (((p.vols[c][i] >> 16) * p.vol_wet + 0x4000) >> 15) + 0x4000) >> 15);
                 }
-                vols[c][i] = clamp32((int64_t)vols[c][i] * rate[c] >> 16);
+                p.vols[c][i] = clamp32((int64_t)p.vols[c][i] * p.rate[c] >> 16);
             }
 
             dry[c] += 8;
@@ -773,32 +1201,29 @@ void aEnvMixerImpl(uint8_t flags, ENVMIX_STATE state) {
         nbytes -= 16;
         in += 8;
     } while (nbytes > 0);
-
-    memcpy(state, vols[0], 32);
-    memcpy(state + 16, vols[1], 32);
-    state[32] = target[0];
-    state[35] = target[1];
-    state[33] = (int16_t)(rate[0] >> 16);
-    state[34] = (int16_t)rate[0];
-    state[36] = (int16_t)(rate[1] >> 16);
-    state[37] = (int16_t)rate[1];
-    state[38] = vol_dry;
-    state[39] = vol_wet;
 #endif
+
+    envmixer_save(&p, state);
 }
 
 void aMixImpl(int16_t gain, uint16_t in_addr, uint16_t out_addr) {
-    int nbytes = ROUND_UP_32(rspa.nbytes);
-    int16_t *in = rspa.buf.as_s16 + in_addr / sizeof(int16_t);
-    int16_t *out = rspa.buf.as_s16 + out_addr / sizeof(int16_t);
+    struct MixerContext *ctx = mixer_ctx;
+    int nbytes = ROUND_UP_32(ctx->nbytes);
+    int16_t *in = ctx->buf.as_s16 + in_addr / sizeof(int16_t);
+    int16_t *out = ctx->buf.as_s16 + out_addr / sizeof(int16_t);
+    track_read_regs(ctx, MIXER_REG_BUF);
+    track_read(ctx, TRACK_DMEM(in_addr), nbytes);
+    track_read(ctx, TRACK_DMEM(out_addr), nbytes);
+    track_write(ctx, TRACK_DMEM(out_addr), nbytes);
 #if HAS_SSE41
-    __m128i gain_vec = _mm_set1_epi16(gain);
-#elif !HAS_NEON
+    // Each sample and its input in a pair, for _mm_madd_epi16
+    __m128i coefs = _mm_set1_epi32((uint16_t)0x7fff | (uint32_t)(uint16_t)gain << 16);
+    __m128i round = _mm_set1_epi32(0x4000);
+#elif !HAS_NEON && !HAS_VECTOR
     int i;
     int32_t sample;
 #endif
 
-#if !HAS_NEON
     if (gain == -0x8000) {
         while (nbytes > 0) {
 #if HAS_SSE41
@@ -814,6 +1239,18 @@ void aMixImpl(int16_t gain, uint16_t in_addr, uint16_t out_addr) {
             _mm_storeu_si128((__m128i *)out, out1);
             _mm_storeu_si128((__m128i *)(out + 8), out2);
 
+            out += 16;
+            in += 16;
+#elif HAS_NEON
+            vst1q_s16(out, vqsubq_s16(vld1q_s16(out), vld1q_s16(in)));
+            vst1q_s16(out + 8, vqsubq_s16(vld1q_s16(out + 8), vld1q_s16(in + 8)));
+
+            out += 16;
+            in += 16;
+#elif HAS_VECTOR
+            VEC_STORE16(out, vec_load16(out) - vec_load16(in));
+            VEC_STORE16(out + 8, vec_load16(out + 8) - vec_load16(in + 8));
+
             out += 16;
             in += 16;
 #else
@@ -826,7 +1263,6 @@ void aMixImpl(int16_t gain, uint16_t in_addr, uint16_t out_addr) {
             nbytes -= 16 * sizeof(int16_t);
         }
     }
-#endif
 
     while (nbytes > 0) {
 #if HAS_SSE41
@@ -836,8 +1272,12 @@ void aMixImpl(int16_t gain, uint16_t in_addr, uint16_t out_addr) {
         in1 = _mm_loadu_si128((const __m128i *)in);
         in2 = _mm_loadu_si128((const __m128i *)(in + 8));
 
-        out1 = _mm_adds_epi16(out1, _mm_mulhrs_epi16(in1, gain_vec));
-        out2 = _mm_adds_epi16(out2, _mm_mulhrs_epi16(in2, gain_vec));
+        out1 = _mm_packs_epi32(
+            _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(out1, in1), coefs), round), 15),
+            _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(out1, in1), coefs), round), 15));
+        out2 = _mm_packs_epi32(
+            _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(out2, in2), coefs), round), 15),
+            _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(out2, in2), coefs), round), 15));
 
         _mm_storeu_si128((__m128i *)out, out1);
         _mm_storeu_si128((__m128i *)(out + 8), out2);
@@ -851,12 +1291,20 @@ void aMixImpl(int16_t gain, uint16_t in_addr, uint16_t out_addr) {
         in1 = vld1q_s16(in);
         in2 = vld1q_s16(in + 8);
 
-        out1 = vqaddq_s16(out1, vqrdmulhq_n_s16(in1, gain));
-        out2 = vqaddq_s16(out2, vqrdmulhq_n_s16(in2, gain));
+        out1 = vcombine_s16(vqrshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_low_s16(out1), 0x7fff), vget_low_s16(in1), gain), 15),
+                            vqrshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_high_s16(out1), 0x7fff), vget_high_s16(in1), gain), 15));
+        out2 = vcombine_s16(vqrshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_low_s16(out2), 0x7fff), vget_low_s16(in2), gain), 15),
+                            vqrshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_high_s16(out2), 0x7fff), vget_high_s16(in2), gain), 15));
 
         vst1q_s16(out, out1);
         vst1q_s16(out + 8, out2);
 
+        out += 16;
+        in += 16;
+#elif HAS_VECTOR
+        VEC_STORE16(out, (vec_load16(out) * 0x7fff + vec_load16(in) * gain + 0x4000) >> 15);
+        VEC_STORE16(out + 8, (vec_load16(out + 8) * 0x7fff + vec_load16(in + 8) * gain + 0x4000) >> 15);
+
         out += 16;
         in += 16;
 #else
@@ -869,3 +1317,306 @@ void aMixImpl(int16_t gain, uint16_t in_addr, uint16_t out_addr) {
         nbytes -= 16 * sizeof(int16_t);
     }
 }
+
+struct MixerContext *mixer_context_create(void) {
+    struct MixerContext *ctx = calloc(1, sizeof(struct MixerContext));
+    if (ctx != NULL) {
+        ctx->tracking = true;
+        ctx->written_lo = TRACK_SIZE;
+    }
+    return ctx;
+}
+
+void mixer_context_destroy(struct MixerContext *ctx) {
+    free(ctx);
+}
+
+void mixer_set_context(struct MixerContext *ctx) {
+    mixer_ctx = ctx != NULL ? ctx : &mixer_default_ctx;
+}
+
+void mixer_context_reset_tracking(struct MixerContext *ctx) {
+    if (ctx->written_lo < ctx->written_hi) {
+        memset(ctx->written + ctx->written_lo, TRACK_UNTOUCHED, ctx->written_hi - ctx->written_lo);
+    }
+    ctx->written_lo = TRACK_SIZE;
+    ctx->written_hi = 0;
+    ctx->read_unwritten = false;
+    ctx->regs_written = 0;
+}
+
+bool mixer_context_read_unwritten(const struct MixerContext *ctx) {
+    return ctx->read_unwritten;
+}
+
+void mixer_context_merge(const struct MixerContext *src) {
+    struct MixerContext *ctx = mixer_ctx;
+    const uint8_t *from = (const uint8_t *)src->adpcm_table;
+    uint8_t *to = (uint8_t *)ctx->adpcm_table;
+    uint8_t copied[TRACK_SIZE];
+    const uint8_t *first_copy;
+    int i, end;
+
+    // Copies take the bytes they came from as they are before the merge
+    first_copy = src->written_lo < src->written_hi
+        ? memchr(src->written + src->written_lo, TRACK_COPIED, src->written_hi - src->written_lo) : NULL;
+    for (i = first_copy != NULL ? first_copy - src->written : src->written_hi; i < src->written_hi; i++) {
+        if (src->written[i] == TRACK_COPIED) {
+            copied[i] = to[src->copied_from[i]];
+        }
+    }
+    for (i = src->written_lo; i < src->written_hi; i = end) {
+        for (end = i + 1; end < src->written_hi && src->written[end] == src->written[i]; end++) {
+        }
+        if (src->written[i] == TRACK_WRITTEN) {
+            memcpy(to + i, from + i, end - i);
+        } else if (src->written[i] == TRACK_COPIED) {
+            memcpy(to + i, copied + i, end - i);
+        }
+    }
+    if (src->regs_written & MIXER_REG_BUF) {
+        ctx->in = src->in;
+        ctx->out = src->out;
+        ctx->nbytes = src->nbytes;
+    }
+    if (src->regs_written & MIXER_REG_AUX) {
+        ctx->dry_right = src->dry_right;
+        ctx->wet_left = src->wet_left;
+        ctx->wet_right = src->wet_right;
+    }
+    if (src->regs_written & MIXER_REG_VOL_LEFT) {
+        ctx->vol[0] = src->vol[0];
+    }
+    if (src->regs_written & MIXER_REG_VOL_RIGHT) {
+        ctx->vol[1] = src->vol[1];
+    }
+    if (src->regs_written & MIXER_REG_RATE_LEFT) {
+        ctx->target[0] = src->target[0];
+        ctx->rate[0] = src->rate[0];
+    }
+    if (src->regs_written & MIXER_REG_RATE_RIGHT) {
+        ctx->target[1] = src->target[1];
+        ctx->rate[1] = src->rate[1];
+    }
+    if (src->regs_written & MIXER_REG_DRY_WET) {
+        ctx->vol_dry = src->vol_dry;
+        ctx->vol_wet = src->vol_wet;
+    }
+    if (src->regs_written & MIXER_REG_LOOP) {
+        ctx->adpcm_loop_state = src->adpcm_loop_state;
+    }
+}
+
+// Windowed sinc: the lowpass runs at up times the input rate, and each output
+// frame takes one of its up phases over RESAMPLER_TAPS input frames. The
+// coefficients of a phase are 16 bit and sum to exactly 1, so silence and DC
+// pass through unchanged. Their magnitudes add up to less than 2, so the 32
+// bit sums can't overflow in any order, which keeps the kernels bit for bit
+// the same.
+#define RESAMPLER_TAPS 32
+#define RESAMPLER_BLOCK 512 // input frames taken in at a time
+#define RESAMPLER_ROLLOFF 0.9 // of the lower rate's Nyquist frequency
+#define RESAMPLER_KAISER_BETA 8.0
+
+struct MixerResampler {
+    int up, down; // the output rate over the input rate, reduced
+    int phase; // of the next output frame, in 1/up of an input frame
+    int pos; // first input frame of the next output frame, may lie past len
+    int len; // frames in hist
+    int16_t *coefs; // [up][RESAMPLER_TAPS]
+    int16_t hist[2][RESAMPLER_TAPS - 1 + RESAMPLER_BLOCK];
+};
+
+static double resampler_bessel_i0(double x) {
+    double sum = 1.0, term = 1.0;
+    int k;
+
+    for (k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Returns false if the magnitudes come to 2 or more
+static bool resampler_make_coefs(int16_t *coefs, int phase, int up, double cutoff) {
+    double taps[RESAMPLER_TAPS];
+    double total = 0.0;
+    int sum = 0, peak = 0, magnitude = 0;
+    int k;
+
+    for (k = 0; k < RESAMPLER_TAPS; k++) {
+        // Input frames from the output frame to tap k
+        double t = k - (RESAMPLER_TAPS / 2 - 1) - (double)phase / up;
+        double w = t / (RESAMPLER_TAPS / 2);
+        double x = M_PI * cutoff * t;
+        taps[k] = (x == 0.0 ? 1.0 : sin(x) / x) * resampler_bessel_i0(RESAMPLER_KAISER_BETA * sqrt(w * w < 1.0 ? 1.0 - w * w : 0.0));
+        total += taps[k];
+    }
+    for (k = 0; k < RESAMPLER_TAPS; k++) {
+        coefs[k] = (int16_t)lrint(taps[k] / total * 0x8000);
+        sum += coefs[k];
+        if (coefs[k] > coefs[peak]) {
+            peak = k;
+        }
+    }
+    // What the rounding lost goes on the biggest tap
+    coefs[peak] += 0x8000 - sum;
+    for (k = 0; k < RESAMPLER_TAPS; k++) {
+        magnitude += abs(coefs[k]);
+    }
+    return magnitude < 0x10000;
+}
+
+void mixer_resampler_destroy(struct MixerResampler *rs) {
+    if (rs != NULL) {
+        free(rs->coefs);
+        free(rs);
+    }
+}
+
+struct MixerResampler *mixer_resampler_create(int in_rate, int out_rate) {
+    struct MixerResampler *rs;
+    int a = in_rate, b = out_rate;
+    int p;
+
+    if (in_rate <= 0 || out_rate <= 0) {
+        return NULL;
+    }
+    while (b != 0) {
+        int r = a % b;
+        a = b;
+        b = r;
+    }
+    rs = calloc(1, sizeof(struct MixerResampler));
+    if (rs == NULL) {
+        return NULL;
+    }
+    rs->up = out_rate / a;
+    rs->down = in_rate / a;
+    rs->coefs = malloc(rs->up * RESAMPLER_TAPS * sizeof(int16_t));
+    if (rs->coefs == NULL) {
+        free(rs);
+        return NULL;
+    }
+    for (p = 0; p < rs->up; p++) {
+        if (!resampler_make_coefs(rs->coefs + p * RESAMPLER_TAPS, p, rs->up,
+                                  RESAMPLER_ROLLOFF * (rs->up < rs->down ? (double)rs->up / rs->down : 1.0))) {
+            mixer_resampler_destroy(rs);
+            return NULL;
+        }
+    }
+    // Silence before the first frame, so the first output frame lies on it
+    rs->len = RESAMPLER_TAPS / 2 - 1;
+    return rs;
+}
+
+int mixer_resampler_max_output(const struct MixerResampler *rs, int in_frames) {
+    return (int)((int64_t)in_frames * rs->up / rs->down) + 2;
+}
+
+// One stereo output frame from RESAMPLER_TAPS frames of each channel
+static inline void resampler_frame(const int16_t *left, const int16_t *right, const int16_t *coefs, int16_t *out) {
+#if HAS_SSE41
+    __m128i acc_left = _mm_setzero_si128();
+    __m128i acc_right = _mm_setzero_si128();
+    __m128i sums;
+    int k;
+
+    for (k = 0; k < RESAMPLER_TAPS; k += 8) {
+        __m128i c = _mm_loadu_si128((const __m128i *)(coefs + k));
+        acc_left = _mm_add_epi32(acc_left, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(left + k)), c));
+        acc_right = _mm_add_epi32(acc_right, _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(right + k)), c));
+    }
+    sums = _mm_hadd_epi32(acc_left, acc_right);
+    sums = _mm_hadd_epi32(sums, sums);
+    sums = _mm_srai_epi32(_mm_add_epi32(sums, _mm_set1_epi32(0x4000)), 15);
+    sums = _mm_packs_epi32(sums, sums);
+    *(int32_t *)out = _mm_cvtsi128_si32(sums);
+#elif HAS_NEON
+    int32x4_t acc_left = vdupq_n_s32(0);
+    int32x4_t acc_right = vdupq_n_s32(0);
+    int32x2_t sums;
+    int k;
+
+    for (k = 0; k < RESAMPLER_TAPS; k += 8) {
+        int16x8_t c = vld1q_s16(coefs + k);
+        int16x8_t l = vld1q_s16(left + k);
+        int16x8_t r = vld1q_s16(right + k);
+        acc_left = vmlal_s16(acc_left, vget_low_s16(l), vget_low_s16(c));
+        acc_left = vmlal_s16(acc_left, vget_high_s16(l), vget_high_s16(c));
+        acc_right = vmlal_s16(acc_right, vget_low_s16(r), vget_low_s16(c));
+        acc_right = vmlal_s16(acc_right, vget_high_s16(r), vget_high_s16(c));
+    }
+    sums = vpadd_s32(vadd_s32(vget_low_s32(acc_left), vget_high_s32(acc_left)),
+                     vadd_s32(vget_low_s32(acc_right), vget_high_s32(acc_right)));
+    sums = vrshr_n_s32(sums, 15);
+    vst1_lane_s32((int32_t *)out, vreinterpret_s32_s16(vqmovn_s32(vcombine_s32(sums, sums))), 0);
+#elif HAS_VECTOR
+    v8s32 acc_left = {0};
+    v8s32 acc_right = {0};
+    int32_t sum_left = 0x4000, sum_right = 0x4000;
+    int k;
+
+    for (k = 0; k < RESAMPLER_TAPS; k += 8) {
+        v8s32 c = vec_load16(coefs + k);
+        acc_left += vec_load16(left + k) * c;
+        acc_right += vec_load16(right + k) * c;
+    }
+    for (k = 0; k < 8; k++) {
+        sum_left += acc_left[k];
+        sum_right += acc_right[k];
+    }
+    out[0] = clamp16(sum_left >> 15);
+    out[1] = clamp16(sum_right >> 15);
+#else
+    int32_t sum_left = 0x4000, sum_right = 0x4000;
+    int k;
+
+    for (k = 0; k < RESAMPLER_TAPS; k++) {
+        sum_left += left[k] * coefs[k];
+        sum_right += right[k] * coefs[k];
+    }
+    out[0] = clamp16(sum_left >> 15);
+    out[1] = clamp16(sum_right >> 15);
+#endif
+}
+
+int mixer_resampler_process(struct MixerResampler *rs, const int16_t *in, int in_frames, int16_t *out) {
+    int out_frames = 0;
+
+    while (in_frames > 0) {
+        int n = in_frames < RESAMPLER_BLOCK ? in_frames : RESAMPLER_BLOCK;
+        int i;
+
+        for (i = 0; i < n; i++) {
+            rs->hist[0][rs->len + i] = in[i * 2];
+            rs->hist[1][rs->len + i] = in[i * 2 + 1];
+        }
+        rs->len += n;
+        in += n * 2;
+        in_frames -= n;
+
+        while (rs->pos + RESAMPLER_TAPS <= rs->len) {
+            resampler_frame(rs->hist[0] + rs->pos, rs->hist[1] + rs->pos,
+                            rs->coefs + rs->phase * RESAMPLER_TAPS, out + out_frames * 2);
+            out_frames++;
+            rs->phase += rs->down;
+            while (rs->phase >= rs->up) {
+                rs->phase -= rs->up;
+                rs->pos++;
+            }
+        }
+        // Keep what the next output frames still need
+        if (rs->pos < rs->len) {
+            memmove(rs->hist[0], rs->hist[0] + rs->pos, (rs->len - rs->pos) * sizeof(int16_t));
+            memmove(rs->hist[1], rs->hist[1] + rs->pos, (rs->len - rs->pos) * sizeof(int16_t));
+            rs->len -= rs->pos;
+            rs->pos = 0;
+        } else {
+            rs->pos -= rs->len;
+            rs->len = 0;
+        }
+    }
+    return out_frames;
+}
@@ -1,6 +1,7 @@
 #ifndef MIXER_H
 #define MIXER_H
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <ultra64.h>
 
@@ -30,10 +31,44 @@ void aInterleaveImpl(uint16_t left, uint16_t right);
 void aDMEMMoveImpl(uint16_t in_addr, uint16_t out_addr, int nbytes);
 void aSetLoopImpl(ADPCM_STATE *adpcm_loop_state);
 void aADPCMdecImpl(uint8_t flags, ADPCM_STATE state);
+// As aADPCMdec from frame on, copying the frames from pcm (the whole sample
+// decoded, see pcm_cache.h) where that gives the same result
+void aADPCMdecCachedImpl(uint8_t flags, ADPCM_STATE state, const int16_t *pcm, int frame);
 void aResampleImpl(uint8_t flags, uint16_t pitch, RESAMPLE_STATE state);
 void aEnvMixerImpl(uint8_t flags, ENVMIX_STATE state);
 void aMixImpl(int16_t gain, uint16_t in_addr, uint16_t out_addr);
 
+// The registers and DMEM the commands work on. Each thread runs them against
+// the default context unless it picks another, so that notes can be
+// synthesized side by side. A context from mixer_context_create also notes
+// which bytes and registers its commands write, and whether they read any
+// they didn't write: if they didn't, merging it into the context they would
+// have run in gives the same state as running them there.
+struct MixerContext;
+
+struct MixerContext *mixer_context_create(void);
+void mixer_context_destroy(struct MixerContext *ctx);
+// Runs the calling thread's commands against ctx, or the default context if NULL
+void mixer_set_context(struct MixerContext *ctx);
+// Forgets everything written so far, as for a fresh run of commands
+void mixer_context_reset_tracking(struct MixerContext *ctx);
+bool mixer_context_read_unwritten(const struct MixerContext *ctx);
+// Copies what src's commands wrote into the calling thread's context
+void mixer_context_merge(const struct MixerContext *src);
+
+// Converts the interleaved stereo the synthesis puts out to another rate, for
+// backends that feed the device at its own rate instead of letting it convert
+// from 32 kHz. The output lags the input by about 16 input frames.
+struct MixerResampler;
+
+// Returns NULL if it can't convert between the rates
+struct MixerResampler *mixer_resampler_create(int in_rate, int out_rate);
+void mixer_resampler_destroy(struct MixerResampler *rs);
+// Most frames mixer_resampler_process puts out for in_frames
+int mixer_resampler_max_output(const struct MixerResampler *rs, int in_frames);
+// Returns the number of frames written to out
+int mixer_resampler_process(struct MixerResampler *rs, const int16_t *in, int in_frames, int16_t *out);
+
 #define aSegment(pkt, s, b) do { } while(0)
 #define aClearBuffer(pkt, d, c) aClearBufferImpl(d, c)
 #define aLoadBuffer(pkt, s) aLoadBufferImpl(s)
@@ -46,6 +81,7 @@ void aMixImpl(int16_t gain, uint16_t in_addr, uint16_t out_addr);
 #define aDMEMMove(pkt, i, o, c) aDMEMMoveImpl(i, o, c)
 #define aSetLoop(pkt, a) aSetLoopImpl(a)
 #define aADPCMdec(pkt, f, s) aADPCMdecImpl(f, s)
+#define aADPCMdecCached(pkt, f, s, p, n) aADPCMdecCachedImpl(f, s, p, n)
 #define aResample(pkt, f, p, s) aResampleImpl(f, p, s)
 #define aEnvMixer(pkt, f, s) aEnvMixerImpl(f, s)
 #define aMix(pkt, f, g, i, o) aMixImpl(g, i, o)
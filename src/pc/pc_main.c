@@ -8,6 +8,8 @@
 #include "sm64.h"
 
 #include "game/memory.h"
+#include "game/sound_init.h"
+#include "buffers/buffers.h"
 #include "audio/external.h"
 
 #include "gfx/gfx_pc.h"
@@ -24,6 +26,7 @@
 #include "audio/audio_pulse.h"
 #include "audio/audio_alsa.h"
 #include "audio/audio_sdl.h"
+#include "audio/audio_sdl_callback.h"
 #include "audio/audio_null.h"
 
 #include "controller/controller_keyboard.h"
@@ -61,11 +64,30 @@ void set_vblank_handler(UNUSED s32 index, UNUSED struct VblankHandler *handler,
 
 static uint8_t inited = 0;
 
+#include <SDL2/SDL.h>
+
+// Pipelined mode runs the game ticks on their own thread. While tick N+1
+// builds its display list in one gfx pool, the main thread draws tick N's
+// from the other. The main thread only lets the next tick start once it has
+// picked up the last one, so the game is never more than one frame ahead and
+// a pool is never written while it is being drawn. Window events are handled
+// between ticks, so the keyboard state doesn't change under the game.
+static struct {
+    SDL_Thread *thread;
+    SDL_sem *tick_start;
+    SDL_sem *tick_done;
+    struct SPTask *task; // display list of the last finished tick
+} pipeline;
+
 #include "game/game_init.h" // for gGlobalTimer
 void send_display_list(struct SPTask *spTask) {
     if (!inited) {
         return;
     }
+    if (pipeline.thread != NULL) {
+        pipeline.task = spTask;
+        return;
+    }
     gfx_run((Gfx *)spTask->task.t.data_ptr);
 }
 
@@ -77,9 +99,6 @@ void send_display_list(struct SPTask *spTask) {
 #define SAMPLES_LOW 528
 #endif
 
-#include <SDL2/SDL.h>
-
-SDL_mutex *snd_mutex = NULL;
 SDL_Thread *snd_thread = NULL;
 int snd_thread_status = -1;
 extern s32 gAudioFrameCount;
@@ -87,8 +106,12 @@ extern s32 sGameLoopTicked;
 extern u32 gAudioRandom;
 extern u64 *gAudioCmdBuffers[2];
 
+// The audio thread never waits for the game: whatever the game asked of the
+// sound engine is queued (see external.c) and picked up by the next buffer.
 int sdl_snd_dispatch_fn(void *ptr)
 {
+    bool started = false;
+
     while (snd_thread_status < 0)
         SDL_Delay(0);
 
@@ -96,15 +119,19 @@ int sdl_snd_dispatch_fn(void *ptr)
         if (snd_thread_status > 0) 
             return 1;
 
-        if (audio_api->buffered() >= audio_api->get_desired_buffered()) {
-            SDL_Delay(16);
+        int excess = audio_api->buffered() - audio_api->get_desired_buffered();
+        if (excess >= 0) {
+            // Wake up about when the device will have played the excess
+            // (32 frames per ms), so a small target doesn't run dry
+            SDL_Delay(excess / 32 < 16 ? excess / 32 + 1 : 16);
             continue;
         }
 
-        // Audio Critical Section
-        SDL_LockMutex(snd_mutex);
-
         int samples_left = audio_api->buffered();
+        if (started && samples_left == 0) {
+            // The device ran dry since the last buffer went out
+            ProfEmitCounter("audio_underruns", 1);
+        }
         u32 num_audio_samples = samples_left < audio_api->get_desired_buffered() ? SAMPLES_HIGH : SAMPLES_LOW;
         //printf("Audio samples: %d %u\n", samples_left, num_audio_samples);
         s16 audio_buffer[SAMPLES_HIGH * 2 * 2];
@@ -115,11 +142,10 @@ int sdl_snd_dispatch_fn(void *ptr)
             u32 num_audio_samples = audio_cnt < 2 ? 528 : 544;*/
             create_next_audio_buffer(audio_buffer + i * (num_audio_samples * 2), num_audio_samples);
         }
-        audio_game_loop_tick();
-        SDL_UnlockMutex(snd_mutex);
 
         //printf("Audio samples before submitting: %d\n", audio_api->buffered());
         audio_api->play((u8 *)audio_buffer, 2 * num_audio_samples * 4);
+        started = true;
 
     }
 
@@ -130,9 +156,8 @@ void produce_one_frame(void) {
     ProfEmitEventStart("frame");
     gfx_start_frame();
     
-    SDL_LockMutex(snd_mutex);
-        game_loop_one_iteration();
-    SDL_UnlockMutex(snd_mutex);
+    game_loop_one_iteration();
+    audio_game_loop_tick();
     snd_thread_status = 0;
 
     display_and_vsync();
@@ -158,6 +183,46 @@ void produce_one_frame(void) {
     ProfSampleFrame();
 }
 
+static int game_thread_fn(UNUSED void *arg) {
+    while (true) {
+        SDL_SemWait(pipeline.tick_start);
+        game_loop_one_iteration();
+        audio_game_loop_tick();
+        snd_thread_status = 0;
+
+        display_and_vsync();
+        SDL_SemPost(pipeline.tick_done);
+    }
+    return 0;
+}
+
+static void produce_one_frame_pipelined(void) {
+    ProfEmitEventStart("wait_game_tick");
+    SDL_SemWait(pipeline.tick_done);
+    ProfEmitEventEnd("wait_game_tick");
+    // Neither thread has anything in flight here, so the profiler frame ends
+    // here too: it holds the previous frame's rendering and this tick
+    ProfSampleFrame();
+
+    ProfEmitEventStart("frame");
+    struct SPTask *task = pipeline.task;
+    gfx_start_frame();
+    SDL_SemPost(pipeline.tick_start);
+
+    gfx_run((Gfx *)task->task.t.data_ptr);
+    gfx_end_frame();
+    ProfEmitEventEnd("frame");
+}
+
+static void pipeline_init(void) {
+    pipeline.tick_start = SDL_CreateSemaphore(1);
+    pipeline.tick_done = SDL_CreateSemaphore(0);
+    pipeline.thread = SDL_CreateThread(game_thread_fn, "th_game", NULL);
+    if (pipeline.thread == NULL) {
+        printf("Couldn't start the game thread, rendering serially: %s\n", SDL_GetError());
+    }
+}
+
 #ifdef TARGET_WEB
 static void em_main_loop(void) {
 }
@@ -202,7 +267,10 @@ static void on_fullscreen_changed(bool is_now_fullscreen) {
 void main_func(void) {
 #ifdef USE_SYSTEM_MALLOC
     main_pool_init();
-    gGfxAllocOnlyPool = alloc_only_pool_init();
+    for (int i = 0; i < GFX_NUM_POOLS; i++) {
+        gGfxAllocOnlyPools[i] = alloc_only_pool_init();
+    }
+    gGfxAllocOnlyPool = gGfxAllocOnlyPools[0];
 #else
     static u64 pool[0x165000/8 / 4 * sizeof(void *)];
     main_pool_init(pool, pool + sizeof(pool) / sizeof(pool[0]));
@@ -256,11 +324,18 @@ void main_func(void) {
     }
 #endif
 #if defined(TARGET_WEB) || defined(TARGET_OD)
+    if (audio_api == NULL && configAudioCallback && audio_sdl_callback.init()) {
+        audio_api = &audio_sdl_callback;
+    }
     if (audio_api == NULL && audio_sdl.init()) {
         audio_api = &audio_sdl;
+    }
+    if (audio_api == &audio_sdl || audio_api == &audio_sdl_callback) {
         if (!snd_thread) {
-            snd_mutex = SDL_CreateMutex();
             snd_thread = SDL_CreateThread(sdl_snd_dispatch_fn, "th_snd", (void*)NULL);
+            if (snd_thread) {
+                audio_use_command_queue();
+            }
         }
     }
 #endif
@@ -279,8 +354,11 @@ void main_func(void) {
     inited = 1;
 #else
     inited = 1;
+    if (configPipelinedRender) {
+        pipeline_init();
+    }
     while (1) {
-        wm_api->main_loop(produce_one_frame);
+        wm_api->main_loop(pipeline.thread != NULL ? produce_one_frame_pipelined : produce_one_frame);
     }
 #endif
 }
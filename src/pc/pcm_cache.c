@@ -0,0 +1,243 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pcm_cache.h"
+#include "configfile.h"
+#include "cheapProfiler.h"
+#include "../audio/internal.h"
+
+#define PCM_CACHE_BUCKETS 256
+// Longer samples (music instruments mostly) stream as before. 2 s at 32 kHz.
+#define PCM_CACHE_MAX_SAMPLES 65536
+
+struct PcmCacheEntry {
+    const struct AudioBankSample *sample;
+    struct PcmCacheEntry *hash_next;
+    struct PcmCacheEntry *lru_prev; // more recently used
+    struct PcmCacheEntry *lru_next; // less recently used
+    size_t size;                    // bytes of pcm, 0 if the sample doesn't qualify
+    int16_t pcm[];
+};
+
+static struct {
+    struct PcmCacheEntry *buckets[PCM_CACHE_BUCKETS];
+    struct PcmCacheEntry *lru_head;
+    struct PcmCacheEntry *lru_tail;
+    struct PcmCacheEntry *held; // evicted while held, linked by hash_next
+    bool holding;
+    struct PcmCacheStats stats;
+} cache;
+
+static inline uint32_t pcm_cache_bucket(const struct AudioBankSample *sample) {
+    uintptr_t key = (uintptr_t)sample;
+    return (uint32_t)((key >> 4) ^ (key >> 12)) % PCM_CACHE_BUCKETS;
+}
+
+static inline int16_t pcm_cache_clamp16(int32_t v) {
+    if (v < -0x8000) {
+        return -0x8000;
+    } else if (v > 0x7fff) {
+        return 0x7fff;
+    }
+    return (int16_t)v;
+}
+
+// The scalar aADPCMdecImpl from a zeroed state, which every variant of the
+// mixer matches. Returns false for data the mixer would decode with whatever
+// codebook a previous note left loaded.
+static bool pcm_cache_decode(const struct AudioBankSample *sample, int16_t *out, size_t num_frames) {
+    const struct AdpcmBook *book = sample->book;
+    const uint8_t *in = sample->sampleAddr;
+    int16_t prev1 = 0;
+    int16_t prev2 = 0;
+
+    if (book->order != 2) {
+        return false;
+    }
+    for (size_t f = 0; f < num_frames; f++) {
+        int shift = *in >> 4;
+        int table_index = *in++ & 0xf;
+        if (table_index >= book->npredictors || table_index >= 8) {
+            return false;
+        }
+        const int16_t *tbl0 = book->book + table_index * 16;
+        const int16_t *tbl1 = tbl0 + 8;
+        for (int i = 0; i < 2; i++) {
+            int16_t ins[8];
+            for (int j = 0; j < 4; j++) {
+                ins[j * 2] = (((*in >> 4) << 28) >> 28) << shift;
+                ins[j * 2 + 1] = (((*in++ & 0xf) << 28) >> 28) << shift;
+            }
+            for (int j = 0; j < 8; j++) {
+                int32_t acc = tbl0[j] * prev2 + tbl1[j] * prev1 + (ins[j] << 11);
+                for (int k = 0; k < j; k++) {
+                    acc += tbl1[((j - k) - 1)] * ins[k];
+                }
+                acc >>= 11;
+                out[j] = pcm_cache_clamp16(acc);
+            }
+            prev2 = out[6];
+            prev1 = out[7];
+            out += 8;
+        }
+    }
+    return true;
+}
+
+static void pcm_cache_unlink(struct PcmCacheEntry *e) {
+    if (e->lru_prev != NULL) {
+        e->lru_prev->lru_next = e->lru_next;
+    } else {
+        cache.lru_head = e->lru_next;
+    }
+    if (e->lru_next != NULL) {
+        e->lru_next->lru_prev = e->lru_prev;
+    } else {
+        cache.lru_tail = e->lru_prev;
+    }
+}
+
+static void pcm_cache_push_front(struct PcmCacheEntry *e) {
+    e->lru_prev = NULL;
+    e->lru_next = cache.lru_head;
+    if (cache.lru_head != NULL) {
+        cache.lru_head->lru_prev = e;
+    } else {
+        cache.lru_tail = e;
+    }
+    cache.lru_head = e;
+}
+
+static void pcm_cache_evict_lru(void) {
+    struct PcmCacheEntry *e = cache.lru_tail;
+    struct PcmCacheEntry **link = &cache.buckets[pcm_cache_bucket(e->sample)];
+    while (*link != e) {
+        link = &(*link)->hash_next;
+    }
+    *link = e->hash_next;
+    pcm_cache_unlink(e);
+    cache.stats.bytes -= e->size;
+    cache.stats.entries--;
+    cache.stats.evictions++;
+    ProfEmitCounter("pcm_cache_evictions", 1);
+    if (cache.holding) {
+        e->hash_next = cache.held;
+        cache.held = e;
+    } else {
+        free(e);
+    }
+}
+
+static struct PcmCacheEntry *pcm_cache_insert(const struct AudioBankSample *sample) {
+    size_t budget = (size_t)configPcmCacheKb * 1024;
+    struct AdpcmLoop *loop = sample->loop;
+    size_t num_frames = (loop->end + 15) / 16;
+    size_t size = num_frames * 16 * sizeof(int16_t);
+    struct PcmCacheEntry *e;
+
+    if (loop->end == 0 || loop->end > PCM_CACHE_MAX_SAMPLES || size > budget / 4) {
+        size = 0;
+    }
+    e = malloc(sizeof(struct PcmCacheEntry) + size);
+    if (e == NULL) {
+        return NULL;
+    }
+    e->sample = sample;
+    e->size = size;
+    if (size != 0) {
+        if (!pcm_cache_decode(sample, e->pcm, num_frames)) {
+            e->size = 0;
+        } else if (loop->count != 0) {
+            // After a restart the mixer takes the frame holding the loop start
+            // from loop->state and decodes on from there
+            if (loop->start >= loop->end || memcmp(loop->state, e->pcm + loop->start / 16 * 16, sizeof(loop->state)) != 0) {
+                e->size = 0;
+            }
+        }
+    }
+    if (e->size == 0 && size != 0) {
+        // Only remembered as not qualifying
+        struct PcmCacheEntry *shrunk = realloc(e, sizeof(struct PcmCacheEntry));
+        if (shrunk != NULL) {
+            e = shrunk;
+        }
+    }
+
+    e->hash_next = cache.buckets[pcm_cache_bucket(sample)];
+    cache.buckets[pcm_cache_bucket(sample)] = e;
+    if (e->size != 0) {
+        while (cache.stats.bytes + e->size > budget) {
+            pcm_cache_evict_lru();
+        }
+        pcm_cache_push_front(e);
+        cache.stats.bytes += e->size;
+        cache.stats.entries++;
+    }
+    return e;
+}
+
+const int16_t *pcm_cache_get(const struct AudioBankSample *sample) {
+    struct PcmCacheEntry *e;
+
+    if (configPcmCacheKb == 0) {
+        return NULL;
+    }
+    for (e = cache.buckets[pcm_cache_bucket(sample)]; e != NULL; e = e->hash_next) {
+        if (e->sample == sample) {
+            break;
+        }
+    }
+    if (e == NULL) {
+        e = pcm_cache_insert(sample);
+        if (e == NULL || e->size == 0) {
+            return NULL;
+        }
+        cache.stats.misses++;
+        ProfEmitCounter("pcm_cache_misses", 1);
+        return e->pcm;
+    }
+    if (e->size == 0) {
+        return NULL;
+    }
+    if (e != cache.lru_head) {
+        pcm_cache_unlink(e);
+        pcm_cache_push_front(e);
+    }
+    cache.stats.hits++;
+    ProfEmitCounter("pcm_cache_hits", 1);
+    return e->pcm;
+}
+
+void pcm_cache_hold(void) {
+    cache.holding = true;
+}
+
+void pcm_cache_release(void) {
+    while (cache.held != NULL) {
+        struct PcmCacheEntry *next = cache.held->hash_next;
+        free(cache.held);
+        cache.held = next;
+    }
+    cache.holding = false;
+}
+
+void pcm_cache_clear(void) {
+    for (int i = 0; i < PCM_CACHE_BUCKETS; i++) {
+        struct PcmCacheEntry *e = cache.buckets[i];
+        while (e != NULL) {
+            struct PcmCacheEntry *next = e->hash_next;
+            free(e);
+            e = next;
+        }
+        cache.buckets[i] = NULL;
+    }
+    cache.lru_head = NULL;
+    cache.lru_tail = NULL;
+    cache.stats.bytes = 0;
+    cache.stats.entries = 0;
+}
+
+void pcm_cache_get_stats(struct PcmCacheStats *stats) {
+    *stats = cache.stats;
+}
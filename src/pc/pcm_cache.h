@@ -0,0 +1,39 @@
+#ifndef PCM_CACHE_H
+#define PCM_CACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct AudioBankSample;
+
+// Fully decoded copies of the short ADPCM samples notes play, so synthesis
+// copies their frames instead of decoding them on every update (see
+// aADPCMdecCached for when it still decodes). A sample qualifies if it ends,
+// or if its loop restarts with the decoder state the first pass had at the
+// loop start (then every pass decodes to the same frames). Least recently
+// used samples go once the cache is over configPcmCacheKb. Only touched by
+// the thread running the synthesis.
+
+struct PcmCacheStats {
+    uint32_t hits;
+    uint32_t misses;    // decodes into the cache
+    uint32_t evictions;
+    uint32_t entries;
+    size_t bytes;
+};
+
+// Returns the sample's frames, 16 samples each from the start of the sample,
+// or NULL if it doesn't qualify or doesn't fit
+const int16_t *pcm_cache_get(const struct AudioBankSample *sample);
+
+// Between these, evicted samples stay allocated, so that everything
+// pcm_cache_get returned stays valid until the release
+void pcm_cache_hold(void);
+void pcm_cache_release(void);
+
+// Drops everything, for when banks get loaded over the memory of old ones
+void pcm_cache_clear(void);
+
+void pcm_cache_get_stats(struct PcmCacheStats *stats);
+
+#endif
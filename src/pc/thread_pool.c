@@ -0,0 +1,100 @@
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef __MINGW32__
+#include "SDL.h"
+#else
+#include "SDL2/SDL.h"
+#endif
+
+#include "thread_pool.h"
+
+// Tries before a waiting thread goes to sleep on the semaphore
+#define THREAD_POOL_SPIN 4000
+
+struct ThreadPool {
+    int num_threads; // with the caller
+    SDL_sem *start;  // a post per thread woken for a run
+    SDL_sem *done;   // a post per woken thread out of work
+    ThreadPoolFn fn;
+    void *arg;
+    int count;
+    int next;
+};
+
+static void thread_pool_wait(SDL_sem *sem) {
+    for (int i = 0; i < THREAD_POOL_SPIN; i++) {
+        if (SDL_SemTryWait(sem) == 0) {
+            return;
+        }
+    }
+    SDL_SemWait(sem);
+}
+
+static void thread_pool_work(struct ThreadPool *pool) {
+    int i;
+    while ((i = __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED)) < pool->count) {
+        pool->fn(pool->arg, i);
+    }
+}
+
+static int thread_pool_thread_fn(void *data) {
+    struct ThreadPool *pool = data;
+    while (true) {
+        thread_pool_wait(pool->start);
+        thread_pool_work(pool);
+        SDL_SemPost(pool->done);
+    }
+    return 0;
+}
+
+struct ThreadPool *thread_pool_create(int num_threads, const char *name) {
+    struct ThreadPool *pool = calloc(1, sizeof(struct ThreadPool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    pool->num_threads = 1;
+    pool->start = SDL_CreateSemaphore(0);
+    pool->done = SDL_CreateSemaphore(0);
+    while (pool->start != NULL && pool->done != NULL && pool->num_threads < num_threads) {
+        if (SDL_CreateThread(thread_pool_thread_fn, name, pool) == NULL) {
+            printf("Couldn't start a %s thread: %s\n", name, SDL_GetError());
+            break;
+        }
+        pool->num_threads++;
+    }
+    if (pool->num_threads == 1) {
+        if (pool->start != NULL) {
+            SDL_DestroySemaphore(pool->start);
+        }
+        if (pool->done != NULL) {
+            SDL_DestroySemaphore(pool->done);
+        }
+        free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void thread_pool_run(struct ThreadPool *pool, int count, ThreadPoolFn fn, void *arg) {
+    int helpers = count - 1 < pool->num_threads - 1 ? count - 1 : pool->num_threads - 1;
+    int i;
+
+    pool->fn = fn;
+    pool->arg = arg;
+    pool->count = count;
+    pool->next = 0;
+    // The semaphores order these stores before the woken threads' loads
+    for (i = 0; i < helpers; i++) {
+        SDL_SemPost(pool->start);
+    }
+    thread_pool_work(pool);
+    for (i = 0; i < helpers; i++) {
+        thread_pool_wait(pool->done);
+    }
+}
+
+int thread_pool_num_cores(void) {
+    return SDL_GetCPUCount();
+}
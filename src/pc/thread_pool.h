@@ -0,0 +1,23 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+// Threads that run one function over a range of indices, for work that splits
+// into independent items. The calling thread takes items too, so a pool for
+// n threads starts n - 1 of them. Waiting threads spin a little before they
+// sleep, as the work comes in short bursts a few hundred times a second.
+
+struct ThreadPool;
+
+typedef void (*ThreadPoolFn)(void *arg, int index);
+
+// Returns NULL if no thread could be started
+struct ThreadPool *thread_pool_create(int num_threads, const char *name);
+
+// Calls fn(arg, i) for every i in [0, count) and returns once all are done.
+// The order and the threads the calls run on aren't defined.
+void thread_pool_run(struct ThreadPool *pool, int count, ThreadPoolFn fn, void *arg);
+
+// Logical cores of the machine
+int thread_pool_num_cores(void);
+
+#endif
@@ -0,0 +1,157 @@
+#!/usr/bin/env python3
+# Adds bounding box culling to the big display lists of a level model.inc.c.
+#
+# The geometry at the end of a display list (its vertex loads and triangles,
+# after the last state change) gets a prologue that loads the 8 corners of its
+# bounding box and a G_CULLDL over them, so the renderer can skip the whole
+# tail before transforming any of it when the box is off screen. State changes
+# stay in front of the prologue, so a skipped list leaves the same state behind.
+import sys
+import re
+
+VTX_ARRAY_RE = re.compile(r"^(?:static )?const Vtx (\w+)\[\] = \{")
+VTX_RE = re.compile(r"\{\{\{\s*(-?\d+),\s*(-?\d+),\s*(-?\d+)\s*\}")
+GFX_ARRAY_RE = re.compile(r"^(?:static )?const Gfx (\w+)\[\] = \{")
+CMD_RE = re.compile(r"^\s*(\w+)\((.*)\),\s*$")
+VERTEX_ARG_RE = re.compile(r"^(\w+)(?:\s*\+\s*(\d+))?$")
+
+
+def parse_vertex_arrays(lines):
+    arrays = {}
+    ambiguous = set()
+    current = None
+    for line in lines:
+        m = VTX_ARRAY_RE.match(line)
+        if m:
+            current = m.group(1)
+            if current in arrays:
+                # Defined more than once under different #ifdefs
+                ambiguous.add(current)
+            arrays[current] = []
+            continue
+        if current is not None:
+            if line.startswith("};"):
+                current = None
+                continue
+            m = VTX_RE.search(line)
+            if m:
+                arrays[current].append(tuple(int(c) for c in m.groups()))
+    for name in ambiguous:
+        del arrays[name]
+    return arrays
+
+
+def parse_command(line):
+    m = CMD_RE.match(line)
+    if m is None:
+        return None, None
+    return m.group(1), [a.strip() for a in m.group(2).split(",")]
+
+
+# Returns (insertion line, bounding box) for the geometry tail of a display
+# list, or None when it can't safely be culled
+def find_tail(body, arrays, min_vertices):
+    commands = []
+    for i, line in enumerate(body):
+        if not line.strip() or line.strip().startswith("//"):
+            continue
+        name, args = parse_command(line)
+        if name is None:
+            return None
+        commands.append((i, name, args))
+    if not commands or commands[-1][1] != "gsSPEndDisplayList":
+        return None
+
+    start = None
+    for idx, (i, name, args) in enumerate(commands[:-1]):
+        if name not in ("gsSPVertex", "gsSP1Triangle", "gsSP2Triangles"):
+            start = None
+        elif name == "gsSPVertex" and start is None:
+            start = idx
+    if start is None:
+        return None
+
+    loaded = set()
+    points = []
+    for i, name, args in commands[start:-1]:
+        if name == "gsSPVertex":
+            m = VERTEX_ARG_RE.match(args[0])
+            if m is None or m.group(1) not in arrays:
+                return None
+            offset = int(m.group(2) or 0)
+            count = int(args[1], 0)
+            dest = int(args[2], 0)
+            vertices = arrays[m.group(1)][offset:offset + count]
+            if len(vertices) != count:
+                return None
+            points.extend(vertices)
+            loaded.update(range(dest, dest + count))
+        else:
+            indices = [args[0], args[1], args[2]]
+            if name == "gsSP2Triangles":
+                indices += [args[4], args[5], args[6]]
+            # Vertices loaded before the tail would be overwritten by the box
+            if any(int(v, 0) not in loaded for v in indices):
+                return None
+
+    if len(points) < min_vertices:
+        return None
+    lo = [min(p[k] for p in points) for k in range(3)]
+    hi = [max(p[k] for p in points) for k in range(3)]
+    return commands[start][0], (lo, hi)
+
+
+def main():
+    min_vertices = 64
+    args = sys.argv[1:]
+    if len(args) == 3 and args[0] == "-m":
+        min_vertices = int(args[1])
+        args = args[2:]
+    if len(args) != 1:
+        print("Usage: {} [-m min_vertices] <model.inc.c> > <output.inc.c>".format(sys.argv[0]))
+        sys.exit(1)
+
+    with open(args[0]) as f:
+        lines = f.read().split("\n")
+    arrays = parse_vertex_arrays(lines)
+
+    out = []
+    i = 0
+    while i < len(lines):
+        m = GFX_ARRAY_RE.match(lines[i])
+        if m is None:
+            out.append(lines[i])
+            i += 1
+            continue
+        end = i + 1
+        while end < len(lines) and not lines[end].startswith("};"):
+            end += 1
+        body = lines[i + 1:end]
+        tail = find_tail(body, arrays, min_vertices)
+        if tail is None:
+            out.extend(lines[i:end])
+            i = end
+            continue
+
+        name = m.group(1)
+        insert, (lo, hi) = tail
+        out.append("static const Vtx {}_cull_box[] = {{".format(name))
+        for c in range(8):
+            x = hi[0] if c & 1 else lo[0]
+            y = hi[1] if c & 2 else lo[1]
+            z = hi[2] if c & 4 else lo[2]
+            out.append("    {{{{{{{:6}, {:6}, {:6}}}, 0, {{0, 0}}, {{0x00, 0x00, 0x00, 0x00}}}}}},".format(x, y, z))
+        out.append("};")
+        out.append("")
+        out.append(lines[i])
+        out.extend(body[:insert])
+        out.append("    gsSPVertex({}_cull_box, 8, 0),".format(name))
+        out.append("    gsSPCullDisplayList(0, 7),")
+        out.extend(body[insert:])
+        i = end
+
+    sys.stdout.write("\n".join(out))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,73 @@
+#!/usr/bin/env python3
+# Writes a texture atlas allocation trace for tools/atlasbench.c from the
+# level display lists in the tree.
+#
+# Every level directory given, in order, stands for entering that level. The
+# textures its display lists load (gsDPSetTextureImage followed by a
+# gsDPLoadBlock, which gives the size) get allocated in the order they first
+# appear, and the previous level's textures that the new one doesn't load get
+# freed before that, which is where the renderer's texture cache ends up once
+# it has been through the new level. Going back to the same level twice gives
+# the churn of walking in and out of courses.
+#
+# Trace format, one operation per line:
+#   level <name>
+#   alloc <id> <width> <height>
+#   free <id>
+import os
+import re
+import sys
+
+TEXTURE_IMAGE_RE = re.compile(r"gsDPSetTextureImage\(\s*\w+,\s*\w+,\s*\d+,\s*(\w+)\s*\)")
+LOAD_BLOCK_RE = re.compile(r"gsDPLoadBlock\(\s*\w+,\s*0,\s*0,\s*(\d+)\s*\*\s*(\d+)\s*-\s*1,\s*CALC_DXT\(\s*(\d+),")
+
+
+def level_textures(level_dir):
+    textures = []
+    seen = set()
+    for root, dirs, files in os.walk(level_dir):
+        dirs.sort()
+        for name in sorted(files):
+            if not name.endswith(".inc.c"):
+                continue
+            image = None
+            with open(os.path.join(root, name)) as f:
+                for line in f:
+                    m = TEXTURE_IMAGE_RE.search(line)
+                    if m:
+                        image = m.group(1)
+                        continue
+                    m = LOAD_BLOCK_RE.search(line)
+                    if m and image is not None:
+                        width = int(m.group(3))
+                        height = int(m.group(1)) * int(m.group(2)) // width
+                        key = (image, width, height)
+                        if key not in seen:
+                            seen.add(key)
+                            textures.append(key)
+                        image = None
+    return textures
+
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: atlas_trace.py LEVEL_DIR...", file=sys.stderr)
+        sys.exit(1)
+    live = {}
+    next_id = 1
+    for level_dir in sys.argv[1:]:
+        textures = level_textures(level_dir)
+        print("level " + os.path.basename(os.path.normpath(level_dir)))
+        wanted = set(textures)
+        for key in list(live):
+            if key not in wanted:
+                print("free %d" % live.pop(key))
+        for key in textures:
+            if key not in live:
+                live[key] = next_id
+                print("alloc %d %d %d" % (next_id, key[1], key[2]))
+                next_id += 1
+
+
+if __name__ == "__main__":
+    main()
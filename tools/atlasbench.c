@@ -0,0 +1,382 @@
+/* texture atlas allocation benchmark and check for the PC port */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/pc/gfx/texture_atlas.h"
+
+// Replays texture allocation traces (see tools/atlas_trace.py, make atlasbench
+// writes one for the levels in the tree to bench/atlasbench/levels.trace in
+// the build directory) against atlas pages set up like the renderer's: 2048
+// texels square, 1 texel of padding, a texture goes on the first page it fits
+// on and pages get added up to -pages. Reports how long
+// allocations take and how full the pages are after each level. Then it runs
+// a random churn, allocating and freeing textures around -live of them on a
+// single page, the worst case for keeping the free space tidy.
+//
+// Both check that every live texture lies inside its page, has the size that
+// was asked for and doesn't overlap any other, after each level of a trace
+// and every CHECK_PERIOD operations of the churn. Exits with 1 if that fails.
+
+#define PAGE_DIMENSIONS 2048
+#define PADDING 1
+#define MAX_PAGES 8
+#define CHECK_PERIOD 100
+
+enum OpType {
+    OP_LEVEL,
+    OP_ALLOC,
+    OP_FREE
+};
+
+struct Op {
+    enum OpType type;
+    uint32_t id;
+    uint16_t w, h;
+    char level[32];
+};
+
+struct Live {
+    bool used;
+    uint8_t page;
+    uint32_t atlas_id;
+    uint16_t w, h;
+};
+
+static struct {
+    AtlasPacker packer;
+    Atlas *pages[MAX_PAGES];
+    int num_pages;
+    int max_pages;
+    struct Live *live; // by trace id
+    uint32_t live_cap;
+    uint32_t num_live;
+    uint32_t failures;
+    int64_t allocs;
+    double alloc_ms;
+    double max_alloc_ms;
+    int64_t frees;
+    double free_ms;
+} bench;
+
+static double get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static struct Op *load_trace(const char *path, size_t *num_ops) {
+    FILE *f = fopen(path, "r");
+    struct Op *ops = NULL;
+    size_t n = 0, cap = 0;
+    char line[128];
+
+    if (f == NULL) {
+        return NULL;
+    }
+    while (fgets(line, sizeof(line), f) != NULL) {
+        struct Op op;
+        unsigned id, w, h;
+        memset(&op, 0, sizeof(op));
+        if (sscanf(line, "level %31s", op.level) == 1) {
+            op.type = OP_LEVEL;
+        } else if (sscanf(line, "alloc %u %u %u", &id, &w, &h) == 3) {
+            op.type = OP_ALLOC;
+            op.id = id;
+            op.w = w;
+            op.h = h;
+        } else if (sscanf(line, "free %u", &id) == 1) {
+            op.type = OP_FREE;
+            op.id = id;
+        } else {
+            continue;
+        }
+        if (n == cap) {
+            cap = cap == 0 ? 1024 : cap * 2;
+            ops = realloc(ops, cap * sizeof(struct Op));
+        }
+        ops[n++] = op;
+    }
+    fclose(f);
+    *num_ops = n;
+    return ops;
+}
+
+static void reset(int max_pages) {
+    for (int i = 0; i < bench.num_pages; i++) {
+        atlas_destroy(bench.pages[i]);
+    }
+    bench.num_pages = 0;
+    bench.max_pages = max_pages;
+    if (bench.live != NULL) {
+        memset(bench.live, 0, bench.live_cap * sizeof(struct Live));
+    }
+    bench.num_live = 0;
+    bench.failures = 0;
+    bench.allocs = 0;
+    bench.alloc_ms = 0.0;
+    bench.max_alloc_ms = 0.0;
+    bench.frees = 0;
+    bench.free_ms = 0.0;
+}
+
+static void grow_live(uint32_t id) {
+    if (id >= bench.live_cap) {
+        uint32_t cap = bench.live_cap == 0 ? 1024 : bench.live_cap;
+        while (cap <= id) {
+            cap *= 2;
+        }
+        bench.live = realloc(bench.live, cap * sizeof(struct Live));
+        memset(bench.live + bench.live_cap, 0, (cap - bench.live_cap) * sizeof(struct Live));
+        bench.live_cap = cap;
+    }
+}
+
+// As gfx_atlas_allocate, without evicting anything when the pages are full
+static void do_alloc(uint32_t id, uint16_t w, uint16_t h) {
+    double t0 = get_time_ms();
+    bool done = false;
+
+    grow_live(id);
+    for (;;) {
+        for (int page = 0; page < bench.num_pages && !done; page++) {
+            uint32_t atlas_id;
+            if (!atlas_gen_texture(bench.pages[page], &atlas_id)) {
+                continue;
+            }
+            if (atlas_allocate_vtex_space(bench.pages[page], atlas_id, w, h)) {
+                struct Live *l = &bench.live[id];
+                l->used = true;
+                l->page = page;
+                l->atlas_id = atlas_id;
+                l->w = w;
+                l->h = h;
+                bench.num_live++;
+                done = true;
+            } else {
+                atlas_destroy_vtex(bench.pages[page], atlas_id);
+            }
+        }
+        if (done || bench.num_pages == bench.max_pages) {
+            break;
+        }
+        if (!atlas_create_with_packer(&bench.pages[bench.num_pages], PAGE_DIMENSIONS, PADDING, bench.packer)) {
+            break;
+        }
+        bench.num_pages++;
+    }
+
+    double t = get_time_ms() - t0;
+    bench.allocs++;
+    bench.alloc_ms += t;
+    if (t > bench.max_alloc_ms) {
+        bench.max_alloc_ms = t;
+    }
+    if (!done) {
+        bench.failures++;
+    }
+}
+
+static void do_free(uint32_t id) {
+    struct Live *l;
+    double t0;
+
+    if (id >= bench.live_cap || !bench.live[id].used) {
+        return;
+    }
+    l = &bench.live[id];
+    t0 = get_time_ms();
+    atlas_destroy_vtex(bench.pages[l->page], l->atlas_id);
+    bench.free_ms += get_time_ms() - t0;
+    bench.frees++;
+    l->used = false;
+    bench.num_live--;
+}
+
+static bool check_pages(void) {
+    static uint16_t (*rects)[4];
+    static uint32_t rects_cap;
+
+    if (rects_cap < bench.num_live) {
+        rects_cap = bench.num_live * 2;
+        rects = realloc(rects, rects_cap * sizeof(*rects));
+    }
+    for (int page = 0; page < bench.num_pages; page++) {
+        uint32_t n = 0;
+        for (uint32_t id = 0; id < bench.live_cap; id++) {
+            struct Live *l = &bench.live[id];
+            if (!l->used || l->page != page) {
+                continue;
+            }
+            uint16_t *r = rects[n++];
+            if (!atlas_get_vtex_xywh_coords(bench.pages[page], l->atlas_id, 1, r)) {
+                fprintf(stderr, "texture %u is gone from page %d\n", id, page);
+                return false;
+            }
+            if (r[2] != l->w + 2 * PADDING || r[3] != l->h + 2 * PADDING) {
+                fprintf(stderr, "texture %u is %ux%u instead of %ux%u\n", id, r[2] - 2 * PADDING, r[3] - 2 * PADDING, l->w, l->h);
+                return false;
+            }
+            if (r[0] + r[2] > PAGE_DIMENSIONS || r[1] + r[3] > PAGE_DIMENSIONS) {
+                fprintf(stderr, "texture %u at %u,%u sticks out of page %d\n", id, r[0], r[1], page);
+                return false;
+            }
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            for (uint32_t j = i + 1; j < n; j++) {
+                const uint16_t *a = rects[i], *b = rects[j];
+                if (a[0] < b[0] + b[2] && b[0] < a[0] + a[2] && a[1] < b[1] + b[3] && b[1] < a[1] + a[3]) {
+                    fprintf(stderr, "textures at %u,%u and %u,%u overlap on page %d\n", a[0], a[1], b[0], b[1], page);
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static void print_fill(const char *name) {
+    printf("%-20s %5u live, fill", name, bench.num_live);
+    for (int page = 0; page < bench.num_pages; page++) {
+        printf(" %5.1f%%", atlas_get_used_area(bench.pages[page]) * 100.0 / ((double)PAGE_DIMENSIONS * PAGE_DIMENSIONS));
+    }
+    printf("\n");
+}
+
+static void print_times(void) {
+    printf("%lld allocations, %.2f us avg, %.2f us max, %u didn't fit; %lld frees, %.2f us avg\n",
+           (long long)bench.allocs, bench.allocs > 0 ? bench.alloc_ms * 1000.0 / bench.allocs : 0.0,
+           bench.max_alloc_ms * 1000.0, bench.failures,
+           (long long)bench.frees, bench.frees > 0 ? bench.free_ms * 1000.0 / bench.frees : 0.0);
+}
+
+static bool replay(const struct Op *ops, size_t num_ops, int max_pages) {
+    const char *level = NULL;
+
+    reset(max_pages);
+    for (size_t i = 0; i < num_ops; i++) {
+        const struct Op *op = &ops[i];
+        switch (op->type) {
+            case OP_LEVEL:
+                if (level != NULL) {
+                    print_fill(level);
+                    if (!check_pages()) {
+                        return false;
+                    }
+                }
+                level = op->level;
+                break;
+            case OP_ALLOC:
+                do_alloc(op->id, op->w, op->h);
+                break;
+            case OP_FREE:
+                do_free(op->id);
+                break;
+        }
+    }
+    print_fill(level != NULL ? level : "end");
+    if (!check_pages()) {
+        return false;
+    }
+    print_times();
+    return true;
+}
+
+static bool churn(int ops, uint32_t target_live) {
+    static const uint16_t sizes[] = { 8, 16, 32, 64, 128 };
+    uint32_t seed = 1;
+    uint32_t next_id = 0;
+
+    reset(1);
+    for (int i = 0; i < ops; i++) {
+        seed = seed * 1664525 + 1013904223;
+        if (bench.num_live == 0 || bench.num_live < target_live || (seed >> 16) % 2 == 0) {
+            seed = seed * 1664525 + 1013904223;
+            // Mostly small textures, like the game's
+            uint16_t w = sizes[(seed >> 16) % 4 + ((seed >> 30) == 0)];
+            uint16_t h = sizes[(seed >> 20) % 4];
+            do_alloc(next_id++, w, h);
+        } else {
+            // Some live texture, looking from a random id on
+            seed = seed * 1664525 + 1013904223;
+            uint32_t id = (seed >> 8) % next_id;
+            while (!bench.live[id].used) {
+                id = (id + 1) % next_id;
+            }
+            do_free(id);
+        }
+        if ((i + 1) % CHECK_PERIOD == 0 && !check_pages()) {
+            return false;
+        }
+    }
+    print_fill("churn");
+    if (!check_pages()) {
+        return false;
+    }
+    print_times();
+    return true;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-holes] [-pages n] [-churn ops] [-live n] [trace]...\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int max_pages = 2;
+    int churn_ops = 20000;
+    int target_live = 600;
+    bool ok = true;
+
+    bench.packer = ATLAS_PACKER_SKYLINE;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-holes") == 0) {
+            bench.packer = ATLAS_PACKER_HOLES;
+        } else if (strcmp(argv[i], "-pages") == 0 && i + 1 < argc) {
+            max_pages = atoi(argv[++i]);
+            if (max_pages < 1 || max_pages > MAX_PAGES) {
+                usage(argv[0]);
+            }
+        } else if (strcmp(argv[i], "-churn") == 0 && i + 1 < argc) {
+            churn_ops = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-live") == 0 && i + 1 < argc) {
+            target_live = atoi(argv[++i]);
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+        }
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            if (strcmp(argv[i], "-holes") != 0) {
+                i++;
+            }
+            continue;
+        }
+        size_t num_ops;
+        struct Op *ops = load_trace(argv[i], &num_ops);
+        if (ops == NULL) {
+            fprintf(stderr, "Can't read %s\n", argv[i]);
+            return 1;
+        }
+        printf("%s:\n", argv[i]);
+        if (!replay(ops, num_ops, max_pages)) {
+            fprintf(stderr, "%s: atlas check failed\n", argv[i]);
+            ok = false;
+        }
+        free(ops);
+    }
+
+    if (churn_ops > 0) {
+        printf("churn, %d operations around %d live textures:\n", churn_ops, target_live);
+        if (!churn(churn_ops, target_live)) {
+            fprintf(stderr, "churn: atlas check failed\n");
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+/* audio mixer throughput benchmark for the PC port */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <PR/abi.h>
+
+#include "../src/pc/mixer.h"
+
+// Runs mixer kernels over synthetic audio and reports how many frames of it
+// each gets through per second, and what that is as a multiple of real time
+// at the synthesis' 32 kHz. For the note kernels that's about how many notes
+// they could keep up with, for the output resampler how much of the CPU
+// converting the game's output takes (its inverse). The output resampler runs
+// at 44.1 and 48 kHz, plus the rates given with -rate.
+
+#define SYNTHESIS_RATE 32000
+#define UPDATE_FRAMES 544 // what the audio thread makes at a time
+#define NOTE_FRAMES 160 // a note's share of an update, per command
+#define MAX_RATES 8
+
+#define DMEM_IN 0x400
+#define DMEM_OUT 0x800
+
+static int16_t stereo_in[UPDATE_FRAMES * 2];
+static int16_t *stereo_out;
+static int16_t note_in[NOTE_FRAMES * 2];
+static RESAMPLE_STATE resample_state;
+static struct MixerResampler *resampler;
+
+static double get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void make_input(void) {
+    uint32_t seed = 1;
+    int i;
+
+    // Noise, so no kernel gets to take a shortcut on silence
+    for (i = 0; i < UPDATE_FRAMES * 2; i++) {
+        seed = seed * 1664525 + 1013904223;
+        stereo_in[i] = (int16_t)(seed >> 16) / 2;
+    }
+    memcpy(note_in, stereo_in, sizeof(note_in));
+}
+
+static int run_mix(void) {
+    aSetBufferImpl(0, DMEM_IN, 0, NOTE_FRAMES * 2);
+    aLoadBufferImpl(note_in);
+    aMixImpl(0x4000, DMEM_IN, DMEM_OUT);
+    return NOTE_FRAMES;
+}
+
+static int run_resample(void) {
+    aSetBufferImpl(0, DMEM_IN, 0, sizeof(note_in));
+    aLoadBufferImpl(note_in);
+    aSetBufferImpl(0, DMEM_IN, DMEM_OUT, NOTE_FRAMES * 2);
+    // A note a little above its sample's pitch
+    aResampleImpl(0, 0x9000, resample_state);
+    return NOTE_FRAMES;
+}
+
+static int run_output(void) {
+    mixer_resampler_process(resampler, stereo_in, UPDATE_FRAMES, stereo_out);
+    return UPDATE_FRAMES;
+}
+
+static void bench(const char *name, int (*run)(void), double seconds) {
+    double t0 = get_time_ms(), t;
+    int64_t frames = 0;
+
+    // Whole batches, so the clock isn't read after every call
+    do {
+        int i;
+        for (i = 0; i < 256; i++) {
+            frames += run();
+        }
+        t = get_time_ms() - t0;
+    } while (t < seconds * 1000.0);
+    printf("%-20s %8.2f M frames/s %8.1fx real time\n", name, frames / t / 1000.0, frames / t * 1000.0 / SYNTHESIS_RATE);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-t seconds] [-rate hz]...\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    int rates[MAX_RATES] = { 44100, 48000 };
+    int num_rates = 2;
+    double seconds = 2.0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc && num_rates < MAX_RATES) {
+            rates[num_rates++] = atoi(argv[++i]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (seconds <= 0.0) {
+        usage(argv[0]);
+    }
+
+    make_input();
+    aSetBufferImpl(0, DMEM_IN, DMEM_OUT, NOTE_FRAMES * 2);
+    aResampleImpl(A_INIT, 0x9000, resample_state);
+
+    bench("aMix", run_mix, seconds);
+    bench("aResample", run_resample, seconds);
+    for (int i = 0; i < num_rates; i++) {
+        char name[32];
+        resampler = mixer_resampler_create(SYNTHESIS_RATE, rates[i]);
+        if (resampler == NULL) {
+            fprintf(stderr, "Can't resample to %d Hz\n", rates[i]);
+            return 1;
+        }
+        stereo_out = malloc(mixer_resampler_max_output(resampler, UPDATE_FRAMES) * 2 * sizeof(int16_t));
+        if (stereo_out == NULL) {
+            return 1;
+        }
+        snprintf(name, sizeof(name), "output %d Hz", rates[i]);
+        bench(name, run_output, seconds);
+        free(stereo_out);
+        mixer_resampler_destroy(resampler);
+    }
+    return 0;
+}
@@ -0,0 +1,415 @@
+/* color combiner enumerator for the PC port */
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+#ifndef _LANGUAGE_C
+#define _LANGUAGE_C
+#endif
+#include <PR/mbi.h>
+#include "../src/pc/gfx/gfx_cc_id.h"
+
+// Walks the display list sources for G_SETCOMBINE, the render mode half of
+// G_SETOTHERMODE_L and G_AC_DITHER, and writes every cc_id the renderer can
+// derive from them (see gfx_cc_id.h). Which render mode a display list ends up
+// drawn with is mostly decided by the layer it's in, so every combine mode is
+// paired with every render mode found.
+
+#define COMBINER(name) { #name, (Gfx) gsDPSetCombineLERP(name, name) }
+#define RENDER_MODE(name) { #name, name }
+
+typedef struct {
+    const char *name;
+    Gfx cmd;
+} Combiner;
+
+typedef struct {
+    const char *name;
+    uint32_t value;
+} RenderMode;
+
+typedef struct {
+    uint32_t value;
+    const char *combiner;
+    const char *render_mode;
+} Found;
+
+static Combiner *combiners;
+static int numCombiners;
+static RenderMode *renderModes;
+static int numRenderModes;
+
+// Combine modes found, as indices into combiners
+static bool usedCombiners[128];
+
+// Render modes found, both cycles or'ed together like G_SETOTHERMODE_L does
+static Found *usedRenderModes;
+static int numUsedRenderModes;
+static int capUsedRenderModes;
+
+static bool usesDither;
+
+static void init_combiners(void) {
+    // Can't be a static table: the gbi macros don't give constant expressions
+    Combiner table[] = {
+        COMBINER(G_CC_PRIMITIVE), COMBINER(G_CC_SHADE),
+        COMBINER(G_CC_MODULATEI), COMBINER(G_CC_MODULATEIDECALA), COMBINER(G_CC_MODULATEIFADE),
+        COMBINER(G_CC_MODULATERGB), COMBINER(G_CC_MODULATERGBDECALA), COMBINER(G_CC_MODULATERGBFADE),
+        COMBINER(G_CC_MODULATEIA), COMBINER(G_CC_MODULATEIFADEA), COMBINER(G_CC_MODULATEFADE),
+        COMBINER(G_CC_MODULATERGBA), COMBINER(G_CC_MODULATERGBFADEA),
+        COMBINER(G_CC_MODULATEI_PRIM), COMBINER(G_CC_MODULATEIA_PRIM), COMBINER(G_CC_MODULATEIDECALA_PRIM),
+        COMBINER(G_CC_MODULATERGB_PRIM), COMBINER(G_CC_MODULATERGBA_PRIM), COMBINER(G_CC_MODULATERGBDECALA_PRIM),
+        COMBINER(G_CC_FADE), COMBINER(G_CC_FADEA),
+        COMBINER(G_CC_DECALRGB), COMBINER(G_CC_DECALRGBA), COMBINER(G_CC_DECALFADE), COMBINER(G_CC_DECALFADEA),
+        COMBINER(G_CC_BLENDI), COMBINER(G_CC_BLENDIA), COMBINER(G_CC_BLENDIDECALA),
+        COMBINER(G_CC_BLENDRGBA), COMBINER(G_CC_BLENDRGBDECALA), COMBINER(G_CC_BLENDRGBFADEA),
+        COMBINER(G_CC_ADDRGB), COMBINER(G_CC_ADDRGBDECALA), COMBINER(G_CC_ADDRGBFADE),
+        COMBINER(G_CC_REFLECTRGB), COMBINER(G_CC_REFLECTRGBDECALA),
+        COMBINER(G_CC_HILITERGB), COMBINER(G_CC_HILITERGBA), COMBINER(G_CC_HILITERGBDECALA),
+        COMBINER(G_CC_SHADEDECALA), COMBINER(G_CC_SHADEFADEA),
+        COMBINER(G_CC_BLENDPE), COMBINER(G_CC_BLENDPEDECALA),
+        COMBINER(G_CC_TEMPLERP), COMBINER(G_CC_TRILERP), COMBINER(G_CC_INTERFERENCE),
+        COMBINER(G_CC_1CYUV2RGB), COMBINER(G_CC_YUV2RGB), COMBINER(G_CC_PASS2),
+        COMBINER(G_CC_MODULATEI2), COMBINER(G_CC_MODULATEIA2), COMBINER(G_CC_MODULATERGB2), COMBINER(G_CC_MODULATERGBA2),
+        COMBINER(G_CC_MODULATEI_PRIM2), COMBINER(G_CC_MODULATEIA_PRIM2),
+        COMBINER(G_CC_MODULATERGB_PRIM2), COMBINER(G_CC_MODULATERGBA_PRIM2),
+        COMBINER(G_CC_DECALRGB2),
+        COMBINER(G_CC_BLENDI2), COMBINER(G_CC_BLENDIA2), COMBINER(G_CC_CHROMA_KEY2),
+        COMBINER(G_CC_HILITERGB2), COMBINER(G_CC_HILITERGBA2), COMBINER(G_CC_HILITERGBDECALA2), COMBINER(G_CC_HILITERGBPASSA2),
+    };
+    numCombiners = sizeof(table) / sizeof(table[0]);
+    combiners = malloc(sizeof(table));
+    memcpy(combiners, table, sizeof(table));
+}
+
+static void init_render_modes(void) {
+    // Same, some of the blender bits are shifted into the sign bit
+    RenderMode table[] = {
+        RENDER_MODE(G_RM_AA_ZB_OPA_SURF), RENDER_MODE(G_RM_AA_ZB_OPA_SURF2),
+        RENDER_MODE(G_RM_AA_ZB_XLU_SURF), RENDER_MODE(G_RM_AA_ZB_XLU_SURF2),
+        RENDER_MODE(G_RM_AA_ZB_OPA_DECAL), RENDER_MODE(G_RM_AA_ZB_OPA_DECAL2),
+        RENDER_MODE(G_RM_AA_ZB_XLU_DECAL), RENDER_MODE(G_RM_AA_ZB_XLU_DECAL2),
+        RENDER_MODE(G_RM_AA_ZB_OPA_INTER), RENDER_MODE(G_RM_AA_ZB_OPA_INTER2),
+        RENDER_MODE(G_RM_AA_ZB_XLU_INTER), RENDER_MODE(G_RM_AA_ZB_XLU_INTER2),
+        RENDER_MODE(G_RM_AA_ZB_XLU_LINE), RENDER_MODE(G_RM_AA_ZB_XLU_LINE2),
+        RENDER_MODE(G_RM_AA_ZB_DEC_LINE), RENDER_MODE(G_RM_AA_ZB_DEC_LINE2),
+        RENDER_MODE(G_RM_AA_ZB_TEX_EDGE), RENDER_MODE(G_RM_AA_ZB_TEX_EDGE2),
+        RENDER_MODE(G_RM_AA_ZB_TEX_INTER), RENDER_MODE(G_RM_AA_ZB_TEX_INTER2),
+        RENDER_MODE(G_RM_AA_ZB_SUB_SURF), RENDER_MODE(G_RM_AA_ZB_SUB_SURF2),
+        RENDER_MODE(G_RM_AA_ZB_PCL_SURF), RENDER_MODE(G_RM_AA_ZB_PCL_SURF2),
+        RENDER_MODE(G_RM_AA_ZB_OPA_TERR), RENDER_MODE(G_RM_AA_ZB_OPA_TERR2),
+        RENDER_MODE(G_RM_AA_ZB_TEX_TERR), RENDER_MODE(G_RM_AA_ZB_TEX_TERR2),
+        RENDER_MODE(G_RM_AA_ZB_SUB_TERR), RENDER_MODE(G_RM_AA_ZB_SUB_TERR2),
+        RENDER_MODE(G_RM_RA_ZB_OPA_SURF), RENDER_MODE(G_RM_RA_ZB_OPA_SURF2),
+        RENDER_MODE(G_RM_RA_ZB_OPA_DECAL), RENDER_MODE(G_RM_RA_ZB_OPA_DECAL2),
+        RENDER_MODE(G_RM_RA_ZB_OPA_INTER), RENDER_MODE(G_RM_RA_ZB_OPA_INTER2),
+        RENDER_MODE(G_RM_AA_OPA_SURF), RENDER_MODE(G_RM_AA_OPA_SURF2),
+        RENDER_MODE(G_RM_AA_XLU_SURF), RENDER_MODE(G_RM_AA_XLU_SURF2),
+        RENDER_MODE(G_RM_AA_XLU_LINE), RENDER_MODE(G_RM_AA_XLU_LINE2),
+        RENDER_MODE(G_RM_AA_DEC_LINE), RENDER_MODE(G_RM_AA_DEC_LINE2),
+        RENDER_MODE(G_RM_AA_TEX_EDGE), RENDER_MODE(G_RM_AA_TEX_EDGE2),
+        RENDER_MODE(G_RM_AA_SUB_SURF), RENDER_MODE(G_RM_AA_SUB_SURF2),
+        RENDER_MODE(G_RM_AA_PCL_SURF), RENDER_MODE(G_RM_AA_PCL_SURF2),
+        RENDER_MODE(G_RM_AA_OPA_TERR), RENDER_MODE(G_RM_AA_OPA_TERR2),
+        RENDER_MODE(G_RM_AA_TEX_TERR), RENDER_MODE(G_RM_AA_TEX_TERR2),
+        RENDER_MODE(G_RM_AA_SUB_TERR), RENDER_MODE(G_RM_AA_SUB_TERR2),
+        RENDER_MODE(G_RM_RA_OPA_SURF), RENDER_MODE(G_RM_RA_OPA_SURF2),
+        RENDER_MODE(G_RM_ZB_OPA_SURF), RENDER_MODE(G_RM_ZB_OPA_SURF2),
+        RENDER_MODE(G_RM_ZB_XLU_SURF), RENDER_MODE(G_RM_ZB_XLU_SURF2),
+        RENDER_MODE(G_RM_ZB_OPA_DECAL), RENDER_MODE(G_RM_ZB_OPA_DECAL2),
+        RENDER_MODE(G_RM_ZB_XLU_DECAL), RENDER_MODE(G_RM_ZB_XLU_DECAL2),
+        RENDER_MODE(G_RM_ZB_CLD_SURF), RENDER_MODE(G_RM_ZB_CLD_SURF2),
+        RENDER_MODE(G_RM_ZB_OVL_SURF), RENDER_MODE(G_RM_ZB_OVL_SURF2),
+        RENDER_MODE(G_RM_ZB_PCL_SURF), RENDER_MODE(G_RM_ZB_PCL_SURF2),
+        RENDER_MODE(G_RM_OPA_SURF), RENDER_MODE(G_RM_OPA_SURF2),
+        RENDER_MODE(G_RM_XLU_SURF), RENDER_MODE(G_RM_XLU_SURF2),
+        RENDER_MODE(G_RM_CLD_SURF), RENDER_MODE(G_RM_CLD_SURF2),
+        RENDER_MODE(G_RM_TEX_EDGE), RENDER_MODE(G_RM_TEX_EDGE2),
+        RENDER_MODE(G_RM_PCL_SURF), RENDER_MODE(G_RM_PCL_SURF2),
+        RENDER_MODE(G_RM_ADD), RENDER_MODE(G_RM_ADD2),
+        RENDER_MODE(G_RM_NOOP), RENDER_MODE(G_RM_NOOP2),
+        RENDER_MODE(G_RM_VISCVG), RENDER_MODE(G_RM_VISCVG2),
+        RENDER_MODE(G_RM_OPA_CI), RENDER_MODE(G_RM_OPA_CI2),
+        RENDER_MODE(G_RM_CUSTOM_AA_ZB_XLU_SURF), RENDER_MODE(G_RM_CUSTOM_AA_ZB_XLU_SURF2),
+        RENDER_MODE(G_RM_FOG_SHADE_A), RENDER_MODE(G_RM_FOG_PRIM_A),
+        RENDER_MODE(G_RM_PASS),
+    };
+    numRenderModes = sizeof(table) / sizeof(table[0]);
+    renderModes = malloc(sizeof(table));
+    memcpy(renderModes, table, sizeof(table));
+}
+
+static int find_combiner(const char *name) {
+    for (int i = 0; i < numCombiners; i++) {
+        if (strcmp(combiners[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static const RenderMode *find_render_mode(const char *name) {
+    for (int i = 0; i < numRenderModes; i++) {
+        if (strcmp(renderModes[i].name, name) == 0) {
+            return &renderModes[i];
+        }
+    }
+    return NULL;
+}
+
+static void add_render_mode(const RenderMode *c0, const RenderMode *c1) {
+    uint32_t value = c0->value | c1->value;
+    for (int i = 0; i < numUsedRenderModes; i++) {
+        if (usedRenderModes[i].value == value) {
+            return;
+        }
+    }
+    if (numUsedRenderModes == capUsedRenderModes) {
+        capUsedRenderModes = capUsedRenderModes ? capUsedRenderModes * 2 : 64;
+        usedRenderModes = realloc(usedRenderModes, capUsedRenderModes * sizeof(*usedRenderModes));
+    }
+    usedRenderModes[numUsedRenderModes].value = value;
+    usedRenderModes[numUsedRenderModes].combiner = NULL;
+    usedRenderModes[numUsedRenderModes].render_mode = c0->name;
+    numUsedRenderModes++;
+}
+
+// Splits the arguments of the macro call whose '(' is at p, with whitespace
+// removed. Returns the number of arguments, or -1 if there are too many.
+static int parse_args(const char *p, char args[][64], int maxArgs) {
+    int numArgs = 0;
+    int depth = 0;
+    int len = 0;
+    for (p++; *p != '\0'; p++) {
+        if ((*p == ',' && depth == 0) || (*p == ')' && depth == 0)) {
+            if (numArgs == maxArgs) {
+                return -1;
+            }
+            args[numArgs][len] = '\0';
+            numArgs++;
+            len = 0;
+            if (*p == ')') {
+                return numArgs;
+            }
+            continue;
+        }
+        if (*p == '(') {
+            depth++;
+        } else if (*p == ')') {
+            depth--;
+        }
+        if (!isspace((unsigned char)*p) && len < 63) {
+            args[numArgs][len++] = *p;
+        }
+    }
+    return -1;
+}
+
+// The layer render modes in rendering_graph_node.c, which are set from a
+// table instead of by name. Returns how many G_RM_ names the table has.
+static int parse_table(const char *text, const char *tableName, const RenderMode **modes, int maxModes) {
+    const char *p = strstr(text, tableName);
+    if (p == NULL || (p = strchr(p, '=')) == NULL) {
+        return 0;
+    }
+    const char *end = strstr(p, "};");
+    int n = 0;
+    while ((p = strstr(p, "G_RM_")) != NULL && p < end && n < maxModes) {
+        char name[64];
+        int len = 0;
+        while (len < 63 && (isalnum((unsigned char)p[len]) || p[len] == '_')) {
+            name[len] = p[len];
+            len++;
+        }
+        name[len] = '\0';
+        modes[n] = find_render_mode(name);
+        if (modes[n] != NULL) {
+            n++;
+        }
+        p += len;
+    }
+    return n;
+}
+
+static void scan_file(const char *path) {
+    char *text;
+    long size = read_file(path, (unsigned char **)&text);
+    if (size < 0) {
+        ERROR("Error reading %s\n", path);
+        exit(EXIT_FAILURE);
+    }
+    text = realloc(text, size + 1);
+    text[size] = '\0';
+
+    char args[3][64];
+    for (const char *p = text; (p = strstr(p, "DPSet")) != NULL; p++) {
+        // Display list macros start with gs, the ones used from code with g
+        bool gs = p - text >= 2 && p[-2] == 'g' && p[-1] == 's';
+        bool g = p - text >= 1 && p[-1] == 'g' && !gs;
+        if (!gs && !g) {
+            continue;
+        }
+        int skip = g ? 1 : 0; // the display list pointer
+        const char *open = strchr(p, '(');
+        if (open == NULL) {
+            break;
+        }
+        if (strncmp(p, "DPSetCombineMode(", 17) == 0) {
+            if (parse_args(open, args, 3) != 2 + skip) {
+                continue;
+            }
+            int i = find_combiner(args[skip]);
+            if (i < 0) {
+                ERROR("%s: unknown combine mode %s\n", path, args[skip]);
+                continue;
+            }
+            usedCombiners[i] = true;
+        } else if (strncmp(p, "DPSetCombineLERP(", 17) == 0) {
+            ERROR("%s: gsDPSetCombineLERP isn't supported, use gsDPSetCombineMode\n", path);
+        } else if (strncmp(p, "DPSetRenderMode(", 16) == 0) {
+            if (parse_args(open, args, 3) != 2 + skip) {
+                continue;
+            }
+            if (strncmp(args[skip], "G_RM_", 5) != 0) {
+                continue; // set from a table, see parse_table
+            }
+            const RenderMode *c0 = find_render_mode(args[skip]);
+            const RenderMode *c1 = find_render_mode(args[skip + 1]);
+            if (c0 == NULL || c1 == NULL) {
+                ERROR("%s: unknown render mode %s, %s\n", path, args[skip], args[skip + 1]);
+                continue;
+            }
+            add_render_mode(c0, c1);
+        } else if (strncmp(p, "DPSetAlphaCompare(", 18) == 0) {
+            if (parse_args(open, args, 2) == 1 + skip && strcmp(args[skip], "G_AC_DITHER") == 0) {
+                usesDither = true;
+            }
+        }
+    }
+
+    const RenderMode *modes1[32], *modes2[32];
+    int n1 = parse_table(text, "renderModeTable_1Cycle", modes1, 32);
+    int n2 = parse_table(text, "renderModeTable_2Cycle", modes2, 32);
+    for (int i = 0; i < n1 && i < n2; i++) {
+        add_render_mode(modes1[i], modes2[i]);
+    }
+
+    free(text);
+}
+
+static int compare_found(const void *a, const void *b) {
+    uint32_t va = ((const Found *)a)->value;
+    uint32_t vb = ((const Found *)b)->value;
+    return va < vb ? -1 : va > vb;
+}
+
+static int write_table(const char *path) {
+    // gfx_pc.c draws texture and fill rectangles with these
+    usedCombiners[find_combiner("G_CC_DECALRGBA")] = true;
+    usedCombiners[find_combiner("G_CC_SHADE")] = true;
+
+    int maxIds = numCombiners * numUsedRenderModes * 2;
+    Found *ids = malloc((maxIds + 1) * sizeof(*ids));
+    int numIds = 0;
+    for (int i = 0; i < numCombiners; i++) {
+        if (!usedCombiners[i]) {
+            continue;
+        }
+        uint32_t combine_mode = gfx_cc_combine_mode(combiners[i].cmd.words.w0, combiners[i].cmd.words.w1);
+        for (int j = 0; j < numUsedRenderModes; j++) {
+            for (int dither = 0; dither <= (usesDither ? 1 : 0); dither++) {
+                uint32_t other_mode_l = usedRenderModes[j].value | (dither ? G_AC_DITHER : 0);
+                ids[numIds].value = gfx_cc_id(combine_mode, other_mode_l);
+                ids[numIds].combiner = combiners[i].name;
+                ids[numIds].render_mode = usedRenderModes[j].render_mode;
+                numIds++;
+            }
+        }
+    }
+    qsort(ids, numIds, sizeof(*ids), compare_found);
+
+    size_t cap = 128 + (size_t)numIds * 128;
+    char *out = malloc(cap);
+    size_t len = 0;
+    len += snprintf(out + len, cap - len, "// Generated by tools/ccenum, do not edit\n\n");
+    len += snprintf(out + len, cap - len, "static const uint32_t gfx_cc_table[] = {\n");
+    int unique = 0;
+    for (int i = 0; i < numIds; i++) {
+        if (i > 0 && ids[i].value == ids[i - 1].value) {
+            continue;
+        }
+        len += snprintf(out + len, cap - len, "    0x%08x, // %s, %s\n", ids[i].value, ids[i].combiner, ids[i].render_mode);
+        unique++;
+    }
+    if (unique == 0) {
+        len += snprintf(out + len, cap - len, "    0x00000000,\n");
+    }
+    len += snprintf(out + len, cap - len, "};\n");
+    free(ids);
+
+    // Left alone when nothing changed, so the renderer isn't rebuilt for nothing
+    unsigned char *old;
+    long oldSize = read_file(path, &old);
+    bool same = oldSize == (long)len && memcmp(old, out, len) == 0;
+    if (oldSize >= 0) {
+        free(old);
+    }
+    if (!same) {
+        FILE *f = fopen(path, "wb");
+        if (f == NULL) {
+            ERROR("Error opening %s\n", path);
+            free(out);
+            return -1;
+        }
+        fwrite(out, 1, len, f);
+        if (fclose(f) != 0) {
+            ERROR("Error writing %s\n", path);
+            free(out);
+            return -1;
+        }
+    }
+    free(out);
+
+    printf("%s: %d color combiners\n", path, unique);
+    return 0;
+}
+
+static void usage(void) {
+    ERROR("Usage: ccenum OUTPUT LIST\n"
+          "\n"
+          "Scans the C sources named in LIST (one path per line) for the combine\n"
+          "and render modes their display lists set, and writes every color\n"
+          "combiner id the PC renderer can derive from them to OUTPUT as a C table.\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    init_combiners();
+    init_render_modes();
+
+    FILE *list = fopen(argv[2], "r");
+    if (list == NULL) {
+        ERROR("Error opening %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), list) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0') {
+            scan_file(line);
+        }
+    }
+    fclose(list);
+
+    return write_table(argv[1]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
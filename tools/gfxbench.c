@@ -0,0 +1,291 @@
+/* display list replay benchmark for the PC port */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <PR/gbi.h>
+
+#include "../src/pc/gfx/gfx_pc.h"
+#include "../src/pc/gfx/gfx_capture.h"
+#include "../src/pc/gfx/gfx_rendering_api.h"
+#include "../src/pc/gfx/gfx_window_manager_api.h"
+#include "../src/pc/gfx/gfx_dummy.h"
+#include "../src/pc/gfx/gfx_opengl.h"
+#include "../src/pc/gfx/gfx_vertex_batch.h"
+#include "../src/pc/gfx/gfx_glx.h"
+#include "../src/pc/gfx/gfx_sdl.h"
+#include "../src/pc/configfile.h"
+
+// Replays the frames of a capture written by the game (capture_frames in
+// sm64config.txt, see src/pc/gfx/gfx_capture.h) through gfx_run and reports
+// the CPU time, triangles and flushes of every frame. The dummy backend leaves
+// only the renderer's own work (walking the lists, transforms, texture
+// imports, batching), -gl adds the real backend up to the end of gfx_run.
+// The renderer options come from sm64config.txt, as in the game.
+//
+// -vtx records every G_VTX load of one replay instead (vertices, MP_matrix
+// and fog), then times the vertex batch kernel the build picked against the
+// scalar reference on them and checks that both give the same bits. Loads in
+// retained display lists only run while they're recorded, retained_geometry
+// off in sm64config.txt gets all of them.
+
+#define CONFIG_FILE "sm64config.txt"
+
+static void bench_wm_init(const char *game_name, bool start_in_fullscreen) {
+}
+
+static void bench_wm_set_keyboard_callbacks(bool (*on_key_down)(int scancode), bool (*on_key_up)(int scancode), void (*on_all_keys_up)(void)) {
+}
+
+static void bench_wm_set_fullscreen_changed_callback(void (*on_fullscreen_changed)(bool is_now_fullscreen)) {
+}
+
+static void bench_wm_set_fullscreen(bool enable) {
+}
+
+static void bench_wm_main_loop(void (*run_one_game_iter)(void)) {
+}
+
+static void bench_wm_get_dimensions(uint32_t *width, uint32_t *height) {
+    *width = 320;
+    *height = 240;
+}
+
+static void bench_wm_handle_events(void) {
+}
+
+static bool bench_wm_start_frame(void) {
+    return true;
+}
+
+static void bench_wm_swap_buffers_begin(void) {
+}
+
+static void bench_wm_swap_buffers_end(void) {
+}
+
+static double bench_wm_get_time(void) {
+    return 0.0;
+}
+
+// The dummy backend's window manager sleeps to 30 fps, this one doesn't
+static struct GfxWindowManagerAPI bench_wm_api = {
+    bench_wm_init,
+    bench_wm_set_keyboard_callbacks,
+    bench_wm_set_fullscreen_changed_callback,
+    bench_wm_set_fullscreen,
+    bench_wm_main_loop,
+    bench_wm_get_dimensions,
+    bench_wm_handle_events,
+    bench_wm_start_frame,
+    bench_wm_swap_buffers_begin,
+    bench_wm_swap_buffers_end,
+    bench_wm_get_time
+};
+
+static double get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+struct VertexLoad {
+    size_t first; // in vtx_bench.vertices
+    size_t n_vertices;
+    float mp_matrix[4][4];
+    struct GfxVertexBatchParams params;
+};
+
+static struct {
+    Vtx *vertices;
+    size_t num_vertices, max_vertices;
+    struct VertexLoad *loads;
+    size_t num_loads, max_loads;
+} vtx_bench;
+
+static void *grow(void *array, size_t *max, size_t elem_size) {
+    *max = *max != 0 ? *max * 2 : 1024;
+    array = realloc(array, *max * elem_size);
+    if (array == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    return array;
+}
+
+static void record_vertex_load(const Vtx *vertices, size_t n_vertices, const struct GfxVertexBatchParams *params) {
+    while (vtx_bench.num_vertices + n_vertices > vtx_bench.max_vertices) {
+        vtx_bench.vertices = grow(vtx_bench.vertices, &vtx_bench.max_vertices, sizeof(Vtx));
+    }
+    if (vtx_bench.num_loads == vtx_bench.max_loads) {
+        vtx_bench.loads = grow(vtx_bench.loads, &vtx_bench.max_loads, sizeof(struct VertexLoad));
+    }
+    struct VertexLoad *load = &vtx_bench.loads[vtx_bench.num_loads++];
+    load->first = vtx_bench.num_vertices;
+    load->n_vertices = n_vertices;
+    memcpy(load->mp_matrix, params->mp_matrix, sizeof(load->mp_matrix));
+    load->params = *params; // mp_matrix is pointed at the copy once the array stops moving
+    memcpy(vtx_bench.vertices + vtx_bench.num_vertices, vertices, n_vertices * sizeof(Vtx));
+    vtx_bench.num_vertices += n_vertices;
+}
+
+static double time_vertex_loads(bool scalar, struct GfxVertexBatch *out) {
+    double t0 = get_time_ms();
+    for (size_t i = 0; i < vtx_bench.num_loads; i++) {
+        const struct VertexLoad *load = &vtx_bench.loads[i];
+        if (scalar) {
+            gfx_vertex_batch_transform_scalar(vtx_bench.vertices + load->first, load->n_vertices, &load->params, &out[i & 1]);
+        } else {
+            gfx_vertex_batch_transform(vtx_bench.vertices + load->first, load->n_vertices, &load->params, &out[i & 1]);
+        }
+    }
+    return get_time_ms() - t0;
+}
+
+static bool same_vertex_results(void) {
+    struct GfxVertexBatch batch, reference;
+    for (size_t i = 0; i < vtx_bench.num_loads; i++) {
+        const struct VertexLoad *load = &vtx_bench.loads[i];
+        gfx_vertex_batch_transform(vtx_bench.vertices + load->first, load->n_vertices, &load->params, &batch);
+        gfx_vertex_batch_transform_scalar(vtx_bench.vertices + load->first, load->n_vertices, &load->params, &reference);
+        for (size_t j = 0; j < load->n_vertices; j++) {
+            if (memcmp(&batch.x[j], &reference.x[j], sizeof(float)) != 0 ||
+                memcmp(&batch.y[j], &reference.y[j], sizeof(float)) != 0 ||
+                memcmp(&batch.z[j], &reference.z[j], sizeof(float)) != 0 ||
+                memcmp(&batch.w[j], &reference.w[j], sizeof(float)) != 0 ||
+                batch.clip_rej[j] != reference.clip_rej[j] ||
+                (load->params.fog && memcmp(&batch.fog_z[j], &reference.fog_z[j], sizeof(float)) != 0)) {
+                fprintf(stderr, "load %zu vertex %zu differs from the scalar reference\n", i, j);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+static int bench_vertex_loads(const struct GfxCapture *capture, int passes) {
+    static struct GfxVertexBatch out[2];
+
+    gfx_vertex_batch_set_observer(record_vertex_load);
+    for (size_t i = 0; i < capture->num_frames; i++) {
+        gfx_start_frame();
+        gfx_run_capture(&capture->frames[i]);
+        gfx_end_frame();
+    }
+    gfx_vertex_batch_set_observer(NULL);
+    for (size_t i = 0; i < vtx_bench.num_loads; i++) {
+        vtx_bench.loads[i].params.mp_matrix = (const float (*)[4])vtx_bench.loads[i].mp_matrix;
+    }
+    printf("%zu loads, %zu vertices\n", vtx_bench.num_loads, vtx_bench.num_vertices);
+    if (vtx_bench.num_vertices == 0) {
+        return 1;
+    }
+    if (!same_vertex_results()) {
+        return 1;
+    }
+
+    for (int pass = 0; pass < passes; pass++) {
+        double t_batch = time_vertex_loads(false, out);
+        double t_scalar = time_vertex_loads(true, out);
+        printf("pass %d: batch %.3f ms (%.1f Mvtx/s), scalar %.3f ms (%.1f Mvtx/s), %.2fx\n", pass,
+               t_batch, vtx_bench.num_vertices / t_batch / 1000.0,
+               t_scalar, vtx_bench.num_vertices / t_scalar / 1000.0, t_scalar / t_batch);
+    }
+    free(vtx_bench.vertices);
+    free(vtx_bench.loads);
+    return 0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-gl] [-vtx] [-n passes] <capture.bin>\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    bool use_gl = false;
+    bool vtx = false;
+    int passes = 1;
+    const char *filename = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-gl") == 0) {
+            use_gl = true;
+        } else if (strcmp(argv[i], "-vtx") == 0) {
+            vtx = true;
+        } else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            passes = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && filename == NULL) {
+            filename = argv[i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (filename == NULL || passes < 1) {
+        usage(argv[0]);
+    }
+
+    struct GfxCapture capture;
+    if (!gfx_capture_load(&capture, filename)) {
+        return 1;
+    }
+    if (capture.num_frames == 0) {
+        fprintf(stderr, "%s has no frames\n", filename);
+        return 1;
+    }
+
+    configfile_load(CONFIG_FILE);
+
+    struct GfxWindowManagerAPI *wm_api = &bench_wm_api;
+    struct GfxRenderingAPI *rendering_api = &gfx_dummy_renderer_api;
+    if (use_gl) {
+#ifdef ENABLE_OPENGL
+        rendering_api = &gfx_opengl_api;
+    #if (defined(__linux__) || defined(__BSD__)) && !defined(TARGET_OD)
+        wm_api = &gfx_glx;
+    #else
+        wm_api = &gfx_sdl;
+    #endif
+#else
+        fprintf(stderr, "This build has no OpenGL backend\n");
+        return 1;
+#endif
+    }
+    gfx_init(wm_api, rendering_api, "gfxbench", false);
+
+    if (vtx) {
+        int ret = bench_vertex_loads(&capture, passes);
+        gfx_capture_free(&capture);
+        return ret;
+    }
+
+    printf("%s: %zu frames, %s backend\n", filename, capture.num_frames, use_gl ? "OpenGL" : "dummy");
+    for (int pass = 0; pass < passes; pass++) {
+        double total = 0.0, min = 0.0, max = 0.0;
+        for (size_t i = 0; i < capture.num_frames; i++) {
+            struct GfxFrameStats stats;
+            gfx_start_frame();
+            double t0 = get_time_ms();
+            gfx_run_capture(&capture.frames[i]);
+            double t = get_time_ms() - t0;
+            gfx_end_frame();
+            gfx_get_frame_stats(&stats);
+
+            printf("pass %d frame %zu: %.3f ms, %u tris, %u flushes, %u draw calls\n",
+                   pass, i, t, stats.triangles, stats.flushes, stats.draw_calls);
+            total += t;
+            if (i == 0 || t < min) {
+                min = t;
+            }
+            if (i == 0 || t > max) {
+                max = t;
+            }
+        }
+        printf("pass %d: avg %.3f ms, min %.3f ms, max %.3f ms\n", pass, total / capture.num_frames, min, max);
+    }
+
+    gfx_capture_free(&capture);
+    return 0;
+}
@@ -0,0 +1,234 @@
+/* audio mixer kernel check for the PC port */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <PR/abi.h>
+
+#include "../src/pc/mixer.h"
+
+// Runs every mixer command on random DMEM, parameters and state, and prints a
+// hash of DMEM and the state after each run, one line per run. The mixer
+// object it's linked with decides which kernels run, so building it once per
+// flavour (make mixertest does sse41, neon and vector where the host has them,
+// and scalar) and diffing the output against the scalar build's checks that
+// every flavour gives the same bits, and the line that differs tells where.
+
+#define DMEM_SIZE 2512
+#define CASES 200
+
+static uint32_t seed = 1;
+static int16_t dmem[DMEM_SIZE / sizeof(int16_t)];
+
+static uint32_t rnd(void) {
+    seed = seed * 1664525 + 1013904223;
+    return seed >> 8;
+}
+
+static int16_t rnd_s16(void) {
+    return (int16_t)(rnd() >> 4);
+}
+
+static void rnd_fill(void *data, size_t size) {
+    uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        bytes[i] = rnd() >> 8;
+    }
+}
+
+static uint32_t hash(uint32_t h, const void *data, size_t size) {
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        h = (h ^ bytes[i]) * 16777619U;
+    }
+    return h;
+}
+
+// Random DMEM, so that no kernel gets away with reading what it shouldn't
+static void load_dmem(void) {
+    rnd_fill(dmem, sizeof(dmem));
+    aSetBufferImpl(0, 0, 0, DMEM_SIZE);
+    aLoadBufferImpl(dmem);
+}
+
+static void report(const char *name, int run, const void *state, size_t state_size) {
+    aSetBufferImpl(0, 0, 0, DMEM_SIZE);
+    aSaveBufferImpl(dmem);
+    uint32_t h = hash(2166136261U, dmem, sizeof(dmem));
+    h = hash(h, state, state_size);
+    printf("%s %d: %08x\n", name, run, (unsigned)h);
+}
+
+static void test_adpcmdec(void) {
+    static int16_t book[8][2][8];
+    static ADPCM_STATE state;
+    static ADPCM_STATE loop_state;
+    uint8_t frames[9 * 24];
+
+    for (int i = 0; i < CASES; i++) {
+        int npredictors = 1 + rnd() % 4;
+        for (int p = 0; p < npredictors; p++) {
+            for (int j = 0; j < 16; j++) {
+                // Roughly the range of real codebooks
+                book[p][j / 8][j % 8] = rnd_s16() / 4;
+            }
+        }
+        aLoadADPCMImpl(npredictors * 2 * 16, &book[0][0][0]);
+        rnd_fill(loop_state, sizeof(loop_state));
+        aSetLoopImpl(&loop_state);
+        for (int run = 0; run < 3; run++) {
+            int num_frames = 1 + rnd() % 20;
+            rnd_fill(frames, sizeof(frames));
+            for (int f = 0; f < num_frames; f++) {
+                frames[f * 9] = (rnd() % 13) << 4 | (rnd() % npredictors);
+            }
+            load_dmem();
+            aSetBufferImpl(0, 0x200, 0, sizeof(frames));
+            aLoadBufferImpl(frames);
+            aSetBufferImpl(0, 0x200, 0x400, num_frames * 32);
+            uint8_t flags = run == 0 ? A_INIT : rnd() % 4 == 0 ? A_LOOP : A_CONTINUE;
+            aADPCMdecImpl(flags, state);
+            report("aADPCMdec", i * 3 + run, state, sizeof(state));
+        }
+    }
+}
+
+static void test_resample(void) {
+    static RESAMPLE_STATE state;
+
+    for (int i = 0; i < CASES; i++) {
+        for (int run = 0; run < 3; run++) {
+            // Up to about two octaves either way, plus what the reverb uses
+            uint16_t pitch = i % 8 == 0 ? 0xff60 : 0x2000 + rnd() % 0xe000;
+            int nbytes = 16 * (1 + rnd() % 20);
+            load_dmem();
+            aSetBufferImpl(0, 0x100, 0x700, nbytes);
+            aResampleImpl(run == 0 ? A_INIT : A_CONTINUE, pitch, state);
+            report("aResample", i * 3 + run, state, sizeof(state));
+        }
+    }
+}
+
+static void test_envmixer(void) {
+    static ENVMIX_STATE state;
+
+    for (int i = 0; i < CASES; i++) {
+        bool aux = rnd() % 2;
+        for (int run = 0; run < 3; run++) {
+            int nbytes = 16 * (1 + rnd() % 20);
+            load_dmem();
+            aSetBufferImpl(0, 0x000, 0x200, nbytes);
+            aSetBufferImpl(A_AUX, 0x400, 0x600, 0x800);
+            if (run == 0) {
+                for (int c = 0; c < 2; c++) {
+                    uint8_t side = c == 0 ? A_LEFT : A_RIGHT;
+                    // A rate of 1.0 plus or minus a bit, as from the volume ramps
+                    int32_t rate = 0x10000 + (int32_t)(rnd() % 0x2000) - 0x1000;
+                    aSetVolumeImpl(A_VOL | side, rnd() % 0x8000, 0, 0);
+                    aSetVolumeImpl(A_RATE | side, rnd() % 0x8000, (int16_t)(rate >> 16), (int16_t)rate);
+                }
+                aSetVolumeImpl(A_AUX, rnd() % 0x8000, 0, rnd() % 0x8000);
+            }
+            aEnvMixerImpl((run == 0 ? A_INIT : A_CONTINUE) | (aux ? A_AUX : 0), state);
+            report("aEnvMixer", i * 3 + run, state, sizeof(state));
+        }
+    }
+}
+
+static void test_mix(void) {
+    for (int i = 0; i < CASES; i++) {
+        int nbytes = 16 * (1 + rnd() % 40);
+        // The game's gains, then anything
+        int16_t gain = i == 0 ? 0x7fff : i == 1 ? (int16_t)0x8000 : rnd_s16();
+        load_dmem();
+        aSetBufferImpl(0, 0, 0, nbytes);
+        aMixImpl(gain, 0x000, 0x400);
+        report("aMix", i, NULL, 0);
+    }
+}
+
+static void test_interleave(void) {
+    for (int i = 0; i < CASES; i++) {
+        load_dmem();
+        aSetBufferImpl(0, 0, 0x400, 16 * (1 + rnd() % 20));
+        aInterleaveImpl(0x000, 0x200);
+        report("aInterleave", i, NULL, 0);
+    }
+}
+
+static void test_adpcmdec_cached(void) {
+    static int16_t book[2][8];
+    static int16_t pcm[16 * 24];
+    static ADPCM_STATE state;
+    uint8_t frames[9 * 24];
+
+    for (int i = 0; i < CASES; i++) {
+        for (int j = 0; j < 16; j++) {
+            book[j / 8][j % 8] = rnd_s16() / 4;
+        }
+        aLoadADPCMImpl(sizeof(book), &book[0][0]);
+        rnd_fill(frames, sizeof(frames));
+        for (int f = 0; f < 24; f++) {
+            frames[f * 9] = (rnd() % 13) << 4;
+        }
+        // Decode the whole sample for the cache, as pcm_cache.c does
+        aSetBufferImpl(0, 0x200, 0, sizeof(frames));
+        aLoadBufferImpl(frames);
+        aSetBufferImpl(0, 0x200, 0x400, sizeof(pcm));
+        aADPCMdecImpl(A_INIT, state);
+        aSetBufferImpl(0, 0x420, 0, sizeof(pcm));
+        aSaveBufferImpl(pcm);
+
+        int frame = rnd() % 20;
+        load_dmem();
+        aSetBufferImpl(0, 0x200, 0, sizeof(frames) - frame * 9);
+        aLoadBufferImpl(frames + frame * 9);
+        aSetBufferImpl(0, 0x200, 0x400, 32 * (1 + rnd() % (24 - frame)));
+        if (frame == 0) {
+            aADPCMdecCachedImpl(A_INIT, state, pcm, frame);
+        } else {
+            // Carry on from the two samples before it, like a note that's playing
+            memcpy(state, pcm + frame * 16 - 16, sizeof(state));
+            aADPCMdecCachedImpl(A_CONTINUE, state, pcm, frame);
+        }
+        report("aADPCMdecCached", i, state, sizeof(state));
+    }
+}
+
+static void test_output_resampler(void) {
+    static const int rates[] = { 22050, 44100, 48000, 96000 };
+    static int16_t in[1024 * 2];
+    int16_t *out;
+
+    for (size_t r = 0; r < sizeof(rates) / sizeof(rates[0]); r++) {
+        struct MixerResampler *rs = mixer_resampler_create(32000, rates[r]);
+        if (rs == NULL) {
+            printf("resampler %d Hz: can't create\n", rates[r]);
+            continue;
+        }
+        out = malloc(mixer_resampler_max_output(rs, 1024) * 2 * sizeof(int16_t));
+        for (int i = 0; i < CASES / 4; i++) {
+            int frames = 1 + rnd() % 1024;
+            rnd_fill(in, frames * 2 * sizeof(int16_t));
+            int n = mixer_resampler_process(rs, in, frames, out);
+            uint32_t h = hash(2166136261U, out, n * 2 * sizeof(int16_t));
+            printf("resampler %d Hz %d: %d frames %08x\n", rates[r], i, n, (unsigned)h);
+        }
+        free(out);
+        mixer_resampler_destroy(rs);
+    }
+}
+
+int main(void) {
+    test_adpcmdec();
+    test_adpcmdec_cached();
+    test_resample();
+    test_envmixer();
+    test_mix();
+    test_interleave();
+    test_output_resampler();
+    return 0;
+}
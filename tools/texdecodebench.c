@@ -0,0 +1,141 @@
+/* texture decoder benchmark and check for the PC port */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/pc/gfx/gfx_texture_decode.h"
+
+// Runs every N64 texture format through gfx_texture_decode, with the kernels
+// the build picked, and through the scalar reference. First both decode
+// random texels at every size up to a few blocks plus a full TMEM load, so
+// each kernel's tail gets exercised, and have to give the same bits. Then
+// both decode full TMEM loads for a while and it reports texels per second.
+// Exits with 1 if any format doesn't match.
+
+#define TMEM_BYTES 4096
+#define CHECK_BYTES 128
+
+static const struct {
+    enum GfxTextureDecodeFormat fmt;
+    const char *name;
+} formats[] = {
+    { GFX_TEXTURE_RGBA16, "RGBA16" },
+    { GFX_TEXTURE_IA4, "IA4" },
+    { GFX_TEXTURE_IA8, "IA8" },
+    { GFX_TEXTURE_IA16, "IA16" },
+    { GFX_TEXTURE_I4, "I4" },
+    { GFX_TEXTURE_I8, "I8" },
+    { GFX_TEXTURE_CI4, "CI4" },
+    { GFX_TEXTURE_CI8, "CI8" },
+};
+
+static uint8_t src[TMEM_BYTES];
+static uint8_t palette[256 * 2];
+// The 4 bit formats make two texels of every byte
+static uint8_t out[TMEM_BYTES * 2 * 4];
+static uint8_t reference[TMEM_BYTES * 2 * 4];
+
+static double get_time_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void make_input(void) {
+    uint32_t seed = 1;
+    size_t i;
+
+    for (i = 0; i < TMEM_BYTES; i++) {
+        seed = seed * 1664525 + 1013904223;
+        src[i] = seed >> 24;
+    }
+    for (i = 0; i < sizeof(palette); i++) {
+        seed = seed * 1664525 + 1013904223;
+        palette[i] = seed >> 24;
+    }
+}
+
+static bool check_size(enum GfxTextureDecodeFormat fmt, size_t size_bytes) {
+    size_t texels, ref_texels;
+
+    // Poison both, so texels one of them leaves alone show up
+    memset(out, 0xaa, sizeof(out));
+    memset(reference, 0x55, sizeof(reference));
+    texels = gfx_texture_decode(fmt, src, size_bytes, palette, out);
+    ref_texels = gfx_texture_decode_scalar(fmt, src, size_bytes, palette, reference);
+    return texels == ref_texels && memcmp(out, reference, texels * 4) == 0;
+}
+
+static bool check(enum GfxTextureDecodeFormat fmt) {
+    size_t size;
+
+    for (size = 0; size <= CHECK_BYTES; size++) {
+        if (!check_size(fmt, size)) {
+            fprintf(stderr, "mismatch at %u bytes\n", (unsigned)size);
+            return false;
+        }
+    }
+    if (!check_size(fmt, TMEM_BYTES)) {
+        fprintf(stderr, "mismatch at %d bytes\n", TMEM_BYTES);
+        return false;
+    }
+    return true;
+}
+
+static double bench(enum GfxTextureDecodeFormat fmt, bool scalar, double seconds) {
+    double t0 = get_time_ms(), t;
+    int64_t texels = 0;
+
+    // Whole batches, so the clock isn't read after every call
+    do {
+        int i;
+        for (i = 0; i < 64; i++) {
+            if (scalar) {
+                texels += gfx_texture_decode_scalar(fmt, src, TMEM_BYTES, palette, out);
+            } else {
+                texels += gfx_texture_decode(fmt, src, TMEM_BYTES, palette, out);
+            }
+        }
+        t = get_time_ms() - t0;
+    } while (t < seconds * 1000.0);
+    return texels / t / 1000.0;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr, "Usage: %s [-t seconds]\n", name);
+    exit(1);
+}
+
+int main(int argc, char **argv) {
+    double seconds = 0.5;
+    bool ok = true;
+    size_t i;
+
+    for (int arg = 1; arg < argc; arg++) {
+        if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc) {
+            seconds = atof(argv[++arg]);
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (seconds <= 0.0) {
+        usage(argv[0]);
+    }
+
+    make_input();
+    for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        if (!check(formats[i].fmt)) {
+            fprintf(stderr, "%s: kernels don't match the scalar decoder\n", formats[i].name);
+            ok = false;
+            continue;
+        }
+        double fast = bench(formats[i].fmt, false, seconds);
+        double scalar = bench(formats[i].fmt, true, seconds);
+        printf("%-8s %8.1f M texels/s, scalar %8.1f M texels/s, %5.2fx\n", formats[i].name, fast, scalar, fast / scalar);
+    }
+    return ok ? 0 : 1;
+}
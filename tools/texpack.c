@@ -0,0 +1,223 @@
+/* pre-decoded texture pack generator for the PC port */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "n64graphics.h"
+#include "utils.h"
+
+#define GFX_TEXTURE_PACK_TOOL
+#include "../src/pc/gfx/gfx_texture_pack.h"
+
+// G_IM_FMT_* / G_IM_SIZ_* from PR/gbi.h
+#define FMT_RGBA 0
+#define FMT_IA 3
+#define FMT_I 4
+#define SIZ_4b 0
+#define SIZ_8b 1
+#define SIZ_16b 2
+
+typedef struct {
+    const char *ext;
+    uint8_t fmt;
+    uint8_t siz;
+    int depth;
+} TexFormat;
+
+// CI textures are decoded through the palette at runtime, so they are not packed.
+// RGBA32 is uploaded as is and IA1 is never used by the renderer.
+static const TexFormat formats[] = {
+    { ".rgba16", FMT_RGBA, SIZ_16b, 16 },
+    { ".ia4",    FMT_IA,   SIZ_4b,  4 },
+    { ".ia8",    FMT_IA,   SIZ_8b,  8 },
+    { ".ia16",   FMT_IA,   SIZ_16b, 16 },
+    { ".i4",     FMT_I,    SIZ_4b,  4 },
+    { ".i8",     FMT_I,    SIZ_8b,  8 },
+};
+
+typedef struct {
+    struct GfxTexturePackEntry entry;
+    uint8_t *rgba32;
+} PackTexture;
+
+static PackTexture *textures;
+static uint32_t numTextures;
+static uint32_t capTextures;
+
+static const TexFormat *find_format(const char *path) {
+    size_t len = strlen(path);
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+        size_t extLen = strlen(formats[i].ext);
+        if (len > extLen && strcmp(path + len - extLen, formats[i].ext) == 0) {
+            return &formats[i];
+        }
+    }
+    return NULL;
+}
+
+// Decodes with n64graphics and lays the result out the way gfx_pc.c's import_texture_* does
+static uint8_t *decode(const TexFormat *format, const uint8_t *raw, long size, uint32_t *numTexels) {
+    int texels = format->depth == 4 ? size * 2 : size / (format->depth / 8);
+    uint8_t *out = malloc(texels * 4);
+    if (out == NULL) {
+        return NULL;
+    }
+
+    if (format->fmt == FMT_RGBA) {
+        rgba *img = raw2rgba(raw, texels, 1, format->depth);
+        if (img == NULL) {
+            free(out);
+            return NULL;
+        }
+        memcpy(out, img, texels * 4);
+        free(img);
+    } else {
+        ia *img = format->fmt == FMT_IA ? raw2ia(raw, texels, 1, format->depth) : raw2i(raw, texels, 1, format->depth);
+        if (img == NULL) {
+            free(out);
+            return NULL;
+        }
+        for (int i = 0; i < texels; i++) {
+            out[4 * i + 0] = img[i].intensity;
+            out[4 * i + 1] = img[i].intensity;
+            out[4 * i + 2] = img[i].intensity;
+            // n64graphics copies the intensity into the alpha of I4, the renderer treats I textures as opaque
+            out[4 * i + 3] = format->fmt == FMT_I ? 0xFF : img[i].alpha;
+        }
+        free(img);
+    }
+
+    *numTexels = texels;
+    return out;
+}
+
+static int add_texture(const char *path) {
+    const TexFormat *format = find_format(path);
+    if (format == NULL) {
+        return 0;
+    }
+
+    uint8_t *raw;
+    long size = read_file(path, &raw);
+    if (size <= 0) {
+        ERROR("Error reading %s\n", path);
+        return -1;
+    }
+
+    PackTexture tex;
+    uint32_t numTexels;
+    memset(&tex, 0, sizeof(tex));
+    tex.entry.key = gfx_texture_pack_hash(raw, size);
+    tex.entry.size_bytes = size;
+    tex.entry.fmt = format->fmt;
+    tex.entry.siz = format->siz;
+    tex.rgba32 = decode(format, raw, size, &numTexels);
+    free(raw);
+    if (tex.rgba32 == NULL) {
+        ERROR("Error decoding %s\n", path);
+        return -1;
+    }
+    tex.entry.rgba32_size = numTexels * 4;
+
+    if (numTextures == capTextures) {
+        capTextures = capTextures ? capTextures * 2 : 256;
+        textures = realloc(textures, capTextures * sizeof(*textures));
+        if (textures == NULL) {
+            ERROR("Out of memory\n");
+            return -1;
+        }
+    }
+    textures[numTextures++] = tex;
+    return 0;
+}
+
+static int compare_textures(const void *a, const void *b) {
+    const struct GfxTexturePackEntry *ea = &((const PackTexture *)a)->entry;
+    const struct GfxTexturePackEntry *eb = &((const PackTexture *)b)->entry;
+    return gfx_texture_pack_compare(ea, eb->key, eb->size_bytes, eb->fmt, eb->siz);
+}
+
+static int write_pack(const char *path) {
+    qsort(textures, numTextures, sizeof(*textures), compare_textures);
+
+    // Identical textures used in several places only need to be stored once
+    uint32_t unique = 0;
+    for (uint32_t i = 0; i < numTextures; i++) {
+        if (unique > 0 && compare_textures(&textures[unique - 1], &textures[i]) == 0) {
+            free(textures[i].rgba32);
+            continue;
+        }
+        textures[unique++] = textures[i];
+    }
+    numTextures = unique;
+
+    struct GfxTexturePackHeader header;
+    header.magic = GFX_TEXTURE_PACK_MAGIC;
+    header.num_entries = numTextures;
+
+    uint32_t offset = sizeof(header) + numTextures * sizeof(struct GfxTexturePackEntry);
+    offset = (offset + 15) & ~15;
+    for (uint32_t i = 0; i < numTextures; i++) {
+        textures[i].entry.offset = offset;
+        offset += (textures[i].entry.rgba32_size + 15) & ~15;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (f == NULL) {
+        ERROR("Error opening %s\n", path);
+        return -1;
+    }
+    static const uint8_t zeros[16];
+    fwrite(&header, sizeof(header), 1, f);
+    for (uint32_t i = 0; i < numTextures; i++) {
+        fwrite(&textures[i].entry, sizeof(textures[i].entry), 1, f);
+    }
+    long pos = ftell(f);
+    for (uint32_t i = 0; i < numTextures; i++) {
+        fwrite(zeros, 1, textures[i].entry.offset - pos, f);
+        fwrite(textures[i].rgba32, 1, textures[i].entry.rgba32_size, f);
+        pos = textures[i].entry.offset + textures[i].entry.rgba32_size;
+    }
+    if (fclose(f) != 0) {
+        ERROR("Error writing %s\n", path);
+        return -1;
+    }
+
+    printf("%s: %u textures, %u bytes\n", path, numTextures, offset);
+    return 0;
+}
+
+static void usage(void) {
+    ERROR("Usage: texpack OUTPUT LIST\n"
+          "\n"
+          "Decodes the raw textures named in LIST (one path per line, formats\n"
+          "taken from the .rgba16/.ia4/.ia8/.ia16/.i4/.i8 extension) to RGBA32\n"
+          "and writes them to the texture pack OUTPUT. Other formats are skipped.\n");
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 3) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    FILE *list = fopen(argv[2], "r");
+    if (list == NULL) {
+        ERROR("Error opening %s\n", argv[2]);
+        return EXIT_FAILURE;
+    }
+    char line[1024];
+    while (fgets(line, sizeof(line), list) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] != '\0' && add_texture(line) != 0) {
+            fclose(list);
+            return EXIT_FAILURE;
+        }
+    }
+    fclose(list);
+
+    return write_pack(argv[1]) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}